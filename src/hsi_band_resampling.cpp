@@ -0,0 +1,407 @@
+#include "./hsi_band_resampling.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "./hsi_parallel.h"
+
+namespace hsi {
+namespace {
+
+// The number of pixels resampled at a time by each thread.
+constexpr long kPixelBlockSize = 4096;
+
+// Gaussian responses are treated as zero beyond this many FWHMs from their
+// centers (where they are below 1e-10).
+constexpr double kGaussianSupportWidths = 3;
+
+// The number of integration steps per FWHM (or table step) of the narrowest
+// response in an overlap integral, and the maximum number of steps.
+constexpr double kStepsPerWidth = 10;
+constexpr int kMaxIntegrationSteps = 100000;
+
+double GetGaussianResponse(
+    const double center, const double fwhm, const double wavelength) {
+  const double offset = (wavelength - center) / fwhm;
+  return std::exp(-4 * std::log(2.0) * offset * offset);
+}
+
+double GetResponse(
+    const HSIResponseFunction& response, const double wavelength) {
+  if (response.responses.empty()) {
+    return GetGaussianResponse(response.center, response.fwhm, wavelength);
+  }
+  const std::vector<double>& wavelengths = response.wavelengths;
+  if (wavelength < wavelengths.front() || wavelength > wavelengths.back()) {
+    return 0;
+  }
+  const size_t upper = std::max<size_t>(
+      1,
+      std::upper_bound(wavelengths.begin(), wavelengths.end(), wavelength) -
+          wavelengths.begin());
+  if (upper == wavelengths.size()) {
+    return response.responses.back();
+  }
+  const double fraction = (wavelength - wavelengths[upper - 1]) /
+      (wavelengths[upper] - wavelengths[upper - 1]);
+  return response.responses[upper - 1] +
+      fraction * (response.responses[upper] - response.responses[upper - 1]);
+}
+
+// Checks the response function, and returns the wavelengths where it is
+// non-zero and the scale of its finest detail.
+void GetResponseSupport(
+    const HSIResponseFunction& response,
+    double* min_wavelength,
+    double* max_wavelength,
+    double* resolution) {
+
+  if (response.responses.empty()) {
+    if (!(response.fwhm > 0)) {
+      FatalError("Gaussian response functions must have a positive FWHM.");
+    }
+    *min_wavelength = response.center - kGaussianSupportWidths * response.fwhm;
+    *max_wavelength = response.center + kGaussianSupportWidths * response.fwhm;
+    *resolution = response.fwhm;
+    return;
+  }
+  const std::vector<double>& wavelengths = response.wavelengths;
+  if (wavelengths.size() != response.responses.size() ||
+      wavelengths.size() < 2) {
+    FatalError("Tabulated response functions need two or more wavelengths.");
+  }
+  *resolution = wavelengths.back() - wavelengths.front();
+  for (size_t i = 1; i < wavelengths.size(); ++i) {
+    if (!(wavelengths[i] > wavelengths[i - 1])) {
+      FatalError("Response function wavelengths must be increasing.");
+    }
+    *resolution = std::min(*resolution, wavelengths[i] - wavelengths[i - 1]);
+  }
+  *min_wavelength = wavelengths.front();
+  *max_wavelength = wavelengths.back();
+}
+
+// Returns the unnormalized weight of a source band for the target response:
+// the integral of the product of the responses if the source band has a
+// width, and otherwise the target response at the band's wavelength times the
+// spacing of the bands there.
+double GetBandWeight(
+    const HSIResponseFunction& response,
+    const std::vector<double>& source_wavelengths,
+    const std::vector<double>& source_fwhm,
+    const int band) {
+
+  double min_wavelength;
+  double max_wavelength;
+  double resolution;
+  GetResponseSupport(response, &min_wavelength, &max_wavelength, &resolution);
+  const double wavelength = source_wavelengths[band];
+  const double fwhm = source_fwhm.empty() ? 0 : source_fwhm[band];
+  if (fwhm <= 0) {
+    const int num_bands = source_wavelengths.size();
+    const double spacing = (num_bands == 1) ? 1 : 0.5 * std::abs(
+        source_wavelengths[std::min(band + 1, num_bands - 1)] -
+        source_wavelengths[std::max(band - 1, 0)]) *
+        ((band == 0 || band == num_bands - 1) ? 2 : 1);
+    return GetResponse(response, wavelength) * spacing;
+  }
+
+  // Trapezoidal integration over the overlap of the supports.
+  const double start =
+      std::max(min_wavelength, wavelength - kGaussianSupportWidths * fwhm);
+  const double end =
+      std::min(max_wavelength, wavelength + kGaussianSupportWidths * fwhm);
+  if (end <= start) {
+    return 0;
+  }
+  const int num_steps = std::min(
+      kMaxIntegrationSteps,
+      std::max(1, static_cast<int>(std::ceil(
+          (end - start) * kStepsPerWidth / std::min(resolution, fwhm)))));
+  const double step = (end - start) / num_steps;
+  double sum = 0;
+  for (int i = 0; i <= num_steps; ++i) {
+    const double x = start + i * step;
+    const double value =
+        GetResponse(response, x) * GetGaussianResponse(wavelength, fwhm, x);
+    sum += (i == 0 || i == num_steps) ? 0.5 * value : value;
+  }
+  return sum * step;
+}
+
+}  // namespace
+
+HSIBandResampler::HSIBandResampler(
+    const std::vector<double>& source_wavelengths,
+    const std::vector<double>& source_fwhm,
+    const std::vector<HSIResponseFunction>& target_responses,
+    const HSIBandResamplingOptions& options)
+    : options_(options),
+      num_source_bands_(source_wavelengths.size()) {
+
+  if (num_source_bands_ == 0) {
+    FatalError("Resampling requires the wavelengths of the source bands.");
+  }
+  if (!source_fwhm.empty() &&
+      static_cast<int>(source_fwhm.size()) != num_source_bands_) {
+    FatalError("The source FWHM must have one value for each band.");
+  }
+  if (target_responses.empty()) {
+    FatalError("Resampling requires at least one target band.");
+  }
+
+  // The weights of all source bands for each target band.
+  const int num_targets = target_responses.size();
+  std::vector<std::vector<double>> band_weights(num_targets);
+  std::vector<bool> is_required(num_source_bands_, false);
+  for (int target = 0; target < num_targets; ++target) {
+    std::vector<double>& weights = band_weights[target];
+    weights.resize(num_source_bands_);
+    for (int band = 0; band < num_source_bands_; ++band) {
+      weights[band] = GetBandWeight(
+          target_responses[target], source_wavelengths, source_fwhm, band);
+    }
+    const double max_weight = *std::max_element(weights.begin(), weights.end());
+    if (!(max_weight > 0)) {
+      FatalError("Target band " + std::to_string(target) +
+                 " does not overlap the source bands.");
+    }
+    double sum = 0;
+    for (double& weight : weights) {
+      if (weight < options_.min_relative_weight * max_weight) {
+        weight = 0;
+      }
+      sum += weight;
+    }
+    for (int band = 0; band < num_source_bands_; ++band) {
+      weights[band] /= sum;
+      if (weights[band] > 0) {
+        is_required[band] = true;
+      }
+    }
+  }
+
+  std::vector<int> required_indices(num_source_bands_, -1);
+  for (int band = 0; band < num_source_bands_; ++band) {
+    if (is_required[band]) {
+      required_indices[band] = required_bands_.size();
+      required_bands_.push_back(band);
+    }
+  }
+  band_offsets_.push_back(0);
+  for (int target = 0; target < num_targets; ++target) {
+    for (int band = 0; band < num_source_bands_; ++band) {
+      if (band_weights[target][band] > 0) {
+        required_band_indices_.push_back(required_indices[band]);
+        weights_.push_back(band_weights[target][band]);
+      }
+    }
+    band_offsets_.push_back(weights_.size());
+  }
+}
+
+void HSIBandResampler::GetBandWeights(
+    const int target_band,
+    std::vector<int>* source_bands,
+    std::vector<float>* weights) const {
+
+  source_bands->clear();
+  weights->clear();
+  for (int i = band_offsets_[target_band]; i < band_offsets_[target_band + 1];
+       ++i) {
+    source_bands->push_back(required_bands_[required_band_indices_[i]]);
+    weights->push_back(weights_[i]);
+  }
+}
+
+void HSIBandResampler::ResampleBands(
+    const HSIData& hsi_data,
+    const std::vector<int>& data_bands,
+    HSIData* resampled_data) const {
+
+  const int num_targets = num_target_bands();
+  resampled_data->num_rows = hsi_data.num_rows;
+  resampled_data->num_cols = hsi_data.num_cols;
+  resampled_data->num_bands = num_targets;
+  resampled_data->interleave_format = HSI_INTERLEAVE_BSQ;
+  resampled_data->data_type = HSI_DATA_TYPE_FLOAT;
+  resampled_data->raw_data.resize(
+      static_cast<long>(resampled_data->NumDataPoints()) * sizeof(float));
+  float* output = reinterpret_cast<float*>(resampled_data->raw_data.data());
+
+  // Float BSQ bands are used in place; otherwise the required bands of each
+  // block of pixels are gathered as floats.
+  const long num_pixels =
+      static_cast<long>(hsi_data.num_rows) * hsi_data.num_cols;
+  const bool is_bsq_float =
+      hsi_data.interleave_format == HSI_INTERLEAVE_BSQ &&
+      hsi_data.data_type == HSI_DATA_TYPE_FLOAT;
+  const int num_required = required_bands_.size();
+  ParallelFor(
+      0, num_pixels, options_.num_threads, kPixelBlockSize,
+      [&](const long begin, const long end) {
+        std::vector<int> rows;
+        std::vector<int> cols;
+        std::vector<int> bands;
+        std::vector<float> block_values;
+        std::vector<const float*> band_values(num_required);
+        for (long pixel = begin; pixel < end; pixel += kPixelBlockSize) {
+          const long block_size = std::min(kPixelBlockSize, end - pixel);
+          if (is_bsq_float) {
+            const float* values =
+                reinterpret_cast<const float*>(hsi_data.raw_data.data());
+            for (int i = 0; i < num_required; ++i) {
+              band_values[i] = values + data_bands[i] * num_pixels + pixel;
+            }
+          } else {
+            rows.resize(block_size);
+            cols.resize(block_size);
+            bands.resize(block_size);
+            block_values.resize(num_required * block_size);
+            for (long i = 0; i < block_size; ++i) {
+              rows[i] = (pixel + i) / hsi_data.num_cols;
+              cols[i] = (pixel + i) % hsi_data.num_cols;
+            }
+            for (int i = 0; i < num_required; ++i) {
+              std::fill(bands.begin(), bands.end(), data_bands[i]);
+              hsi_data.GatherValues(
+                  rows.data(),
+                  cols.data(),
+                  bands.data(),
+                  block_size,
+                  &block_values[i * block_size]);
+              band_values[i] = &block_values[i * block_size];
+            }
+          }
+          for (int target = 0; target < num_targets; ++target) {
+            float* target_values = output + target * num_pixels + pixel;
+            std::fill(target_values, target_values + block_size, 0.0f);
+            for (int i = band_offsets_[target]; i < band_offsets_[target + 1];
+                 ++i) {
+              const float* values = band_values[required_band_indices_[i]];
+              const float weight = weights_[i];
+              for (long j = 0; j < block_size; ++j) {
+                target_values[j] += weight * values[j];
+              }
+            }
+          }
+        }
+      });
+}
+
+HSIData HSIBandResampler::Resample(const HSIDataView& data_view) const {
+  HSIData materialized_data;
+  const HSIData& hsi_data = data_view.GetCompactData(&materialized_data);
+  if (hsi_data.num_bands != num_source_bands_) {
+    FatalError("The data must have the source bands of the resampler.");
+  }
+  HSIData resampled_data;
+  ResampleBands(hsi_data, required_bands_, &resampled_data);
+  return resampled_data;
+}
+
+void HSIBandResampler::ReadResampledBands(
+    const HSIDataRange& data_range,
+    const HSIDataReader& reader,
+    const ResampledRowsCallback& callback) const {
+
+  const HSIDataOptions& data_options = reader.GetOptions();
+  if (data_options.num_data_bands != num_source_bands_) {
+    FatalError("The data must have the source bands of the resampler.");
+  }
+  // The bands read from the file, and the index among them of each required
+  // band.
+  const bool is_bip = (data_options.interleave_format == HSI_INTERLEAVE_BIP);
+  std::vector<int> read_bands;
+  std::vector<int> data_bands;
+  if (is_bip) {
+    for (int band = required_bands_.front(); band <= required_bands_.back();
+         ++band) {
+      read_bands.push_back(band);
+    }
+    for (const int band : required_bands_) {
+      data_bands.push_back(band - required_bands_.front());
+    }
+  } else {
+    read_bands = required_bands_;
+    for (size_t i = 0; i < required_bands_.size(); ++i) {
+      data_bands.push_back(i);
+    }
+  }
+  const int num_read_bands = read_bands.size();
+
+  long row_stride;
+  long col_stride;
+  long band_stride;
+  GetInterleaveStrides(
+      data_options.interleave_format,
+      data_options.num_data_rows,
+      data_options.num_data_cols,
+      data_options.num_data_bands,
+      &row_stride,
+      &col_stride,
+      &band_stride);
+  const int num_cols = data_range.end_col - data_range.start_col;
+  const int tile_rows = std::max(1, options_.tile_rows);
+  std::vector<HSIValueRun> runs;
+  HSIData resampled_data;
+  for (int row = data_range.start_row; row < data_range.end_row;
+       row += tile_rows) {
+    const int end_row = std::min(row + tile_rows, data_range.end_row);
+    const int num_rows = end_row - row;
+
+    // Read the bands of the tile in file order, keeping the file's
+    // interleave format.
+    runs.clear();
+    HSIValueRun run;
+    run.num_values = num_cols;
+    if (is_bip) {
+      HSIDataRange tile_range = data_range;
+      tile_range.start_row = row;
+      tile_range.end_row = end_row;
+      tile_range.start_band = read_bands.front();
+      tile_range.end_band = read_bands.back() + 1;
+      GetDataRangeRuns(data_options, tile_range, &runs);
+    } else if (data_options.interleave_format == HSI_INTERLEAVE_BSQ) {
+      for (int i = 0; i < num_read_bands; ++i) {
+        for (int tile_row = row; tile_row < end_row; ++tile_row) {
+          run.file_index = read_bands[i] * band_stride +
+              tile_row * row_stride + data_range.start_col;
+          run.destination_index =
+              (static_cast<long>(i) * num_rows + tile_row - row) * num_cols;
+          runs.push_back(run);
+        }
+      }
+    } else {
+      for (int tile_row = row; tile_row < end_row; ++tile_row) {
+        for (int i = 0; i < num_read_bands; ++i) {
+          run.file_index = tile_row * row_stride +
+              read_bands[i] * band_stride + data_range.start_col;
+          run.destination_index =
+              (static_cast<long>(tile_row - row) * num_read_bands + i) *
+              num_cols;
+          runs.push_back(run);
+        }
+      }
+    }
+    HSIData tile_data;
+    tile_data.num_rows = num_rows;
+    tile_data.num_cols = num_cols;
+    tile_data.num_bands = num_read_bands;
+    tile_data.interleave_format = data_options.interleave_format;
+    tile_data.data_type = GetUnpackedDataType(data_options.data_type);
+    tile_data.raw_data.resize(
+        static_cast<long>(tile_data.NumDataPoints()) *
+        GetDataSize(tile_data.data_type));
+    reader.ReadValueRuns(
+        runs, options_.max_gap_bytes, tile_data.raw_data.data());
+    ConvertToInMemoryFormat(data_options, &tile_data);
+
+    ResampleBands(tile_data, data_bands, &resampled_data);
+    callback(resampled_data, row - data_range.start_row);
+  }
+}
+
+}  // namespace hsi
@@ -0,0 +1,121 @@
+// Provides resampling of hyperspectral data to the bands of another sensor
+// (e.g. a multispectral band set), given the spectral response function (SRF)
+// of each target band.
+//
+// Each target band is a weighted sum of the source bands, with weights from
+// the overlap of the target response with the response of each source band (a
+// Gaussian with the band's FWHM, if known). The weights are stored as a sparse
+// matrix, so a target band only touches the few source bands under its
+// response, and only the source bands with non-zero weights are read from the
+// file.
+
+#ifndef SRC_HSI_BAND_RESAMPLING_H_
+#define SRC_HSI_BAND_RESAMPLING_H_
+
+#include <functional>
+#include <vector>
+
+#include "./hsi_data_reader.h"
+#include "./hsi_data_view.h"
+
+namespace hsi {
+
+// The spectral response function of a target band, in the wavelength units of
+// the source data. If responses is empty, the response is a Gaussian with the
+// given center and full width at half maximum. Otherwise it is tabulated: the
+// response at wavelengths[i] is responses[i] (linearly interpolated, and zero
+// outside of the table).
+struct HSIResponseFunction {
+  double center = 0;
+  double fwhm = 0;
+  std::vector<double> wavelengths;
+  std::vector<double> responses;
+};
+
+struct HSIBandResamplingOptions {
+  // Weights below this fraction of the largest weight of a target band are
+  // dropped (and the others rescaled to sum to one), so that the far tails of
+  // the responses do not require reading more source bands.
+  double min_relative_weight = 1e-3;
+
+  // The number of threads. Zero means one for each hardware thread.
+  int num_threads = 0;
+
+  // The number of rows read at a time by ReadResampledBands().
+  int tile_rows = 64;
+
+  // Runs of values separated by at most this many bytes in the file are read
+  // with one read.
+  long max_gap_bytes = 64 * 1024;
+};
+
+// Called by HSIBandResampler::ReadResampledBands() with the resampled rows of
+// each tile, starting at the given row of the range.
+typedef std::function<void(const HSIData& resampled_rows, const int start_row)>
+    ResampledRowsCallback;
+
+class HSIBandResampler {
+ public:
+  // source_wavelengths holds the center wavelength of each source band (e.g.
+  // HSIDataOptions::wavelengths), and source_fwhm the width of each source
+  // band's response. If source_fwhm is empty, the source bands are treated as
+  // samples of the spectrum at their center wavelengths.
+  HSIBandResampler(
+      const std::vector<double>& source_wavelengths,
+      const std::vector<double>& source_fwhm,
+      const std::vector<HSIResponseFunction>& target_responses,
+      const HSIBandResamplingOptions& options);
+
+  int num_target_bands() const {
+    return band_offsets_.size() - 1;
+  }
+
+  // The source bands with a non-zero weight for any target band, in order.
+  const std::vector<int>& required_bands() const {
+    return required_bands_;
+  }
+
+  // Returns the source bands of the given target band and their weights,
+  // which sum to one.
+  void GetBandWeights(
+      const int target_band,
+      std::vector<int>* source_bands,
+      std::vector<float>* weights) const;
+
+  // Returns the resampled data of the view (or of HSIData), which must have
+  // all source bands, as BSQ float data with one band for each target band.
+  HSIData Resample(const HSIDataView& data_view) const;
+
+  // Resamples the given rows and columns of the data as above, reading one
+  // tile of rows at a time with only the required bands (from BSQ and BIL
+  // files; BIP files are read from the first to the last required band). The
+  // bands of the range are ignored.
+  void ReadResampledBands(
+      const HSIDataRange& data_range,
+      const HSIDataReader& reader,
+      const ResampledRowsCallback& callback) const;
+
+ private:
+  // Writes the resampled data to the BSQ float output, given the band of the
+  // data that holds each required band.
+  void ResampleBands(
+      const HSIData& hsi_data,
+      const std::vector<int>& data_bands,
+      HSIData* resampled_data) const;
+
+  const HSIBandResamplingOptions options_;
+  int num_source_bands_;
+
+  // The weights of target band i are weights_[band_offsets_[i]] to
+  // weights_[band_offsets_[i + 1]], for the required bands with the indices
+  // in required_band_indices_.
+  std::vector<int> band_offsets_;
+  std::vector<int> required_band_indices_;
+  std::vector<float> weights_;
+
+  std::vector<int> required_bands_;
+};
+
+}  // namespace hsi
+
+#endif  // SRC_HSI_BAND_RESAMPLING_H_
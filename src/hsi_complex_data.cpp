@@ -0,0 +1,143 @@
+#include "./hsi_complex_data.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <cmath>
+#include <complex>
+
+namespace hsi {
+namespace {
+
+// Computes the component of a single complex value.
+template <typename T>
+T ComputeComponent(
+    const std::complex<T>& value, const HSIComplexComponent component) {
+  switch (component) {
+    case HSI_COMPLEX_REAL:
+      return value.real();
+    case HSI_COMPLEX_IMAGINARY:
+      return value.imag();
+    case HSI_COMPLEX_PHASE:
+      return std::atan2(value.imag(), value.real());
+    case HSI_COMPLEX_POWER:
+      return value.real() * value.real() + value.imag() * value.imag();
+    case HSI_COMPLEX_MAGNITUDE:
+    default:
+      return std::sqrt(
+          value.real() * value.real() + value.imag() * value.imag());
+  }
+}
+
+}  // namespace
+
+void ExtractComplexComponent(
+    const std::complex<float>* values,
+    const long num_values,
+    const HSIComplexComponent component,
+    float* component_values) {
+
+  long i = 0;
+#ifdef __AVX2__
+  // Each iteration loads 8 interleaved (real, imaginary) pairs into two
+  // registers. The horizontal add and the shuffles pair up the values within
+  // 128-bit lanes, so the results are permuted back into order.
+  const float* components = reinterpret_cast<const float*>(values);
+  if (component != HSI_COMPLEX_PHASE) {
+    for (; i + 8 <= num_values; i += 8) {
+      const __m256 first = _mm256_loadu_ps(components + 2 * i);
+      const __m256 second = _mm256_loadu_ps(components + 2 * i + 8);
+      __m256 result;
+      if (component == HSI_COMPLEX_REAL) {
+        result = _mm256_shuffle_ps(first, second, _MM_SHUFFLE(2, 0, 2, 0));
+      } else if (component == HSI_COMPLEX_IMAGINARY) {
+        result = _mm256_shuffle_ps(first, second, _MM_SHUFFLE(3, 1, 3, 1));
+      } else {
+        result = _mm256_hadd_ps(
+            _mm256_mul_ps(first, first), _mm256_mul_ps(second, second));
+        if (component == HSI_COMPLEX_MAGNITUDE) {
+          result = _mm256_sqrt_ps(result);
+        }
+      }
+      result = _mm256_castpd_ps(_mm256_permute4x64_pd(
+          _mm256_castps_pd(result), _MM_SHUFFLE(3, 1, 2, 0)));
+      _mm256_storeu_ps(component_values + i, result);
+    }
+  }
+#endif
+  for (; i < num_values; ++i) {
+    component_values[i] = ComputeComponent(values[i], component);
+  }
+}
+
+void ExtractComplexComponent(
+    const std::complex<double>* values,
+    const long num_values,
+    const HSIComplexComponent component,
+    double* component_values) {
+
+  long i = 0;
+#ifdef __AVX2__
+  const double* components = reinterpret_cast<const double*>(values);
+  if (component != HSI_COMPLEX_PHASE) {
+    for (; i + 4 <= num_values; i += 4) {
+      const __m256d first = _mm256_loadu_pd(components + 2 * i);
+      const __m256d second = _mm256_loadu_pd(components + 2 * i + 4);
+      __m256d result;
+      if (component == HSI_COMPLEX_REAL) {
+        result = _mm256_unpacklo_pd(first, second);
+      } else if (component == HSI_COMPLEX_IMAGINARY) {
+        result = _mm256_unpackhi_pd(first, second);
+      } else {
+        result = _mm256_hadd_pd(
+            _mm256_mul_pd(first, first), _mm256_mul_pd(second, second));
+        if (component == HSI_COMPLEX_MAGNITUDE) {
+          result = _mm256_sqrt_pd(result);
+        }
+      }
+      result = _mm256_permute4x64_pd(result, _MM_SHUFFLE(3, 1, 2, 0));
+      _mm256_storeu_pd(component_values + i, result);
+    }
+  }
+#endif
+  for (; i < num_values; ++i) {
+    component_values[i] = ComputeComponent(values[i], component);
+  }
+}
+
+HSIData ExtractComplexComponent(
+    const HSIData& complex_data, const HSIComplexComponent component) {
+
+  if (!IsComplexDataType(complex_data.data_type)) {
+    return complex_data;
+  }
+  HSIData component_data;
+  component_data.num_rows = complex_data.num_rows;
+  component_data.num_cols = complex_data.num_cols;
+  component_data.num_bands = complex_data.num_bands;
+  component_data.interleave_format = complex_data.interleave_format;
+  component_data.data_type =
+      GetComplexComponentDataType(complex_data.data_type);
+  const long num_values = complex_data.NumDataPoints();
+  component_data.raw_data.resize(
+      num_values * GetDataSize(component_data.data_type));
+  if (complex_data.data_type == HSI_DATA_TYPE_COMPLEX_FLOAT) {
+    ExtractComplexComponent(
+        reinterpret_cast<const std::complex<float>*>(
+            complex_data.raw_data.data()),
+        num_values,
+        component,
+        reinterpret_cast<float*>(component_data.raw_data.data()));
+  } else {
+    ExtractComplexComponent(
+        reinterpret_cast<const std::complex<double>*>(
+            complex_data.raw_data.data()),
+        num_values,
+        component,
+        reinterpret_cast<double*>(component_data.raw_data.data()));
+  }
+  return component_data;
+}
+
+}  // namespace hsi
@@ -0,0 +1,37 @@
+// Provides kernels that derive real-valued products (real and imaginary
+// parts, magnitude, phase, and power) from complex HSI data, such as
+// SAR-derived or interferometric products. The HSIDataReader applies these
+// kernels while reading if HSIDataOptions::extract_complex_component is set.
+
+#ifndef SRC_HSI_COMPLEX_DATA_H_
+#define SRC_HSI_COMPLEX_DATA_H_
+
+#include <complex>
+
+#include "./hsi_data_reader.h"
+
+namespace hsi {
+
+// Computes the given component of each of the num_values complex values.
+void ExtractComplexComponent(
+    const std::complex<float>* values,
+    const long num_values,
+    const HSIComplexComponent component,
+    float* component_values);
+
+void ExtractComplexComponent(
+    const std::complex<double>* values,
+    const long num_values,
+    const HSIComplexComponent component,
+    double* component_values);
+
+// Returns data of the same size and interleave format that contains the given
+// component of each complex value. The data type is float for complex float
+// data, and double for complex double data. Data that is not complex is
+// returned unchanged.
+HSIData ExtractComplexComponent(
+    const HSIData& complex_data, const HSIComplexComponent component);
+
+}  // namespace hsi
+
+#endif  // SRC_HSI_COMPLEX_DATA_H_
@@ -0,0 +1,414 @@
+#include "./hsi_continuum_removal.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#include "./hsi_parallel.h"
+
+namespace hsi {
+namespace {
+
+// The number of pixels processed at a time by each thread.
+constexpr long kPixelBlockSize = 1024;
+
+// Computes the continuum (the upper convex hull, interpolated at every band)
+// of the spectrum. hull is scratch space for num_bands band indices.
+void ComputeContinuum(
+    const float* wavelengths,
+    const float* spectrum,
+    const int num_bands,
+    int* hull,
+    float* continuum) {
+
+  // Monotone chain: a hull point is removed when the new point is on or above
+  // the line from the point before it.
+  int hull_size = 0;
+  for (int band = 0; band < num_bands; ++band) {
+    while (hull_size >= 2) {
+      const int first = hull[hull_size - 2];
+      const int last = hull[hull_size - 1];
+      const float cross =
+          (wavelengths[last] - wavelengths[first]) *
+              (spectrum[band] - spectrum[first]) -
+          (spectrum[last] - spectrum[first]) *
+              (wavelengths[band] - wavelengths[first]);
+      if (cross < 0) {
+        break;
+      }
+      hull_size--;
+    }
+    hull[hull_size++] = band;
+  }
+  continuum[0] = spectrum[0];
+  for (int i = 0; i + 1 < hull_size; ++i) {
+    const int first = hull[i];
+    const int last = hull[i + 1];
+    const float slope = (spectrum[last] - spectrum[first]) /
+        (wavelengths[last] - wavelengths[first]);
+    for (int band = first + 1; band <= last; ++band) {
+      continuum[band] =
+          spectrum[first] + slope * (wavelengths[band] - wavelengths[first]);
+    }
+  }
+}
+
+// Computes spectrum / continuum, or 0 where the continuum is not positive.
+void DivideByContinuum(
+    const float* spectrum,
+    const float* continuum,
+    const int num_bands,
+    float* continuum_removed_spectrum) {
+
+  int band = 0;
+#ifdef __AVX2__
+  const __m256 zero = _mm256_setzero_ps();
+  for (; band + 8 <= num_bands; band += 8) {
+    const __m256 continuum_values = _mm256_loadu_ps(continuum + band);
+    const __m256 quotient =
+        _mm256_div_ps(_mm256_loadu_ps(spectrum + band), continuum_values);
+    _mm256_storeu_ps(
+        continuum_removed_spectrum + band,
+        _mm256_and_ps(
+            quotient, _mm256_cmp_ps(continuum_values, zero, _CMP_GT_OQ)));
+  }
+#endif
+  for (; band < num_bands; ++band) {
+    continuum_removed_spectrum[band] = (continuum[band] > 0) ?
+        spectrum[band] / continuum[band] : 0;
+  }
+}
+
+// Calls process_block(spectra, first_pixel, num_pixels) for blocks of
+// consecutive pixels (in row-major order) of the view, in parallel. The
+// spectra of each block are passed as contiguous floats, one spectrum after
+// the other.
+void ProcessSpectra(
+    const HSIDataView& data_view,
+    const int num_threads,
+    const std::function<void(const float*, const long, const long)>&
+        process_block) {
+
+  const HSIData& hsi_data = data_view.GetUnderlyingData();
+  const int num_cols = data_view.num_cols();
+  const int num_bands = data_view.num_bands();
+  const long num_pixels = static_cast<long>(data_view.num_rows()) * num_cols;
+  // Views of all of the data use the gathers of HSIData (or the BIP floats
+  // in place). The spectra of other views are copied value by value.
+  const bool is_whole_data = data_view.IsWholeData();
+  const bool is_float = hsi_data.data_type == HSI_DATA_TYPE_FLOAT;
+  const bool is_bip_float = is_whole_data && is_float &&
+      hsi_data.interleave_format == HSI_INTERLEAVE_BIP;
+  ParallelFor(
+      0, num_pixels, num_threads, kPixelBlockSize,
+      [&](const long begin, const long end) {
+        std::vector<int> rows;
+        std::vector<int> cols;
+        std::vector<float> spectra;
+        for (long pixel = begin; pixel < end; pixel += kPixelBlockSize) {
+          const long block_size = std::min(kPixelBlockSize, end - pixel);
+          if (is_bip_float) {
+            process_block(
+                reinterpret_cast<const float*>(hsi_data.raw_data.data()) +
+                    pixel * num_bands,
+                pixel,
+                block_size);
+            continue;
+          }
+          rows.resize(block_size);
+          cols.resize(block_size);
+          for (long i = 0; i < block_size; ++i) {
+            rows[i] = (pixel + i) / num_cols;
+            cols[i] = (pixel + i) % num_cols;
+          }
+          spectra.resize(block_size * num_bands);
+          if (is_whole_data) {
+            hsi_data.GatherSpectra(
+                rows.data(), cols.data(), block_size, spectra.data());
+          } else {
+            for (long i = 0; i < block_size; ++i) {
+              float* spectrum = spectra.data() + i * num_bands;
+              for (int band = 0; band < num_bands; ++band) {
+                if (is_float) {
+                  std::memcpy(
+                      spectrum + band,
+                      data_view.GetValueBytes(rows[i], cols[i], band),
+                      sizeof(float));
+                } else {
+                  spectrum[band] = static_cast<float>(
+                      data_view.GetValueAsDouble(rows[i], cols[i], band));
+                }
+              }
+            }
+          }
+          process_block(spectra.data(), pixel, block_size);
+        }
+      });
+}
+
+// The bands of an absorption feature window.
+struct FeatureBands {
+  int start_band = 0;
+  int num_bands = 0;
+};
+
+// Computes the band depth and position of a feature in the spectrum.
+void ComputeFeature(
+    const float* wavelengths,
+    const float* spectrum,
+    const FeatureBands& feature_bands,
+    int* hull,
+    float* continuum,
+    float* depth,
+    float* position) {
+
+  *depth = 0;
+  *position = 0;
+  const int num_bands = feature_bands.num_bands;
+  if (num_bands < 3) {
+    return;
+  }
+  const float* feature_wavelengths = wavelengths + feature_bands.start_band;
+  const float* feature_spectrum = spectrum + feature_bands.start_band;
+  ComputeContinuum(
+      feature_wavelengths, feature_spectrum, num_bands, hull, continuum);
+  DivideByContinuum(feature_spectrum, continuum, num_bands, continuum);
+  const int minimum =
+      std::min_element(continuum, continuum + num_bands) - continuum;
+  if (continuum[minimum] >= 1) {
+    return;
+  }
+  *depth = 1 - continuum[minimum];
+  *position = feature_wavelengths[minimum];
+  if (minimum > 0 && minimum + 1 < num_bands) {
+    // The vertex of the parabola through the minimum and its neighbors.
+    const float before = continuum[minimum - 1];
+    const float after = continuum[minimum + 1];
+    const float curvature = before - 2 * continuum[minimum] + after;
+    if (curvature > 0) {
+      const float offset = 0.5f * (before - after) / curvature;
+      *position += offset * 0.5f * (feature_wavelengths[minimum + 1] -
+                                    feature_wavelengths[minimum - 1]);
+    }
+  }
+}
+
+// Checks the wavelengths and returns them as floats.
+std::vector<float> GetFloatWavelengths(
+    const std::vector<double>& wavelengths, const int num_bands) {
+
+  if (static_cast<int>(wavelengths.size()) != num_bands) {
+    FatalError("There must be one wavelength for each band.");
+  }
+  for (int band = 1; band < num_bands; ++band) {
+    if (wavelengths[band] <= wavelengths[band - 1]) {
+      FatalError("Wavelengths must be increasing.");
+    }
+  }
+  return std::vector<float>(wavelengths.begin(), wavelengths.end());
+}
+
+// Returns the wavelengths of the bands of the range from the reader's options.
+std::vector<double> GetRangeWavelengths(
+    const HSIDataRange& data_range, const HSIDataReader& reader) {
+
+  const std::vector<double>& all_wavelengths = reader.GetOptions().wavelengths;
+  if (static_cast<int>(all_wavelengths.size()) <
+      reader.GetOptions().num_data_bands) {
+    FatalError("The data has no wavelength for each band.");
+  }
+  return std::vector<double>(
+      all_wavelengths.begin() + data_range.start_band,
+      all_wavelengths.begin() + data_range.end_band);
+}
+
+}  // namespace
+
+void RemoveContinuum(
+    const float* wavelengths,
+    const float* spectrum,
+    const int num_bands,
+    float* continuum_removed_spectrum) {
+
+  if (num_bands <= 0) {
+    return;
+  }
+  std::vector<int> hull(num_bands);
+  ComputeContinuum(
+      wavelengths,
+      spectrum,
+      num_bands,
+      hull.data(),
+      continuum_removed_spectrum);
+  DivideByContinuum(
+      spectrum,
+      continuum_removed_spectrum,
+      num_bands,
+      continuum_removed_spectrum);
+}
+
+HSIData RemoveContinuum(
+    const HSIDataView& data_view,
+    const std::vector<double>& wavelengths,
+    const HSIContinuumRemovalOptions& options) {
+
+  const int num_cols = data_view.num_cols();
+  const int num_bands = data_view.num_bands();
+  const std::vector<float> band_wavelengths =
+      GetFloatWavelengths(wavelengths, num_bands);
+  HSIData removed_data;
+  removed_data.num_rows = data_view.num_rows();
+  removed_data.num_cols = num_cols;
+  removed_data.num_bands = num_bands;
+  removed_data.interleave_format = data_view.interleave_format();
+  removed_data.data_type = HSI_DATA_TYPE_FLOAT;
+  removed_data.raw_data.resize(
+      static_cast<long>(data_view.NumDataPoints()) * sizeof(float));
+  float* removed_values =
+      reinterpret_cast<float*>(removed_data.raw_data.data());
+  long row_stride;
+  long col_stride;
+  long band_stride;
+  GetInterleaveStrides(
+      removed_data.interleave_format,
+      removed_data.num_rows,
+      num_cols,
+      num_bands,
+      &row_stride,
+      &col_stride,
+      &band_stride);
+
+  ProcessSpectra(
+      data_view, options.num_threads,
+      [&](const float* spectra, const long first_pixel, const long count) {
+        std::vector<int> hull(num_bands);
+        std::vector<float> spectrum(num_bands);
+        for (long i = 0; i < count; ++i) {
+          const long pixel = first_pixel + i;
+          const long index = (pixel / num_cols) * row_stride +
+              (pixel % num_cols) * col_stride;
+          // BIP spectra are written in place; others are scattered.
+          float* removed_spectrum = (band_stride == 1) ?
+              removed_values + index : spectrum.data();
+          ComputeContinuum(
+              band_wavelengths.data(),
+              spectra + i * num_bands,
+              num_bands,
+              hull.data(),
+              removed_spectrum);
+          DivideByContinuum(
+              spectra + i * num_bands,
+              removed_spectrum,
+              num_bands,
+              removed_spectrum);
+          if (band_stride != 1) {
+            for (int band = 0; band < num_bands; ++band) {
+              removed_values[index + band * band_stride] = spectrum[band];
+            }
+          }
+        }
+      });
+  return removed_data;
+}
+
+HSIData ComputeAbsorptionFeatures(
+    const HSIDataView& data_view,
+    const std::vector<double>& wavelengths,
+    const std::vector<HSIAbsorptionFeatureWindow>& feature_windows,
+    const HSIContinuumRemovalOptions& options) {
+
+  const int num_bands = data_view.num_bands();
+  const std::vector<float> band_wavelengths =
+      GetFloatWavelengths(wavelengths, num_bands);
+  std::vector<FeatureBands> features;
+  for (const HSIAbsorptionFeatureWindow& window : feature_windows) {
+    FeatureBands feature_bands;
+    feature_bands.start_band = std::lower_bound(
+        wavelengths.begin(), wavelengths.end(), window.start_wavelength) -
+        wavelengths.begin();
+    feature_bands.num_bands = std::upper_bound(
+        wavelengths.begin(), wavelengths.end(), window.end_wavelength) -
+        wavelengths.begin() - feature_bands.start_band;
+    feature_bands.num_bands = std::max(0, feature_bands.num_bands);
+    features.push_back(feature_bands);
+  }
+
+  HSIData feature_data;
+  feature_data.num_rows = data_view.num_rows();
+  feature_data.num_cols = data_view.num_cols();
+  feature_data.num_bands = 2 * static_cast<int>(features.size());
+  feature_data.interleave_format = HSI_INTERLEAVE_BSQ;
+  feature_data.data_type = HSI_DATA_TYPE_FLOAT;
+  feature_data.raw_data.resize(
+      static_cast<long>(feature_data.NumDataPoints()) * sizeof(float));
+  float* feature_values =
+      reinterpret_cast<float*>(feature_data.raw_data.data());
+  const long num_pixels =
+      static_cast<long>(feature_data.num_rows) * feature_data.num_cols;
+
+  ProcessSpectra(
+      data_view, options.num_threads,
+      [&](const float* spectra, const long first_pixel, const long count) {
+        std::vector<int> hull(num_bands);
+        std::vector<float> continuum(num_bands);
+        for (long i = 0; i < count; ++i) {
+          const long pixel = first_pixel + i;
+          for (size_t feature = 0; feature < features.size(); ++feature) {
+            ComputeFeature(
+                band_wavelengths.data(),
+                spectra + i * num_bands,
+                features[feature],
+                hull.data(),
+                continuum.data(),
+                &feature_values[2 * feature * num_pixels + pixel],
+                &feature_values[(2 * feature + 1) * num_pixels + pixel]);
+          }
+        }
+      });
+  return feature_data;
+}
+
+void ReadContinuumRemoved(
+    const HSIDataRange& data_range,
+    const HSIContinuumRemovalOptions& options,
+    HSIDataReader* reader,
+    const ContinuumRowsCallback& callback) {
+
+  const std::vector<double> wavelengths =
+      GetRangeWavelengths(data_range, *reader);
+  ForEachPrefetchedTile(
+      data_range,
+      options.tile_rows,
+      reader,
+      [&](const HSIDataView& tile_view, const int start_row) {
+        callback(RemoveContinuum(tile_view, wavelengths, options), start_row);
+      });
+}
+
+void ReadAbsorptionFeatures(
+    const HSIDataRange& data_range,
+    const std::vector<HSIAbsorptionFeatureWindow>& feature_windows,
+    const HSIContinuumRemovalOptions& options,
+    HSIDataReader* reader,
+    const ContinuumRowsCallback& callback) {
+
+  const std::vector<double> wavelengths =
+      GetRangeWavelengths(data_range, *reader);
+  ForEachPrefetchedTile(
+      data_range,
+      options.tile_rows,
+      reader,
+      [&](const HSIDataView& tile_view, const int start_row) {
+        callback(
+            ComputeAbsorptionFeatures(
+                tile_view, wavelengths, feature_windows, options),
+            start_row);
+      });
+}
+
+}  // namespace hsi
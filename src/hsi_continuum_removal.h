@@ -0,0 +1,90 @@
+// Provides continuum removal and absorption feature extraction, as used for
+// mineral mapping. The continuum of a spectrum is its upper convex hull (over
+// wavelength), and the continuum-removed spectrum is the spectrum divided by
+// its continuum: 1 where the spectrum touches the hull, and less than 1 in
+// absorption features. The hull is computed with a monotone chain, in linear
+// time in the number of bands.
+//
+// An absorption feature is described by a wavelength window. Its band depth
+// is 1 minus the minimum of the spectrum divided by the continuum of the
+// window, and its position is the wavelength of that minimum.
+
+#ifndef SRC_HSI_CONTINUUM_REMOVAL_H_
+#define SRC_HSI_CONTINUUM_REMOVAL_H_
+
+#include <functional>
+#include <vector>
+
+#include "./hsi_data_reader.h"
+#include "./hsi_data_view.h"
+
+namespace hsi {
+
+// The wavelength range of an absorption feature, inclusive.
+struct HSIAbsorptionFeatureWindow {
+  double start_wavelength = 0;
+  double end_wavelength = 0;
+};
+
+struct HSIContinuumRemovalOptions {
+  // The number of threads. Zero means one for each hardware thread.
+  int num_threads = 0;
+
+  // The number of rows read at a time by ReadContinuumRemoved() and
+  // ReadAbsorptionFeatures().
+  int tile_rows = 64;
+};
+
+// Computes the continuum-removed spectrum of num_bands values. wavelengths
+// must be increasing. Values where the continuum is not positive are set to 0.
+void RemoveContinuum(
+    const float* wavelengths,
+    const float* spectrum,
+    const int num_bands,
+    float* continuum_removed_spectrum);
+
+// Returns the continuum-removed spectra of all pixels of the view (or of
+// HSIData) as floats, with the size of the view and the interleave format of
+// its data. There must be one wavelength for each band.
+HSIData RemoveContinuum(
+    const HSIDataView& data_view,
+    const std::vector<double>& wavelengths,
+    const HSIContinuumRemovalOptions& options);
+
+// Returns the band depth and position of each absorption feature for all
+// pixels of the view (or of HSIData), as BSQ float data with two bands for
+// each feature: band 2 * i is the depth of feature i, and band 2 * i + 1 is
+// its position. The position is refined between bands with a parabola
+// through the minimum and its neighbors. Pixels without a feature (depth 0)
+// have position 0.
+HSIData ComputeAbsorptionFeatures(
+    const HSIDataView& data_view,
+    const std::vector<double>& wavelengths,
+    const std::vector<HSIAbsorptionFeatureWindow>& feature_windows,
+    const HSIContinuumRemovalOptions& options);
+
+// Called by ReadContinuumRemoved() and ReadAbsorptionFeatures() with the
+// results of each tile, starting at the given row of the range.
+typedef std::function<void(const HSIData& result_rows, const int start_row)>
+    ContinuumRowsCallback;
+
+// Computes the continuum-removed spectra or the absorption features as above
+// for the given range, reading one tile of rows at a time from the reader
+// (the next tile while the current one is processed), so that whole scenes
+// can be processed without loading them. The wavelengths are taken from the
+// reader's options.
+void ReadContinuumRemoved(
+    const HSIDataRange& data_range,
+    const HSIContinuumRemovalOptions& options,
+    HSIDataReader* reader,
+    const ContinuumRowsCallback& callback);
+void ReadAbsorptionFeatures(
+    const HSIDataRange& data_range,
+    const std::vector<HSIAbsorptionFeatureWindow>& feature_windows,
+    const HSIContinuumRemovalOptions& options,
+    HSIDataReader* reader,
+    const ContinuumRowsCallback& callback);
+
+}  // namespace hsi
+
+#endif  // SRC_HSI_CONTINUUM_REMOVAL_H_
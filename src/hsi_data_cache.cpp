@@ -0,0 +1,375 @@
+#include "./hsi_data_cache.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace hsi {
+namespace {
+
+// Extensions of the cached data file and of the file holding its full key.
+const char kDataFileExtension[] = ".dat";
+const char kKeyFileExtension[] = ".key";
+
+// Approximate number of bytes of source data converted at a time when a new
+// cache entry is created.
+constexpr long kInsertChunkBytes = 256L * 1024L * 1024L;
+
+// 64-bit FNV-1a hash, which (unlike std::hash) is stable across builds so
+// that cache file names can be shared between programs.
+std::string HashKey(const std::string& key) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (const char c : key) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 1099511628211ULL;
+  }
+  char hex[17];
+  std::snprintf(hex, sizeof(hex), "%016llx",
+                static_cast<unsigned long long>(hash));  // NOLINT
+  return std::string(hex);
+}
+
+// Returns the expected size in bytes of the cached copy of the given data.
+long GetCachedFileSize(const HSIDataOptions& data_options) {
+  return static_cast<long>(data_options.num_data_rows) *
+      data_options.num_data_cols * data_options.num_data_bands *
+      GetDataSize(data_options.GetInMemoryDataType());
+}
+
+// Writes all bytes at the given file offset. Returns false on failure.
+bool WriteAllAt(const int fd, const char* bytes, long size, long offset) {
+  while (size > 0) {
+    const ssize_t written = pwrite(fd, bytes, size, offset);
+    if (written <= 0) {
+      return false;
+    }
+    bytes += written;
+    size -= written;
+    offset += written;
+  }
+  return true;
+}
+
+}  // namespace
+
+HSIDataCache::HSIDataCache(
+    const std::string& cache_directory, const long quota_bytes)
+    : cache_directory_(cache_directory), quota_bytes_(quota_bytes) {}
+
+std::string HSIDataCache::GetCacheKey(
+    const HSIDataOptions& data_options) const {
+
+  struct stat file_stat;
+  if (stat(data_options.hsi_file_path.c_str(), &file_stat) != 0) {
+    return "";
+  }
+  std::ostringstream key;
+  key << "path = " << data_options.hsi_file_path << "\n"
+      << "mtime = " << file_stat.st_mtim.tv_sec << "."
+      << file_stat.st_mtim.tv_nsec << "\n"
+      << "size = " << file_stat.st_size << "\n"
+      << "interleave = " << data_options.interleave_format << "\n"
+      << "data type = " << data_options.data_type << "\n"
+      << "byte order = " << data_options.big_endian << "\n"
+      << "bit order = " << data_options.packed_msb_first << "\n"
+      << "header offset = " << data_options.header_offset << "\n"
+      << "rows = " << data_options.num_data_rows << "\n"
+      << "cols = " << data_options.num_data_cols << "\n"
+      << "bands = " << data_options.num_data_bands << "\n"
+      << "extract complex component = "
+      << data_options.extract_complex_component << "\n"
+      << "complex component = " << data_options.complex_component << "\n"
+      << "target interleave = "
+      << data_options.GetInMemoryInterleaveFormat() << "\n"
+      << "target data type = " << data_options.GetInMemoryDataType() << "\n";
+  return key.str();
+}
+
+bool HSIDataCache::Lookup(
+    const HSIDataOptions& data_options,
+    std::string* cached_file_path) const {
+
+  const std::string key = GetCacheKey(data_options);
+  if (key.empty()) {
+    return false;
+  }
+  const std::string base_path = cache_directory_ + "/" + HashKey(key);
+  const std::string data_path = base_path + kDataFileExtension;
+
+  // Compare the full key to guard against hash collisions.
+  std::ifstream key_file(base_path + kKeyFileExtension);
+  if (!key_file.is_open()) {
+    return false;
+  }
+  std::stringstream stored_key;
+  stored_key << key_file.rdbuf();
+  if (stored_key.str() != key) {
+    return false;
+  }
+  struct stat data_stat;
+  if (stat(data_path.c_str(), &data_stat) != 0 ||
+      data_stat.st_size != GetCachedFileSize(data_options)) {
+    return false;
+  }
+
+  // The data file's modification time records when it was last used.
+  utime(data_path.c_str(), nullptr);
+  *cached_file_path = data_path;
+  return true;
+}
+
+std::string HSIDataCache::Insert(
+    const HSIDataOptions& data_options,
+    const ReadFunction& read_function) const {
+
+  const std::string key = GetCacheKey(data_options);
+  if (key.empty()) {
+    Error("Cannot cache " + data_options.hsi_file_path +
+          ": file not found.");
+    return "";
+  }
+  const std::string base_path = cache_directory_ + "/" + HashKey(key);
+  const std::string data_path = base_path + kDataFileExtension;
+  const std::string key_path = base_path + kKeyFileExtension;
+
+  // Write to temporary files first, and rename them into place when they are
+  // complete, so that concurrent readers never see partial entries.
+  const std::string temp_suffix = ".tmp" + std::to_string(getpid());
+  const int fd = open(
+      (data_path + temp_suffix).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    Error("Cannot create cache file in " + cache_directory_ + ".");
+    return "";
+  }
+
+  const HSIDataType target_type = data_options.GetInMemoryDataType();
+  const HSIDataInterleaveFormat target_interleave =
+      data_options.GetInMemoryInterleaveFormat();
+  const int target_data_size = GetDataSize(target_type);
+  const long bytes_per_row =
+      static_cast<long>(data_options.num_data_cols) *
+      data_options.num_data_bands *
+      std::max(GetDataSize(data_options.data_type), target_data_size);
+  const int chunk_rows = static_cast<int>(std::max(
+      1L, std::min(static_cast<long>(data_options.num_data_rows),
+                   kInsertChunkBytes / bytes_per_row)));
+
+  // Convert the cube one chunk of rows at a time to bound memory use.
+  bool success = true;
+  HSIDataRange chunk_range;
+  chunk_range.start_col = 0;
+  chunk_range.end_col = data_options.num_data_cols;
+  chunk_range.start_band = 0;
+  chunk_range.end_band = data_options.num_data_bands;
+  for (int row = 0; row < data_options.num_data_rows && success;
+       row += chunk_rows) {
+    chunk_range.start_row = row;
+    chunk_range.end_row =
+        std::min(row + chunk_rows, data_options.num_data_rows);
+    HSIData chunk_data;
+    read_function(chunk_range, &chunk_data);
+    ConvertToInMemoryFormat(data_options, &chunk_data);
+
+    const int num_chunk_rows = chunk_data.num_rows;
+    if (target_interleave == HSI_INTERLEAVE_BSQ) {
+      // Each band of the chunk goes to a different part of the file.
+      const long band_bytes =
+          static_cast<long>(num_chunk_rows) * chunk_data.num_cols *
+          target_data_size;
+      const long file_band_bytes =
+          static_cast<long>(data_options.num_data_rows) *
+          data_options.num_data_cols * target_data_size;
+      const long row_bytes =
+          static_cast<long>(data_options.num_data_cols) * target_data_size;
+      for (int band = 0; band < chunk_data.num_bands && success; ++band) {
+        success = WriteAllAt(
+            fd,
+            chunk_data.raw_data.data() + band * band_bytes,
+            band_bytes,
+            band * file_band_bytes + row * row_bytes);
+      }
+    } else {
+      // BIL and BIP chunks of whole rows are contiguous in the file.
+      success = WriteAllAt(
+          fd,
+          chunk_data.raw_data.data(),
+          chunk_data.raw_data.size(),
+          static_cast<long>(row) * data_options.num_data_cols *
+              data_options.num_data_bands * target_data_size);
+    }
+  }
+  close(fd);
+
+  if (success) {
+    std::ofstream key_file(key_path + temp_suffix);
+    key_file << key;
+    key_file.close();
+    success = !key_file.fail() &&
+        std::rename((data_path + temp_suffix).c_str(),
+                    data_path.c_str()) == 0 &&
+        std::rename((key_path + temp_suffix).c_str(),
+                    key_path.c_str()) == 0;
+  }
+  if (!success) {
+    Error("Failed to write cache entry for " + data_options.hsi_file_path +
+          ".");
+    std::remove((data_path + temp_suffix).c_str());
+    std::remove((key_path + temp_suffix).c_str());
+    return "";
+  }
+
+  // Entries of earlier versions of the file can never be used again.
+  RemoveOutdatedEntries(key);
+  EvictEntries(data_path);
+  return data_path;
+}
+
+bool HSIDataCache::ReadRange(
+    const HSIDataOptions& data_options,
+    const std::string& cached_file_path,
+    const HSIDataRange& data_range,
+    HSIData* hsi_data) const {
+
+  const int fd = open(cached_file_path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  const long file_size = GetCachedFileSize(data_options);
+  void* mapped = mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    return false;
+  }
+
+  hsi_data->data_type = data_options.GetInMemoryDataType();
+  hsi_data->interleave_format = data_options.GetInMemoryInterleaveFormat();
+  CopyDataRange(
+      reinterpret_cast<const char*>(mapped),
+      data_options.num_data_rows,
+      data_options.num_data_cols,
+      data_options.num_data_bands,
+      data_range,
+      hsi_data);
+  munmap(mapped, file_size);
+  return true;
+}
+
+void HSIDataCache::EvictEntries(const std::string& keep_file_path) const {
+  if (quota_bytes_ <= 0) {
+    return;
+  }
+  DIR* directory = opendir(cache_directory_.c_str());
+  if (directory == nullptr) {
+    return;
+  }
+
+  // Collect (last use time, size, path) of all cached data files.
+  std::vector<std::pair<time_t, std::pair<long, std::string>>> entries;
+  long total_bytes = 0;
+  const std::string extension(kDataFileExtension);
+  struct dirent* entry;
+  while ((entry = readdir(directory)) != nullptr) {
+    const std::string name(entry->d_name);
+    if (name.size() <= extension.size() ||
+        name.compare(name.size() - extension.size(), extension.size(),
+                     extension) != 0) {
+      continue;
+    }
+    const std::string path = cache_directory_ + "/" + name;
+    struct stat file_stat;
+    if (stat(path.c_str(), &file_stat) != 0) {
+      continue;
+    }
+    total_bytes += file_stat.st_size;
+    entries.push_back(std::make_pair(
+        file_stat.st_mtime, std::make_pair(file_stat.st_size, path)));
+  }
+  closedir(directory);
+
+  std::sort(entries.begin(), entries.end());
+  for (const auto& lru_entry : entries) {
+    if (total_bytes <= quota_bytes_) {
+      break;
+    }
+    const std::string& path = lru_entry.second.second;
+    if (path == keep_file_path) {
+      continue;
+    }
+    const std::string key_path =
+        path.substr(0, path.size() - extension.size()) + kKeyFileExtension;
+    std::remove(key_path.c_str());
+    if (std::remove(path.c_str()) == 0) {
+      total_bytes -= lru_entry.second.first;
+    }
+  }
+}
+
+void HSIDataCache::RemoveEntries(const std::string& hsi_file_path) const {
+  // Every key starts with the path of the source file.
+  const std::string path_line = "path = " + hsi_file_path + "\n";
+  RemoveMatchingEntries([&path_line](const std::string& key) {
+    return key.compare(0, path_line.size(), path_line) == 0;
+  });
+}
+
+void HSIDataCache::RemoveOutdatedEntries(const std::string& key) const {
+  // The first three lines of a key identify the version of the source file:
+  // its path, modification time and size.
+  size_t version_size = 0;
+  for (int line = 0; line < 3; ++line) {
+    version_size = key.find('\n', version_size) + 1;
+  }
+  const std::string path_line = key.substr(0, key.find('\n') + 1);
+  const std::string version = key.substr(0, version_size);
+  RemoveMatchingEntries([&](const std::string& stored_key) {
+    return stored_key.compare(0, path_line.size(), path_line) == 0 &&
+        stored_key.compare(0, version.size(), version) != 0;
+  });
+}
+
+void HSIDataCache::RemoveMatchingEntries(
+    const std::function<bool(const std::string& key)>& key_matches) const {
+
+  DIR* directory = opendir(cache_directory_.c_str());
+  if (directory == nullptr) {
+    return;
+  }
+  const std::string extension(kKeyFileExtension);
+  std::vector<std::string> base_paths;
+  struct dirent* entry;
+  while ((entry = readdir(directory)) != nullptr) {
+    const std::string name(entry->d_name);
+    if (name.size() <= extension.size() ||
+        name.compare(name.size() - extension.size(), extension.size(),
+                     extension) != 0) {
+      continue;
+    }
+    const std::string base_path = cache_directory_ + "/" +
+        name.substr(0, name.size() - extension.size());
+    std::ifstream key_file(base_path + kKeyFileExtension);
+    std::stringstream stored_key;
+    stored_key << key_file.rdbuf();
+    if (key_matches(stored_key.str())) {
+      base_paths.push_back(base_path);
+    }
+  }
+  closedir(directory);
+
+  for (const std::string& base_path : base_paths) {
+    std::remove((base_path + kKeyFileExtension).c_str());
+    std::remove((base_path + kDataFileExtension).c_str());
+  }
+}
+
+}  // namespace hsi
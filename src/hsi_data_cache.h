@@ -0,0 +1,92 @@
+// Provides the HSIDataCache class, an opt-in persistent on-disk cache of
+// converted HSI data. Reading a cube typically involves swapping the byte
+// order, casting the values to another type, and transposing them to another
+// interleave format. The cache stores the result of that work for the entire
+// cube, so that later reads of the same file (even by other processes) can
+// copy the requested range directly out of the memory-mapped cached copy.
+//
+// Cache entries are keyed by the source file path, modification time and
+// size, plus the file layout and the conversion applied. Modifying the source
+// file therefore invalidates its entries, which are deleted when the new
+// version is cached. The least recently used entries are evicted to keep the
+// cache directory under a disk quota.
+//
+// The cache is normally used transparently by setting
+// HSIDataOptions::cache_directory before reading with an HSIDataReader.
+
+#ifndef SRC_HSI_DATA_CACHE_H_
+#define SRC_HSI_DATA_CACHE_H_
+
+#include <functional>
+#include <string>
+
+#include "./hsi_data_reader.h"
+
+namespace hsi {
+
+class HSIDataCache {
+ public:
+  // Reads the given range of the source file as stored in the file (no
+  // conversion) into the given HSIData. Used to fill new cache entries.
+  typedef std::function<void(const HSIDataRange&, HSIData*)> ReadFunction;
+
+  // The cache directory must already exist. If quota_bytes is zero, the cache
+  // size is not limited.
+  HSIDataCache(const std::string& cache_directory, const long quota_bytes);
+
+  // Returns true and sets cached_file_path if an up-to-date cached copy of
+  // the data described by data_options exists. The entry is marked as most
+  // recently used.
+  bool Lookup(
+      const HSIDataOptions& data_options,
+      std::string* cached_file_path) const;
+
+  // Converts the entire cube described by data_options and stores it in the
+  // cache, reading the source in chunks of rows with read_function. Removes
+  // the entries of earlier versions of the source file, and evicts old
+  // entries if the quota is exceeded. Returns the path of the new cached
+  // file, or an empty string on failure.
+  std::string Insert(
+      const HSIDataOptions& data_options,
+      const ReadFunction& read_function) const;
+
+  // Memory-maps the cached file and copies the given range out of it into
+  // hsi_data. Returns true on success.
+  bool ReadRange(
+      const HSIDataOptions& data_options,
+      const std::string& cached_file_path,
+      const HSIDataRange& data_range,
+      HSIData* hsi_data) const;
+
+  // Deletes least recently used entries until the total size of the cache is
+  // within the quota. The entry at keep_file_path is never deleted.
+  void EvictEntries(const std::string& keep_file_path) const;
+
+  // Deletes all entries of the given source file, whatever their conversion.
+  // Used when the source file is modified in place.
+  void RemoveEntries(const std::string& hsi_file_path) const;
+
+ private:
+  // Returns the cache key for the given data, or an empty string if the
+  // source file cannot be found.
+  std::string GetCacheKey(const HSIDataOptions& data_options) const;
+
+  // Deletes the entries of the same source file as the given key that were
+  // made from a different version of the file (modification time or size).
+  // Entries of the current version with other conversions are kept.
+  void RemoveOutdatedEntries(const std::string& key) const;
+
+  // Deletes all entries whose stored key satisfies key_matches.
+  void RemoveMatchingEntries(
+      const std::function<bool(const std::string& key)>& key_matches) const;
+
+  // The directory where cached files and their metadata are stored.
+  const std::string cache_directory_;
+
+  // The maximum total size of the cached data files.
+  const long quota_bytes_;
+};
+
+}  // namespace hsi
+
+#endif  // SRC_HSI_DATA_CACHE_H_
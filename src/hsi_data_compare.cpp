@@ -0,0 +1,367 @@
+#include "./hsi_data_compare.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace hsi {
+namespace {
+
+// Values are classified by their bits because the release build assumes
+// finite math, under which comparisons with NaN and infinity may be folded
+// away. The bits of non-negative floats (such as absolute differences) order
+// them like their values when compared as signed integers.
+constexpr int32_t kFloatExponentMask = 0x7f800000;
+constexpr int32_t kFloatAbsMask = 0x7fffffff;
+
+int32_t GetFloatBits(const float value) {
+  int32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+float GetFloatFromBits(const int32_t bits) {
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+// Running per-band sums over all compared tiles. The maximum is kept as the
+// bits of the (non-negative) absolute difference.
+struct BandAccumulator {
+  double sum = 0;
+  double sum_squares = 0;
+  int32_t max_abs_difference_bits = 0;
+  long num_changed_values = 0;
+};
+
+// Compares num_values values of the same band in two spans. Updates the
+// band accumulator and, for each position, the bits of the largest absolute
+// difference seen so far in pixel_max_abs_difference_bits.
+//
+// A value that is NaN on one side only is changed, with an infinite absolute
+// difference, and is left out of the sums. Values that are NaN on both sides
+// or have identical bits (including equal infinities) are unchanged.
+void CompareSpan(
+    const float* first,
+    const float* second,
+    const int num_values,
+    const int32_t tolerance_bits,
+    int32_t* pixel_max_abs_difference_bits,
+    BandAccumulator* accumulator) {
+
+  // The sums are accumulated in double, so that long spans of small
+  // differences are not lost to float rounding.
+  int i = 0;
+  double sum = 0;
+  double sum_squares = 0;
+  int32_t max_abs_difference_bits = accumulator->max_abs_difference_bits;
+  long num_changed_values = 0;
+#ifdef __AVX2__
+  const __m256i abs_mask = _mm256_set1_epi32(kFloatAbsMask);
+  const __m256i exponent_mask = _mm256_set1_epi32(kFloatExponentMask);
+  const __m256i tolerance_vector = _mm256_set1_epi32(tolerance_bits);
+  __m256d sum_vector = _mm256_setzero_pd();
+  __m256d sum_squares_vector = _mm256_setzero_pd();
+  __m256i max_vector = _mm256_set1_epi32(max_abs_difference_bits);
+  __m256i changed_vector = _mm256_setzero_si256();
+  for (; i + 8 <= num_values; i += 8) {
+    const __m256 first_vector = _mm256_loadu_ps(first + i);
+    const __m256 second_vector = _mm256_loadu_ps(second + i);
+    const __m256i first_bits = _mm256_castps_si256(first_vector);
+    const __m256i second_bits = _mm256_castps_si256(second_vector);
+    const __m256i first_nan = _mm256_cmpgt_epi32(
+        _mm256_and_si256(first_bits, abs_mask), exponent_mask);
+    const __m256i second_nan = _mm256_cmpgt_epi32(
+        _mm256_and_si256(second_bits, abs_mask), exponent_mask);
+    const __m256i nan_mismatch = _mm256_xor_si256(first_nan, second_nan);
+    const __m256i unchanged = _mm256_or_si256(
+        _mm256_and_si256(first_nan, second_nan),
+        _mm256_cmpeq_epi32(first_bits, second_bits));
+    const __m256i skipped = _mm256_or_si256(nan_mismatch, unchanged);
+    __m256i abs_difference_bits = _mm256_and_si256(
+        _mm256_castps_si256(_mm256_sub_ps(first_vector, second_vector)),
+        abs_mask);
+    abs_difference_bits = _mm256_or_si256(
+        _mm256_andnot_si256(skipped, abs_difference_bits),
+        _mm256_and_si256(nan_mismatch, exponent_mask));
+
+    // Widen each half of the values to double for the sums, leaving out the
+    // skipped lanes.
+    for (int half = 0; half < 2; ++half) {
+      const __m256d double_difference = _mm256_sub_pd(
+          _mm256_cvtps_pd(half == 0 ?
+              _mm256_castps256_ps128(first_vector) :
+              _mm256_extractf128_ps(first_vector, 1)),
+          _mm256_cvtps_pd(half == 0 ?
+              _mm256_castps256_ps128(second_vector) :
+              _mm256_extractf128_ps(second_vector, 1)));
+      const __m256d skipped_lanes = _mm256_castsi256_pd(_mm256_cvtepi32_epi64(
+          half == 0 ? _mm256_castsi256_si128(skipped) :
+                      _mm256_extracti128_si256(skipped, 1)));
+      const __m256d summed_difference =
+          _mm256_andnot_pd(skipped_lanes, double_difference);
+      sum_vector = _mm256_add_pd(sum_vector, summed_difference);
+      sum_squares_vector = _mm256_add_pd(
+          sum_squares_vector,
+          _mm256_mul_pd(summed_difference, summed_difference));
+    }
+    max_vector = _mm256_max_epi32(max_vector, abs_difference_bits);
+    __m256i* pixel_max = reinterpret_cast<__m256i*>(
+        pixel_max_abs_difference_bits + i);
+    _mm256_storeu_si256(
+        pixel_max,
+        _mm256_max_epi32(_mm256_loadu_si256(pixel_max), abs_difference_bits));
+    // Comparison lanes are all ones (-1 as an integer) when changed.
+    changed_vector = _mm256_sub_epi32(
+        changed_vector,
+        _mm256_cmpgt_epi32(abs_difference_bits, tolerance_vector));
+  }
+  double double_lanes[4];
+  _mm256_storeu_pd(double_lanes, sum_vector);
+  for (const double lane : double_lanes) {
+    sum += lane;
+  }
+  _mm256_storeu_pd(double_lanes, sum_squares_vector);
+  for (const double lane : double_lanes) {
+    sum_squares += lane;
+  }
+  int32_t lanes[8];
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), max_vector);
+  for (const int32_t lane : lanes) {
+    max_abs_difference_bits = std::max(max_abs_difference_bits, lane);
+  }
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), changed_vector);
+  for (const int32_t count : lanes) {
+    num_changed_values += count;
+  }
+#endif
+  for (; i < num_values; ++i) {
+    const int32_t first_bits = GetFloatBits(first[i]);
+    const int32_t second_bits = GetFloatBits(second[i]);
+    const bool first_nan = (first_bits & kFloatAbsMask) > kFloatExponentMask;
+    const bool second_nan =
+        (second_bits & kFloatAbsMask) > kFloatExponentMask;
+    int32_t abs_difference_bits = 0;
+    if (first_nan != second_nan) {
+      abs_difference_bits = kFloatExponentMask;
+    } else if (!first_nan && first_bits != second_bits) {
+      abs_difference_bits =
+          GetFloatBits(first[i] - second[i]) & kFloatAbsMask;
+      const double double_difference =
+          static_cast<double>(first[i]) - second[i];
+      sum += double_difference;
+      sum_squares += double_difference * double_difference;
+    }
+    max_abs_difference_bits =
+        std::max(max_abs_difference_bits, abs_difference_bits);
+    pixel_max_abs_difference_bits[i] =
+        std::max(pixel_max_abs_difference_bits[i], abs_difference_bits);
+    if (abs_difference_bits > tolerance_bits) {
+      ++num_changed_values;
+    }
+  }
+  accumulator->sum += sum;
+  accumulator->sum_squares += sum_squares;
+  accumulator->max_abs_difference_bits = max_abs_difference_bits;
+  accumulator->num_changed_values += num_changed_values;
+}
+
+// Returns the data as floats in BIL order, converting only if needed.
+const float* GetBILFloats(const HSIData& hsi_data, HSIData* converted_data) {
+  if (hsi_data.data_type == HSI_DATA_TYPE_FLOAT &&
+      hsi_data.interleave_format == HSI_INTERLEAVE_BIL) {
+    return reinterpret_cast<const float*>(hsi_data.raw_data.data());
+  }
+  *converted_data =
+      ConvertData(hsi_data, HSI_DATA_TYPE_FLOAT, HSI_INTERLEAVE_BIL);
+  return reinterpret_cast<const float*>(converted_data->raw_data.data());
+}
+
+// Compares a tile of rows that is first_row rows into the compared range, and
+// adds the results to the accumulators and the result.
+void CompareTile(
+    const HSIData& first_data,
+    const HSIData& second_data,
+    const int first_row,
+    const int range_num_cols,
+    const HSIComparisonOptions& options,
+    std::vector<BandAccumulator>* accumulators,
+    HSIComparisonResult* result) {
+
+  HSIData first_converted;
+  HSIData second_converted;
+  const float* first = GetBILFloats(first_data, &first_converted);
+  const float* second = GetBILFloats(second_data, &second_converted);
+
+  // BIL keeps each band of a row contiguous, so every span covers all the
+  // pixels of one row in one band.
+  const int num_cols = first_data.num_cols;
+  const int num_bands = first_data.num_bands;
+  const int32_t tolerance_bits =
+      GetFloatBits(static_cast<float>(options.tolerance));
+  std::vector<int32_t> pixel_max_abs_difference_bits(num_cols);
+  for (int row = 0; row < first_data.num_rows; ++row) {
+    std::fill(
+        pixel_max_abs_difference_bits.begin(),
+        pixel_max_abs_difference_bits.end(),
+        0);
+    for (int band = 0; band < num_bands; ++band) {
+      const long offset =
+          (static_cast<long>(row) * num_bands + band) * num_cols;
+      CompareSpan(
+          first + offset,
+          second + offset,
+          num_cols,
+          tolerance_bits,
+          pixel_max_abs_difference_bits.data(),
+          &(accumulators->at(band)));
+    }
+    for (int col = 0; col < num_cols; ++col) {
+      const bool changed =
+          pixel_max_abs_difference_bits[col] > tolerance_bits;
+      if (changed) {
+        ++result->num_changed_pixels;
+      }
+      if (options.compute_changed_pixel_mask) {
+        result->changed_pixel_mask[
+            static_cast<long>(first_row + row) * range_num_cols + col] =
+                changed ? 1 : 0;
+      }
+    }
+  }
+  result->num_rows_compared += first_data.num_rows;
+}
+
+// Fills in the final statistics from the accumulators.
+void FinishResult(
+    const std::vector<BandAccumulator>& accumulators,
+    const long num_pixels_compared,
+    HSIComparisonResult* result) {
+
+  result->band_stats.resize(accumulators.size());
+  const int num_bands = accumulators.size();
+  int32_t max_abs_difference_bits = 0;
+  for (int band = 0; band < num_bands; ++band) {
+    const BandAccumulator& accumulator = accumulators[band];
+    HSIBandDifferenceStats& stats = result->band_stats[band];
+    if (num_pixels_compared > 0) {
+      stats.mean_difference = accumulator.sum / num_pixels_compared;
+      stats.rms_difference =
+          std::sqrt(accumulator.sum_squares / num_pixels_compared);
+    }
+    stats.max_abs_difference =
+        GetFloatFromBits(accumulator.max_abs_difference_bits);
+    stats.num_changed_values = accumulator.num_changed_values;
+    max_abs_difference_bits =
+        std::max(max_abs_difference_bits, accumulator.max_abs_difference_bits);
+  }
+  result->max_abs_difference = GetFloatFromBits(max_abs_difference_bits);
+}
+
+// Returns true if the comparison should stop given the changes so far.
+bool ShouldStop(
+    const HSIComparisonOptions& options, const HSIComparisonResult& result) {
+  return options.max_changed_pixels >= 0 &&
+      result.num_changed_pixels > options.max_changed_pixels;
+}
+
+}  // namespace
+
+HSIComparisonResult CompareData(
+    const HSIDataRange& data_range,
+    const HSIComparisonOptions& options,
+    HSIDataReader* first_reader,
+    HSIDataReader* second_reader) {
+
+  const HSIDataOptions& first_options = first_reader->GetOptions();
+  const HSIDataOptions& second_options = second_reader->GetOptions();
+  if (first_options.num_data_rows != second_options.num_data_rows ||
+      first_options.num_data_cols != second_options.num_data_cols ||
+      first_options.num_data_bands != second_options.num_data_bands) {
+    FatalError("Cannot compare cubes of different sizes.");
+  }
+
+  const int num_rows = data_range.end_row - data_range.start_row;
+  const int num_cols = data_range.end_col - data_range.start_col;
+  const int num_bands = data_range.end_band - data_range.start_band;
+  const int tile_rows = std::max(1, options.tile_rows);
+  HSIComparisonResult result;
+  if (options.compute_changed_pixel_mask) {
+    result.changed_pixel_mask.assign(
+        static_cast<long>(num_rows) * num_cols, 0);
+  }
+  std::vector<BandAccumulator> accumulators(num_bands);
+
+  HSIDataRange tile_range = data_range;
+  for (int row = data_range.start_row; row < data_range.end_row;
+       row += tile_rows) {
+    tile_range.start_row = row;
+    tile_range.end_row = std::min(row + tile_rows, data_range.end_row);
+    first_reader->ReadData(tile_range);
+    second_reader->ReadData(tile_range);
+    CompareTile(
+        first_reader->GetData(),
+        second_reader->GetData(),
+        row - data_range.start_row,
+        num_cols,
+        options,
+        &accumulators,
+        &result);
+    if (ShouldStop(options, result)) {
+      result.stopped_early = tile_range.end_row < data_range.end_row;
+      break;
+    }
+  }
+  FinishResult(
+      accumulators,
+      static_cast<long>(result.num_rows_compared) * num_cols,
+      &result);
+  return result;
+}
+
+HSIComparisonResult CompareData(
+    const HSIDataView& first_view,
+    const HSIDataView& second_view,
+    const HSIComparisonOptions& options) {
+
+  HSIData first_materialized_data;
+  HSIData second_materialized_data;
+  const HSIData& first_data =
+      first_view.GetCompactData(&first_materialized_data);
+  const HSIData& second_data =
+      second_view.GetCompactData(&second_materialized_data);
+
+  if (first_data.num_rows != second_data.num_rows ||
+      first_data.num_cols != second_data.num_cols ||
+      first_data.num_bands != second_data.num_bands) {
+    FatalError("Cannot compare data of different sizes.");
+  }
+  HSIComparisonResult result;
+  if (options.compute_changed_pixel_mask) {
+    result.changed_pixel_mask.assign(
+        static_cast<long>(first_data.num_rows) * first_data.num_cols, 0);
+  }
+  std::vector<BandAccumulator> accumulators(first_data.num_bands);
+  CompareTile(
+      first_data,
+      second_data,
+      0,
+      first_data.num_cols,
+      options,
+      &accumulators,
+      &result);
+  FinishResult(
+      accumulators,
+      static_cast<long>(first_data.num_rows) * first_data.num_cols,
+      &result);
+  return result;
+}
+
+}  // namespace hsi
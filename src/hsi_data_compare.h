@@ -0,0 +1,94 @@
+// Provides streaming comparison of two hyperspectral cubes, e.g. to validate a
+// reprocessed cube against the original acquisition. The cubes are read in
+// lock-step, one tile of rows at a time, so only a single tile of each cube is
+// in memory at any point regardless of the size of the data.
+//
+// The two cubes may use different interleave formats and data types. Values
+// are compared as floats, and the difference statistics are accumulated in
+// double. A value that is NaN in only one cube is a change with an infinite
+// absolute difference, and is left out of the mean and RMS differences.
+// Values that are NaN in both cubes are unchanged.
+
+#ifndef SRC_HSI_DATA_COMPARE_H_
+#define SRC_HSI_DATA_COMPARE_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "./hsi_data_reader.h"
+#include "./hsi_data_view.h"
+
+namespace hsi {
+
+// Options that control the comparison.
+struct HSIComparisonOptions {
+  // Values whose absolute difference is greater than this are considered
+  // changed.
+  double tolerance = 0.0;
+
+  // The number of rows read from each cube at a time.
+  int tile_rows = 64;
+
+  // Stop comparing after the tile in which the number of changed pixels
+  // exceeds this value. Set to 0 to stop at the first changed pixel, or to a
+  // negative number to always compare the entire range.
+  long max_changed_pixels = -1;
+
+  // If true, a per-pixel mask of changed pixels is stored in the result.
+  bool compute_changed_pixel_mask = true;
+};
+
+// Statistics of the differences (first - second) for a single band.
+struct HSIBandDifferenceStats {
+  double mean_difference = 0;
+  double rms_difference = 0;
+  double max_abs_difference = 0;
+  long num_changed_values = 0;
+};
+
+// The result of comparing two cubes.
+struct HSIComparisonResult {
+  // True if the comparison stopped before the end of the range because the
+  // max_changed_pixels limit was exceeded. The statistics then only cover the
+  // first num_rows_compared rows.
+  bool stopped_early = false;
+  int num_rows_compared = 0;
+
+  // The largest absolute difference over all values compared.
+  double max_abs_difference = 0;
+
+  // The number of pixels with at least one changed value.
+  long num_changed_pixels = 0;
+
+  // Statistics for each band in the compared range.
+  std::vector<HSIBandDifferenceStats> band_stats;
+
+  // If requested, one value per pixel in the compared range (row-major), set
+  // to 1 if any band of that pixel changed and 0 otherwise.
+  std::vector<uint8_t> changed_pixel_mask;
+
+  // Returns true if no value differed by more than the tolerance.
+  bool IsUnchanged() const {
+    return num_changed_pixels == 0;
+  }
+};
+
+// Compares the given range of the two cubes in a single streaming pass. Both
+// readers must describe cubes of the same size. The data previously loaded in
+// either reader is replaced.
+HSIComparisonResult CompareData(
+    const HSIDataRange& data_range,
+    const HSIComparisonOptions& options,
+    HSIDataReader* first_reader,
+    HSIDataReader* second_reader);
+
+// Compares two cubes that are already in memory, given as views (or as
+// HSIData). They must have the same number of rows, columns, and bands.
+HSIComparisonResult CompareData(
+    const HSIDataView& first_view,
+    const HSIDataView& second_view,
+    const HSIComparisonOptions& options);
+
+}  // namespace hsi
+
+#endif  // SRC_HSI_DATA_COMPARE_H_
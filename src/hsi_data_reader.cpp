@@ -1,20 +1,56 @@
 #include "./hsi_data_reader.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 #include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <complex>
+#include <cstring>
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <memory>
+#include <sstream>
 #include <string>
 #include <unordered_map>
 #include <utility>
 #include <vector>
 
+#include "./hsi_complex_data.h"
+#include "./hsi_data_cache.h"
+#include "./hsi_data_view.h"
+#include "./hsi_half_float.h"
+#include "./hsi_packed_data.h"
+#include "./hsi_parallel.h"
+
 namespace hsi {
 
 /*******************************************************************************
 *** Support Functions and Objects
 *******************************************************************************/
 
+// Reads separated by at most this many bytes are combined into a single read
+// during progressive reads. The gap is also limited to two strides of pixels
+// of each level (see ReadDataProgressive()).
+constexpr long kProgressiveReadMaxGapBytes = 64 * 1024;
+
+// The number of values converted at a time from or to half precision.
+constexpr int kHalfPrecisionChunkSize = 1024;
+
+// Approximate number of bytes of file data read at a time when the data is
+// converted while it is read.
+constexpr long kConversionChunkBytes = 64L * 1024L * 1024L;
+
+// The number of values gathered at a time before they are converted.
+constexpr int kGatherChunkSize = 1024;
+
 // These functions are used to report errors and quit the program if necessary.
 void Error(const std::string& message) {
   std::cerr << "Error: \"" << message << "\"." << std::endl;
@@ -71,7 +107,14 @@ std::unordered_map<std::string, std::string> GetConfigFileValues(
       continue;
     }
     const std::string key = TrimString(line.substr(0, split_position));
-    const std::string value = TrimString(line.substr(split_position + 1));
+    std::string value = TrimString(line.substr(split_position + 1));
+    // Lists in braces (e.g. "wavelength = { ... }") may span multiple lines.
+    if (value.find('{') == 0) {
+      while (value.find('}') == std::string::npos &&
+             std::getline(config_file, line)) {
+        value += " " + TrimString(line);
+      }
+    }
     config_values[key] = value;
   }
   config_file.close();
@@ -79,6 +122,126 @@ std::unordered_map<std::string, std::string> GetConfigFileValues(
   return config_values;
 }
 
+// Parses a list in braces, such as "{400.5, 410.2, 420.0}", into its trimmed
+// comma-separated items.
+std::vector<std::string> ParseList(const std::string& list_value) {
+  std::vector<std::string> items;
+  const size_t start = list_value.find('{');
+  const size_t end = list_value.rfind('}');
+  if (start == std::string::npos || end == std::string::npos || end < start) {
+    return items;
+  }
+  std::stringstream list_stream(list_value.substr(start + 1, end - start - 1));
+  std::string item;
+  while (std::getline(list_stream, item, ',')) {
+    item = TrimString(item);
+    if (!item.empty()) {
+      items.push_back(item);
+    }
+  }
+  return items;
+}
+
+// Parses a list of numbers in braces.
+std::vector<double> ParseNumberList(const std::string& list_value) {
+  std::vector<double> numbers;
+  for (const std::string& item : ParseList(list_value)) {
+    numbers.push_back(std::atof(item.c_str()));
+  }
+  return numbers;
+}
+
+// Parses the "map info" header field:
+//   {projection, reference sample, reference line, reference x, reference y,
+//    pixel width, pixel height, [UTM zone, North or South,] datum,
+//    units=name, rotation=degrees}
+// where the items after the pixel size are optional.
+HSIMapInfo ParseMapInfo(const std::string& map_info_value) {
+  HSIMapInfo map_info;
+  const std::vector<std::string> items = ParseList(map_info_value);
+  if (items.size() < 7) {
+    Error("Invalid map info: " + map_info_value);
+    return map_info;
+  }
+  map_info.projection = items[0];
+  map_info.reference_sample = std::atof(items[1].c_str());
+  map_info.reference_line = std::atof(items[2].c_str());
+  map_info.reference_x = std::atof(items[3].c_str());
+  map_info.reference_y = std::atof(items[4].c_str());
+  map_info.pixel_width = std::atof(items[5].c_str());
+  map_info.pixel_height = std::atof(items[6].c_str());
+  size_t next_item = 7;
+  if (map_info.projection == "UTM" && items.size() >= 9) {
+    map_info.utm_zone = std::atoi(items[7].c_str());
+    map_info.utm_north = (items[8] != "South");
+    next_item = 9;
+  }
+  for (size_t i = next_item; i < items.size(); ++i) {
+    const size_t split_position = items[i].find('=');
+    if (split_position == std::string::npos) {
+      map_info.datum = items[i];
+      continue;
+    }
+    const std::string key = TrimString(items[i].substr(0, split_position));
+    const std::string value = TrimString(items[i].substr(split_position + 1));
+    if (key == "units") {
+      map_info.units = value;
+    } else if (key == "rotation") {
+      map_info.rotation = std::atof(value.c_str());
+    }
+  }
+  return map_info;
+}
+
+bool IsHalfPrecisionDataType(const HSIDataType data_type) {
+  return data_type == HSI_DATA_TYPE_HALF_FLOAT ||
+      data_type == HSI_DATA_TYPE_BFLOAT16;
+}
+
+bool IsPackedDataType(const HSIDataType data_type) {
+  return data_type == HSI_DATA_TYPE_PACKED_UINT10 ||
+      data_type == HSI_DATA_TYPE_PACKED_UINT12 ||
+      data_type == HSI_DATA_TYPE_PACKED_UINT14;
+}
+
+int GetPackedBitDepth(const HSIDataType data_type) {
+  switch (data_type) {
+    case HSI_DATA_TYPE_PACKED_UINT10:
+      return 10;
+    case HSI_DATA_TYPE_PACKED_UINT12:
+      return 12;
+    case HSI_DATA_TYPE_PACKED_UINT14:
+      return 14;
+    default:
+      return 8 * GetDataSize(data_type);
+  }
+}
+
+HSIDataType GetUnpackedDataType(const HSIDataType data_type) {
+  return IsPackedDataType(data_type) ?
+      HSI_DATA_TYPE_UNSIGNED_INT16 : data_type;
+}
+
+bool IsComplexDataType(const HSIDataType data_type) {
+  return data_type == HSI_DATA_TYPE_COMPLEX_FLOAT ||
+      data_type == HSI_DATA_TYPE_COMPLEX_DOUBLE;
+}
+
+int GetComponentSize(const HSIDataType& data_type) {
+  const int data_size = GetDataSize(data_type);
+  return IsComplexDataType(data_type) ? data_size / 2 : data_size;
+}
+
+HSIDataType GetComplexComponentDataType(const HSIDataType data_type) {
+  if (data_type == HSI_DATA_TYPE_COMPLEX_FLOAT) {
+    return HSI_DATA_TYPE_FLOAT;
+  }
+  if (data_type == HSI_DATA_TYPE_COMPLEX_DOUBLE) {
+    return HSI_DATA_TYPE_DOUBLE;
+  }
+  return data_type;
+}
+
 // Returns the size of the data value based on the given HSIDataType.
 int GetDataSize(const HSIDataType& data_type) {
   switch (data_type) {
@@ -90,7 +253,16 @@ int GetDataSize(const HSIDataType& data_type) {
       return sizeof(int32_t);
     case HSI_DATA_TYPE_DOUBLE:
       return sizeof(double);
+    case HSI_DATA_TYPE_COMPLEX_FLOAT:
+      return 2 * sizeof(float);
+    case HSI_DATA_TYPE_COMPLEX_DOUBLE:
+      return 2 * sizeof(double);
     case HSI_DATA_TYPE_UNSIGNED_INT16:
+    case HSI_DATA_TYPE_HALF_FLOAT:
+    case HSI_DATA_TYPE_BFLOAT16:
+    case HSI_DATA_TYPE_PACKED_UINT10:
+    case HSI_DATA_TYPE_PACKED_UINT12:
+    case HSI_DATA_TYPE_PACKED_UINT14:
       return sizeof(uint16_t);
     case HSI_DATA_TYPE_UNSIGNED_INT32:
       return sizeof(uint32_t);
@@ -104,6 +276,671 @@ int GetDataSize(const HSIDataType& data_type) {
   }
 }
 
+double GetValueAsDouble(
+    const HSIDataValue& value, const HSIDataType data_type) {
+
+  switch (data_type) {
+    case HSI_DATA_TYPE_BYTE:
+      return static_cast<double>(value.value_as_byte);
+    case HSI_DATA_TYPE_INT16:
+      return static_cast<double>(value.value_as_int16);
+    case HSI_DATA_TYPE_INT32:
+      return static_cast<double>(value.value_as_int32);
+    case HSI_DATA_TYPE_FLOAT:
+      return static_cast<double>(value.value_as_float);
+    case HSI_DATA_TYPE_UNSIGNED_INT16:
+      return static_cast<double>(value.value_as_uint16);
+    case HSI_DATA_TYPE_UNSIGNED_INT32:
+      return static_cast<double>(value.value_as_uint32);
+    case HSI_DATA_TYPE_UNSIGNED_INT64:
+      return static_cast<double>(value.value_as_uint64);
+    case HSI_DATA_TYPE_UNSIGNED_LONG:
+      return static_cast<double>(value.value_as_unsigned_long);
+    case HSI_DATA_TYPE_COMPLEX_FLOAT:
+    case HSI_DATA_TYPE_COMPLEX_DOUBLE:
+      return std::abs(GetValueAsComplex(value, data_type));
+    case HSI_DATA_TYPE_HALF_FLOAT:
+      return static_cast<double>(HalfToFloat(value.value_as_uint16));
+    case HSI_DATA_TYPE_BFLOAT16:
+      return static_cast<double>(BFloat16ToFloat(value.value_as_uint16));
+    case HSI_DATA_TYPE_DOUBLE:
+    default:
+      return value.value_as_double;
+  }
+}
+
+std::complex<double> GetValueAsComplex(
+    const HSIDataValue& value, const HSIDataType data_type) {
+
+  if (data_type == HSI_DATA_TYPE_COMPLEX_FLOAT) {
+    return std::complex<double>(
+        value.value_as_complex_float[0], value.value_as_complex_float[1]);
+  }
+  if (data_type == HSI_DATA_TYPE_COMPLEX_DOUBLE) {
+    return std::complex<double>(
+        value.value_as_complex_double[0], value.value_as_complex_double[1]);
+  }
+  return std::complex<double>(GetValueAsDouble(value, data_type), 0);
+}
+
+void GetInterleaveStrides(
+    const HSIDataInterleaveFormat interleave_format,
+    const int num_rows,
+    const int num_cols,
+    const int num_bands,
+    long* row_stride,
+    long* col_stride,
+    long* band_stride) {
+
+  if (interleave_format == HSI_INTERLEAVE_BSQ) {
+    // BSQ: band > row > col.
+    *col_stride = 1;
+    *row_stride = num_cols;
+    *band_stride = static_cast<long>(num_rows) * num_cols;
+  } else if (interleave_format == HSI_INTERLEAVE_BIL) {
+    // BIL: row > band > col.
+    *col_stride = 1;
+    *band_stride = num_cols;
+    *row_stride = static_cast<long>(num_bands) * num_cols;
+  } else {
+    // BIP: row > col > band.
+    *band_stride = 1;
+    *col_stride = num_bands;
+    *row_stride = static_cast<long>(num_cols) * num_bands;
+  }
+}
+
+// Casts a single value. Complex values are cast to real values by taking
+// their magnitude, and real values become complex values with a zero
+// imaginary part.
+template <typename SourceType, typename DestinationType>
+inline void CastValue(const SourceType& source, DestinationType* destination) {
+  *destination = static_cast<DestinationType>(source);
+}
+template <typename T, typename DestinationType>
+inline void CastValue(
+    const std::complex<T>& source, DestinationType* destination) {
+  *destination = static_cast<DestinationType>(std::abs(source));
+}
+template <typename SourceType, typename T>
+inline void CastValue(
+    const SourceType& source, std::complex<T>* destination) {
+  *destination = std::complex<T>(static_cast<T>(source), 0);
+}
+template <typename T, typename U>
+inline void CastValue(
+    const std::complex<T>& source, std::complex<U>* destination) {
+  *destination = std::complex<U>(source.real(), source.imag());
+}
+
+// Casts each value from SourceType to DestinationType.
+template <typename SourceType, typename DestinationType>
+void CastValues(
+    const char* source, const long num_values, char* destination) {
+
+  const SourceType* source_values =
+      reinterpret_cast<const SourceType*>(source);
+  DestinationType* destination_values =
+      reinterpret_cast<DestinationType*>(destination);
+  for (long i = 0; i < num_values; ++i) {
+    CastValue(source_values[i], &destination_values[i]);
+  }
+}
+
+// Dispatches CastValues for the given destination type.
+template <typename SourceType>
+void CastValuesTo(
+    const char* source,
+    const long num_values,
+    const HSIDataType destination_type,
+    char* destination) {
+
+  switch (destination_type) {
+    case HSI_DATA_TYPE_BYTE:
+      CastValues<SourceType, char>(source, num_values, destination);
+      break;
+    case HSI_DATA_TYPE_INT16:
+      CastValues<SourceType, int16_t>(source, num_values, destination);
+      break;
+    case HSI_DATA_TYPE_INT32:
+      CastValues<SourceType, int32_t>(source, num_values, destination);
+      break;
+    case HSI_DATA_TYPE_DOUBLE:
+      CastValues<SourceType, double>(source, num_values, destination);
+      break;
+    case HSI_DATA_TYPE_COMPLEX_FLOAT:
+      CastValues<SourceType, std::complex<float>>(
+          source, num_values, destination);
+      break;
+    case HSI_DATA_TYPE_COMPLEX_DOUBLE:
+      CastValues<SourceType, std::complex<double>>(
+          source, num_values, destination);
+      break;
+    case HSI_DATA_TYPE_UNSIGNED_INT16:
+      CastValues<SourceType, uint16_t>(source, num_values, destination);
+      break;
+    case HSI_DATA_TYPE_UNSIGNED_INT32:
+      CastValues<SourceType, uint32_t>(source, num_values, destination);
+      break;
+    case HSI_DATA_TYPE_UNSIGNED_INT64:
+      CastValues<SourceType, uint64_t>(source, num_values, destination);
+      break;
+    case HSI_DATA_TYPE_UNSIGNED_LONG:
+      CastValues<SourceType, unsigned long>(  // NOLINT
+          source, num_values, destination);
+      break;
+    case HSI_DATA_TYPE_FLOAT:
+    default:
+      CastValues<SourceType, float>(source, num_values, destination);
+      break;
+  }
+}
+
+// Converts values from or to a 16-bit floating point type by way of floats,
+// one chunk at a time, using the vectorized half precision kernels.
+void ConvertValuesThroughFloats(
+    const char* source,
+    const HSIDataType source_type,
+    const long num_values,
+    const HSIDataType destination_type,
+    char* destination) {
+
+  const int source_size = GetDataSize(source_type);
+  const int destination_size = GetDataSize(destination_type);
+  float floats[kHalfPrecisionChunkSize];
+  for (long i = 0; i < num_values; i += kHalfPrecisionChunkSize) {
+    const long chunk_size =
+        std::min<long>(kHalfPrecisionChunkSize, num_values - i);
+    const char* chunk_source = source + i * source_size;
+    char* chunk_destination = destination + i * destination_size;
+    const uint16_t* source_bits =
+        reinterpret_cast<const uint16_t*>(chunk_source);
+    if (source_type == HSI_DATA_TYPE_HALF_FLOAT) {
+      ConvertHalfsToFloats(source_bits, chunk_size, floats);
+    } else if (source_type == HSI_DATA_TYPE_BFLOAT16) {
+      ConvertBFloat16sToFloats(source_bits, chunk_size, floats);
+    } else {
+      ConvertValues(
+          chunk_source,
+          source_type,
+          chunk_size,
+          HSI_DATA_TYPE_FLOAT,
+          reinterpret_cast<char*>(floats));
+    }
+    uint16_t* destination_bits =
+        reinterpret_cast<uint16_t*>(chunk_destination);
+    if (destination_type == HSI_DATA_TYPE_HALF_FLOAT) {
+      ConvertFloatsToHalfs(floats, chunk_size, destination_bits);
+    } else if (destination_type == HSI_DATA_TYPE_BFLOAT16) {
+      ConvertFloatsToBFloat16s(floats, chunk_size, destination_bits);
+    } else {
+      ConvertValues(
+          reinterpret_cast<const char*>(floats),
+          HSI_DATA_TYPE_FLOAT,
+          chunk_size,
+          destination_type,
+          chunk_destination);
+    }
+  }
+}
+
+void ConvertValues(
+    const char* source,
+    const HSIDataType source_type,
+    const long num_values,
+    const HSIDataType destination_type,
+    char* destination) {
+
+  // Packed types are unpacked as soon as they are read.
+  const HSIDataType from_type = GetUnpackedDataType(source_type);
+  const HSIDataType to_type = GetUnpackedDataType(destination_type);
+  if (from_type == to_type) {
+    std::memcpy(destination, source, num_values * GetDataSize(from_type));
+    return;
+  }
+  if (IsHalfPrecisionDataType(from_type) ||
+      IsHalfPrecisionDataType(to_type)) {
+    ConvertValuesThroughFloats(
+        source, from_type, num_values, to_type, destination);
+    return;
+  }
+  switch (from_type) {
+    case HSI_DATA_TYPE_BYTE:
+      CastValuesTo<char>(source, num_values, to_type, destination);
+      break;
+    case HSI_DATA_TYPE_INT16:
+      CastValuesTo<int16_t>(source, num_values, to_type, destination);
+      break;
+    case HSI_DATA_TYPE_INT32:
+      CastValuesTo<int32_t>(source, num_values, to_type, destination);
+      break;
+    case HSI_DATA_TYPE_DOUBLE:
+      CastValuesTo<double>(source, num_values, to_type, destination);
+      break;
+    case HSI_DATA_TYPE_COMPLEX_FLOAT:
+      CastValuesTo<std::complex<float>>(
+          source, num_values, to_type, destination);
+      break;
+    case HSI_DATA_TYPE_COMPLEX_DOUBLE:
+      CastValuesTo<std::complex<double>>(
+          source, num_values, to_type, destination);
+      break;
+    case HSI_DATA_TYPE_UNSIGNED_INT16:
+      CastValuesTo<uint16_t>(source, num_values, to_type, destination);
+      break;
+    case HSI_DATA_TYPE_UNSIGNED_INT32:
+      CastValuesTo<uint32_t>(source, num_values, to_type, destination);
+      break;
+    case HSI_DATA_TYPE_UNSIGNED_INT64:
+      CastValuesTo<uint64_t>(source, num_values, to_type, destination);
+      break;
+    case HSI_DATA_TYPE_UNSIGNED_LONG:
+      CastValuesTo<unsigned long>(  // NOLINT
+          source, num_values, to_type, destination);
+      break;
+    case HSI_DATA_TYPE_FLOAT:
+    default:
+      CastValuesTo<float>(source, num_values, to_type, destination);
+      break;
+  }
+}
+
+HSIData ConvertData(
+    const HSIData& hsi_data,
+    const HSIDataType data_type,
+    const HSIDataInterleaveFormat interleave_format) {
+
+  HSIData converted_data;
+  converted_data.num_rows = hsi_data.num_rows;
+  converted_data.num_cols = hsi_data.num_cols;
+  converted_data.num_bands = hsi_data.num_bands;
+  converted_data.data_type = data_type;
+  converted_data.interleave_format = interleave_format;
+
+  const long num_values = hsi_data.NumDataPoints();
+  const int data_size = GetDataSize(data_type);
+  std::vector<char> cast_data(num_values * data_size);
+  ConvertValues(
+      hsi_data.raw_data.data(),
+      hsi_data.data_type,
+      num_values,
+      data_type,
+      cast_data.data());
+  if (hsi_data.interleave_format == interleave_format) {
+    converted_data.raw_data.swap(cast_data);
+    return converted_data;
+  }
+
+  // Reorder the values by walking the destination in memory order and
+  // gathering each value from the source with the source strides.
+  long source_row_stride, source_col_stride, source_band_stride;
+  GetInterleaveStrides(
+      hsi_data.interleave_format,
+      hsi_data.num_rows,
+      hsi_data.num_cols,
+      hsi_data.num_bands,
+      &source_row_stride,
+      &source_col_stride,
+      &source_band_stride);
+  int dims[3];
+  long source_strides[3];
+  if (interleave_format == HSI_INTERLEAVE_BSQ) {
+    dims[0] = hsi_data.num_bands;
+    dims[1] = hsi_data.num_rows;
+    dims[2] = hsi_data.num_cols;
+    source_strides[0] = source_band_stride;
+    source_strides[1] = source_row_stride;
+    source_strides[2] = source_col_stride;
+  } else if (interleave_format == HSI_INTERLEAVE_BIL) {
+    dims[0] = hsi_data.num_rows;
+    dims[1] = hsi_data.num_bands;
+    dims[2] = hsi_data.num_cols;
+    source_strides[0] = source_row_stride;
+    source_strides[1] = source_band_stride;
+    source_strides[2] = source_col_stride;
+  } else {
+    dims[0] = hsi_data.num_rows;
+    dims[1] = hsi_data.num_cols;
+    dims[2] = hsi_data.num_bands;
+    source_strides[0] = source_row_stride;
+    source_strides[1] = source_col_stride;
+    source_strides[2] = source_band_stride;
+  }
+  converted_data.raw_data.resize(num_values * data_size);
+  char* destination = converted_data.raw_data.data();
+  for (int i = 0; i < dims[0]; ++i) {
+    for (int j = 0; j < dims[1]; ++j) {
+      const long source_index = i * source_strides[0] + j * source_strides[1];
+      for (int k = 0; k < dims[2]; ++k) {
+        const char* value =
+            &cast_data[(source_index + k * source_strides[2]) * data_size];
+        std::memcpy(destination, value, data_size);
+        destination += data_size;
+      }
+    }
+  }
+  return converted_data;
+}
+
+void ConvertToInMemoryFormat(
+    const HSIDataOptions& data_options, HSIData* hsi_data) {
+
+  if (data_options.extract_complex_component &&
+      IsComplexDataType(hsi_data->data_type)) {
+    *hsi_data =
+        ExtractComplexComponent(*hsi_data, data_options.complex_component);
+  }
+  const HSIDataType data_type = data_options.GetInMemoryDataType();
+  const HSIDataInterleaveFormat interleave_format =
+      data_options.GetInMemoryInterleaveFormat();
+  if (hsi_data->data_type != data_type ||
+      hsi_data->interleave_format != interleave_format) {
+    *hsi_data = ConvertData(*hsi_data, data_type, interleave_format);
+  }
+}
+
+void CopyDataRange(
+    const char* cube_bytes,
+    const int num_rows,
+    const int num_cols,
+    const int num_bands,
+    const HSIDataRange& data_range,
+    HSIData* hsi_data) {
+
+  const int data_size = GetDataSize(hsi_data->data_type);
+  hsi_data->num_rows = data_range.end_row - data_range.start_row;
+  hsi_data->num_cols = data_range.end_col - data_range.start_col;
+  hsi_data->num_bands = data_range.end_band - data_range.start_band;
+  hsi_data->raw_data.resize(
+      static_cast<long>(hsi_data->NumDataPoints()) * data_size);
+  char* destination = hsi_data->raw_data.data();
+
+  // Copy one contiguous span along the fastest-changing dimension at a time.
+  const long num_pixels_per_band = static_cast<long>(num_rows) * num_cols;
+  if (hsi_data->interleave_format == HSI_INTERLEAVE_BSQ) {
+    const long span_bytes = hsi_data->num_cols * data_size;
+    for (int band = data_range.start_band; band < data_range.end_band;
+         ++band) {
+      for (int row = data_range.start_row; row < data_range.end_row; ++row) {
+        const long index = band * num_pixels_per_band +
+            static_cast<long>(row) * num_cols + data_range.start_col;
+        std::memcpy(destination, cube_bytes + index * data_size, span_bytes);
+        destination += span_bytes;
+      }
+    }
+  } else if (hsi_data->interleave_format == HSI_INTERLEAVE_BIL) {
+    const long span_bytes = hsi_data->num_cols * data_size;
+    for (int row = data_range.start_row; row < data_range.end_row; ++row) {
+      for (int band = data_range.start_band; band < data_range.end_band;
+           ++band) {
+        const long index = static_cast<long>(row) * num_cols * num_bands +
+            static_cast<long>(band) * num_cols + data_range.start_col;
+        std::memcpy(destination, cube_bytes + index * data_size, span_bytes);
+        destination += span_bytes;
+      }
+    }
+  } else {
+    const long span_bytes = hsi_data->num_bands * data_size;
+    for (int row = data_range.start_row; row < data_range.end_row; ++row) {
+      for (int col = data_range.start_col; col < data_range.end_col; ++col) {
+        const long index = static_cast<long>(row) * num_cols * num_bands +
+            static_cast<long>(col) * num_bands + data_range.start_band;
+        std::memcpy(destination, cube_bytes + index * data_size, span_bytes);
+        destination += span_bytes;
+      }
+    }
+  }
+}
+
+// Computes the index (in number of values) of each of the num_values
+// positions (rows[i], cols[i], bands[i]) in the data. Positions outside of
+// the data get index -1. Returns the number of such positions.
+long ComputeGatherIndices(
+    const HSIData& hsi_data,
+    const int* rows,
+    const int* cols,
+    const int* bands,
+    const long num_values,
+    int32_t* indices) {
+
+  long row_stride;
+  long col_stride;
+  long band_stride;
+  GetInterleaveStrides(
+      hsi_data.interleave_format,
+      hsi_data.num_rows,
+      hsi_data.num_cols,
+      hsi_data.num_bands,
+      &row_stride,
+      &col_stride,
+      &band_stride);
+  long num_invalid = 0;
+  long i = 0;
+#ifdef __AVX2__
+  // NumDataPoints() is an int, so all valid indices fit in 32 bits.
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i invalid_index = _mm256_set1_epi32(-1);
+  const __m256i num_rows = _mm256_set1_epi32(hsi_data.num_rows);
+  const __m256i num_cols = _mm256_set1_epi32(hsi_data.num_cols);
+  const __m256i num_bands = _mm256_set1_epi32(hsi_data.num_bands);
+  const __m256i row_strides = _mm256_set1_epi32(row_stride);
+  const __m256i col_strides = _mm256_set1_epi32(col_stride);
+  const __m256i band_strides = _mm256_set1_epi32(band_stride);
+  for (; i + 8 <= num_values; i += 8) {
+    const __m256i row = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(rows + i));
+    const __m256i col = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(cols + i));
+    const __m256i band = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(bands + i));
+    // Valid lanes are below each size, and none of the indices is negative.
+    const __m256i valid = _mm256_andnot_si256(
+        _mm256_cmpgt_epi32(
+            zero, _mm256_or_si256(_mm256_or_si256(row, col), band)),
+        _mm256_and_si256(
+            _mm256_and_si256(
+                _mm256_cmpgt_epi32(num_rows, row),
+                _mm256_cmpgt_epi32(num_cols, col)),
+            _mm256_cmpgt_epi32(num_bands, band)));
+    const __m256i index = _mm256_add_epi32(
+        _mm256_add_epi32(
+            _mm256_mullo_epi32(row, row_strides),
+            _mm256_mullo_epi32(col, col_strides)),
+        _mm256_mullo_epi32(band, band_strides));
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i*>(indices + i),
+        _mm256_blendv_epi8(invalid_index, index, valid));
+    num_invalid += 8 - __builtin_popcount(
+        _mm256_movemask_ps(_mm256_castsi256_ps(valid)));
+  }
+#endif
+  for (; i < num_values; ++i) {
+    if (rows[i] < 0 || rows[i] >= hsi_data.num_rows ||
+        cols[i] < 0 || cols[i] >= hsi_data.num_cols ||
+        bands[i] < 0 || bands[i] >= hsi_data.num_bands) {
+      indices[i] = -1;
+      num_invalid++;
+      continue;
+    }
+    indices[i] =
+        rows[i] * row_stride + cols[i] * col_stride + bands[i] * band_stride;
+  }
+  return num_invalid;
+}
+
+// Gathers the values at the given indices from values of the same type.
+// Indices of -1 give 0.
+template <typename T>
+void GatherTypedValues(
+    const T* source, const int32_t* indices, const long num_values, T* values) {
+  for (long i = 0; i < num_values; ++i) {
+    values[i] = (indices[i] < 0) ? 0 : source[indices[i]];
+  }
+}
+
+#ifdef __AVX2__
+template <>
+void GatherTypedValues(
+    const float* source,
+    const int32_t* indices,
+    const long num_values,
+    float* values) {
+
+  const __m256i invalid_index = _mm256_set1_epi32(-1);
+  long i = 0;
+  for (; i + 8 <= num_values; i += 8) {
+    const __m256i index = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(indices + i));
+    const __m256 valid =
+        _mm256_castsi256_ps(_mm256_cmpgt_epi32(index, invalid_index));
+    _mm256_storeu_ps(
+        values + i,
+        _mm256_mask_i32gather_ps(
+            _mm256_setzero_ps(), source, index, valid, sizeof(float)));
+  }
+  for (; i < num_values; ++i) {
+    values[i] = (indices[i] < 0) ? 0 : source[indices[i]];
+  }
+}
+
+template <>
+void GatherTypedValues(
+    const double* source,
+    const int32_t* indices,
+    const long num_values,
+    double* values) {
+
+  const __m128i invalid_index = _mm_set1_epi32(-1);
+  long i = 0;
+  for (; i + 4 <= num_values; i += 4) {
+    const __m128i index = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(indices + i));
+    const __m256d valid = _mm256_castsi256_pd(
+        _mm256_cvtepi32_epi64(_mm_cmpgt_epi32(index, invalid_index)));
+    _mm256_storeu_pd(
+        values + i,
+        _mm256_mask_i32gather_pd(
+            _mm256_setzero_pd(), source, index, valid, sizeof(double)));
+  }
+  for (; i < num_values; ++i) {
+    values[i] = (indices[i] < 0) ? 0 : source[indices[i]];
+  }
+}
+#endif
+
+// Gathers the values at the given indices and casts them to T (of
+// destination_type). Indices of -1 give 0.
+template <typename T>
+void GatherIndexedValues(
+    const HSIData& hsi_data,
+    const int32_t* indices,
+    const long num_values,
+    const HSIDataType destination_type,
+    T* values) {
+
+  if (hsi_data.data_type == destination_type) {
+    GatherTypedValues(
+        reinterpret_cast<const T*>(hsi_data.raw_data.data()),
+        indices,
+        num_values,
+        values);
+    return;
+  }
+  // Gather the raw values of other types one chunk at a time, and convert
+  // each chunk.
+  const int data_size = GetDataSize(hsi_data.data_type);
+  const char* source = hsi_data.raw_data.data();
+  std::vector<char> chunk(kGatherChunkSize * data_size);
+  for (long i = 0; i < num_values; i += kGatherChunkSize) {
+    const long chunk_size = std::min<long>(kGatherChunkSize, num_values - i);
+    for (long j = 0; j < chunk_size; ++j) {
+      const int32_t index = indices[i + j];
+      if (index < 0) {
+        std::memset(&chunk[j * data_size], 0, data_size);
+      } else {
+        std::memcpy(
+            &chunk[j * data_size],
+            source + static_cast<long>(index) * data_size,
+            data_size);
+      }
+    }
+    ConvertValues(
+        chunk.data(),
+        hsi_data.data_type,
+        chunk_size,
+        destination_type,
+        reinterpret_cast<char*>(values + i));
+  }
+}
+
+// Implements HSIData::GatherValues() for T of destination_type.
+template <typename T>
+void GatherValuesAs(
+    const HSIData& hsi_data,
+    const int* rows,
+    const int* cols,
+    const int* bands,
+    const long num_values,
+    const HSIDataType destination_type,
+    T* values) {
+
+  std::vector<int32_t> indices(num_values);
+  const long num_invalid = ComputeGatherIndices(
+      hsi_data, rows, cols, bands, num_values, indices.data());
+  if (num_invalid > 0) {
+    Error(std::to_string(num_invalid) +
+          " gathered positions are out of range.");
+  }
+  GatherIndexedValues(
+      hsi_data, indices.data(), num_values, destination_type, values);
+}
+
+// Implements HSIData::GatherSpectra() for T of destination_type.
+template <typename T>
+void GatherSpectraAs(
+    const HSIData& hsi_data,
+    const int* rows,
+    const int* cols,
+    const long num_pixels,
+    const HSIDataType destination_type,
+    T* spectra) {
+
+  // Compute the index of the first band of each pixel, and add the band
+  // offsets to it.
+  const std::vector<int> first_bands(num_pixels, 0);
+  std::vector<int32_t> pixel_indices(num_pixels);
+  const long num_invalid = ComputeGatherIndices(
+      hsi_data, rows, cols, first_bands.data(), num_pixels,
+      pixel_indices.data());
+  if (num_invalid > 0) {
+    Error(std::to_string(num_invalid) +
+          " gathered pixels are out of range.");
+  }
+  long row_stride;
+  long col_stride;
+  long band_stride;
+  GetInterleaveStrides(
+      hsi_data.interleave_format,
+      hsi_data.num_rows,
+      hsi_data.num_cols,
+      hsi_data.num_bands,
+      &row_stride,
+      &col_stride,
+      &band_stride);
+  const int num_bands = hsi_data.num_bands;
+  std::vector<int32_t> indices(num_pixels * num_bands);
+  for (long pixel = 0; pixel < num_pixels; ++pixel) {
+    const int32_t pixel_index = pixel_indices[pixel];
+    int32_t* spectrum_indices = &indices[pixel * num_bands];
+    for (int band = 0; band < num_bands; ++band) {
+      spectrum_indices[band] =
+          (pixel_index < 0) ? -1 : pixel_index + band * band_stride;
+    }
+  }
+  GatherIndexedValues(
+      hsi_data, indices.data(), indices.size(), destination_type, spectra);
+}
+
 // Reverse the bytes in the given bytes array. Assumes that the given array
 // contains data_size values.
 void ReverseBytes(const int data_size, char* bytes) {
@@ -115,25 +952,46 @@ void ReverseBytes(const int data_size, char* bytes) {
   }
 }
 
+bool IsMachineBigEndian() {
+  // Set an unsigned 1, and check whether its first byte is empty (zero).
+  const unsigned int value = 1U;
+  unsigned char first_byte;
+  std::memcpy(&first_byte, &value, 1);
+  return first_byte != 1U;
+}
+
+// Reverse the bytes of each component of a value. Complex values consist of
+// two components that are swapped separately. All other values have a single
+// component of data_size bytes.
+void ReverseValueBytes(
+    const int data_size, const int component_size, char* bytes) {
+  for (int i = 0; i < data_size; i += component_size) {
+    ReverseBytes(component_size, bytes + i);
+  }
+}
+
 // Reads the next value in the file from the given file value index. This is
 // a generic binary data read, and can be used to read the next value (of any
-// bye size) from an HSI file.
+// bye size) from an HSI file. The current value index is that of the last
+// value read (-1 if none), and value indices start after the header offset.
 void ReadNextValue(
     const long next_value_index,
     const long current_value_index,
+    const long header_offset,
     const int data_size,
+    const int component_size,
     std::ifstream* data_file,
     std::vector<char>* raw_data,
     const bool reverse_byte_order) {
 
   // Skip to next position if necessary.
-  if (next_value_index > (current_value_index + 1)) {
-    data_file->seekg(next_value_index * data_size);
+  if (next_value_index != (current_value_index + 1)) {
+    data_file->seekg(header_offset + next_value_index * data_size);
   }
   char next_bytes[data_size];  // NOLINT
   data_file->read(next_bytes, data_size);
   if (reverse_byte_order) {
-    ReverseBytes(data_size, next_bytes);
+    ReverseValueBytes(data_size, component_size, next_bytes);
   }
   raw_data->insert(raw_data->end(), next_bytes, next_bytes + data_size);
 }
@@ -144,15 +1002,16 @@ void ReadDataBSQ(
     const HSIDataOptions& data_options,
     const bool machine_big_endian,
     const HSIDataRange& data_range,
-    const long start_index,
+    const long header_offset,
     std::ifstream* data_file,
     HSIData* hsi_data) {
 
   const int data_size = GetDataSize(hsi_data->data_type);
+  const int component_size = GetComponentSize(hsi_data->data_type);
 
-  // Skip to current index.
-  long current_index = start_index;
-  data_file->seekg(current_index * data_size);
+  // Skip past the header; no value has been read yet.
+  long current_index = -1;
+  data_file->seekg(header_offset);
 
   const bool reverse_byte_order =
       (data_options.big_endian != machine_big_endian);
@@ -167,7 +1026,9 @@ void ReadDataBSQ(
         ReadNextValue(
             next_index,
             current_index,
+            header_offset,
             data_size,
+            component_size,
             data_file,
             &(hsi_data->raw_data),
             reverse_byte_order);
@@ -183,15 +1044,16 @@ void ReadDataBIL(
     const HSIDataOptions& data_options,
     const bool machine_big_endian,
     const HSIDataRange& data_range,
-    const long start_index,
+    const long header_offset,
     std::ifstream* data_file,
     HSIData* hsi_data) {
 
   const int data_size = GetDataSize(hsi_data->data_type);
+  const int component_size = GetComponentSize(hsi_data->data_type);
 
-  // Skip to current index.
-  long current_index = start_index;
-  data_file->seekg(current_index * data_size);
+  // Skip past the header; no value has been read yet.
+  long current_index = -1;
+  data_file->seekg(header_offset);
 
   const bool reverse_byte_order =
       (data_options.big_endian != machine_big_endian);
@@ -206,7 +1068,9 @@ void ReadDataBIL(
         ReadNextValue(
             next_index,
             current_index,
+            header_offset,
             data_size,
+            component_size,
             data_file,
             &(hsi_data->raw_data),
             reverse_byte_order);
@@ -222,15 +1086,16 @@ void ReadDataBIP(
     const HSIDataOptions& data_options,
     const bool machine_big_endian,
     const HSIDataRange& data_range,
-    const long start_index,
+    const long header_offset,
     std::ifstream* data_file,
     HSIData* hsi_data) {
 
   const int data_size = GetDataSize(hsi_data->data_type);
+  const int component_size = GetComponentSize(hsi_data->data_type);
 
-  // Skip to current index.
-  long current_index = start_index;
-  data_file->seekg(current_index * data_size);
+  // Skip past the header; no value has been read yet.
+  long current_index = -1;
+  data_file->seekg(header_offset);
 
   const bool reverse_byte_order =
       (data_options.big_endian != machine_big_endian);
@@ -247,7 +1112,9 @@ void ReadDataBIP(
         ReadNextValue(
             next_index,
             current_index,
+            header_offset,
             data_size,
+            component_size,
             data_file,
             &(hsi_data->raw_data),
             reverse_byte_order);
@@ -257,6 +1124,278 @@ void ReadDataBIP(
   }
 }
 
+// Checks that the given range is non-empty and within the data size. Fatal
+// error otherwise.
+void CheckDataRange(
+    const HSIDataOptions& data_options, const HSIDataRange& data_range) {
+
+  // Check that the given ranges are valid.
+  if (data_range.start_row < 0 ||
+      data_range.end_row > data_options.num_data_rows) {
+    FatalError("Invalid row range: must be between 0 and " +
+               std::to_string(data_options.num_data_rows));
+  }
+  if (data_range.start_col < 0 ||
+      data_range.end_col > data_options.num_data_cols) {
+    FatalError("Invalid column range: must be between 0 and " +
+               std::to_string(data_options.num_data_cols));
+  }
+  if (data_range.start_band < 0 ||
+      data_range.end_band > data_options.num_data_bands) {
+    FatalError("Invalid band range: must be between 0 and " +
+               std::to_string(data_options.num_data_bands));
+  }
+
+  // Check that the ranges are positive / valid.
+  if (data_range.end_row - data_range.start_row <= 0) {
+    FatalError("Row range must be positive.");
+  }
+  if (data_range.end_col - data_range.start_col <= 0) {
+    FatalError("Column range must be positive.");
+  }
+  if (data_range.end_band - data_range.start_band <= 0) {
+    FatalError("Band range must be positive.");
+  }
+}
+
+// Returns true if the pixel at the given row and col (relative to the start of
+// the range) is read in the progressive read level with the given stride. A
+// pixel is read at the first level whose stride divides both its row and col.
+// previous_strides holds the strides of all earlier levels, which need not
+// divide each other (e.g. 5, 2, 1).
+bool IsNewProgressivePixel(
+    const int row,
+    const int col,
+    const int stride,
+    const std::vector<int>& previous_strides) {
+  if (row % stride != 0 || col % stride != 0) {
+    return false;
+  }
+  for (const int previous_stride : previous_strides) {
+    if (row % previous_stride == 0 && col % previous_stride == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Appends a run of values to the list of runs, extending the last run instead
+// if the new one directly follows it both in the file and in memory.
+void AddValueRun(
+    const long file_index,
+    const long num_values,
+    const long destination_index,
+    std::vector<HSIValueRun>* runs) {
+
+  if (!runs->empty()) {
+    HSIValueRun& last_run = runs->back();
+    if (last_run.file_index + last_run.num_values == file_index &&
+        last_run.destination_index + last_run.num_values ==
+            destination_index) {
+      last_run.num_values += num_values;
+      return;
+    }
+  }
+  HSIValueRun run;
+  run.file_index = file_index;
+  run.num_values = num_values;
+  run.destination_index = destination_index;
+  runs->push_back(run);
+}
+
+void GetDataRangeRuns(
+    const HSIDataOptions& data_options,
+    const HSIDataRange& data_range,
+    std::vector<HSIValueRun>* runs) {
+
+  long row_stride, col_stride, band_stride;
+  GetInterleaveStrides(
+      data_options.interleave_format,
+      data_options.num_data_rows,
+      data_options.num_data_cols,
+      data_options.num_data_bands,
+      &row_stride,
+      &col_stride,
+      &band_stride);
+  const long num_cols = data_range.end_col - data_range.start_col;
+  const long num_bands = data_range.end_band - data_range.start_band;
+  long destination_index = 0;
+  if (data_options.interleave_format == HSI_INTERLEAVE_BSQ) {
+    for (int band = data_range.start_band; band < data_range.end_band;
+         ++band) {
+      for (int row = data_range.start_row; row < data_range.end_row; ++row) {
+        AddValueRun(
+            band * band_stride + row * row_stride + data_range.start_col,
+            num_cols,
+            destination_index,
+            runs);
+        destination_index += num_cols;
+      }
+    }
+  } else if (data_options.interleave_format == HSI_INTERLEAVE_BIL) {
+    for (int row = data_range.start_row; row < data_range.end_row; ++row) {
+      for (int band = data_range.start_band; band < data_range.end_band;
+           ++band) {
+        AddValueRun(
+            row * row_stride + band * band_stride + data_range.start_col,
+            num_cols,
+            destination_index,
+            runs);
+        destination_index += num_cols;
+      }
+    }
+  } else {
+    for (int row = data_range.start_row; row < data_range.end_row; ++row) {
+      for (int col = data_range.start_col; col < data_range.end_col; ++col) {
+        AddValueRun(
+            row * row_stride + col * col_stride + data_range.start_band,
+            num_bands,
+            destination_index,
+            runs);
+        destination_index += num_bands;
+      }
+    }
+  }
+}
+
+const char* GetFileLayoutValues(
+    const HSIDataOptions& data_options,
+    const HSIDataRange& data_range,
+    const HSIData& hsi_data,
+    std::vector<HSIValueRun>* runs,
+    HSIData* converted_data) {
+
+  CheckDataRange(data_options, data_range);
+  if (hsi_data.num_rows != data_range.end_row - data_range.start_row ||
+      hsi_data.num_cols != data_range.end_col - data_range.start_col ||
+      hsi_data.num_bands != data_range.end_band - data_range.start_band) {
+    FatalError("The data to write must have the size of the range.");
+  }
+  if (IsPackedDataType(data_options.data_type)) {
+    FatalError("Ranges of packed data cannot be written.");
+  }
+  runs->clear();
+  GetDataRangeRuns(data_options, data_range, runs);
+
+  // Cast and reorder the data to the file's layout, in which the runs of the
+  // range are contiguous.
+  const bool needs_conversion =
+      hsi_data.data_type != data_options.data_type ||
+      hsi_data.interleave_format != data_options.interleave_format;
+  const bool reverse_byte_order =
+      (data_options.big_endian != IsMachineBigEndian());
+  if (!needs_conversion && !reverse_byte_order) {
+    return hsi_data.raw_data.data();
+  }
+  if (needs_conversion) {
+    *converted_data = ConvertData(
+        hsi_data, data_options.data_type, data_options.interleave_format);
+  } else {
+    *converted_data = hsi_data;
+  }
+  if (reverse_byte_order) {
+    const int data_size = GetDataSize(data_options.data_type);
+    const int component_size = GetComponentSize(data_options.data_type);
+    char* bytes = converted_data->raw_data.data();
+    const long num_bytes = converted_data->raw_data.size();
+    for (long i = 0; i < num_bytes; i += data_size) {
+      ReverseValueBytes(data_size, component_size, bytes + i);
+    }
+  }
+  return converted_data->raw_data.data();
+}
+
+HSIDataRange GetBSQImageDataRange(
+    const HSIDataOptions& data_options, const HSIDataRange& image_range) {
+
+  if (image_range.start_row < 0 ||
+      image_range.end_row > data_options.GetNumLines() ||
+      image_range.start_row >= image_range.end_row) {
+    FatalError("Invalid line range: must be between 0 and " +
+               std::to_string(data_options.GetNumLines()));
+  }
+  if (image_range.start_col < 0 ||
+      image_range.end_col > data_options.GetNumSamples() ||
+      image_range.start_col >= image_range.end_col) {
+    FatalError("Invalid sample range: must be between 0 and " +
+               std::to_string(data_options.GetNumSamples()));
+  }
+  HSIDataRange data_range = image_range;
+  int last_row = 0;
+  int last_col = 0;
+  data_options.GetPixelPosition(
+      image_range.start_col,
+      image_range.start_row,
+      &data_range.start_row,
+      &data_range.start_col);
+  data_options.GetPixelPosition(
+      image_range.end_col - 1, image_range.end_row - 1, &last_row, &last_col);
+  data_range.end_row = last_row + 1;
+  data_range.start_col = 0;
+  data_range.end_col = data_options.num_data_cols;
+  return data_range;
+}
+
+HSIData GetBSQImageRange(
+    const HSIDataOptions& data_options,
+    const HSIDataRange& image_range,
+    const HSIData& bsq_data,
+    const HSIDataInterleaveFormat interleave_format) {
+
+  HSIData converted_data;
+  if (bsq_data.data_type != HSI_DATA_TYPE_FLOAT ||
+      bsq_data.interleave_format != HSI_INTERLEAVE_BSQ) {
+    converted_data =
+        ConvertData(bsq_data, HSI_DATA_TYPE_FLOAT, HSI_INTERLEAVE_BSQ);
+  }
+  const HSIData& float_data =
+      converted_data.raw_data.empty() ? bsq_data : converted_data;
+  const float* values =
+      reinterpret_cast<const float*>(float_data.raw_data.data());
+  const long band_size =
+      static_cast<long>(float_data.num_rows) * float_data.num_cols;
+
+  // Each line of samples is consecutive in its band, at its offset from the
+  // first data row that was read.
+  const long data_offset =
+      static_cast<long>(GetBSQImageDataRange(data_options, image_range)
+          .start_row) * data_options.num_data_cols;
+  HSIData image_data;
+  image_data.num_rows = image_range.end_row - image_range.start_row;
+  image_data.num_cols = image_range.end_col - image_range.start_col;
+  image_data.num_bands = float_data.num_bands;
+  image_data.data_type = HSI_DATA_TYPE_FLOAT;
+  image_data.interleave_format = interleave_format;
+  image_data.raw_data.resize(
+      static_cast<long>(image_data.NumDataPoints()) * sizeof(float));
+  float* image_values = reinterpret_cast<float*>(image_data.raw_data.data());
+  long row_stride = 0;
+  long col_stride = 0;
+  long band_stride = 0;
+  GetInterleaveStrides(
+      interleave_format,
+      image_data.num_rows,
+      image_data.num_cols,
+      image_data.num_bands,
+      &row_stride,
+      &col_stride,
+      &band_stride);
+  for (int band = 0; band < image_data.num_bands; ++band) {
+    for (int line = 0; line < image_data.num_rows; ++line) {
+      const float* line_values = values + band * band_size +
+          static_cast<long>(image_range.start_row + line) *
+              data_options.GetNumSamples() +
+          image_range.start_col - data_offset;
+      float* image_line_values =
+          image_values + line * row_stride + band * band_stride;
+      for (int sample = 0; sample < image_data.num_cols; ++sample) {
+        image_line_values[sample * col_stride] = line_values[sample];
+      }
+    }
+  }
+  return image_data;
+}
+
 /*******************************************************************************
 *** HSIDataOptions
 *******************************************************************************/
@@ -316,6 +1455,12 @@ void HSIDataOptions::ReadHeaderFromFile(const std::string& header_file_path) {
     } else if (itr->second == "5" || itr->second == "double") {
       data_type = HSI_DATA_TYPE_DOUBLE;
       data_type_name = "double";
+    } else if (itr->second == "6" || itr->second == "complex") {
+      data_type = HSI_DATA_TYPE_COMPLEX_FLOAT;
+      data_type_name = "complex float";
+    } else if (itr->second == "9" || itr->second == "dcomplex") {
+      data_type = HSI_DATA_TYPE_COMPLEX_DOUBLE;
+      data_type_name = "complex double";
     } else if (itr->second == "12" || itr->second == "uint16") {
       data_type = HSI_DATA_TYPE_UNSIGNED_INT16;
       data_type_name = "unsigned int16";
@@ -328,6 +1473,21 @@ void HSIDataOptions::ReadHeaderFromFile(const std::string& header_file_path) {
     } else if (itr->second == "15" || itr->second == "ulong") {
       data_type = HSI_DATA_TYPE_UNSIGNED_LONG;
       data_type_name = "unsigned long";
+    } else if (itr->second == "120" || itr->second == "half") {
+      data_type = HSI_DATA_TYPE_HALF_FLOAT;
+      data_type_name = "half float";
+    } else if (itr->second == "121" || itr->second == "bfloat16") {
+      data_type = HSI_DATA_TYPE_BFLOAT16;
+      data_type_name = "bfloat16";
+    } else if (itr->second == "110" || itr->second == "packed10") {
+      data_type = HSI_DATA_TYPE_PACKED_UINT10;
+      data_type_name = "packed 10-bit";
+    } else if (itr->second == "112" || itr->second == "packed12") {
+      data_type = HSI_DATA_TYPE_PACKED_UINT12;
+      data_type_name = "packed 12-bit";
+    } else if (itr->second == "114" || itr->second == "packed14") {
+      data_type = HSI_DATA_TYPE_PACKED_UINT14;
+      data_type_name = "packed 14-bit";
     } else {
       FatalError("Unsupported/unknown data type: " + itr->second);
     }
@@ -341,6 +1501,13 @@ void HSIDataOptions::ReadHeaderFromFile(const std::string& header_file_path) {
               << (big_endian ? "true" : "false") << "." << std::endl;
   }
 
+  itr = header_values.find("bit order");
+  if (itr != header_values.end()) {
+    packed_msb_first = (itr->second != "lsb");
+    std::cout << "Option set: packed bit order = "
+              << (packed_msb_first ? "msb" : "lsb") << "." << std::endl;
+  }
+
   itr = header_values.find("header offset");
   if (itr != header_values.end()) {
     header_offset = std::atoi(itr->second.c_str());
@@ -372,6 +1539,129 @@ void HSIDataOptions::ReadHeaderFromFile(const std::string& header_file_path) {
     num_data_bands = std::atoi(itr->second.c_str());
     std::cout << "Number of bands = " << num_data_bands << "." << std::endl;
   }
+
+  itr = header_values.find("wavelength");
+  if (itr != header_values.end()) {
+    wavelengths = ParseNumberList(itr->second);
+    std::cout << "Number of wavelengths = " << wavelengths.size() << "."
+              << std::endl;
+  }
+
+  itr = header_values.find("fwhm");
+  if (itr != header_values.end()) {
+    fwhm = ParseNumberList(itr->second);
+  }
+
+  itr = header_values.find("map info");
+  if (itr != header_values.end()) {
+    map_info = ParseMapInfo(itr->second);
+    std::cout << "Map projection = " << map_info.projection << "."
+              << std::endl;
+  }
+}
+
+void HSIDataOptions::WriteHeaderToFile(
+    const std::string& header_file_path) const {
+
+  std::ofstream header_file(header_file_path);
+  if (!header_file.is_open()) {
+    FatalError("File " + header_file_path +
+               " could not be opened for writing.");
+  }
+  WriteHeader(&header_file);
+  header_file.close();
+  if (!header_file) {
+    FatalError("Failed to write to " + header_file_path + ".");
+  }
+}
+
+void HSIDataOptions::WriteHeader(std::ostream* header_stream) const {
+  std::ostream& header_file = *header_stream;
+  const bool is_bsq = (interleave_format == HSI_INTERLEAVE_BSQ);
+  header_file.precision(15);
+  header_file << "ENVI\n"
+              << "samples = " << GetNumSamples() << "\n"
+              << "lines = " << GetNumLines() << "\n"
+              << "bands = " << num_data_bands << "\n"
+              << "header offset = " << header_offset << "\n"
+              << "file type = ENVI Standard\n"
+              << "data type = " << static_cast<int>(data_type) << "\n"
+              << "interleave = "
+              << (is_bsq ? "bsq" :
+                  (interleave_format == HSI_INTERLEAVE_BIL ? "bil" : "bip"))
+              << "\n"
+              << "byte order = " << (big_endian ? 1 : 0) << "\n";
+  if (IsPackedDataType(data_type)) {
+    header_file << "bit order = " << (packed_msb_first ? "msb" : "lsb")
+                << "\n";
+  }
+  const auto write_list = [&](
+      const std::string& key, const std::vector<double>& values) {
+    header_file << key << " = {";
+    for (size_t i = 0; i < values.size(); ++i) {
+      header_file << (i == 0 ? "" : ", ") << values[i];
+    }
+    header_file << "}\n";
+  };
+  if (!wavelengths.empty()) {
+    write_list("wavelength", wavelengths);
+  }
+  if (!fwhm.empty()) {
+    write_list("fwhm", fwhm);
+  }
+  if (map_info.IsValid()) {
+    header_file << "map info = {" << map_info.projection << ", "
+                << map_info.reference_sample << ", "
+                << map_info.reference_line << ", "
+                << map_info.reference_x << ", " << map_info.reference_y << ", "
+                << map_info.pixel_width << ", " << map_info.pixel_height;
+    if (map_info.projection == "UTM") {
+      header_file << ", " << map_info.utm_zone << ", "
+                  << (map_info.utm_north ? "North" : "South");
+    }
+    if (!map_info.datum.empty()) {
+      header_file << ", " << map_info.datum;
+    }
+    if (!map_info.units.empty()) {
+      header_file << ", units=" << map_info.units;
+    }
+    if (map_info.rotation != 0) {
+      header_file << ", rotation=" << map_info.rotation;
+    }
+    header_file << "}\n";
+  }
+}
+
+/*******************************************************************************
+*** HSIMapInfo
+*******************************************************************************/
+
+// The pixel grid is an affine transform of the map, where one sample is a
+// step of pixel_width along the rotated x axis, and one line is a step of
+// pixel_height along the rotated -y axis.
+void HSIMapInfo::PixelToMap(
+    const double sample, const double line, double* x, double* y) const {
+
+  const double angle = rotation * M_PI / 180;
+  const double sample_offset = sample - (reference_sample - 1);
+  const double line_offset = line - (reference_line - 1);
+  *x = reference_x + sample_offset * pixel_width * std::cos(angle) +
+      line_offset * pixel_height * std::sin(angle);
+  *y = reference_y + sample_offset * pixel_width * std::sin(angle) -
+      line_offset * pixel_height * std::cos(angle);
+}
+
+void HSIMapInfo::MapToPixel(
+    const double x, const double y, double* sample, double* line) const {
+
+  const double angle = rotation * M_PI / 180;
+  const double x_offset = x - reference_x;
+  const double y_offset = y - reference_y;
+  *sample = (reference_sample - 1) +
+      (x_offset * std::cos(angle) + y_offset * std::sin(angle)) / pixel_width;
+  *line = (reference_line - 1) +
+      (x_offset * std::sin(angle) - y_offset * std::cos(angle)) /
+          pixel_height;
 }
 
 /*******************************************************************************
@@ -466,28 +1756,13 @@ HSIDataValue HSIData::GetValue(
 double HSIData::GetValueAsDouble(
     const int row, const int col, const int band) const {
 
-  const HSIDataValue value = GetValue(row, col, band);
-  switch (data_type) {
-    case HSI_DATA_TYPE_BYTE:
-      return static_cast<double>(value.value_as_byte);
-    case HSI_DATA_TYPE_INT16:
-      return static_cast<double>(value.value_as_int16);
-    case HSI_DATA_TYPE_INT32:
-      return static_cast<double>(value.value_as_int32);
-    case HSI_DATA_TYPE_FLOAT:
-      return static_cast<double>(value.value_as_float);
-    case HSI_DATA_TYPE_UNSIGNED_INT16:
-      return static_cast<double>(value.value_as_uint16);
-    case HSI_DATA_TYPE_UNSIGNED_INT32:
-      return static_cast<double>(value.value_as_uint32);
-    case HSI_DATA_TYPE_UNSIGNED_INT64:
-      return static_cast<double>(value.value_as_uint64);
-    case HSI_DATA_TYPE_UNSIGNED_LONG:
-      return static_cast<double>(value.value_as_unsigned_long);
-    case HSI_DATA_TYPE_DOUBLE:
-    default:
-      return value.value_as_double;
-  }
+  return hsi::GetValueAsDouble(GetValue(row, col, band), data_type);
+}
+
+std::complex<double> HSIData::GetValueAsComplex(
+    const int row, const int col, const int band) const {
+
+  return hsi::GetValueAsComplex(GetValue(row, col, band), data_type);
 }
 
 std::vector<HSIDataValue> HSIData::GetSpectrum(
@@ -512,59 +1787,200 @@ std::vector<double> HSIData::GetSpectrumAsDoubles(
   return spectrum;
 }
 
+void HSIData::GatherValues(
+    const int* rows,
+    const int* cols,
+    const int* bands,
+    const long num_values,
+    float* values) const {
+
+  GatherValuesAs(
+      *this, rows, cols, bands, num_values, HSI_DATA_TYPE_FLOAT, values);
+}
+
+void HSIData::GatherValues(
+    const int* rows,
+    const int* cols,
+    const int* bands,
+    const long num_values,
+    double* values) const {
+
+  GatherValuesAs(
+      *this, rows, cols, bands, num_values, HSI_DATA_TYPE_DOUBLE, values);
+}
+
+void HSIData::GatherSpectra(
+    const int* rows,
+    const int* cols,
+    const long num_pixels,
+    float* spectra) const {
+
+  GatherSpectraAs(
+      *this, rows, cols, num_pixels, HSI_DATA_TYPE_FLOAT, spectra);
+}
+
+void HSIData::GatherSpectra(
+    const int* rows,
+    const int* cols,
+    const long num_pixels,
+    double* spectra) const {
+
+  GatherSpectraAs(
+      *this, rows, cols, num_pixels, HSI_DATA_TYPE_DOUBLE, spectra);
+}
+
 /*******************************************************************************
 *** HSIDataReader
 *******************************************************************************/
 
 HSIDataReader::HSIDataReader(const HSIDataOptions& data_options)
-    : data_options_(data_options) {
+    : data_options_(data_options), hsi_data_(std::make_shared<HSIData>()) {
 
-  // Determine the machine endian. Union of memory means "unsigned int value"
-  // and "unsigned char bytes" share the same memory.
-  union UnsignedNumber {
-    unsigned int value;
-    unsigned char bytes[sizeof(unsigned int)];
-  };
-
-  // Set the value to unsigned 1, and check the byte array to see if it is in
-  // big endian or little endian order. The left-most byte will be empty (zero)
-  // if the machine is big endian.
-  UnsignedNumber number;
-  number.value = 1U;  // Unsigned int 1.
-  machine_big_endian_ = (number.bytes[0] != 1U);
+  machine_big_endian_ = IsMachineBigEndian();
 }
 
 void HSIDataReader::ReadData(const HSIDataRange& data_range) {
-  // Check that the given ranges are valid.
-  if (data_range.start_row < 0 ||
-      data_range.end_row > data_options_.num_data_rows) {
-    FatalError("Invalid row range: must be between 0 and " +
-               std::to_string(data_options_.num_data_rows));
+  CheckDataRange(data_options_, data_range);
+  UnshareData();
+
+  // If caching is enabled, serve the range from the cached (already
+  // converted) copy of the full cube, creating it first if necessary.
+  if (!data_options_.cache_directory.empty()) {
+    HSIDataCache cache(
+        data_options_.cache_directory, data_options_.cache_quota_bytes);
+    std::string cached_file_path;
+    if (!cache.Lookup(data_options_, &cached_file_path)) {
+      cached_file_path = cache.Insert(
+          data_options_,
+          [this](const HSIDataRange& chunk_range, HSIData* chunk_data) {
+            ReadDataFromFile(chunk_range, chunk_data);
+          });
+    }
+    if (!cached_file_path.empty() &&
+        cache.ReadRange(
+            data_options_, cached_file_path, data_range, hsi_data_.get())) {
+      return;
+    }
+    Error("Cache unavailable. Reading " + data_options_.hsi_file_path +
+          " directly.");
   }
-  if (data_range.start_col < 0 ||
-      data_range.end_col > data_options_.num_data_cols) {
-    FatalError("Invalid column range: must be between 0 and " +
-               std::to_string(data_options_.num_data_cols));
+
+  // Packed samples that are read as floats are unpacked to floats directly,
+  // without an intermediate copy of the range as 16-bit integers.
+  if (IsPackedDataType(data_options_.data_type) &&
+      data_options_.GetInMemoryDataType() == HSI_DATA_TYPE_FLOAT &&
+      data_options_.GetInMemoryInterleaveFormat() ==
+          data_options_.interleave_format) {
+    ReadPackedDataAsFloats(data_range);
+    return;
   }
-  if (data_range.start_band < 0 ||
-      data_range.end_band > data_options_.num_data_bands) {
-    FatalError("Invalid band range: must be between 0 and " +
-               std::to_string(data_options_.num_data_bands));
+
+  // Data that keeps its interleave format, but changes type (e.g. to the
+  // real-valued component of complex data), is converted in chunks as it is
+  // read to avoid holding the full range in both formats.
+  if (data_options_.GetInMemoryInterleaveFormat() ==
+          data_options_.interleave_format &&
+      data_options_.GetInMemoryDataType() !=
+          GetUnpackedDataType(data_options_.data_type)) {
+    ReadAndConvertDataInChunks(data_range);
+    return;
   }
+  ReadDataFromFile(data_range, hsi_data_.get());
+  ConvertToInMemoryFormat(data_options_, hsi_data_.get());
+}
 
-  // Check that the ranges are positive / valid.
-  hsi_data_.num_rows = data_range.end_row - data_range.start_row;
-  hsi_data_.num_cols = data_range.end_col - data_range.start_col;
-  hsi_data_.num_bands = data_range.end_band - data_range.start_band;
-  if (hsi_data_.num_rows <= 0) {
-    FatalError("Row range must be positive.");
+void HSIDataReader::UnshareData() {
+  if (hsi_data_.use_count() > 1) {
+    hsi_data_ = std::make_shared<HSIData>();
   }
-  if (hsi_data_.num_cols <= 0) {
-    FatalError("Column range must be positive.");
+}
+
+HSIDataView HSIDataReader::GetDataView() const {
+  return HSIDataView(std::shared_ptr<const HSIData>(hsi_data_));
+}
+
+void HSIDataReader::ReadAndConvertDataInChunks(
+    const HSIDataRange& data_range) {
+
+  hsi_data_->num_rows = data_range.end_row - data_range.start_row;
+  hsi_data_->num_cols = data_range.end_col - data_range.start_col;
+  hsi_data_->num_bands = data_range.end_band - data_range.start_band;
+  hsi_data_->data_type = data_options_.GetInMemoryDataType();
+  hsi_data_->interleave_format = data_options_.interleave_format;
+  hsi_data_->raw_data.clear();
+  hsi_data_->raw_data.reserve(
+      static_cast<long>(hsi_data_->NumDataPoints()) *
+      GetDataSize(hsi_data_->data_type));
+
+  // Chunks are split along the slowest-changing dimension (bands for BSQ,
+  // rows otherwise), so the converted chunks are contiguous in memory.
+  const bool split_bands =
+      (data_options_.interleave_format == HSI_INTERLEAVE_BSQ);
+  const long slice_bytes =
+      static_cast<long>(hsi_data_->NumDataPoints()) *
+      GetDataSize(data_options_.data_type) /
+      (split_bands ? hsi_data_->num_bands : hsi_data_->num_rows);
+  const int slices_per_chunk = static_cast<int>(
+      std::max(1L, kConversionChunkBytes / std::max(1L, slice_bytes)));
+  const int start = split_bands ? data_range.start_band : data_range.start_row;
+  const int end = split_bands ? data_range.end_band : data_range.end_row;
+  HSIDataRange chunk_range = data_range;
+  HSIData chunk_data;
+  for (int slice = start; slice < end; slice += slices_per_chunk) {
+    const int slice_end = std::min(slice + slices_per_chunk, end);
+    if (split_bands) {
+      chunk_range.start_band = slice;
+      chunk_range.end_band = slice_end;
+    } else {
+      chunk_range.start_row = slice;
+      chunk_range.end_row = slice_end;
+    }
+    ReadDataFromFile(chunk_range, &chunk_data);
+    ConvertToInMemoryFormat(data_options_, &chunk_data);
+    hsi_data_->raw_data.insert(
+        hsi_data_->raw_data.end(),
+        chunk_data.raw_data.begin(),
+        chunk_data.raw_data.end());
   }
-  if (hsi_data_.num_bands <= 0) {
-    FatalError("Band range must be positive.");
+}
+
+void HSIDataReader::ReadPackedDataAsFloats(const HSIDataRange& data_range) {
+  hsi_data_->num_rows = data_range.end_row - data_range.start_row;
+  hsi_data_->num_cols = data_range.end_col - data_range.start_col;
+  hsi_data_->num_bands = data_range.end_band - data_range.start_band;
+  hsi_data_->data_type = HSI_DATA_TYPE_FLOAT;
+  hsi_data_->interleave_format = data_options_.interleave_format;
+  hsi_data_->raw_data.resize(
+      static_cast<long>(hsi_data_->NumDataPoints()) * sizeof(float));
+  std::vector<HSIValueRun> runs;
+  GetDataRangeRuns(data_options_, data_range, &runs);
+  ReadValueRuns(runs, 0, true, hsi_data_->raw_data.data());
+}
+
+void HSIDataReader::ReadDataFromFile(
+    const HSIDataRange& data_range, HSIData* hsi_data) const {
+
+  hsi_data->num_rows = data_range.end_row - data_range.start_row;
+  hsi_data->num_cols = data_range.end_col - data_range.start_col;
+  hsi_data->num_bands = data_range.end_band - data_range.start_band;
+
+  // Set the size of the data vector and the HSI data struct.
+  hsi_data->raw_data.clear();
+  hsi_data->interleave_format = data_options_.interleave_format;
+  hsi_data->data_type = GetUnpackedDataType(data_options_.data_type);
+  const long num_data_points = hsi_data->NumDataPoints();
+  const long num_bytes = num_data_points * GetDataSize(hsi_data->data_type);
+
+  // Packed samples are not aligned to bytes, so they are read in contiguous
+  // runs that are unpacked as a whole.
+  if (IsPackedDataType(data_options_.data_type)) {
+    std::vector<HSIValueRun> runs;
+    GetDataRangeRuns(data_options_, data_range, &runs);
+    hsi_data->raw_data.resize(num_bytes);
+    ReadValueRuns(runs, 0, hsi_data->raw_data.data());
+    return;
   }
+  hsi_data->raw_data.reserve(num_bytes);
 
   // Try to open the file.
   std::ifstream data_file(data_options_.hsi_file_path);
@@ -573,15 +1989,6 @@ void HSIDataReader::ReadData(const HSIDataRange& data_range) {
                " could not be opened for reading.");
   }
 
-  // Set the size of the data vector and the HSI data struct.
-  hsi_data_.raw_data.clear();
-  const long num_data_points =
-      hsi_data_.num_rows * hsi_data_.num_cols * hsi_data_.num_bands;
-  const long num_bytes = num_data_points * GetDataSize(hsi_data_.data_type);
-  hsi_data_.raw_data.reserve(num_bytes);
-  hsi_data_.interleave_format = data_options_.interleave_format;
-  hsi_data_.data_type = data_options_.data_type;
-
   if (data_options_.interleave_format == HSI_INTERLEAVE_BSQ) {
     ReadDataBSQ(
         data_options_,
@@ -589,7 +1996,7 @@ void HSIDataReader::ReadData(const HSIDataRange& data_range) {
         data_range,
         data_options_.header_offset,
         &data_file,
-        &hsi_data_);
+        hsi_data);
   } else if (data_options_.interleave_format == HSI_INTERLEAVE_BIL) {
     ReadDataBIL(
         data_options_,
@@ -597,7 +2004,7 @@ void HSIDataReader::ReadData(const HSIDataRange& data_range) {
         data_range,
         data_options_.header_offset,
         &data_file,
-        &hsi_data_);
+        hsi_data);
   } else if (data_options_.interleave_format == HSI_INTERLEAVE_BIP) {
     ReadDataBIP(
         data_options_,
@@ -605,7 +2012,241 @@ void HSIDataReader::ReadData(const HSIDataRange& data_range) {
         data_range,
         data_options_.header_offset,
         &data_file,
-        &hsi_data_);
+        hsi_data);
+  }
+}
+
+void HSIDataReader::ReadValueRuns(
+    const std::vector<HSIValueRun>& runs,
+    const long max_gap_bytes,
+    char* destination) const {
+
+  ReadValueRuns(runs, max_gap_bytes, false, destination);
+}
+
+void HSIDataReader::ReadValueRuns(
+    const std::vector<HSIValueRun>& runs,
+    const long max_gap_bytes,
+    const bool unpack_to_floats,
+    char* destination) const {
+
+  std::ifstream data_file(data_options_.hsi_file_path, std::ios::binary);
+  if (!data_file.is_open()) {
+    FatalError("File " + data_options_.hsi_file_path +
+               " could not be opened for reading.");
+  }
+  // Packed samples are not aligned to bytes, so positions in the file are
+  // computed in bits.
+  const bool packed = IsPackedDataType(data_options_.data_type);
+  const int bit_depth = GetPackedBitDepth(data_options_.data_type);
+  const int data_size = GetDataSize(data_options_.data_type);
+  const int component_size = GetComponentSize(data_options_.data_type);
+  const bool reverse_byte_order =
+      (data_options_.big_endian != machine_big_endian_);
+  const long max_gap_values = max_gap_bytes * 8 / bit_depth;
+  const int destination_size = unpack_to_floats ? sizeof(float) : data_size;
+
+  std::vector<char> buffer;
+  int first_run = 0;
+  const int num_runs = runs.size();
+  while (first_run < num_runs) {
+    // Extend the read over all following runs that are close enough.
+    const long read_start = runs[first_run].file_index;
+    long read_end = read_start + runs[first_run].num_values;
+    int end_run = first_run + 1;
+    while (end_run < num_runs &&
+           runs[end_run].file_index >= read_end &&
+           runs[end_run].file_index - read_end <= max_gap_values) {
+      read_end = runs[end_run].file_index + runs[end_run].num_values;
+      ++end_run;
+    }
+
+    const long read_start_byte = read_start * bit_depth / 8;
+    const long read_end_byte = (read_end * bit_depth + 7) / 8;
+    buffer.resize(read_end_byte - read_start_byte);
+    data_file.seekg(data_options_.header_offset + read_start_byte);
+    data_file.read(buffer.data(), buffer.size());
+    if (!data_file) {
+      FatalError("Failed to read from " + data_options_.hsi_file_path + ".");
+    }
+    for (int i = first_run; i < end_run; ++i) {
+      const HSIValueRun& run = runs[i];
+      char* run_destination =
+          destination + run.destination_index * destination_size;
+      const long bit_position =
+          run.file_index * bit_depth - read_start_byte * 8;
+      if (unpack_to_floats) {
+        UnpackSamples(
+            reinterpret_cast<const uint8_t*>(buffer.data()) +
+                (bit_position >> 3),
+            bit_position & 7,
+            run.num_values,
+            bit_depth,
+            data_options_.packed_msb_first,
+            reinterpret_cast<float*>(run_destination));
+        continue;
+      }
+      if (packed) {
+        UnpackSamples(
+            reinterpret_cast<const uint8_t*>(buffer.data()) +
+                (bit_position >> 3),
+            bit_position & 7,
+            run.num_values,
+            bit_depth,
+            data_options_.packed_msb_first,
+            reinterpret_cast<uint16_t*>(run_destination));
+        continue;
+      }
+      std::memcpy(
+          run_destination,
+          buffer.data() + bit_position / 8,
+          run.num_values * data_size);
+      if (reverse_byte_order) {
+        for (long j = 0; j < run.num_values; ++j) {
+          ReverseValueBytes(
+              data_size, component_size, run_destination + j * data_size);
+        }
+      }
+    }
+    first_run = end_run;
+  }
+}
+
+void HSIDataReader::ReadDataProgressive(
+    const HSIDataRange& data_range,
+    const int initial_stride,
+    const ProgressiveReadCallback& callback) {
+
+  CheckDataRange(data_options_, data_range);
+  UnshareData();
+  if (initial_stride < 1) {
+    FatalError("Progressive read stride must be positive.");
+  }
+
+  // The data is read in the file layout, and converted (if requested) for
+  // each level that is passed to the callback.
+  HSIData level_data;
+  level_data.num_rows = data_range.end_row - data_range.start_row;
+  level_data.num_cols = data_range.end_col - data_range.start_col;
+  level_data.num_bands = data_range.end_band - data_range.start_band;
+  level_data.data_type = GetUnpackedDataType(data_options_.data_type);
+  level_data.interleave_format = data_options_.interleave_format;
+  const int data_size = GetDataSize(level_data.data_type);
+  level_data.raw_data.resize(
+      static_cast<long>(level_data.NumDataPoints()) * data_size);
+
+  long file_row_stride, file_col_stride, file_band_stride;
+  GetInterleaveStrides(
+      data_options_.interleave_format,
+      data_options_.num_data_rows,
+      data_options_.num_data_cols,
+      data_options_.num_data_bands,
+      &file_row_stride,
+      &file_col_stride,
+      &file_band_stride);
+  long row_stride, col_stride, band_stride;
+  GetInterleaveStrides(
+      level_data.interleave_format,
+      level_data.num_rows,
+      level_data.num_cols,
+      level_data.num_bands,
+      &row_stride,
+      &col_stride,
+      &band_stride);
+
+  std::vector<int> previous_strides;
+  for (int stride = initial_stride; stride >= 1;
+       previous_strides.push_back(stride), stride /= 2) {
+
+    // Collect the values of all new pixels, in file order.
+    std::vector<HSIValueRun> runs;
+    const int num_bands = level_data.num_bands;
+    if (data_options_.interleave_format == HSI_INTERLEAVE_BSQ) {
+      for (int band = 0; band < num_bands; ++band) {
+        for (int row = 0; row < level_data.num_rows; row += stride) {
+          for (int col = 0; col < level_data.num_cols; col += stride) {
+            if (!IsNewProgressivePixel(row, col, stride, previous_strides)) {
+              continue;
+            }
+            AddValueRun(
+                (data_range.start_band + band) * file_band_stride +
+                    (data_range.start_row + row) * file_row_stride +
+                    data_range.start_col + col,
+                1,
+                band * band_stride + row * row_stride + col,
+                &runs);
+          }
+        }
+      }
+    } else if (data_options_.interleave_format == HSI_INTERLEAVE_BIL) {
+      for (int row = 0; row < level_data.num_rows; row += stride) {
+        for (int band = 0; band < num_bands; ++band) {
+          for (int col = 0; col < level_data.num_cols; col += stride) {
+            if (!IsNewProgressivePixel(row, col, stride, previous_strides)) {
+              continue;
+            }
+            AddValueRun(
+                (data_range.start_row + row) * file_row_stride +
+                    (data_range.start_band + band) * file_band_stride +
+                    data_range.start_col + col,
+                1,
+                row * row_stride + band * band_stride + col,
+                &runs);
+          }
+        }
+      }
+    } else {
+      for (int row = 0; row < level_data.num_rows; row += stride) {
+        for (int col = 0; col < level_data.num_cols; col += stride) {
+          if (!IsNewProgressivePixel(row, col, stride, previous_strides)) {
+            continue;
+          }
+          AddValueRun(
+              (data_range.start_row + row) * file_row_stride +
+                  (data_range.start_col + col) * file_col_stride +
+                  data_range.start_band,
+              num_bands,
+              row * row_stride + col * col_stride,
+              &runs);
+        }
+      }
+    }
+    // Reads are combined across the pixels of a row of the level, but not
+    // across the rows (or bands) in between, which would read the pixels of
+    // the earlier levels again.
+    const long max_gap_bytes = std::min(
+        kProgressiveReadMaxGapBytes,
+        2L * stride * file_col_stride *
+            GetPackedBitDepth(data_options_.data_type) / 8);
+    ReadValueRuns(runs, max_gap_bytes, level_data.raw_data.data());
+
+    // Fill every pixel not read yet with its nearest read pixel above and to
+    // the left, so the level is a complete approximation of the range.
+    HSIData display_data = level_data;
+    if (stride > 1) {
+      char* bytes = display_data.raw_data.data();
+      for (int row = 0; row < level_data.num_rows; ++row) {
+        for (int col = 0; col < level_data.num_cols; ++col) {
+          if (row % stride == 0 && col % stride == 0) {
+            continue;
+          }
+          const long index = row * row_stride + col * col_stride;
+          const long source_index = (row - row % stride) * row_stride +
+              (col - col % stride) * col_stride;
+          for (int band = 0; band < num_bands; ++band) {
+            std::memcpy(
+                bytes + (index + band * band_stride) * data_size,
+                bytes + (source_index + band * band_stride) * data_size,
+                data_size);
+          }
+        }
+      }
+    }
+    ConvertToInMemoryFormat(data_options_, &display_data);
+    if (stride == 1) {
+      *hsi_data_ = display_data;
+    }
+    callback(display_data, stride);
   }
 }
 
@@ -618,17 +2259,18 @@ void HSIDataReader::WriteData(const std::string& save_file_path) const {
 
   const bool reverse_byte_order =
       (data_options_.big_endian != machine_big_endian_);
-  const int data_size = GetDataSize(hsi_data_.data_type);
-  const int num_data_points = hsi_data_.raw_data.size() / data_size;
+  const int data_size = GetDataSize(hsi_data_->data_type);
+  const int component_size = GetComponentSize(hsi_data_->data_type);
+  const int num_data_points = hsi_data_->raw_data.size() / data_size;
   for (long i = 0; i < num_data_points; ++i) {
     const long byte_index = i * data_size;
     char bytes[data_size];  // NOLINT
     std::copy(
-        hsi_data_.raw_data.begin() + byte_index,
-        hsi_data_.raw_data.begin() + byte_index + data_size,
+        hsi_data_->raw_data.begin() + byte_index,
+        hsi_data_->raw_data.begin() + byte_index + data_size,
         bytes);
     if (reverse_byte_order) {
-      ReverseBytes(data_size, bytes);
+      ReverseValueBytes(data_size, component_size, bytes);
     }
     data_file.write(bytes, data_size);
   }
@@ -636,4 +2278,65 @@ void HSIDataReader::WriteData(const std::string& save_file_path) const {
   data_file.close();
 }
 
+void HSIDataReader::WriteRange(
+    const HSIDataRange& data_range,
+    const HSIData& hsi_data,
+    const HSIWriteRangeOptions& options) const {
+
+  HSIData converted_data;
+  std::vector<HSIValueRun> runs;
+  const char* file_values = GetFileLayoutValues(
+      data_options_, data_range, hsi_data, &runs, &converted_data);
+
+  const int fd = open(data_options_.hsi_file_path.c_str(), O_WRONLY);
+  if (fd < 0) {
+    FatalError("File " + data_options_.hsi_file_path +
+               " could not be opened for writing.");
+  }
+  const int data_size = GetDataSize(data_options_.data_type);
+  std::atomic<bool> write_failed(false);
+  ParallelFor(
+      0, runs.size(), options.num_threads, 1,
+      [&](const long begin, const long end) {
+        for (long i = begin; i < end; ++i) {
+          const HSIValueRun& run = runs[i];
+          const char* bytes = file_values + run.destination_index * data_size;
+          const long num_bytes = run.num_values * data_size;
+          const long file_position =
+              data_options_.header_offset + run.file_index * data_size;
+          long num_written = 0;
+          while (num_written < num_bytes) {
+            const ssize_t result = pwrite(
+                fd,
+                bytes + num_written,
+                num_bytes - num_written,
+                file_position + num_written);
+            if (result < 0 && errno == EINTR) {
+              continue;
+            }
+            if (result <= 0) {
+              write_failed = true;
+              return;
+            }
+            num_written += result;
+          }
+        }
+      });
+  if (!write_failed && options.sync && fsync(fd) != 0) {
+    write_failed = true;
+  }
+  close(fd);
+  if (write_failed) {
+    FatalError("Failed to write to " + data_options_.hsi_file_path + ".");
+  }
+
+  // Cached copies of the file are out of date now, even if its modification
+  // time looks unchanged.
+  if (!data_options_.cache_directory.empty()) {
+    HSIDataCache cache(
+        data_options_.cache_directory, data_options_.cache_quota_bytes);
+    cache.RemoveEntries(data_options_.hsi_file_path);
+  }
+}
+
 }  // namespace hsi
@@ -6,7 +6,10 @@
 #ifndef SRC_HSI_DATA_READER_H_
 #define SRC_HSI_DATA_READER_H_
 
+#include <complex>
+#include <functional>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -60,17 +63,106 @@ enum HSIDataInterleaveFormat {
 };
 
 // The precision/type of the data.
-// TODO: Complex 2x32 (6) and 2x64 (9) are also possible HSI data types.
 enum HSIDataType {
   HSI_DATA_TYPE_BYTE = 1,
   HSI_DATA_TYPE_INT16 = 2,
   HSI_DATA_TYPE_INT32 = 3,
   HSI_DATA_TYPE_FLOAT = 4,
   HSI_DATA_TYPE_DOUBLE = 5,
+  // Complex values are stored as (real, imaginary) pairs of 32-bit or 64-bit
+  // floats.
+  HSI_DATA_TYPE_COMPLEX_FLOAT = 6,
+  HSI_DATA_TYPE_COMPLEX_DOUBLE = 9,
   HSI_DATA_TYPE_UNSIGNED_INT16 = 12,
   HSI_DATA_TYPE_UNSIGNED_INT32 = 13,
   HSI_DATA_TYPE_UNSIGNED_INT64 = 14,
-  HSI_DATA_TYPE_UNSIGNED_LONG = 15
+  HSI_DATA_TYPE_UNSIGNED_LONG = 15,
+
+  // Packed unsigned integer samples of 10, 12, or 14 bits, stored as a
+  // continuous bit stream (see hsi_packed_data.h). These are not ENVI types.
+  // They only describe data files: the samples are expanded to 16-bit
+  // unsigned integers (or the target data type) when they are read.
+  HSI_DATA_TYPE_PACKED_UINT10 = 110,
+  HSI_DATA_TYPE_PACKED_UINT12 = 112,
+  HSI_DATA_TYPE_PACKED_UINT14 = 114,
+
+  // 16-bit floating point values, stored as raw bits (see hsi_half_float.h).
+  // These are not ENVI types. They are mainly meant as target data types, to
+  // hold float data in memory at half the size. All accessors widen the values
+  // to floats/doubles on the fly.
+  HSI_DATA_TYPE_HALF_FLOAT = 120,
+  HSI_DATA_TYPE_BFLOAT16 = 121
+};
+
+// Returns true if the data type is one of the 16-bit floating point types.
+bool IsHalfPrecisionDataType(const HSIDataType data_type);
+
+// Real-valued products that can be derived from complex data.
+enum HSIComplexComponent {
+  HSI_COMPLEX_REAL,
+  HSI_COMPLEX_IMAGINARY,
+  HSI_COMPLEX_MAGNITUDE,
+  HSI_COMPLEX_PHASE,
+  HSI_COMPLEX_POWER
+};
+
+// Returns true if the data type is one of the complex types.
+bool IsComplexDataType(const HSIDataType data_type);
+
+// Returns the real type of each component of a complex data type (float or
+// double). Real data types are returned unchanged.
+HSIDataType GetComplexComponentDataType(const HSIDataType data_type);
+
+// Returns true if the data type is one of the packed sample types.
+bool IsPackedDataType(const HSIDataType data_type);
+
+// Returns the number of bits per sample of a packed data type.
+int GetPackedBitDepth(const HSIDataType data_type);
+
+// Returns the type that values of the given file data type have in memory.
+// This is the same type, except that packed samples are unpacked to 16-bit
+// unsigned integers.
+HSIDataType GetUnpackedDataType(const HSIDataType data_type);
+
+// The georeferencing of the data, from the "map info" field of the header.
+// Pixel coordinates are continuous, with (0, 0) at the upper left corner of
+// the first pixel, so the center of the pixel at sample s and line l is at
+// (s + 0.5, l + 0.5).
+struct HSIMapInfo {
+  // The name of the projection (e.g. "UTM"). Empty if there is no map info.
+  std::string projection;
+
+  // The reference pixel, 1-based as in the header (so (1, 1) is the upper
+  // left corner of the first pixel), and its map coordinates.
+  double reference_sample = 1;
+  double reference_line = 1;
+  double reference_x = 0;
+  double reference_y = 0;
+
+  // The size of a pixel, in map units.
+  double pixel_width = 1;
+  double pixel_height = 1;
+
+  // The counterclockwise rotation of the pixel grid, in degrees. Without
+  // rotation, samples increase along x and lines decrease along y.
+  double rotation = 0;
+
+  // The UTM zone and hemisphere, for the UTM projection only.
+  int utm_zone = 0;
+  bool utm_north = true;
+
+  std::string datum;
+  std::string units;
+
+  bool IsValid() const {
+    return !projection.empty();
+  }
+
+  // Converts between pixel and map coordinates.
+  void PixelToMap(
+      const double sample, const double line, double* x, double* y) const;
+  void MapToPixel(
+      const double x, const double y, double* sample, double* line) const;
 };
 
 // Options that specify the location and format of the data. Needed to
@@ -85,6 +177,15 @@ struct HSIDataOptions {
   // error if the read was unsuccessful and the information was not loaded.
   void ReadHeaderFromFile(const std::string& header_file_path);
 
+  // Writes an ENVI header describing the data file (its size, format,
+  // wavelengths, and map info) that ReadHeaderFromFile() reads back into the
+  // same options. Fatal error if the file cannot be written.
+  void WriteHeaderToFile(const std::string& header_file_path) const;
+
+  // Writes the ENVI header text of WriteHeaderToFile() to the stream. Errors
+  // are left in the state of the stream.
+  void WriteHeader(std::ostream* header_stream) const;
+
   // Path to the binary hyperspectral data file.
   std::string hsi_file_path;
 
@@ -93,6 +194,17 @@ struct HSIDataOptions {
   HSIDataType data_type = HSI_DATA_TYPE_FLOAT;
   bool big_endian = false;
 
+  // The bit order of packed data types (see hsi_packed_data.h). Ignored for
+  // all other data types.
+  bool packed_msb_first = true;
+
+  // If true and the data is complex, only the selected real-valued component
+  // is kept in memory. It is computed while the data is read, so the complex
+  // values are never stored in full. The in-memory type is float for complex
+  // float data and double for complex double data.
+  bool extract_complex_component = false;
+  HSIComplexComponent complex_component = HSI_COMPLEX_MAGNITUDE;
+
   // Offset of the header (if the header is attached to the data).
   int header_offset = 0;
 
@@ -102,6 +214,77 @@ struct HSIDataOptions {
   int num_data_rows = 0;
   int num_data_cols = 0;
   int num_data_bands = 0;
+
+  // The center wavelength of each band, if listed in the header. These are in
+  // the units of the header (usually nanometers or micrometers).
+  std::vector<double> wavelengths;
+
+  // The full width at half maximum of each band's response, if listed in the
+  // header, in the units of the wavelengths.
+  std::vector<double> fwhm;
+
+  // The georeferencing of the data, if the header has map info.
+  HSIMapInfo map_info;
+
+  // Optional conversion applied to the data as it is loaded into memory. By
+  // default, the loaded HSIData keeps the data type and interleave format of
+  // the file. If enabled, the values are cast to target_data_type and/or
+  // reordered into target_interleave_format.
+  bool convert_data_type = false;
+  HSIDataType target_data_type = HSI_DATA_TYPE_FLOAT;
+  bool convert_interleave_format = false;
+  HSIDataInterleaveFormat target_interleave_format = HSI_INTERLEAVE_BIP;
+
+  // Opt-in persistent cache of converted data (see hsi_data_cache.h). If a
+  // cache directory is set, the first read of a file converts the entire cube
+  // to native endian, target type and target interleave and stores it there.
+  // Subsequent reads of the same (unmodified) file with the same conversion
+  // copy the requested range out of the memory-mapped cached copy, without
+  // converting it again. Caching a modified file deletes the entries of its
+  // earlier versions. The cache evicts the least recently used entries to
+  // stay under cache_quota_bytes (zero means no limit).
+  std::string cache_directory;
+  long cache_quota_bytes = 0;
+
+  // Returns the data type and interleave format that the data will have in
+  // memory after it is read, taking the above conversion into account.
+  HSIDataType GetInMemoryDataType() const {
+    if (convert_data_type) {
+      return GetUnpackedDataType(target_data_type);
+    }
+    if (extract_complex_component) {
+      return GetComplexComponentDataType(data_type);
+    }
+    return GetUnpackedDataType(data_type);
+  }
+  HSIDataInterleaveFormat GetInMemoryInterleaveFormat() const {
+    return convert_interleave_format ?
+        target_interleave_format : interleave_format;
+  }
+
+  // Returns the numbers of samples and lines of the image, as in the header.
+  // For BSQ data, rows are samples and columns are lines, as in
+  // ReadHeaderFromFile().
+  int GetNumSamples() const {
+    return (interleave_format == HSI_INTERLEAVE_BSQ) ?
+        num_data_rows : num_data_cols;
+  }
+  int GetNumLines() const {
+    return (interleave_format == HSI_INTERLEAVE_BSQ) ?
+        num_data_cols : num_data_rows;
+  }
+
+  // Sets row and col to the position in the data of the pixel at the given
+  // sample and line of the image. Each band of a BSQ file holds lines of
+  // samples, which are read as num_data_rows rows of num_data_cols values, so
+  // the pixel is found through its offset in the band (line * samples +
+  // sample) rather than by swapping the sample and line.
+  void GetPixelPosition(
+      const int sample, const int line, int* row, int* col) const {
+    const long offset = static_cast<long>(line) * GetNumSamples() + sample;
+    *row = static_cast<int>(offset / num_data_cols);
+    *col = static_cast<int>(offset % num_data_cols);
+  }
 };
 
 // Data range object is used for specifying the data range to read with the
@@ -118,13 +301,50 @@ struct HSIDataRange {
   int end_col = 0;
 };
 
+// A run of consecutive values in the data file, and the position in memory
+// where the values are stored when they are read.
+struct HSIValueRun {
+  // Index of the first value of the run in the file, counted in values
+  // (excluding the header offset).
+  long file_index = 0;
+  long num_values = 0;
+
+  // Index of the first value of the run in the destination buffer, counted in
+  // values.
+  long destination_index = 0;
+};
+
+// Appends the runs of values that make up the given range of the data file to
+// runs, in file order. The destination indices place the values contiguously
+// in the same interleave format as the file.
+void GetDataRangeRuns(
+    const HSIDataOptions& data_options,
+    const HSIDataRange& data_range,
+    std::vector<HSIValueRun>* runs);
+
+// Checks that the given range is non-empty and within the data size. Fatal
+// error otherwise.
+void CheckDataRange(
+    const HSIDataOptions& data_options, const HSIDataRange& data_range);
+
+// Options for HSIDataReader::WriteRange().
+struct HSIWriteRangeOptions {
+  // The number of threads writing spans of the range. Zero means one for
+  // each hardware thread.
+  int num_threads = 0;
+
+  // If true, the written data is flushed to the disk (with fsync) before
+  // WriteRange() returns.
+  bool sync = false;
+};
+
 // This memory union occupies multiple bytes, but allows interpreting the data
 // as an arbitrary type.
 union HSIDataValue {
-  HSIDataValue() : value_as_uint64(0) {}
+  HSIDataValue() : bytes() {}
 
-  // The raw bytes.
-  char bytes[8];
+  // The raw bytes. Large enough for a complex double value.
+  char bytes[16];
 
   // Interpret the memory as one of the following types:
   char value_as_byte;
@@ -136,6 +356,9 @@ union HSIDataValue {
   uint32_t value_as_uint32;
   uint64_t value_as_uint64;
   unsigned long value_as_unsigned_long;
+  // Complex values as {real, imaginary}.
+  float value_as_complex_float[2];
+  double value_as_complex_double[2];
 };
 
 // This struct stores and provides access to hyperspectral data. All data is
@@ -169,8 +392,14 @@ struct HSIData {
   // double, it will be cast to a double first.
   //
   // Note that very large unsigned 64-bit integers may not be cast correctly.
+  // Complex values are returned as their magnitude.
   double GetValueAsDouble(const int row, const int col, const int band) const;
 
+  // Returns the value as a complex number. Real values are returned with a
+  // zero imaginary part.
+  std::complex<double> GetValueAsComplex(
+      const int row, const int col, const int band) const;
+
   // Returns a vector containing the spectrum of the pixel at the given row
   // and col of the image.
   std::vector<HSIDataValue> GetSpectrum(const int row, const int col) const;
@@ -178,14 +407,157 @@ struct HSIData {
   // Returns the spectrum as above, but all values are cast to doubles.
   std::vector<double> GetSpectrumAsDoubles(const int row, const int col) const;
 
+  // Gathers the values at num_values positions (rows[i], cols[i], bands[i])
+  // into values, cast to floats or doubles. This is much faster than calling
+  // GetValue() for each position. Positions outside of the data give 0.
+  void GatherValues(
+      const int* rows,
+      const int* cols,
+      const int* bands,
+      const long num_values,
+      float* values) const;
+  void GatherValues(
+      const int* rows,
+      const int* cols,
+      const int* bands,
+      const long num_values,
+      double* values) const;
+
+  // Gathers the spectra of num_pixels pixels at (rows[i], cols[i]) into
+  // spectra, one spectrum after the other, so spectra must hold
+  // num_pixels * num_bands values.
+  void GatherSpectra(
+      const int* rows,
+      const int* cols,
+      const long num_pixels,
+      float* spectra) const;
+  void GatherSpectra(
+      const int* rows,
+      const int* cols,
+      const long num_pixels,
+      double* spectra) const;
+
   // The raw data as bytes.
   std::vector<char> raw_data;
 };
 
+/*******************************************************************************
+*** Support functions shared by the HSI modules.
+*******************************************************************************/
+
+// Report errors. FatalError() also terminates the program.
+void Error(const std::string& message);
+void FatalError(const std::string& message);
+
+// Returns the size in bytes of a single value of the given HSIDataType. For
+// packed types, this is the size of an unpacked value.
+int GetDataSize(const HSIDataType& data_type);
+
+// Returns the value as a double or as a complex number, as
+// HSIData::GetValueAsDouble() and HSIData::GetValueAsComplex().
+double GetValueAsDouble(const HSIDataValue& value, const HSIDataType data_type);
+std::complex<double> GetValueAsComplex(
+    const HSIDataValue& value, const HSIDataType data_type);
+
+// Returns the size in bytes of each component of a value. This is half of the
+// data size for complex types, and the data size for all other types.
+int GetComponentSize(const HSIDataType& data_type);
+
+// Returns true if the machine stores values in big endian byte order.
+bool IsMachineBigEndian();
+
+// Reverses the byte order of a value of data_size bytes in place. The two
+// components of complex values are reversed separately.
+void ReverseValueBytes(
+    const int data_size, const int component_size, char* bytes);
+
+// Returns the offsets (in number of values) between two consecutive rows,
+// columns, and bands of a cube with the given size and interleave format.
+void GetInterleaveStrides(
+    const HSIDataInterleaveFormat interleave_format,
+    const int num_rows,
+    const int num_cols,
+    const int num_bands,
+    long* row_stride,
+    long* col_stride,
+    long* band_stride);
+
+// Casts num_values values of source_type stored in source to
+// destination_type, and writes them to destination.
+void ConvertValues(
+    const char* source,
+    const HSIDataType source_type,
+    const long num_values,
+    const HSIDataType destination_type,
+    char* destination);
+
+// Returns a copy of the given data with all values cast to data_type and
+// reordered into interleave_format.
+HSIData ConvertData(
+    const HSIData& hsi_data,
+    const HSIDataType data_type,
+    const HSIDataInterleaveFormat interleave_format);
+
+// Converts data read from a file (in its file format) to the format that is
+// kept in memory as described by the data options: extracts the complex
+// component, and then casts and reorders the values if requested. Does
+// nothing if no conversion is needed.
+void ConvertToInMemoryFormat(
+    const HSIDataOptions& data_options, HSIData* hsi_data);
+
+// Copies the given range out of a complete data cube of size
+// (num_rows, num_cols, num_bands) stored contiguously in memory, such as a
+// memory-mapped file. The cube must have the data type and interleave format
+// already set in hsi_data, and the copied values keep that layout.
+void CopyDataRange(
+    const char* cube_bytes,
+    const int num_rows,
+    const int num_cols,
+    const int num_bands,
+    const HSIDataRange& data_range,
+    HSIData* hsi_data);
+
+// Prepares data, which must have the size of the given range, to be written
+// to that range of the data file: returns its values in the data type,
+// interleave format, and byte order of the file, and sets runs to the runs of
+// the range (see GetDataRangeRuns()), so that each run is copied as it is from
+// the returned values to the file. The values are converted into
+// converted_data if needed, and are those of hsi_data otherwise. Packed data
+// types are not supported.
+const char* GetFileLayoutValues(
+    const HSIDataOptions& data_options,
+    const HSIDataRange& data_range,
+    const HSIData& hsi_data,
+    std::vector<HSIValueRun>* runs,
+    HSIData* converted_data);
+
+// Returns the range of a BSQ file that holds the given range of its image,
+// whose rows and columns are lines and samples: the whole data rows that hold
+// the lines (see HSIDataOptions::GetPixelPosition()), with the bands of the
+// image range. Fatal error if the lines or samples are outside of the image.
+HSIDataRange GetBSQImageDataRange(
+    const HSIDataOptions& data_options, const HSIDataRange& image_range);
+
+// Returns the given range of the image of a BSQ file as float values of lines
+// of samples, in the given interleave format. bsq_data holds the data of the
+// range returned by GetBSQImageDataRange() for the same image range.
+HSIData GetBSQImageRange(
+    const HSIDataOptions& data_options,
+    const HSIDataRange& image_range,
+    const HSIData& bsq_data,
+    const HSIDataInterleaveFormat interleave_format);
+
+class HSIDataView;
+
 // The HSIDataReader is responsible for loading the data and storing it in
 // memory.
 class HSIDataReader {
  public:
+  // Called with each completed level of a progressive read. level_stride is
+  // the spacing (in rows and columns) between the pixels read so far.
+  typedef std::function<void(const HSIData& hsi_data, const int level_stride)>
+      ProgressiveReadCallback;
+
   explicit HSIDataReader(const HSIDataOptions& data_options);
 
   // Read the data in the specified range. The range must be valid, within the
@@ -197,8 +569,31 @@ class HSIDataReader {
   // will return rows (2, 3, 4, 5, 6) where the first row in the data is row 0.
   void ReadData(const HSIDataRange& data_range);
 
+  // Reads the data in the specified range progressively, from coarse to
+  // fine. The first level reads every initial_stride-th row and column of the
+  // range (e.g. a 1/64 subgrid for a stride of 8), and each following level
+  // halves the stride until every pixel is read. After each level, pixels
+  // that have not been read yet are filled in with the nearest read pixel
+  // above and to the left of them, so the callback always receives a
+  // full-coverage approximation of the range. The last level (stride 1) is
+  // the exact data, which is also stored as in ReadData().
+  void ReadDataProgressive(
+      const HSIDataRange& data_range,
+      const int initial_stride,
+      const ProgressiveReadCallback& callback);
+
+  // Reads the given runs of values from the file into destination, in
+  // machine byte order and without conversion. Runs must be sorted by their
+  // file index. Runs separated by at most max_gap_bytes are coalesced into
+  // a single read.
+  void ReadValueRuns(
+      const std::vector<HSIValueRun>& runs,
+      const long max_gap_bytes,
+      char* destination) const;
+
   void SetData(const HSIData& hsi_data) {
-    hsi_data_ = hsi_data;
+    UnshareData();
+    *hsi_data_ = hsi_data;
   }
 
   // Writes the data currently stored in hsi_data_ in the order that it was
@@ -206,12 +601,67 @@ class HSIDataReader {
   // on success.
   void WriteData(const std::string& save_file_path) const;
 
+  // Writes the given data over the given range of the existing data file, in
+  // place, leaving the rest of the file unchanged. The data must have the size
+  // of the range, and is cast to the file's data type, reordered to its
+  // interleave format, and swapped to its byte order as needed. Only the byte
+  // spans of the range are written, with contiguous spans merged into single
+  // writes. Packed data types are not supported. The data loaded in this
+  // reader is not updated, and the file's entries in the cache directory of
+  // the options are deleted.
+  void WriteRange(
+      const HSIDataRange& data_range,
+      const HSIData& hsi_data,
+      const HSIWriteRangeOptions& options) const;
+
   // Returns the HSIData struct containing any data loaded in from ReadData().
+  // The reference stays valid for the lifetime of the reader and refers to the
+  // data of the latest read, as long as no views from GetDataView() are alive
+  // when the next read starts. Otherwise that read loads into a new buffer, so
+  // GetData() must be called again after it; the old reference refers to the
+  // data of the views and is only valid for as long as they are.
   const HSIData& GetData() const {
-    return hsi_data_;
+    return *hsi_data_;
+  }
+
+  // Returns a view of the data that shares it without copying. The view stays
+  // valid after later reads, which load into a new buffer while the data is
+  // still shared (see GetData()). Kernels that take HSIData can be given the
+  // data of a whole view with HSIDataView::GetUnderlyingData().
+  HSIDataView GetDataView() const;
+
+  // Returns the options describing the data file.
+  const HSIDataOptions& GetOptions() const {
+    return data_options_;
   }
 
  private:
+  // Reads the given range from the data file into hsi_data exactly as it is
+  // stored in the file (except for the byte order), without any conversion.
+  void ReadDataFromFile(
+      const HSIDataRange& data_range, HSIData* hsi_data) const;
+
+  // Reads the given range into hsi_data_ in chunks, converting each chunk to
+  // the in-memory format as it is read. The interleave format must not
+  // change.
+  void ReadAndConvertDataInChunks(const HSIDataRange& data_range);
+
+  // Reads the given range of packed data into hsi_data_, unpacking the
+  // samples directly to floats. The interleave format must not change.
+  void ReadPackedDataAsFloats(const HSIDataRange& data_range);
+
+  // Reads the runs as the public ReadValueRuns() does. If unpack_to_floats is
+  // true, the data must be packed, and its samples are unpacked to floats.
+  void ReadValueRuns(
+      const std::vector<HSIValueRun>& runs,
+      const long max_gap_bytes,
+      const bool unpack_to_floats,
+      char* destination) const;
+
+  // Gives hsi_data_ a new buffer if it is shared with any views, so that they
+  // are not changed by the next read.
+  void UnshareData();
+
   // Contains options and information about the data file which is necessary
   // for the ReadData() method to correctly read in the HSI data.
   const HSIDataOptions data_options_;
@@ -222,7 +672,7 @@ class HSIDataReader {
   bool machine_big_endian_;
 
   // The data struct will get filled in in the ReadData() method.
-  HSIData hsi_data_;
+  std::shared_ptr<HSIData> hsi_data_;
 };
 
 }  // namespace hsi
@@ -0,0 +1,203 @@
+#include "./hsi_data_view.h"
+
+#include <complex>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace hsi {
+
+HSIDataView::HSIDataView(const HSIData& hsi_data)
+    // The aliasing constructor with an empty owner gives a pointer that does
+    // not own the data.
+    : HSIDataView(std::shared_ptr<const HSIData>(
+          std::shared_ptr<const HSIData>(), &hsi_data)) {}
+
+HSIDataView::HSIDataView(std::shared_ptr<const HSIData> hsi_data)
+    : hsi_data_(hsi_data),
+      num_rows_(hsi_data->num_rows),
+      num_cols_(hsi_data->num_cols),
+      num_bands_(hsi_data->num_bands),
+      offset_(0) {
+
+  GetInterleaveStrides(
+      hsi_data->interleave_format,
+      num_rows_,
+      num_cols_,
+      num_bands_,
+      &row_stride_,
+      &col_stride_,
+      &band_stride_);
+}
+
+HSIDataView HSIDataView::Crop(const HSIDataRange& data_range) const {
+  if (data_range.start_row < 0 || data_range.end_row > num_rows_ ||
+      data_range.start_row > data_range.end_row ||
+      data_range.start_col < 0 || data_range.end_col > num_cols_ ||
+      data_range.start_col > data_range.end_col ||
+      data_range.start_band < 0 || data_range.end_band > num_bands_ ||
+      data_range.start_band > data_range.end_band) {
+    FatalError("Crop range is outside of the view.");
+  }
+  HSIDataView view = *this;
+  view.num_rows_ = data_range.end_row - data_range.start_row;
+  view.num_cols_ = data_range.end_col - data_range.start_col;
+  view.num_bands_ = data_range.end_band - data_range.start_band;
+  view.offset_ += data_range.start_row * row_stride_ +
+      data_range.start_col * col_stride_ +
+      data_range.start_band * band_stride_;
+  return view;
+}
+
+HSIDataView HSIDataView::Subsample(
+    const int row_step, const int col_step, const int band_step) const {
+
+  if (row_step <= 0 || col_step <= 0 || band_step <= 0) {
+    FatalError("Subsample steps must be positive.");
+  }
+  HSIDataView view = *this;
+  view.num_rows_ = (num_rows_ + row_step - 1) / row_step;
+  view.num_cols_ = (num_cols_ + col_step - 1) / col_step;
+  view.num_bands_ = (num_bands_ + band_step - 1) / band_step;
+  view.row_stride_ *= row_step;
+  view.col_stride_ *= col_step;
+  view.band_stride_ *= band_step;
+  return view;
+}
+
+HSIDataValue HSIDataView::GetValue(
+    const int row, const int col, const int band) const {
+
+  if (row < 0 || row >= num_rows_ || col < 0 || col >= num_cols_ ||
+      band < 0 || band >= num_bands_) {
+    Error("Index out of range of the view: (" + std::to_string(row) + ", " +
+          std::to_string(col) + ", " + std::to_string(band) + ")");
+    return HSIDataValue();
+  }
+  HSIDataValue value;
+  std::memcpy(
+      value.bytes,
+      GetValueBytes(row, col, band),
+      GetDataSize(hsi_data_->data_type));
+  return value;
+}
+
+double HSIDataView::GetValueAsDouble(
+    const int row, const int col, const int band) const {
+
+  return hsi::GetValueAsDouble(
+      GetValue(row, col, band), hsi_data_->data_type);
+}
+
+std::complex<double> HSIDataView::GetValueAsComplex(
+    const int row, const int col, const int band) const {
+
+  return hsi::GetValueAsComplex(
+      GetValue(row, col, band), hsi_data_->data_type);
+}
+
+std::vector<HSIDataValue> HSIDataView::GetSpectrum(
+    const int row, const int col) const {
+
+  std::vector<HSIDataValue> spectrum;
+  spectrum.reserve(num_bands_);
+  for (int band = 0; band < num_bands_; ++band) {
+    spectrum.push_back(GetValue(row, col, band));
+  }
+  return spectrum;
+}
+
+std::vector<double> HSIDataView::GetSpectrumAsDoubles(
+    const int row, const int col) const {
+
+  std::vector<double> spectrum;
+  spectrum.reserve(num_bands_);
+  for (int band = 0; band < num_bands_; ++band) {
+    spectrum.push_back(GetValueAsDouble(row, col, band));
+  }
+  return spectrum;
+}
+
+bool HSIDataView::IsWholeData() const {
+  // Subsampling with steps > 1 always leaves fewer rows, columns, or bands
+  // than the data has, unless there is only one, in which case the stride
+  // makes no difference.
+  return offset_ == 0 &&
+      num_rows_ == hsi_data_->num_rows &&
+      num_cols_ == hsi_data_->num_cols &&
+      num_bands_ == hsi_data_->num_bands;
+}
+
+const HSIData& HSIDataView::GetCompactData(HSIData* materialized_data) const {
+  if (IsWholeData()) {
+    return *hsi_data_;
+  }
+  *materialized_data = Materialize();
+  return *materialized_data;
+}
+
+HSIData HSIDataView::Materialize() const {
+  HSIData hsi_data;
+  hsi_data.num_rows = num_rows_;
+  hsi_data.num_cols = num_cols_;
+  hsi_data.num_bands = num_bands_;
+  hsi_data.interleave_format = hsi_data_->interleave_format;
+  hsi_data.data_type = hsi_data_->data_type;
+  const int data_size = GetDataSize(hsi_data.data_type);
+  hsi_data.raw_data.resize(static_cast<long>(NumDataPoints()) * data_size);
+  if (hsi_data.raw_data.empty()) {
+    return hsi_data;
+  }
+
+  // Order the dimensions from slowest to fastest changing in the interleave
+  // format, so the values are copied in memory order. Spans that are
+  // contiguous in the underlying data are copied at once.
+  int sizes[3];
+  long strides[3];
+  if (hsi_data.interleave_format == HSI_INTERLEAVE_BSQ) {
+    sizes[0] = num_bands_;
+    strides[0] = band_stride_;
+    sizes[1] = num_rows_;
+    strides[1] = row_stride_;
+    sizes[2] = num_cols_;
+    strides[2] = col_stride_;
+  } else if (hsi_data.interleave_format == HSI_INTERLEAVE_BIL) {
+    sizes[0] = num_rows_;
+    strides[0] = row_stride_;
+    sizes[1] = num_bands_;
+    strides[1] = band_stride_;
+    sizes[2] = num_cols_;
+    strides[2] = col_stride_;
+  } else {
+    sizes[0] = num_rows_;
+    strides[0] = row_stride_;
+    sizes[1] = num_cols_;
+    strides[1] = col_stride_;
+    sizes[2] = num_bands_;
+    strides[2] = band_stride_;
+  }
+  const char* source = hsi_data_->raw_data.data();
+  char* destination = hsi_data.raw_data.data();
+  const long span_bytes = static_cast<long>(sizes[2]) * data_size;
+  for (int i = 0; i < sizes[0]; ++i) {
+    for (int j = 0; j < sizes[1]; ++j) {
+      const long index = offset_ + i * strides[0] + j * strides[1];
+      if (strides[2] == 1) {
+        std::memcpy(destination, source + index * data_size, span_bytes);
+        destination += span_bytes;
+        continue;
+      }
+      for (int k = 0; k < sizes[2]; ++k) {
+        std::memcpy(
+            destination,
+            source + (index + k * strides[2]) * data_size,
+            data_size);
+        destination += data_size;
+      }
+    }
+  }
+  return hsi_data;
+}
+
+}  // namespace hsi
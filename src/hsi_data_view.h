@@ -0,0 +1,127 @@
+// Provides HSIDataView, a lightweight view of a sub-cube of HSIData. A view
+// refers to the values of the data it was created from instead of copying
+// them, so cropping and subsampling a view takes constant time regardless of
+// its size. Views have the same accessors as HSIData, and Materialize()
+// copies the values of a view into compact HSIData when needed.
+//
+// A view created from HSIDataReader::GetDataView() or from a shared_ptr
+// shares ownership of the data (it is reference counted), so it remains valid
+// for as long as the view exists. A view created directly from an HSIData
+// reference does not, and the data must outlive the view. This allows HSIData
+// to be passed anywhere a view is accepted.
+
+#ifndef SRC_HSI_DATA_VIEW_H_
+#define SRC_HSI_DATA_VIEW_H_
+
+#include <complex>
+#include <memory>
+#include <vector>
+
+#include "./hsi_data_reader.h"
+
+namespace hsi {
+
+class HSIDataView {
+ public:
+  // A view of all of the data, which must outlive the view.
+  HSIDataView(const HSIData& hsi_data);  // NOLINT(runtime/explicit)
+
+  // A view of all of the data that shares ownership of it.
+  explicit HSIDataView(std::shared_ptr<const HSIData> hsi_data);
+
+  // Returns a view of the given range of this view. Indices are relative to
+  // this view, and the range must be within it.
+  HSIDataView Crop(const HSIDataRange& data_range) const;
+
+  // Returns a view of every row_step-th row, col_step-th column, and
+  // band_step-th band of this view, starting with the first. Steps must be
+  // positive.
+  HSIDataView Subsample(
+      const int row_step, const int col_step, const int band_step) const;
+
+  int num_rows() const {
+    return num_rows_;
+  }
+  int num_cols() const {
+    return num_cols_;
+  }
+  int num_bands() const {
+    return num_bands_;
+  }
+  int NumDataPoints() const {
+    return num_rows_ * num_cols_ * num_bands_;
+  }
+  HSIDataType data_type() const {
+    return hsi_data_->data_type;
+  }
+  HSIDataInterleaveFormat interleave_format() const {
+    return hsi_data_->interleave_format;
+  }
+
+  // Accessors with the same behavior as in HSIData, with indices relative to
+  // this view.
+  HSIDataValue GetValue(const int row, const int col, const int band) const;
+  double GetValueAsDouble(const int row, const int col, const int band) const;
+  std::complex<double> GetValueAsComplex(
+      const int row, const int col, const int band) const;
+  std::vector<HSIDataValue> GetSpectrum(const int row, const int col) const;
+  std::vector<double> GetSpectrumAsDoubles(const int row, const int col) const;
+
+  // Returns a pointer to the bytes of the given value. Indices are not
+  // checked.
+  const char* GetValueBytes(
+      const int row, const int col, const int band) const {
+    return hsi_data_->raw_data.data() +
+        (offset_ + row * row_stride_ + col * col_stride_ +
+         band * band_stride_) * GetDataSize(hsi_data_->data_type);
+  }
+
+  // The offsets (in number of values) between two consecutive rows, columns,
+  // and bands of the view in the underlying data.
+  long row_stride() const {
+    return row_stride_;
+  }
+  long col_stride() const {
+    return col_stride_;
+  }
+  long band_stride() const {
+    return band_stride_;
+  }
+
+  // Returns true if the view covers all of the underlying data, so that
+  // GetUnderlyingData() can be used without materializing the view.
+  bool IsWholeData() const;
+
+  // Returns the data that the view refers to.
+  const HSIData& GetUnderlyingData() const {
+    return *hsi_data_;
+  }
+
+  // Returns a copy of the values in the view as compact HSIData with the same
+  // data type and interleave format.
+  HSIData Materialize() const;
+
+  // Returns the values of the view as compact HSIData: the underlying data if
+  // the view covers all of it, and otherwise the view materialized into
+  // materialized_data. Kernels that work on compact data use this to accept
+  // views, copying only views of part of the data.
+  const HSIData& GetCompactData(HSIData* materialized_data) const;
+
+ private:
+  std::shared_ptr<const HSIData> hsi_data_;
+
+  int num_rows_;
+  int num_cols_;
+  int num_bands_;
+
+  // The index of the first value of the view, and the strides between values,
+  // in number of values in the underlying data.
+  long offset_;
+  long row_stride_;
+  long col_stride_;
+  long band_stride_;
+};
+
+}  // namespace hsi
+
+#endif  // SRC_HSI_DATA_VIEW_H_
@@ -0,0 +1,352 @@
+#include "./hsi_destriping.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <vector>
+
+#include "./hsi_data_view.h"
+#include "./hsi_parallel.h"
+
+namespace hsi {
+namespace {
+
+// Adds the length values, minus their shifts, to sums and their squares to
+// squared_sums.
+void AccumulateValues(
+    const float* values,
+    const float* shifts,
+    const long length,
+    double* sums,
+    double* squared_sums) {
+
+  long i = 0;
+#ifdef __AVX2__
+  for (; i + 8 <= length; i += 8) {
+    const __m256 x = _mm256_sub_ps(
+        _mm256_loadu_ps(values + i), _mm256_loadu_ps(shifts + i));
+    const __m256d low = _mm256_cvtps_pd(_mm256_castps256_ps128(x));
+    const __m256d high = _mm256_cvtps_pd(_mm256_extractf128_ps(x, 1));
+    _mm256_storeu_pd(
+        sums + i, _mm256_add_pd(_mm256_loadu_pd(sums + i), low));
+    _mm256_storeu_pd(
+        sums + i + 4, _mm256_add_pd(_mm256_loadu_pd(sums + i + 4), high));
+#ifdef __FMA__
+    _mm256_storeu_pd(
+        squared_sums + i,
+        _mm256_fmadd_pd(low, low, _mm256_loadu_pd(squared_sums + i)));
+    _mm256_storeu_pd(
+        squared_sums + i + 4,
+        _mm256_fmadd_pd(high, high, _mm256_loadu_pd(squared_sums + i + 4)));
+#else
+    _mm256_storeu_pd(
+        squared_sums + i,
+        _mm256_add_pd(
+            _mm256_loadu_pd(squared_sums + i), _mm256_mul_pd(low, low)));
+    _mm256_storeu_pd(
+        squared_sums + i + 4,
+        _mm256_add_pd(
+            _mm256_loadu_pd(squared_sums + i + 4), _mm256_mul_pd(high, high)));
+#endif
+  }
+#endif
+  for (; i < length; ++i) {
+    const double x = values[i] - shifts[i];
+    sums[i] += x;
+    squared_sums[i] += x * x;
+  }
+}
+
+// Computes values[i] = gains[i] * values[i] + offsets[i] for length values.
+void ApplyCorrection(
+    const float* gains,
+    const float* offsets,
+    const long length,
+    float* values) {
+
+  long i = 0;
+#ifdef __AVX2__
+  for (; i + 8 <= length; i += 8) {
+#ifdef __FMA__
+    const __m256 corrected = _mm256_fmadd_ps(
+        _mm256_loadu_ps(gains + i),
+        _mm256_loadu_ps(values + i),
+        _mm256_loadu_ps(offsets + i));
+#else
+    const __m256 corrected = _mm256_add_ps(
+        _mm256_mul_ps(
+            _mm256_loadu_ps(gains + i), _mm256_loadu_ps(values + i)),
+        _mm256_loadu_ps(offsets + i));
+#endif
+    _mm256_storeu_ps(values + i, corrected);
+  }
+#endif
+  for (; i < length; ++i) {
+    values[i] = gains[i] * values[i] + offsets[i];
+  }
+}
+
+// Returns the sum of values[i] for i in [begin - half_width, begin +
+// half_width], clipped to the values, for each begin.
+std::vector<double> GetWindowSums(
+    const double* values, const int num_values, const int half_width) {
+  std::vector<double> prefix_sums(num_values + 1, 0);
+  for (int i = 0; i < num_values; ++i) {
+    prefix_sums[i + 1] = prefix_sums[i] + values[i];
+  }
+  std::vector<double> window_sums(num_values);
+  for (int i = 0; i < num_values; ++i) {
+    window_sums[i] = prefix_sums[std::min(num_values, i + half_width + 1)] -
+        prefix_sums[std::max(0, i - half_width)];
+  }
+  return window_sums;
+}
+
+// Returns the data as float values, converting if needed. BIP data is
+// reordered to BIL, whose rows of each band match the column sums.
+HSIData GetFloatLines(const HSIData& lines, const bool allow_bip) {
+  const HSIDataInterleaveFormat interleave_format =
+      (lines.interleave_format == HSI_INTERLEAVE_BIP && !allow_bip) ?
+      HSI_INTERLEAVE_BIL : lines.interleave_format;
+  return ConvertData(lines, HSI_DATA_TYPE_FLOAT, interleave_format);
+}
+
+}  // namespace
+
+HSIDestriper::HSIDestriper(
+    const int num_cols,
+    const int num_bands,
+    const HSIDestripingOptions& options)
+    : options_(options),
+      num_cols_(num_cols),
+      num_bands_(num_bands) {
+
+  if (num_cols <= 0 || num_bands <= 0) {
+    FatalError("Destriping requires at least one column and band.");
+  }
+  const long num_values = static_cast<long>(num_cols) * num_bands;
+  shifts_.resize(num_values, 0);
+  sums_.resize(num_values, 0);
+  squared_sums_.resize(num_values, 0);
+}
+
+void HSIDestriper::CheckSize(const HSIData& lines) const {
+  if (lines.num_cols != num_cols_ || lines.num_bands != num_bands_) {
+    FatalError("The lines must have the columns and bands of the destriper.");
+  }
+}
+
+void HSIDestriper::AddLines(const HSIDataView& lines_view) {
+  HSIData materialized_lines;
+  const HSIData& lines = lines_view.GetCompactData(&materialized_lines);
+  CheckSize(lines);
+  if (lines.num_rows == 0) {
+    return;
+  }
+  const bool is_float_rows =
+      lines.data_type == HSI_DATA_TYPE_FLOAT &&
+      lines.interleave_format != HSI_INTERLEAVE_BIP;
+  HSIData converted_lines;
+  if (!is_float_rows) {
+    converted_lines = GetFloatLines(lines, false);
+  }
+  const HSIData& float_lines = is_float_rows ? lines : converted_lines;
+  const float* values =
+      reinterpret_cast<const float*>(float_lines.raw_data.data());
+  const bool is_bsq = (float_lines.interleave_format == HSI_INTERLEAVE_BSQ);
+
+  // The row of each band and line is contiguous, and each band's sums are
+  // updated by one thread.
+  const int num_rows = float_lines.num_rows;
+  const bool is_first_line = (num_lines_ == 0);
+  ParallelFor(
+      0, num_bands_, options_.num_threads, 1,
+      [&](const long begin, const long end) {
+        for (long band = begin; band < end; ++band) {
+          const long offset = band * num_cols_;
+          for (int row = 0; row < num_rows; ++row) {
+            const float* row_values = values + num_cols_ * (is_bsq ?
+                band * num_rows + row :
+                static_cast<long>(row) * num_bands_ + band);
+            if (is_first_line && row == 0) {
+              std::copy(
+                  row_values, row_values + num_cols_, &shifts_[offset]);
+            }
+            AccumulateValues(
+                row_values,
+                &shifts_[offset],
+                num_cols_,
+                &sums_[offset],
+                &squared_sums_[offset]);
+          }
+        }
+      });
+  num_lines_ += num_rows;
+}
+
+void HSIDestriper::ReadColumnStats(
+    const HSIDataRange& data_range, HSIDataReader* reader) {
+
+  ForEachTileOfLines(
+      data_range,
+      reader,
+      [this](const HSIData& lines, const int) {
+        AddLines(lines);
+      });
+}
+
+void HSIDestriper::ForEachTileOfLines(
+    const HSIDataRange& data_range,
+    HSIDataReader* reader,
+    const std::function<void(const HSIData&, const int)>& function) const {
+
+  const HSIDataOptions& data_options = reader->GetOptions();
+  if (data_options.interleave_format != HSI_INTERLEAVE_BSQ) {
+    ForEachPrefetchedTile(
+        data_range,
+        options_.tile_rows,
+        reader,
+        [&function](const HSIDataView& tile_view, const int start_row) {
+          function(tile_view.GetUnderlyingData(), start_row);
+        });
+    return;
+  }
+
+  // The rows and columns of the range are lines and samples. Each tile reads
+  // the whole data rows that hold its lines.
+  const int tile_lines = std::max(1, options_.tile_rows);
+  std::vector<HSIDataRange> tile_line_ranges;
+  std::vector<std::vector<HSIDataRange>> tile_ranges;
+  for (int line = data_range.start_row; line < data_range.end_row;
+       line += tile_lines) {
+    HSIDataRange tile_line_range = data_range;
+    tile_line_range.start_row = line;
+    tile_line_range.end_row = std::min(line + tile_lines, data_range.end_row);
+    tile_line_ranges.push_back(tile_line_range);
+    tile_ranges.push_back(std::vector<HSIDataRange>(
+        1, GetBSQImageDataRange(data_options, tile_line_range)));
+  }
+  ForEachPrefetchedTile(
+      tile_ranges,
+      {reader},
+      [&](const std::vector<HSIDataView>& tile_views, const int tile) {
+        function(
+            GetBSQImageRange(
+                data_options,
+                tile_line_ranges[tile],
+                tile_views[0].GetUnderlyingData(),
+                HSI_INTERLEAVE_BIL),
+            tile_line_ranges[tile].start_row - data_range.start_row);
+      });
+}
+
+void HSIDestriper::ComputeCorrection() {
+  if (num_lines_ < 2) {
+    FatalError("Destriping requires the statistics of at least two lines.");
+  }
+  const long num_values = static_cast<long>(num_cols_) * num_bands_;
+  gains_.resize(num_values);
+  offsets_.resize(num_values);
+  const int half_width = (options_.reference_window_cols > 0) ?
+      options_.reference_window_cols / 2 : num_cols_;
+  std::vector<double> means(num_cols_);
+  std::vector<double> std_devs(num_cols_);
+  for (int band = 0; band < num_bands_; ++band) {
+    const long offset = static_cast<long>(band) * num_cols_;
+    for (int col = 0; col < num_cols_; ++col) {
+      const double shifted_mean = sums_[offset + col] / num_lines_;
+      means[col] = shifts_[offset + col] + shifted_mean;
+      std_devs[col] = std::sqrt(std::max(
+          0.0,
+          squared_sums_[offset + col] / num_lines_ -
+              shifted_mean * shifted_mean));
+    }
+
+    // The reference statistics are the averages over the window around each
+    // column.
+    const std::vector<double> mean_sums =
+        GetWindowSums(means.data(), num_cols_, half_width);
+    const std::vector<double> std_dev_sums =
+        GetWindowSums(std_devs.data(), num_cols_, half_width);
+    const std::vector<double> ones(num_cols_, 1.0);
+    const std::vector<double> window_sizes =
+        GetWindowSums(ones.data(), num_cols_, half_width);
+    for (int col = 0; col < num_cols_; ++col) {
+      const double reference_mean = mean_sums[col] / window_sizes[col];
+      const double reference_std_dev = std_dev_sums[col] / window_sizes[col];
+      const double gain = (options_.correct_gain && std_devs[col] > 0) ?
+          reference_std_dev / std_devs[col] : 1.0;
+      gains_[offset + col] = gain;
+      offsets_[offset + col] = reference_mean - gain * means[col];
+    }
+  }
+
+  transposed_gains_.resize(num_values);
+  transposed_offsets_.resize(num_values);
+  for (int band = 0; band < num_bands_; ++band) {
+    for (int col = 0; col < num_cols_; ++col) {
+      transposed_gains_[static_cast<long>(col) * num_bands_ + band] =
+          gain(band, col);
+      transposed_offsets_[static_cast<long>(col) * num_bands_ + band] =
+          offset(band, col);
+    }
+  }
+}
+
+void HSIDestriper::CorrectLines(HSIData* lines) const {
+  CheckSize(*lines);
+  if (gains_.empty()) {
+    FatalError("ComputeCorrection() must be called before correcting lines.");
+  }
+  if (lines->data_type != HSI_DATA_TYPE_FLOAT) {
+    *lines = GetFloatLines(*lines, true);
+  }
+  float* values = reinterpret_cast<float*>(lines->raw_data.data());
+
+  // BSQ and BIL data are corrected one row of a band at a time, and BIP data
+  // one line at a time with the transposed correction.
+  const int num_rows = lines->num_rows;
+  const HSIDataInterleaveFormat interleave_format = lines->interleave_format;
+  const long num_segments = (interleave_format == HSI_INTERLEAVE_BIP) ?
+      num_rows : static_cast<long>(num_rows) * num_bands_;
+  const long segment_length = (interleave_format == HSI_INTERLEAVE_BIP) ?
+      static_cast<long>(num_cols_) * num_bands_ : num_cols_;
+  ParallelFor(
+      0, num_segments, options_.num_threads, 1,
+      [&](const long begin, const long end) {
+        for (long segment = begin; segment < end; ++segment) {
+          const float* gains = transposed_gains_.data();
+          const float* offsets = transposed_offsets_.data();
+          if (interleave_format != HSI_INTERLEAVE_BIP) {
+            const long band = (interleave_format == HSI_INTERLEAVE_BSQ) ?
+                segment / num_rows : segment % num_bands_;
+            gains = &gains_[band * num_cols_];
+            offsets = &offsets_[band * num_cols_];
+          }
+          ApplyCorrection(
+              gains, offsets, segment_length,
+              values + segment * segment_length);
+        }
+      });
+}
+
+void HSIDestriper::ReadDestripedLines(
+    const HSIDataRange& data_range,
+    HSIDataReader* reader,
+    const DestripedLinesCallback& callback) const {
+
+  ForEachTileOfLines(
+      data_range,
+      reader,
+      [&](const HSIData& tile_lines, const int start_row) {
+        HSIData lines = tile_lines;
+        CorrectLines(&lines);
+        callback(lines, start_row);
+      });
+}
+
+}  // namespace hsi
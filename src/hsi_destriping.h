@@ -0,0 +1,137 @@
+// Provides destriping of pushbroom data. Each column of a pushbroom image is
+// seen by one detector element, whose small differences in gain and offset
+// show up as stripes along the flight line.
+//
+// Destriping takes two passes over the lines. The first pass accumulates the
+// mean and variance of every column of every band, which takes constant
+// memory however long the flight line is. The correction then maps the
+// statistics of each column to those of a reference (the average of the
+// columns around it), and the second pass applies the resulting gain and
+// offset to each line. Both passes run on tiles of lines, so lines can be
+// streamed from a file (BIL files are read and corrected as contiguous rows)
+// or from a sensor.
+//
+// Lines are the rows of the data, whose columns are the detector elements.
+// The data rows of BSQ files are not image lines (see
+// HSIDataOptions::GetPixelPosition()), so the reading functions reshape their
+// tiles into lines of samples, and destripers for BSQ files are created with
+// the number of samples (HSIDataOptions::GetNumSamples()) as the columns.
+
+#ifndef SRC_HSI_DESTRIPING_H_
+#define SRC_HSI_DESTRIPING_H_
+
+#include <functional>
+#include <vector>
+
+#include "./hsi_data_reader.h"
+#include "./hsi_data_view.h"
+
+namespace hsi {
+
+struct HSIDestripingOptions {
+  // If true, the gain of each column is corrected to match the reference
+  // standard deviation. Otherwise only the offset is corrected, matching the
+  // reference mean.
+  bool correct_gain = true;
+
+  // The number of columns averaged for the reference statistics of each
+  // column. Zero means all columns, so that every column is corrected to the
+  // same statistics; a window keeps cross-track brightness changes (e.g. from
+  // the view angle) that are wider than the window.
+  int reference_window_cols = 0;
+
+  // The number of threads. Zero means one for each hardware thread.
+  int num_threads = 0;
+
+  // The number of lines read at a time by ReadColumnStats() and
+  // ReadDestripedLines().
+  int tile_rows = 64;
+};
+
+// Called by HSIDestriper::ReadDestripedLines() with the corrected lines of
+// each tile, starting at the given row of the range.
+typedef std::function<void(const HSIData& destriped_lines, const int start_row)>
+    DestripedLinesCallback;
+
+class HSIDestriper {
+ public:
+  // Destripes lines with the given number of columns and bands.
+  HSIDestriper(
+      const int num_cols,
+      const int num_bands,
+      const HSIDestripingOptions& options);
+
+  // First pass: adds the lines (rows) of the view (or of HSIData) to the
+  // column statistics. The data can have any data type and interleave format.
+  void AddLines(const HSIDataView& lines_view);
+
+  // Adds the lines of the given range to the column statistics, reading one
+  // tile of lines at a time while the previous tile is added. For BSQ files,
+  // the rows and columns of the range are image lines and samples.
+  void ReadColumnStats(const HSIDataRange& data_range, HSIDataReader* reader);
+
+  // Computes the gains and offsets from the lines added so far. This must be
+  // called between the two passes.
+  void ComputeCorrection();
+
+  long num_lines() const {
+    return num_lines_;
+  }
+
+  // The correction of each column: corrected = gain * value + offset.
+  float gain(const int band, const int col) const {
+    return gains_[static_cast<long>(band) * num_cols_ + col];
+  }
+  float offset(const int band, const int col) const {
+    return offsets_[static_cast<long>(band) * num_cols_ + col];
+  }
+
+  // Second pass: corrects the lines in place. The lines keep their interleave
+  // format and are converted to float data first if needed.
+  void CorrectLines(HSIData* lines) const;
+
+  // Reads the lines of the given range one tile at a time, and returns the
+  // corrected lines of each tile to the callback. For BSQ files, the rows and
+  // columns of the range are image lines and samples, and the corrected lines
+  // are float BIL data.
+  void ReadDestripedLines(
+      const HSIDataRange& data_range,
+      HSIDataReader* reader,
+      const DestripedLinesCallback& callback) const;
+
+ private:
+  // Checks that the data has the columns and bands of the destriper.
+  void CheckSize(const HSIData& lines) const;
+
+  // Calls function(lines, start_line) for each tile of lines of the range,
+  // reading the next tile while the function runs. Tiles of BSQ files are
+  // reshaped into float BIL lines of samples.
+  void ForEachTileOfLines(
+      const HSIDataRange& data_range,
+      HSIDataReader* reader,
+      const std::function<void(const HSIData&, const int)>& function) const;
+
+  const HSIDestripingOptions options_;
+  const int num_cols_;
+  const int num_bands_;
+
+  // The sums of the values and squared values of each column of each band,
+  // at index band * num_cols + col, offset by the first line's values (which
+  // keeps the variance accurate for values far from zero).
+  long num_lines_ = 0;
+  std::vector<float> shifts_;
+  std::vector<double> sums_;
+  std::vector<double> squared_sums_;
+
+  // The correction, with one value for each column of each band at index
+  // band * num_cols + col, and transposed (col * num_bands + band) for BIP
+  // lines.
+  std::vector<float> gains_;
+  std::vector<float> offsets_;
+  std::vector<float> transposed_gains_;
+  std::vector<float> transposed_offsets_;
+};
+
+}  // namespace hsi
+
+#endif  // SRC_HSI_DESTRIPING_H_
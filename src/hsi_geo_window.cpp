@@ -0,0 +1,74 @@
+#include "./hsi_geo_window.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace hsi {
+
+std::vector<HSIRowSpan> GetGeoWindowSpans(
+    const HSIDataOptions& data_options,
+    const double min_x,
+    const double min_y,
+    const double max_x,
+    const double max_y) {
+
+  const HSIMapInfo& map_info = data_options.map_info;
+  if (!map_info.IsValid()) {
+    FatalError("The data has no map info.");
+  }
+  // The corners of the rectangle, in order around it, in pixel coordinates
+  // of the image (with lines as rows and samples as columns).
+  const double corner_xs[] = {min_x, max_x, max_x, min_x};
+  const double corner_ys[] = {min_y, min_y, max_y, max_y};
+  std::vector<HSIPolygonVertex> polygon(4);
+  for (int i = 0; i < 4; ++i) {
+    map_info.MapToPixel(
+        corner_xs[i], corner_ys[i], &polygon[i].col, &polygon[i].row);
+  }
+  return GetDataSpans(
+      data_options,
+      RasterizePolygon(
+          polygon, data_options.GetNumLines(), data_options.GetNumSamples()));
+}
+
+bool GetGeoWindowRange(
+    const HSIDataOptions& data_options,
+    const double min_x,
+    const double min_y,
+    const double max_x,
+    const double max_y,
+    HSIDataRange* data_range) {
+
+  const std::vector<HSIRowSpan> spans =
+      GetGeoWindowSpans(data_options, min_x, min_y, max_x, max_y);
+  if (spans.empty()) {
+    return false;
+  }
+  data_range->start_row = spans.front().row;
+  data_range->end_row = spans.back().row + 1;
+  data_range->start_col = spans.front().start_col;
+  data_range->end_col = spans.front().end_col;
+  for (const HSIRowSpan& span : spans) {
+    data_range->start_col = std::min(data_range->start_col, span.start_col);
+    data_range->end_col = std::max(data_range->end_col, span.end_col);
+  }
+  data_range->start_band = 0;
+  data_range->end_band = data_options.num_data_bands;
+  return true;
+}
+
+HSIROIData ReadGeoWindow(
+    const double min_x,
+    const double min_y,
+    const double max_x,
+    const double max_y,
+    const HSIROIReadOptions& options,
+    const HSIDataReader& reader) {
+
+  return ReadROI(
+      GetGeoWindowSpans(reader.GetOptions(), min_x, min_y, max_x, max_y),
+      options,
+      reader);
+}
+
+}  // namespace hsi
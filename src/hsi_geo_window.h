@@ -0,0 +1,49 @@
+// Provides reads of geographic windows: the pixels whose centers are inside a
+// rectangle in map coordinates, using the map info of the data options. If the
+// pixel grid is rotated relative to the map, the window covers a different
+// span of columns in each row, and only those spans are read.
+
+#ifndef SRC_HSI_GEO_WINDOW_H_
+#define SRC_HSI_GEO_WINDOW_H_
+
+#include <vector>
+
+#include "./hsi_data_reader.h"
+#include "./hsi_roi.h"
+
+namespace hsi {
+
+// Returns the spans of the pixels whose centers are inside the map rectangle
+// from (min_x, min_y) to (max_x, max_y). The options must have map info.
+std::vector<HSIRowSpan> GetGeoWindowSpans(
+    const HSIDataOptions& data_options,
+    const double min_x,
+    const double min_y,
+    const double max_x,
+    const double max_y);
+
+// Sets data_range to the smallest range (with all bands) that contains the
+// pixels of the map rectangle, so it can be read with ReadData(). Returns
+// false if there are no such pixels. Without rotation, the range contains
+// exactly the pixels of the rectangle (except for BSQ data, whose rows are not
+// lines of the image).
+bool GetGeoWindowRange(
+    const HSIDataOptions& data_options,
+    const double min_x,
+    const double min_y,
+    const double max_x,
+    const double max_y,
+    HSIDataRange* data_range);
+
+// Reads the pixels of the map rectangle (see hsi_roi.h).
+HSIROIData ReadGeoWindow(
+    const double min_x,
+    const double min_y,
+    const double max_x,
+    const double max_y,
+    const HSIROIReadOptions& options,
+    const HSIDataReader& reader);
+
+}  // namespace hsi
+
+#endif  // SRC_HSI_GEO_WINDOW_H_
@@ -0,0 +1,158 @@
+#include "./hsi_glt_ortho.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "./hsi_roi.h"
+
+namespace hsi {
+namespace {
+
+// Returns the raw pixel index (row * num_cols + col) of each cell of the GLT
+// tile, or -1 for cells without data.
+std::vector<long> GetSourcePixels(
+    const HSIData& glt_data,
+    const HSIDataOptions& raw_options,
+    const bool use_filled_cells) {
+
+  if (glt_data.num_bands != 2) {
+    FatalError("GLT data must have two bands.");
+  }
+  const HSIData glt_values =
+      ConvertData(glt_data, HSI_DATA_TYPE_INT32, HSI_INTERLEAVE_BIP);
+  const int32_t* cells =
+      reinterpret_cast<const int32_t*>(glt_values.raw_data.data());
+  const long num_cells =
+      static_cast<long>(glt_data.num_rows) * glt_data.num_cols;
+  std::vector<long> source_pixels(num_cells, -1);
+  for (long cell = 0; cell < num_cells; ++cell) {
+    int sample = cells[2 * cell];
+    int line = cells[2 * cell + 1];
+    if (sample == 0 || line == 0 ||
+        (!use_filled_cells && (sample < 0 || line < 0))) {
+      continue;
+    }
+    sample = std::abs(sample) - 1;
+    line = std::abs(line) - 1;
+    if (sample < raw_options.GetNumSamples() &&
+        line < raw_options.GetNumLines()) {
+      int row;
+      int col;
+      raw_options.GetPixelPosition(sample, line, &row, &col);
+      source_pixels[cell] =
+          static_cast<long>(row) * raw_options.num_data_cols + col;
+    }
+  }
+  return source_pixels;
+}
+
+}  // namespace
+
+void Orthorectify(
+    const HSIGLTOrthoOptions& options,
+    const HSIDataReader& raw_reader,
+    HSIDataReader* glt_reader,
+    const OrthoRowsCallback& callback) {
+
+  const HSIDataOptions& raw_options = raw_reader.GetOptions();
+  const HSIDataOptions& glt_options = glt_reader->GetOptions();
+  const int num_cols = glt_options.num_data_cols;
+  const int num_bands = raw_options.num_data_bands;
+  const int data_size = GetDataSize(raw_options.GetInMemoryDataType());
+  const int tile_rows = std::max(1, options.tile_rows);
+  HSIROIReadOptions roi_options;
+  roi_options.max_gap_bytes = options.max_gap_bytes;
+
+  HSIDataRange glt_range;
+  glt_range.start_col = 0;
+  glt_range.end_col = num_cols;
+  glt_range.start_band = 0;
+  glt_range.end_band = 2;
+  std::vector<std::pair<long, long>> sorted_cells;
+  for (int row = 0; row < glt_options.num_data_rows; row += tile_rows) {
+    glt_range.start_row = row;
+    glt_range.end_row = std::min(row + tile_rows, glt_options.num_data_rows);
+    glt_reader->ReadData(glt_range);
+    const std::vector<long> source_pixels = GetSourcePixels(
+        glt_reader->GetData(), raw_options, options.use_filled_cells);
+
+    // Sort the cells by raw pixel, and turn the distinct pixels into spans.
+    sorted_cells.clear();
+    for (size_t cell = 0; cell < source_pixels.size(); ++cell) {
+      if (source_pixels[cell] >= 0) {
+        sorted_cells.push_back(std::make_pair(source_pixels[cell], cell));
+      }
+    }
+    std::sort(sorted_cells.begin(), sorted_cells.end());
+    std::vector<HSIRowSpan> spans;
+    std::vector<long> cell_pixel_indices(source_pixels.size(), -1);
+    long num_pixels = 0;
+    for (size_t i = 0; i < sorted_cells.size(); ++i) {
+      const long source_pixel = sorted_cells[i].first;
+      if (i == 0 || source_pixel != sorted_cells[i - 1].first) {
+        const int source_row = source_pixel / raw_options.num_data_cols;
+        const int source_col = source_pixel % raw_options.num_data_cols;
+        if (spans.empty() || spans.back().row != source_row ||
+            spans.back().end_col != source_col) {
+          HSIRowSpan span;
+          span.row = source_row;
+          span.start_col = source_col;
+          span.end_col = source_col;
+          spans.push_back(span);
+        }
+        spans.back().end_col++;
+        num_pixels++;
+      }
+      cell_pixel_indices[sorted_cells[i].second] = num_pixels - 1;
+    }
+    const HSIROIData roi_data = ReadROI(spans, roi_options, raw_reader);
+
+    // Scatter the spectra into the output tile.
+    HSIData ortho_data;
+    ortho_data.num_rows = glt_range.end_row - glt_range.start_row;
+    ortho_data.num_cols = num_cols;
+    ortho_data.num_bands = num_bands;
+    ortho_data.interleave_format = raw_options.GetInMemoryInterleaveFormat();
+    ortho_data.data_type = raw_options.GetInMemoryDataType();
+    ortho_data.raw_data.assign(
+        static_cast<long>(ortho_data.NumDataPoints()) * data_size, 0);
+    long row_stride;
+    long col_stride;
+    long band_stride;
+    GetInterleaveStrides(
+        ortho_data.interleave_format,
+        ortho_data.num_rows,
+        ortho_data.num_cols,
+        num_bands,
+        &row_stride,
+        &col_stride,
+        &band_stride);
+    const long spectrum_bytes = static_cast<long>(num_bands) * data_size;
+    for (size_t cell = 0; cell < cell_pixel_indices.size(); ++cell) {
+      if (cell_pixel_indices[cell] < 0) {
+        continue;
+      }
+      const char* spectrum = roi_data.spectra.raw_data.data() +
+          cell_pixel_indices[cell] * spectrum_bytes;
+      char* destination = ortho_data.raw_data.data() +
+          ((cell / num_cols) * row_stride + (cell % num_cols) * col_stride) *
+              data_size;
+      if (band_stride == 1) {
+        std::memcpy(destination, spectrum, spectrum_bytes);
+        continue;
+      }
+      for (int band = 0; band < num_bands; ++band) {
+        std::memcpy(
+            destination + band * band_stride * data_size,
+            spectrum + band * data_size,
+            data_size);
+      }
+    }
+    callback(ortho_data, row);
+  }
+}
+
+}  // namespace hsi
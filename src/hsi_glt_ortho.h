@@ -0,0 +1,51 @@
+// Provides orthorectification with an ENVI geometric lookup table (GLT). A GLT
+// is a two-band integer raster on the output (map) grid, where band 0 is the
+// 1-based sample and band 1 the 1-based line of the raw data pixel for each
+// output cell. Zero means the cell has no data, and negative values mark
+// cells filled with the nearest raw pixel.
+//
+// The output is produced one tile of rows at a time. The raw pixels of a tile
+// are sorted into file order, deduplicated, and read as runs of contiguous
+// pixels (with small gaps read through), so the raw data is read mostly
+// sequentially instead of one random spectrum at a time.
+
+#ifndef SRC_HSI_GLT_ORTHO_H_
+#define SRC_HSI_GLT_ORTHO_H_
+
+#include <functional>
+
+#include "./hsi_data_reader.h"
+
+namespace hsi {
+
+struct HSIGLTOrthoOptions {
+  // The number of output rows produced at a time.
+  int tile_rows = 64;
+
+  // If false, cells with negative GLT values (filled with the nearest pixel)
+  // are left without data.
+  bool use_filled_cells = true;
+
+  // Raw pixels separated by at most this many bytes in the file are read with
+  // one read.
+  long max_gap_bytes = 64 * 1024;
+};
+
+// Called by Orthorectify() with the output rows of each tile, starting at the
+// given output row.
+typedef std::function<void(const HSIData& ortho_rows, const int start_row)>
+    OrthoRowsCallback;
+
+// Orthorectifies all bands of the raw data, reading the GLT from glt_reader
+// one tile of rows at a time. The output has the rows and columns of the GLT,
+// and the in-memory data type and interleave format of the raw reader's
+// options. Cells without data are zero.
+void Orthorectify(
+    const HSIGLTOrthoOptions& options,
+    const HSIDataReader& raw_reader,
+    HSIDataReader* glt_reader,
+    const OrthoRowsCallback& callback);
+
+}  // namespace hsi
+
+#endif  // SRC_HSI_GLT_ORTHO_H_
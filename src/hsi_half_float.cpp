@@ -0,0 +1,180 @@
+#include "./hsi_half_float.h"
+
+#if defined(__F16C__) || defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#include <cstring>
+
+namespace hsi {
+namespace {
+
+// Returns the bits of a float and vice versa.
+inline uint32_t FloatBits(const float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+inline float BitsToFloat(const uint32_t bits) {
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+}  // namespace
+
+float HalfToFloat(const uint16_t half) {
+  const uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+  const uint32_t exponent = (half >> 10) & 0x1F;
+  const uint32_t mantissa = half & 0x3FF;
+  if (exponent == 0) {
+    // Zero or subnormal: mantissa * 2^-24.
+    const float magnitude = static_cast<float>(mantissa) * 5.9604645e-8f;
+    return BitsToFloat(sign | FloatBits(magnitude));
+  }
+  if (exponent == 0x1F) {
+    // Infinity, or NaN (made quiet, as F16C does).
+    return BitsToFloat(sign | 0x7F800000 | (mantissa << 13) |
+                       ((mantissa != 0) ? 0x400000 : 0));
+  }
+  return BitsToFloat(sign | ((exponent + 112) << 23) | (mantissa << 13));
+}
+
+uint16_t FloatToHalf(const float value) {
+  const uint32_t bits = FloatBits(value);
+  const uint32_t sign = (bits >> 16) & 0x8000;
+  uint32_t magnitude = bits & 0x7FFFFFFF;
+  if (magnitude >= 0x7F800000) {
+    // Infinity, or NaN (kept quiet).
+    return sign | 0x7C00 |
+        ((magnitude > 0x7F800000) ? (0x200 | ((magnitude >> 13) & 0x3FF)) : 0);
+  }
+  if (magnitude >= 0x477FF000) {
+    // At least 65520, which rounds to infinity.
+    return sign | 0x7C00;
+  }
+  if (magnitude < 0x38800000) {
+    // Subnormal half. Adding 0.5 aligns the mantissa so that the float
+    // addition does the rounding to the half subnormal step of 2^-24.
+    const float shifted = BitsToFloat(magnitude) + 0.5f;
+    return sign | (FloatBits(shifted) - 0x3F000000);
+  }
+  // Normal half. Rebias the exponent from 127 to 15, and round the 13
+  // dropped mantissa bits to nearest even.
+  const uint32_t odd_mantissa = (magnitude >> 13) & 1;
+  magnitude += 0xC8000FFF + odd_mantissa;
+  return sign | (magnitude >> 13);
+}
+
+float BFloat16ToFloat(const uint16_t bfloat16) {
+  return BitsToFloat(static_cast<uint32_t>(bfloat16) << 16);
+}
+
+uint16_t FloatToBFloat16(const float value) {
+  const uint32_t bits = FloatBits(value);
+  if ((bits & 0x7FFFFFFF) > 0x7F800000) {
+    // NaN: truncate and keep it quiet.
+    return (bits >> 16) | 0x40;
+  }
+  return (bits + 0x7FFF + ((bits >> 16) & 1)) >> 16;
+}
+
+void ConvertHalfsToFloats(
+    const uint16_t* halfs, const long num_values, float* values) {
+  long i = 0;
+#if defined(__AVX512F__)
+  for (; i + 16 <= num_values; i += 16) {
+    _mm512_storeu_ps(
+        values + i,
+        _mm512_cvtph_ps(_mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(halfs + i))));
+  }
+#endif
+#if defined(__F16C__)
+  for (; i + 8 <= num_values; i += 8) {
+    _mm256_storeu_ps(
+        values + i,
+        _mm256_cvtph_ps(_mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(halfs + i))));
+  }
+#endif
+  for (; i < num_values; ++i) {
+    values[i] = HalfToFloat(halfs[i]);
+  }
+}
+
+void ConvertFloatsToHalfs(
+    const float* values, const long num_values, uint16_t* halfs) {
+  long i = 0;
+#if defined(__AVX512F__)
+  for (; i + 16 <= num_values; i += 16) {
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i*>(halfs + i),
+        _mm512_cvtps_ph(
+            _mm512_loadu_ps(values + i),
+            _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+  }
+#endif
+#if defined(__F16C__)
+  for (; i + 8 <= num_values; i += 8) {
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(halfs + i),
+        _mm256_cvtps_ph(
+            _mm256_loadu_ps(values + i), _MM_FROUND_TO_NEAREST_INT));
+  }
+#endif
+  for (; i < num_values; ++i) {
+    halfs[i] = FloatToHalf(values[i]);
+  }
+}
+
+void ConvertBFloat16sToFloats(
+    const uint16_t* bfloat16s, const long num_values, float* values) {
+  long i = 0;
+#if defined(__AVX2__)
+  for (; i + 8 <= num_values; i += 8) {
+    const __m256i widened = _mm256_cvtepu16_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(bfloat16s + i)));
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i*>(values + i),
+        _mm256_slli_epi32(widened, 16));
+  }
+#endif
+  for (; i < num_values; ++i) {
+    values[i] = BFloat16ToFloat(bfloat16s[i]);
+  }
+}
+
+void ConvertFloatsToBFloat16s(
+    const float* values, const long num_values, uint16_t* bfloat16s) {
+  long i = 0;
+#if defined(__AVX2__)
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256i rounding_bias = _mm256_set1_epi32(0x7FFF);
+  const __m256i quiet_bit = _mm256_set1_epi32(0x40);
+  for (; i + 8 <= num_values; i += 8) {
+    const __m256 value = _mm256_loadu_ps(values + i);
+    const __m256i bits = _mm256_castps_si256(value);
+    const __m256i odd = _mm256_and_si256(_mm256_srli_epi32(bits, 16), one);
+    const __m256i rounded = _mm256_srli_epi32(
+        _mm256_add_epi32(_mm256_add_epi32(bits, rounding_bias), odd), 16);
+    const __m256i quiet_nan =
+        _mm256_or_si256(_mm256_srli_epi32(bits, 16), quiet_bit);
+    const __m256i is_nan =
+        _mm256_castps_si256(_mm256_cmp_ps(value, value, _CMP_UNORD_Q));
+    const __m256i result = _mm256_blendv_epi8(rounded, quiet_nan, is_nan);
+    // Pack the 32-bit lanes to 16 bits. The pack works within 128-bit lanes,
+    // so the 64-bit blocks are put back in order afterwards.
+    const __m256i packed = _mm256_permute4x64_epi64(
+        _mm256_packus_epi32(result, result), _MM_SHUFFLE(3, 1, 2, 0));
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(bfloat16s + i),
+        _mm256_castsi256_si128(packed));
+  }
+#endif
+  for (; i < num_values; ++i) {
+    bfloat16s[i] = FloatToBFloat16(values[i]);
+  }
+}
+
+}  // namespace hsi
@@ -0,0 +1,42 @@
+// Provides conversions between 32-bit floats and the 16-bit floating point
+// formats used to store HSI data at half the memory footprint:
+//
+//   half (IEEE 754 binary16): 1 sign, 5 exponent and 10 mantissa bits. About
+//   3 significant decimal digits over a range of +/-65504.
+//
+//   bfloat16: 1 sign, 8 exponent and 7 mantissa bits. The same range as a
+//   32-bit float, with about 2 significant decimal digits.
+//
+// 16-bit values are passed around as their raw bits (uint16_t). Narrowing
+// conversions round to the nearest value (ties to even), and NaNs convert to
+// quiet NaNs in both directions (except that bfloat16s widen exactly, since
+// they are the upper bits of a float). The array versions use F16C or AVX-512
+// instructions when the code is compiled for them, and portable scalar code
+// otherwise.
+
+#ifndef SRC_HSI_HALF_FLOAT_H_
+#define SRC_HSI_HALF_FLOAT_H_
+
+#include <cstdint>
+
+namespace hsi {
+
+// Single value conversions.
+float HalfToFloat(const uint16_t half);
+uint16_t FloatToHalf(const float value);
+float BFloat16ToFloat(const uint16_t bfloat16);
+uint16_t FloatToBFloat16(const float value);
+
+// Array conversions of num_values values.
+void ConvertHalfsToFloats(
+    const uint16_t* halfs, const long num_values, float* values);
+void ConvertFloatsToHalfs(
+    const float* values, const long num_values, uint16_t* halfs);
+void ConvertBFloat16sToFloats(
+    const uint16_t* bfloat16s, const long num_values, float* values);
+void ConvertFloatsToBFloat16s(
+    const float* values, const long num_values, uint16_t* bfloat16s);
+
+}  // namespace hsi
+
+#endif  // SRC_HSI_HALF_FLOAT_H_
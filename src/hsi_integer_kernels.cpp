@@ -0,0 +1,439 @@
+#include "./hsi_integer_kernels.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace hsi {
+namespace {
+
+// The number of 16-value iterations after which the 32-bit lanes of a sum
+// are flushed into the 64-bit total. Each lane grows by at most 2 * 65535
+// per iteration, so it cannot overflow before then.
+const long kSumFlushIterations = 1 << 14;
+
+// The type-specific AVX2 operations for signed and unsigned 16-bit values.
+template <typename T>
+struct Int16Ops;
+
+template <>
+struct Int16Ops<int16_t> {
+#ifdef __AVX2__
+  static __m256i Min(const __m256i a, const __m256i b) {
+    return _mm256_min_epi16(a, b);
+  }
+  static __m256i Max(const __m256i a, const __m256i b) {
+    return _mm256_max_epi16(a, b);
+  }
+  // Widens 8 values to 32 bits.
+  static __m256i Widen(const __m128i values) {
+    return _mm256_cvtepi16_epi32(values);
+  }
+  // Maps the values to signed values of the same order, for comparisons.
+  static __m256i ToSigned(const __m256i values) {
+    return values;
+  }
+#endif
+};
+
+template <>
+struct Int16Ops<uint16_t> {
+#ifdef __AVX2__
+  static __m256i Min(const __m256i a, const __m256i b) {
+    return _mm256_min_epu16(a, b);
+  }
+  static __m256i Max(const __m256i a, const __m256i b) {
+    return _mm256_max_epu16(a, b);
+  }
+  static __m256i Widen(const __m128i values) {
+    return _mm256_cvtepu16_epi32(values);
+  }
+  static __m256i ToSigned(const __m256i values) {
+    return _mm256_xor_si256(values, _mm256_set1_epi16(-0x8000));
+  }
+#endif
+};
+
+template <typename T>
+int64_t SumValuesImpl(const T* values, const long num_values) {
+  int64_t sum = 0;
+  long i = 0;
+#ifdef __AVX2__
+  while (i + 16 <= num_values) {
+    const long block_end =
+        std::min(num_values, i + 16 * kSumFlushIterations);
+    __m256i sum_vector = _mm256_setzero_si256();
+    for (; i + 16 <= block_end; i += 16) {
+      const __m256i block = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i*>(values + i));
+      sum_vector = _mm256_add_epi32(
+          sum_vector,
+          _mm256_add_epi32(
+              Int16Ops<T>::Widen(_mm256_castsi256_si128(block)),
+              Int16Ops<T>::Widen(_mm256_extracti128_si256(block, 1))));
+    }
+    int32_t lanes[8];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), sum_vector);
+    for (const int32_t lane : lanes) {
+      sum += lane;
+    }
+  }
+#endif
+  for (; i < num_values; ++i) {
+    sum += values[i];
+  }
+  return sum;
+}
+
+template <typename T>
+void GetMinMaxImpl(
+    const T* values, const long num_values, T* min_value, T* max_value) {
+
+  if (num_values <= 0) {
+    FatalError("Cannot get the min and max of no values.");
+  }
+  T min = values[0];
+  T max = values[0];
+  long i = 0;
+#ifdef __AVX2__
+  if (num_values >= 16) {
+    __m256i min_vector =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values));
+    __m256i max_vector = min_vector;
+    for (i = 16; i + 16 <= num_values; i += 16) {
+      const __m256i block = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i*>(values + i));
+      min_vector = Int16Ops<T>::Min(min_vector, block);
+      max_vector = Int16Ops<T>::Max(max_vector, block);
+    }
+    T lanes[16];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), min_vector);
+    min = *std::min_element(lanes, lanes + 16);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), max_vector);
+    max = *std::max_element(lanes, lanes + 16);
+  }
+#endif
+  for (; i < num_values; ++i) {
+    min = std::min(min, values[i]);
+    max = std::max(max, values[i]);
+  }
+  *min_value = min;
+  *max_value = max;
+}
+
+template <typename T>
+void AddToHistogramImpl(
+    const T* values,
+    const long num_values,
+    const T min_value,
+    const T max_value,
+    const int num_bins,
+    long* bin_counts) {
+
+  if (num_bins <= 0 || max_value < min_value) {
+    FatalError("Invalid histogram bins.");
+  }
+  const int32_t range = static_cast<int32_t>(max_value) - min_value + 1;
+  // With one bin per value, the bin is the offset and needs no division.
+  const bool unit_bins = (range == num_bins);
+  long i = 0;
+#ifdef __AVX2__
+  // The bins of 8 values at a time are computed in vectors, and only the
+  // counts are added one at a time. The bin offset * num_bins / range is
+  // computed in doubles as (offset * num_bins + 0.5) / range, which is at
+  // least 0.5 / range away from the next integer, so that rounding errors do
+  // not change it.
+  const __m256i min_vector = _mm256_set1_epi32(min_value);
+  const __m256i range_vector = _mm256_set1_epi32(range);
+  const __m256i minus_one = _mm256_set1_epi32(-1);
+  const __m256d num_bins_vector = _mm256_set1_pd(num_bins);
+  const __m256d half = _mm256_set1_pd(0.5);
+  const __m256d inverse_range = _mm256_set1_pd(1.0 / range);
+  alignas(32) int32_t bins[8];
+  for (; i + 8 <= num_values; i += 8) {
+    const __m256i offsets = _mm256_sub_epi32(
+        Int16Ops<T>::Widen(_mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(values + i))),
+        min_vector);
+    const int in_range = _mm256_movemask_ps(_mm256_castsi256_ps(
+        _mm256_and_si256(
+            _mm256_cmpgt_epi32(offsets, minus_one),
+            _mm256_cmpgt_epi32(range_vector, offsets))));
+    if (in_range == 0) {
+      continue;
+    }
+    __m256i bin_vector = offsets;
+    if (!unit_bins) {
+      const __m128i low_bins = _mm256_cvttpd_epi32(_mm256_mul_pd(
+          _mm256_add_pd(
+              _mm256_mul_pd(
+                  _mm256_cvtepi32_pd(_mm256_castsi256_si128(offsets)),
+                  num_bins_vector),
+              half),
+          inverse_range));
+      const __m128i high_bins = _mm256_cvttpd_epi32(_mm256_mul_pd(
+          _mm256_add_pd(
+              _mm256_mul_pd(
+                  _mm256_cvtepi32_pd(_mm256_extracti128_si256(offsets, 1)),
+                  num_bins_vector),
+              half),
+          inverse_range));
+      bin_vector = _mm256_inserti128_si256(
+          _mm256_castsi128_si256(low_bins), high_bins, 1);
+    }
+    _mm256_store_si256(reinterpret_cast<__m256i*>(bins), bin_vector);
+    for (int lane = 0; lane < 8; ++lane) {
+      if (in_range & (1 << lane)) {
+        bin_counts[bins[lane]]++;
+      }
+    }
+  }
+#endif
+  for (; i < num_values; ++i) {
+    const T value = values[i];
+    if (value < min_value || value > max_value) {
+      continue;
+    }
+    const int32_t offset = static_cast<int32_t>(value) - min_value;
+    const int bin = unit_bins ? offset :
+        static_cast<int>(static_cast<int64_t>(offset) * num_bins / range);
+    bin_counts[bin]++;
+  }
+}
+
+template <typename T>
+long ThresholdValuesImpl(
+    const T* values, const long num_values, const T threshold, uint8_t* mask) {
+
+  long num_above = 0;
+  long i = 0;
+#ifdef __AVX2__
+  const __m256i threshold_vector =
+      Int16Ops<T>::ToSigned(_mm256_set1_epi16(threshold));
+  const __m256i ones = _mm256_set1_epi8(1);
+  for (; i + 32 <= num_values; i += 32) {
+    const __m256i first = Int16Ops<T>::ToSigned(_mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(values + i)));
+    const __m256i second = Int16Ops<T>::ToSigned(_mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(values + i + 16)));
+    // The pack works within 128-bit lanes, so the 64-bit blocks are put back
+    // in order afterwards.
+    const __m256i above = _mm256_permute4x64_epi64(
+        _mm256_packs_epi16(
+            _mm256_cmpgt_epi16(first, threshold_vector),
+            _mm256_cmpgt_epi16(second, threshold_vector)),
+        _MM_SHUFFLE(3, 1, 2, 0));
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i*>(mask + i), _mm256_and_si256(above, ones));
+    num_above += __builtin_popcount(
+        static_cast<uint32_t>(_mm256_movemask_epi8(above)));
+  }
+#endif
+  for (; i < num_values; ++i) {
+    mask[i] = (values[i] > threshold) ? 1 : 0;
+    num_above += mask[i];
+  }
+  return num_above;
+}
+
+template <typename T>
+void SubtractValuesImpl(
+    const T* first,
+    const T* second,
+    const long num_values,
+    int32_t* differences) {
+
+  long i = 0;
+#ifdef __AVX2__
+  for (; i + 8 <= num_values; i += 8) {
+    const __m256i first_values = Int16Ops<T>::Widen(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(first + i)));
+    const __m256i second_values = Int16Ops<T>::Widen(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(second + i)));
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i*>(differences + i),
+        _mm256_sub_epi32(first_values, second_values));
+  }
+#endif
+  for (; i < num_values; ++i) {
+    differences[i] = static_cast<int32_t>(first[i]) - second[i];
+  }
+}
+
+// Adds num_values values to the 32-bit sums.
+template <typename T>
+void AddToSums(const T* values, const int num_values, int32_t* sums) {
+  int i = 0;
+#ifdef __AVX2__
+  for (; i + 8 <= num_values; i += 8) {
+    const __m256i widened = Int16Ops<T>::Widen(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i)));
+    __m256i* sum_block = reinterpret_cast<__m256i*>(sums + i);
+    _mm256_storeu_si256(
+        sum_block,
+        _mm256_add_epi32(_mm256_loadu_si256(sum_block), widened));
+  }
+#endif
+  for (; i < num_values; ++i) {
+    sums[i] += values[i];
+  }
+}
+
+template <typename T>
+void BinImageImpl(
+    const T* values,
+    const int num_rows,
+    const int num_cols,
+    const int bin_size,
+    T* binned_values) {
+
+  if (bin_size <= 0) {
+    FatalError("The bin size must be positive.");
+  }
+  const int num_binned_rows = num_rows / bin_size;
+  const int num_binned_cols = num_cols / bin_size;
+  const int64_t bin_count = static_cast<int64_t>(bin_size) * bin_size;
+  std::vector<int32_t> column_sums(num_cols);
+  for (int binned_row = 0; binned_row < num_binned_rows; ++binned_row) {
+    // Sum the rows of the block first, then the columns of each bin.
+    std::fill(column_sums.begin(), column_sums.end(), 0);
+    for (int row = binned_row * bin_size; row < (binned_row + 1) * bin_size;
+         ++row) {
+      AddToSums(
+          values + static_cast<long>(row) * num_cols,
+          num_cols,
+          column_sums.data());
+    }
+    for (int binned_col = 0; binned_col < num_binned_cols; ++binned_col) {
+      int64_t sum = 0;
+      for (int col = binned_col * bin_size;
+           col < (binned_col + 1) * bin_size; ++col) {
+        sum += column_sums[col];
+      }
+      // Round half away from zero.
+      const int64_t mean = (sum >= 0) ?
+          (sum + bin_count / 2) / bin_count :
+          -((-sum + bin_count / 2) / bin_count);
+      binned_values[static_cast<long>(binned_row) * num_binned_cols +
+                    binned_col] = static_cast<T>(mean);
+    }
+  }
+}
+
+}  // namespace
+
+int64_t SumValues(const int16_t* values, const long num_values) {
+  return SumValuesImpl(values, num_values);
+}
+
+int64_t SumValues(const uint16_t* values, const long num_values) {
+  return SumValuesImpl(values, num_values);
+}
+
+double MeanValue(const int16_t* values, const long num_values) {
+  if (num_values <= 0) {
+    return 0;
+  }
+  return static_cast<double>(SumValues(values, num_values)) / num_values;
+}
+
+double MeanValue(const uint16_t* values, const long num_values) {
+  if (num_values <= 0) {
+    return 0;
+  }
+  return static_cast<double>(SumValues(values, num_values)) / num_values;
+}
+
+void GetMinMax(
+    const int16_t* values,
+    const long num_values,
+    int16_t* min_value,
+    int16_t* max_value) {
+  GetMinMaxImpl(values, num_values, min_value, max_value);
+}
+
+void GetMinMax(
+    const uint16_t* values,
+    const long num_values,
+    uint16_t* min_value,
+    uint16_t* max_value) {
+  GetMinMaxImpl(values, num_values, min_value, max_value);
+}
+
+void AddToHistogram(
+    const int16_t* values,
+    const long num_values,
+    const int16_t min_value,
+    const int16_t max_value,
+    const int num_bins,
+    long* bin_counts) {
+  AddToHistogramImpl(
+      values, num_values, min_value, max_value, num_bins, bin_counts);
+}
+
+void AddToHistogram(
+    const uint16_t* values,
+    const long num_values,
+    const uint16_t min_value,
+    const uint16_t max_value,
+    const int num_bins,
+    long* bin_counts) {
+  AddToHistogramImpl(
+      values, num_values, min_value, max_value, num_bins, bin_counts);
+}
+
+long ThresholdValues(
+    const int16_t* values,
+    const long num_values,
+    const int16_t threshold,
+    uint8_t* mask) {
+  return ThresholdValuesImpl(values, num_values, threshold, mask);
+}
+
+long ThresholdValues(
+    const uint16_t* values,
+    const long num_values,
+    const uint16_t threshold,
+    uint8_t* mask) {
+  return ThresholdValuesImpl(values, num_values, threshold, mask);
+}
+
+void SubtractValues(
+    const int16_t* first,
+    const int16_t* second,
+    const long num_values,
+    int32_t* differences) {
+  SubtractValuesImpl(first, second, num_values, differences);
+}
+
+void SubtractValues(
+    const uint16_t* first,
+    const uint16_t* second,
+    const long num_values,
+    int32_t* differences) {
+  SubtractValuesImpl(first, second, num_values, differences);
+}
+
+void BinImage(
+    const int16_t* values,
+    const int num_rows,
+    const int num_cols,
+    const int bin_size,
+    int16_t* binned_values) {
+  BinImageImpl(values, num_rows, num_cols, bin_size, binned_values);
+}
+
+void BinImage(
+    const uint16_t* values,
+    const int num_rows,
+    const int num_cols,
+    const int bin_size,
+    uint16_t* binned_values) {
+  BinImageImpl(values, num_rows, num_cols, bin_size, binned_values);
+}
+
+}  // namespace hsi
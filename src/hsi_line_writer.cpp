@@ -0,0 +1,217 @@
+#include "./hsi_line_writer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+namespace hsi {
+namespace {
+
+// The alignment of the ring buffer, so that batches of lines are copied to
+// the kernel from page-aligned memory when the line size allows it.
+constexpr long kBufferAlignment = 4096;
+
+}  // namespace
+
+HSILineWriter::HSILineWriter(
+    const HSIDataOptions& data_options,
+    const std::string& header_file_path,
+    const HSILineWriterOptions& options)
+    : options_(options),
+      data_options_(data_options),
+      header_file_path_(header_file_path),
+      write_position_(0),
+      read_position_(0),
+      num_lines_dropped_(0),
+      num_full_buffers_(0),
+      closing_(false),
+      appending_(false),
+      stopping_(false),
+      failed_(false) {
+
+  if (IsPackedDataType(data_options_.data_type)) {
+    FatalError("Lines of packed data cannot be written.");
+  }
+  if (data_options_.num_data_cols <= 0 || data_options_.num_data_bands <= 0) {
+    FatalError("Lines must have at least one column and band.");
+  }
+  if (options_.buffer_lines <= 0 || options_.max_batch_lines <= 0) {
+    FatalError("The line buffer and batches must hold at least one line.");
+  }
+  data_options_.interleave_format = HSI_INTERLEAVE_BIL;
+  data_options_.header_offset = 0;
+  line_size_ = static_cast<long>(data_options_.num_data_cols) *
+      data_options_.num_data_bands * GetDataSize(data_options_.data_type);
+
+  buffer_storage_.resize(
+      line_size_ * options_.buffer_lines + kBufferAlignment);
+  const uintptr_t storage_address =
+      reinterpret_cast<uintptr_t>(buffer_storage_.data());
+  buffer_ = buffer_storage_.data() +
+      (kBufferAlignment - storage_address % kBufferAlignment) %
+          kBufferAlignment;
+
+  const std::string& file_path = data_options_.hsi_file_path;
+  file_descriptor_ =
+      open(file_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (file_descriptor_ < 0) {
+    FatalError("File " + file_path + " could not be opened for writing.");
+  }
+  if (!WriteHeader(0)) {
+    close(file_descriptor_);
+    FatalError(error_message_);
+  }
+  io_thread_ = std::thread(&HSILineWriter::WriteLines, this);
+}
+
+HSILineWriter::~HSILineWriter() {
+  if (io_thread_.joinable()) {
+    Close();
+  }
+}
+
+bool HSILineWriter::AppendLine(const char* line) {
+  // Announce the append before checking for Close(), which sets closing_
+  // before waiting for the announced append to finish (both sequentially
+  // consistent). So either the line is refused here, or Close() lets the I/O
+  // thread write it before stopping.
+  appending_.store(true);
+  const bool appended = !closing_.load() && AppendLineToBuffer(line);
+  appending_.store(false, std::memory_order_release);
+  return appended;
+}
+
+bool HSILineWriter::AppendLineToBuffer(const char* line) {
+  // No I/O thread takes lines from the buffer after an error, so they are
+  // refused rather than waiting for room that never comes.
+  if (failed()) {
+    return false;
+  }
+  const long position = write_position_.load(std::memory_order_relaxed);
+  if (position - read_position_.load(std::memory_order_acquire) >=
+      options_.buffer_lines) {
+    num_full_buffers_.fetch_add(1, std::memory_order_relaxed);
+    if (!options_.wait_when_full) {
+      num_lines_dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    while (position - read_position_.load(std::memory_order_acquire) >=
+           options_.buffer_lines) {
+      if (failed()) {
+        return false;
+      }
+      std::this_thread::yield();
+    }
+  }
+  std::memcpy(
+      buffer_ + (position % options_.buffer_lines) * line_size_,
+      line,
+      line_size_);
+  write_position_.store(position + 1, std::memory_order_release);
+  return true;
+}
+
+void HSILineWriter::WriteLines() {
+  long next_header_update = options_.header_update_lines;
+  while (true) {
+    // Check for stopping before the write position, so that no line appended
+    // before Close() is missed.
+    const bool stopping = stopping_.load(std::memory_order_acquire);
+    const long read_position = read_position_.load(std::memory_order_relaxed);
+    const long num_buffered =
+        write_position_.load(std::memory_order_acquire) - read_position;
+    if (num_buffered == 0) {
+      if (stopping) {
+        return;
+      }
+      std::this_thread::sleep_for(
+          std::chrono::microseconds(options_.idle_sleep_micros));
+      continue;
+    }
+
+    // Write the buffered lines up to the end of the ring at once.
+    const long slot = read_position % options_.buffer_lines;
+    const long num_lines = std::min(
+        std::min<long>(num_buffered, options_.max_batch_lines),
+        options_.buffer_lines - slot);
+    const char* bytes = buffer_ + slot * line_size_;
+    const long num_bytes = num_lines * line_size_;
+    long num_written = 0;
+    while (num_written < num_bytes) {
+      const ssize_t result = write(
+          file_descriptor_, bytes + num_written, num_bytes - num_written);
+      if (result < 0 && errno == EINTR) {
+        continue;
+      }
+      if (result <= 0) {
+        SetFailed("Failed to write to " + data_options_.hsi_file_path + ".");
+        return;
+      }
+      num_written += result;
+    }
+    read_position_.store(read_position + num_lines, std::memory_order_release);
+
+    if (options_.header_update_lines > 0 &&
+        read_position + num_lines >= next_header_update) {
+      if (!WriteHeader(read_position + num_lines)) {
+        SetFailed(error_message_);
+        return;
+      }
+      next_header_update =
+          read_position + num_lines + options_.header_update_lines;
+    }
+  }
+}
+
+bool HSILineWriter::WriteHeader(const long num_lines) {
+  if (header_file_path_.empty()) {
+    return true;
+  }
+  data_options_.num_data_rows = static_cast<int>(num_lines);
+  const std::string temp_path = header_file_path_ + ".tmp";
+  std::ofstream header_file(temp_path);
+  data_options_.WriteHeader(&header_file);
+  header_file.close();
+  if (!header_file ||
+      std::rename(temp_path.c_str(), header_file_path_.c_str()) != 0) {
+    error_message_ = "Failed to write to " + header_file_path_ + ".";
+    return false;
+  }
+  return true;
+}
+
+void HSILineWriter::SetFailed(const std::string& message) {
+  error_message_ = message;
+  failed_.store(true, std::memory_order_release);
+}
+
+void HSILineWriter::Close() {
+  if (!io_thread_.joinable()) {
+    return;
+  }
+  // Refuse new lines, wait for an append in progress on another thread, and
+  // then let the I/O thread stop once it has written all lines.
+  closing_.store(true);
+  while (appending_.load(std::memory_order_acquire)) {
+    std::this_thread::yield();
+  }
+  stopping_.store(true, std::memory_order_release);
+  io_thread_.join();
+  close(file_descriptor_);
+  if (failed()) {
+    FatalError(error_message_);
+  }
+  if (!WriteHeader(num_lines_written())) {
+    FatalError(error_message_);
+  }
+}
+
+}  // namespace hsi
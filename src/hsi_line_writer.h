@@ -0,0 +1,159 @@
+// Provides the HSILineWriter class, which stores BIL lines as they arrive
+// from a sensor (e.g. from a frame grabber callback) in a growing data file.
+//
+// Lines are copied into a ring buffer that is shared with a dedicated I/O
+// thread without locks: the capturing thread only advances the write
+// position, and the I/O thread only advances the read position. The I/O
+// thread writes all buffered lines at once (up to a batch size) with large
+// sequential writes, so the capturing thread never waits for the disk while
+// the buffer has room. The ENVI header is rewritten with the number of lines
+// stored so far every so many lines, so the file can be opened while it is
+// still growing.
+
+#ifndef SRC_HSI_LINE_WRITER_H_
+#define SRC_HSI_LINE_WRITER_H_
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "./hsi_data_reader.h"
+
+namespace hsi {
+
+struct HSILineWriterOptions {
+  // The number of lines that the ring buffer holds.
+  int buffer_lines = 1024;
+
+  // The maximum number of lines written with one write.
+  int max_batch_lines = 64;
+
+  // If true, AppendLine() waits for room when the buffer is full, which slows
+  // down the capture to the speed of the disk. Otherwise lines that do not fit
+  // are dropped (and counted).
+  bool wait_when_full = false;
+
+  // The header is rewritten after every this many lines. Zero means that it
+  // is only written when the writer is created and closed.
+  int header_update_lines = 1000;
+
+  // How long the I/O thread sleeps when the buffer is empty, in microseconds.
+  // This bounds the delay until an appended line is written.
+  int idle_sleep_micros = 200;
+};
+
+class HSILineWriter {
+ public:
+  // Creates (or truncates) the data file at data_options.hsi_file_path, and
+  // starts the I/O thread. The options give the columns, bands, data type,
+  // and byte order of the lines (which are written as they are), and any
+  // wavelengths or map info for the header. The interleave format is always
+  // BIL, and the number of rows is the number of lines written.
+  HSILineWriter(
+      const HSIDataOptions& data_options,
+      const std::string& header_file_path,
+      const HSILineWriterOptions& options);
+
+  // Closes the writer if Close() has not been called.
+  ~HSILineWriter();
+
+  HSILineWriter(const HSILineWriter&) = delete;
+  HSILineWriter& operator=(const HSILineWriter&) = delete;
+
+  // Copies one line of num_data_cols * num_data_bands values (in BIL order
+  // and in the file's data type and byte order) into the buffer. Returns
+  // false if the line was dropped because the buffer was full, or if the
+  // writer was closed or failed (see failed()). Lines must be appended from
+  // one thread at a time. Every line for which true is returned is written,
+  // even if Close() is called concurrently from another thread.
+  bool AppendLine(const char* line);
+
+  // Writes all buffered lines, stops the I/O thread, writes the final header,
+  // and closes the file. No lines can be appended afterwards. Can be called
+  // from another thread than AppendLine(), e.g. to stop a capture callback.
+  // Fatal error if any write failed.
+  void Close();
+
+  // True if a write of lines or of the header failed on the I/O thread. The
+  // I/O thread then stops, and the error is reported by Close().
+  bool failed() const {
+    return failed_.load(std::memory_order_acquire);
+  }
+
+  // The size of each line in bytes.
+  long line_size() const {
+    return line_size_;
+  }
+
+  // The number of lines written to the file, and the number waiting in the
+  // buffer.
+  long num_lines_written() const {
+    return read_position_.load(std::memory_order_acquire);
+  }
+  long num_lines_buffered() const {
+    return write_position_.load(std::memory_order_acquire) -
+        read_position_.load(std::memory_order_acquire);
+  }
+
+  // The number of lines dropped, and the number of times AppendLine() found
+  // the buffer full (whether it then waited or dropped the line). A growing
+  // number of full buffers means the disk does not keep up with the sensor.
+  long num_lines_dropped() const {
+    return num_lines_dropped_.load(std::memory_order_relaxed);
+  }
+  long num_full_buffers() const {
+    return num_full_buffers_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  // Copies the line into the buffer for AppendLine(), waiting for room if
+  // requested. Returns false if the line was dropped.
+  bool AppendLineToBuffer(const char* line);
+
+  // The loop of the I/O thread, which writes lines until the writer is
+  // stopping and the buffer is empty.
+  void WriteLines();
+
+  // Writes the header with the given number of lines, replacing the previous
+  // header at once. Returns false and sets error_message_ if it fails.
+  bool WriteHeader(const long num_lines);
+
+  // Records an error of the I/O thread, to be reported by Close().
+  void SetFailed(const std::string& message);
+
+  const HSILineWriterOptions options_;
+  HSIDataOptions data_options_;
+  const std::string header_file_path_;
+  long line_size_ = 0;
+  int file_descriptor_ = -1;
+
+  // The ring buffer of options_.buffer_lines lines, which starts at a page
+  // boundary in buffer_storage_.
+  std::vector<char> buffer_storage_;
+  char* buffer_ = nullptr;
+
+  // The total numbers of lines appended to and taken from the buffer. Line i
+  // is in slot i % buffer_lines. Only the capturing thread advances the write
+  // position, and only the I/O thread the read position.
+  std::atomic<long> write_position_;
+  std::atomic<long> read_position_;
+
+  std::atomic<long> num_lines_dropped_;
+  std::atomic<long> num_full_buffers_;
+  // Close() sets closing_ to refuse new lines, waits while appending_ shows
+  // an append in progress, and then sets stopping_ to end the I/O thread.
+  std::atomic<bool> closing_;
+  std::atomic<bool> appending_;
+  std::atomic<bool> stopping_;
+  std::thread io_thread_;
+
+  // Set by the I/O thread when a write fails. The message is written before
+  // the flag is set, and only read after it is seen set.
+  std::atomic<bool> failed_;
+  std::string error_message_;
+};
+
+}  // namespace hsi
+
+#endif  // SRC_HSI_LINE_WRITER_H_
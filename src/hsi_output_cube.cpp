@@ -0,0 +1,90 @@
+#include "./hsi_output_cube.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace hsi {
+
+HSIOutputCube::HSIOutputCube(
+    const HSIDataOptions& data_options,
+    const std::string& header_file_path)
+    : data_options_(data_options) {
+
+  if (IsPackedDataType(data_options_.data_type)) {
+    FatalError("Output cubes of packed data are not supported.");
+  }
+  if (data_options_.num_data_rows <= 0 || data_options_.num_data_cols <= 0 ||
+      data_options_.num_data_bands <= 0) {
+    FatalError("The output cube must have a positive size.");
+  }
+  mapped_size_ = data_options_.header_offset +
+      static_cast<long>(data_options_.num_data_rows) *
+          data_options_.num_data_cols * data_options_.num_data_bands *
+          GetDataSize(data_options_.data_type);
+
+  const std::string& file_path = data_options_.hsi_file_path;
+  file_descriptor_ = open(file_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (file_descriptor_ < 0) {
+    FatalError("File " + file_path + " could not be opened for writing.");
+  }
+  // Reserve the disk space up front, so the writes to the mapped pages do
+  // not fail for lack of space. Fall back to a sparse file where that is not
+  // supported.
+  if (posix_fallocate(file_descriptor_, 0, mapped_size_) != 0 &&
+      ftruncate(file_descriptor_, mapped_size_) != 0) {
+    close(file_descriptor_);
+    FatalError("File " + file_path + " could not be resized.");
+  }
+  void* mapped = mmap(
+      nullptr,
+      mapped_size_,
+      PROT_READ | PROT_WRITE,
+      MAP_SHARED,
+      file_descriptor_,
+      0);
+  if (mapped == MAP_FAILED) {
+    close(file_descriptor_);
+    FatalError("File " + file_path + " could not be mapped.");
+  }
+  mapped_data_ = static_cast<char*>(mapped);
+
+  if (!header_file_path.empty()) {
+    data_options_.WriteHeaderToFile(header_file_path);
+  }
+}
+
+HSIOutputCube::~HSIOutputCube() {
+  munmap(mapped_data_, mapped_size_);
+  close(file_descriptor_);
+}
+
+void HSIOutputCube::WriteRange(
+    const HSIDataRange& data_range, const HSIData& hsi_data) {
+
+  HSIData converted_data;
+  std::vector<HSIValueRun> runs;
+  const char* values = GetFileLayoutValues(
+      data_options_, data_range, hsi_data, &runs, &converted_data);
+
+  const int data_size = GetDataSize(data_options_.data_type);
+  char* file_values = mapped_data_ + data_options_.header_offset;
+  for (const HSIValueRun& run : runs) {
+    std::memcpy(
+        file_values + run.file_index * data_size,
+        values + run.destination_index * data_size,
+        run.num_values * data_size);
+  }
+}
+
+void HSIOutputCube::Flush() {
+  if (msync(mapped_data_, mapped_size_, MS_SYNC) != 0) {
+    FatalError("Failed to write to " + data_options_.hsi_file_path + ".");
+  }
+}
+
+}  // namespace hsi
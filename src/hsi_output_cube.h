@@ -0,0 +1,60 @@
+// Provides the HSIOutputCube class, which creates a new data file of a given
+// size and layout (with its ENVI header) and fills it with tiles written in
+// any order, from any number of threads.
+//
+// The file is preallocated and memory-mapped, so each tile is copied directly
+// to its place in the file (with the file's data type, interleave format, and
+// byte order) and no buffer of the whole cube is needed. The operating system
+// writes the pages back to the disk in the background, and Flush() waits
+// until all of them are written.
+
+#ifndef SRC_HSI_OUTPUT_CUBE_H_
+#define SRC_HSI_OUTPUT_CUBE_H_
+
+#include <string>
+
+#include "./hsi_data_reader.h"
+
+namespace hsi {
+
+class HSIOutputCube {
+ public:
+  // Creates (or truncates) the data file at data_options.hsi_file_path with
+  // the size, interleave format, data type, byte order, and header offset of
+  // the options, filled with zeros. If header_file_path is not empty, the
+  // header is written there. Packed data types are not supported.
+  HSIOutputCube(
+      const HSIDataOptions& data_options,
+      const std::string& header_file_path);
+
+  // Unmaps and closes the file. Data that was not flushed is still written
+  // to the disk by the operating system.
+  ~HSIOutputCube();
+
+  HSIOutputCube(const HSIOutputCube&) = delete;
+  HSIOutputCube& operator=(const HSIOutputCube&) = delete;
+
+  // Writes the data, which must have the size of the range, to the range of
+  // the file. The data can have any data type and interleave format; it is
+  // converted to those of the file. Writes of ranges that do not overlap can
+  // be made concurrently from multiple threads.
+  void WriteRange(const HSIDataRange& data_range, const HSIData& hsi_data);
+
+  // Blocks until all data written so far is stored on the disk.
+  void Flush();
+
+  // Returns the options describing the data file.
+  const HSIDataOptions& GetOptions() const {
+    return data_options_;
+  }
+
+ private:
+  const HSIDataOptions data_options_;
+  int file_descriptor_ = -1;
+  char* mapped_data_ = nullptr;
+  long mapped_size_ = 0;
+};
+
+}  // namespace hsi
+
+#endif  // SRC_HSI_OUTPUT_CUBE_H_
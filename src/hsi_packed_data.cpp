@@ -0,0 +1,190 @@
+#include "./hsi_packed_data.h"
+
+#if defined(__SSSE3__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+
+namespace hsi {
+namespace {
+
+// The number of samples unpacked at a time when converting to floats.
+constexpr int kFloatChunkSize = 1024;
+
+// Unpacks a single sample starting at the given bit of the stream. Bytes past
+// the end of the stream are treated as zeros.
+uint16_t UnpackSample(
+    const uint8_t* bytes,
+    const long num_bytes,
+    const long bit_position,
+    const int bit_depth,
+    const bool msb_first) {
+
+  // A sample of up to 16 bits starting at any bit of a byte fits in 3 bytes.
+  const long byte_index = bit_position >> 3;
+  const int bit_offset = bit_position & 7;
+  uint32_t b0 = bytes[byte_index];
+  uint32_t b1 = (byte_index + 1 < num_bytes) ? bytes[byte_index + 1] : 0;
+  uint32_t b2 = (byte_index + 2 < num_bytes) ? bytes[byte_index + 2] : 0;
+  const uint32_t mask = (1U << bit_depth) - 1;
+  if (msb_first) {
+    const uint32_t word = (b0 << 16) | (b1 << 8) | b2;
+    return (word >> (24 - bit_offset - bit_depth)) & mask;
+  }
+  const uint32_t word = b0 | (b1 << 8) | (b2 << 16);
+  return (word >> bit_offset) & mask;
+}
+
+#ifdef __SSSE3__
+// Groups of 8 samples of 10 or 12 bits fill a whole number of bytes, and each
+// sample is contained within 2 consecutive bytes. The vectorized kernels copy
+// these 2 bytes into a 16-bit lane with a byte shuffle, shift the sample to
+// the top of the lane with a per-lane multiply, and then shift it down.
+struct UnpackTables {
+  __m128i shuffle;
+  __m128i multipliers;
+  int right_shift;
+};
+
+UnpackTables GetUnpackTables(const int bit_depth, const bool msb_first) {
+  int8_t shuffle[16];
+  int16_t multipliers[8];
+  for (int lane = 0; lane < 8; ++lane) {
+    const int first_byte = (lane * bit_depth) >> 3;
+    const int bit_offset = (lane * bit_depth) & 7;
+    // Lanes are little endian: the first shuffled byte is the low byte.
+    if (msb_first) {
+      shuffle[2 * lane] = first_byte + 1;
+      shuffle[2 * lane + 1] = first_byte;
+      multipliers[lane] = 1 << bit_offset;
+    } else {
+      shuffle[2 * lane] = first_byte;
+      shuffle[2 * lane + 1] = first_byte + 1;
+      multipliers[lane] = 1 << (16 - bit_depth - bit_offset);
+    }
+  }
+  UnpackTables tables;
+  tables.shuffle = _mm_loadu_si128(reinterpret_cast<const __m128i*>(shuffle));
+  tables.multipliers =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(multipliers));
+  tables.right_shift = 16 - bit_depth;
+  return tables;
+}
+
+// Unpacks groups of 8 samples, starting at a byte boundary, for as long as
+// the 16-byte loads stay within the stream. Returns the number of samples
+// unpacked.
+long UnpackSampleGroups(
+    const uint8_t* bytes,
+    const long num_bytes,
+    const long num_samples,
+    const int bit_depth,
+    const bool msb_first,
+    uint16_t* samples) {
+
+  const UnpackTables tables = GetUnpackTables(bit_depth, msb_first);
+  const __m128i right_shift = _mm_cvtsi32_si128(tables.right_shift);
+  long i = 0;
+  long byte_index = 0;
+#ifdef __AVX2__
+  const __m256i shuffle = _mm256_broadcastsi128_si256(tables.shuffle);
+  const __m256i multipliers =
+      _mm256_broadcastsi128_si256(tables.multipliers);
+  for (; i + 16 <= num_samples && byte_index + bit_depth + 16 <= num_bytes;
+       i += 16, byte_index += 2 * bit_depth) {
+    const __m128i low = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(bytes + byte_index));
+    const __m128i high = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(bytes + byte_index + bit_depth));
+    __m256i words = _mm256_shuffle_epi8(
+        _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1),
+        shuffle);
+    words = _mm256_srl_epi16(
+        _mm256_mullo_epi16(words, multipliers), right_shift);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(samples + i), words);
+  }
+#endif
+  for (; i + 8 <= num_samples && byte_index + 16 <= num_bytes;
+       i += 8, byte_index += bit_depth) {
+    __m128i words = _mm_shuffle_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + byte_index)),
+        tables.shuffle);
+    words = _mm_srl_epi16(
+        _mm_mullo_epi16(words, tables.multipliers), right_shift);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(samples + i), words);
+  }
+  return i;
+}
+#endif  // __SSSE3__
+
+}  // namespace
+
+long GetPackedByteCount(
+    const int first_bit, const long num_samples, const int bit_depth) {
+  return (first_bit + num_samples * bit_depth + 7) / 8;
+}
+
+void UnpackSamples(
+    const uint8_t* bytes,
+    const int first_bit,
+    const long num_samples,
+    const int bit_depth,
+    const bool msb_first,
+    uint16_t* samples) {
+
+  const long num_bytes =
+      GetPackedByteCount(first_bit, num_samples, bit_depth);
+  long i = 0;
+#ifdef __SSSE3__
+  if (bit_depth == 10 || bit_depth == 12) {
+    // Unpack single samples until the next one starts on a byte boundary.
+    for (; i < num_samples && ((first_bit + i * bit_depth) & 7) != 0; ++i) {
+      samples[i] = UnpackSample(
+          bytes, num_bytes, first_bit + i * bit_depth, bit_depth, msb_first);
+    }
+    if (i < num_samples) {
+      const long byte_index = (first_bit + i * bit_depth) >> 3;
+      i += UnpackSampleGroups(
+          bytes + byte_index,
+          num_bytes - byte_index,
+          num_samples - i,
+          bit_depth,
+          msb_first,
+          samples + i);
+    }
+  }
+#endif
+  for (; i < num_samples; ++i) {
+    samples[i] = UnpackSample(
+        bytes, num_bytes, first_bit + i * bit_depth, bit_depth, msb_first);
+  }
+}
+
+void UnpackSamples(
+    const uint8_t* bytes,
+    const int first_bit,
+    const long num_samples,
+    const int bit_depth,
+    const bool msb_first,
+    float* samples) {
+
+  // Unpack to integers in chunks that stay in cache, and widen each chunk.
+  uint16_t chunk[kFloatChunkSize];
+  for (long i = 0; i < num_samples; i += kFloatChunkSize) {
+    const long chunk_size = std::min<long>(kFloatChunkSize, num_samples - i);
+    const long bit_position = first_bit + i * bit_depth;
+    UnpackSamples(
+        bytes + (bit_position >> 3),
+        bit_position & 7,
+        chunk_size,
+        bit_depth,
+        msb_first,
+        chunk);
+    for (long j = 0; j < chunk_size; ++j) {
+      samples[i + j] = static_cast<float>(chunk[j]);
+    }
+  }
+}
+
+}  // namespace hsi
@@ -0,0 +1,47 @@
+// Provides kernels that unpack bit-packed sensor samples. Some sensors write
+// unsigned 10, 12, or 14-bit samples as a continuous bit stream, without any
+// padding between samples (e.g. two 12-bit samples in three bytes). The
+// HSIDataReader uses these kernels to expand such files (see the
+// HSI_DATA_TYPE_PACKED_* data types) while reading.
+//
+// Bits are numbered from the start of the stream. If msb_first is true, the
+// first sample occupies the most significant bits of the first byte, and each
+// sample is stored with its most significant bit first. Otherwise, the first
+// sample occupies the least significant bits of the first byte, and each
+// sample is stored with its least significant bit first.
+
+#ifndef SRC_HSI_PACKED_DATA_H_
+#define SRC_HSI_PACKED_DATA_H_
+
+#include <cstdint>
+
+namespace hsi {
+
+// Returns the number of bytes that hold num_samples samples of the given bit
+// depth, starting first_bit bits into the first byte.
+long GetPackedByteCount(
+    const int first_bit, const long num_samples, const int bit_depth);
+
+// Unpacks num_samples samples of the given bit depth (at most 16). The first
+// sample starts first_bit (0 to 7) bits into the first byte. The bytes array
+// must contain at least GetPackedByteCount() bytes.
+void UnpackSamples(
+    const uint8_t* bytes,
+    const int first_bit,
+    const long num_samples,
+    const int bit_depth,
+    const bool msb_first,
+    uint16_t* samples);
+
+// Same as above, but the unpacked samples are converted to floats.
+void UnpackSamples(
+    const uint8_t* bytes,
+    const int first_bit,
+    const long num_samples,
+    const int bit_depth,
+    const bool msb_first,
+    float* samples);
+
+}  // namespace hsi
+
+#endif  // SRC_HSI_PACKED_DATA_H_
@@ -0,0 +1,133 @@
+#include "./hsi_parallel.h"
+
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace hsi {
+
+int GetNumThreads(const int num_threads) {
+  if (num_threads > 0) {
+    return num_threads;
+  }
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+void ParallelFor(
+    const long begin,
+    const long end,
+    const int num_threads,
+    const long min_block_size,
+    const std::function<void(const long, const long)>& function) {
+
+  const long size = end - begin;
+  if (size <= 0) {
+    return;
+  }
+  const long max_blocks = std::max(1L, size / std::max(1L, min_block_size));
+  const long num_blocks =
+      std::min(static_cast<long>(GetNumThreads(num_threads)), max_blocks);
+  if (num_blocks == 1) {
+    function(begin, end);
+    return;
+  }
+  // The calling thread runs the first block.
+  const long block_size = (size + num_blocks - 1) / num_blocks;
+  std::vector<std::thread> threads;
+  for (long block_begin = begin + block_size; block_begin < end;
+       block_begin += block_size) {
+    const long block_end = std::min(block_begin + block_size, end);
+    threads.emplace_back(function, block_begin, block_end);
+  }
+  function(begin, std::min(begin + block_size, end));
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
+void ForEachPrefetchedTile(
+    const HSIDataRange& data_range,
+    const int tile_rows,
+    HSIDataReader* reader,
+    const std::function<void(const HSIDataView&, const int)>& function) {
+
+  ForEachPrefetchedTile(
+      std::vector<HSIDataRange>(1, data_range),
+      tile_rows,
+      std::vector<HSIDataReader*>(1, reader),
+      [&function](const std::vector<HSIDataView>& tile_views,
+                  const int start_row) {
+        function(tile_views[0], start_row);
+      });
+}
+
+void ForEachPrefetchedTile(
+    const std::vector<HSIDataRange>& data_ranges,
+    const int tile_rows,
+    const std::vector<HSIDataReader*>& readers,
+    const std::function<void(const std::vector<HSIDataView>&, const int)>&
+        function) {
+
+  if (data_ranges.size() != readers.size()) {
+    FatalError("Each reader of the tiles needs a range.");
+  }
+  if (readers.empty()) {
+    return;
+  }
+  const int start_row = data_ranges[0].start_row;
+  const int end_row = data_ranges[0].end_row;
+  const int num_tile_rows = std::max(1, tile_rows);
+  std::vector<std::vector<HSIDataRange>> tile_ranges;
+  for (int row = start_row; row < end_row; row += num_tile_rows) {
+    tile_ranges.push_back(data_ranges);
+    for (HSIDataRange& tile_range : tile_ranges.back()) {
+      tile_range.start_row = row;
+      tile_range.end_row = std::min(row + num_tile_rows, end_row);
+    }
+  }
+  ForEachPrefetchedTile(
+      tile_ranges,
+      readers,
+      [&](const std::vector<HSIDataView>& tile_views, const int tile) {
+        function(tile_views, tile * num_tile_rows);
+      });
+}
+
+void ForEachPrefetchedTile(
+    const std::vector<std::vector<HSIDataRange>>& tile_ranges,
+    const std::vector<HSIDataReader*>& readers,
+    const std::function<void(const std::vector<HSIDataView>&, const int)>&
+        function) {
+
+  const int num_tiles = tile_ranges.size();
+  const auto read_tile = [&](const int tile) {
+    if (tile_ranges[tile].size() != readers.size()) {
+      FatalError("Each reader of the tiles needs a range.");
+    }
+    for (size_t i = 0; i < readers.size(); ++i) {
+      readers[i]->ReadData(tile_ranges[tile][i]);
+    }
+  };
+
+  if (num_tiles > 0) {
+    read_tile(0);
+  }
+  std::vector<HSIDataView> tile_views;
+  for (int tile = 0; tile < num_tiles; ++tile) {
+    tile_views.clear();
+    for (HSIDataReader* reader : readers) {
+      tile_views.push_back(reader->GetDataView());
+    }
+    std::thread next_tile_read;
+    if (tile + 1 < num_tiles) {
+      next_tile_read = std::thread(read_tile, tile + 1);
+    }
+    function(tile_views, tile);
+    if (next_tile_read.joinable()) {
+      next_tile_read.join();
+    }
+  }
+}
+
+}  // namespace hsi
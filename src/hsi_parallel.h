@@ -0,0 +1,65 @@
+// Provides a simple parallel for loop used by the processing kernels to split
+// work (e.g. across pixels or rows) over multiple threads, and a tile loop
+// that overlaps reading the next tile of a file with processing the current
+// one.
+
+#ifndef SRC_HSI_PARALLEL_H_
+#define SRC_HSI_PARALLEL_H_
+
+#include <functional>
+#include <vector>
+
+#include "./hsi_data_view.h"
+
+namespace hsi {
+
+// Returns the number of threads to use for the requested number of threads.
+// Zero or less means one thread for each hardware thread.
+int GetNumThreads(const int num_threads);
+
+// Calls function(block_begin, block_end) on contiguous blocks that together
+// cover [begin, end), using up to num_threads threads (see GetNumThreads()),
+// and returns once all of them are done. Blocks are at least min_block_size
+// long (except for the last), so small loops run on fewer threads.
+void ParallelFor(
+    const long begin,
+    const long end,
+    const int num_threads,
+    const long min_block_size,
+    const std::function<void(const long, const long)>& function);
+
+// Reads the given range from the reader one tile of tile_rows rows at a time,
+// and calls function(tile_view, start_row) for each tile in order, where
+// start_row is the first row of the tile relative to data_range.start_row.
+// The next tile is read on another thread while the function processes the
+// current one: the view keeps the current tile while the reader loads the
+// next one into a new buffer. The function must not use the reader.
+void ForEachPrefetchedTile(
+    const HSIDataRange& data_range,
+    const int tile_rows,
+    HSIDataReader* reader,
+    const std::function<void(const HSIDataView&, const int)>& function);
+
+// As above, but reads tiles of the same rows from several readers at once,
+// each of its own range (the ranges must all have the rows of the first), and
+// passes one view for each reader.
+void ForEachPrefetchedTile(
+    const std::vector<HSIDataRange>& data_ranges,
+    const int tile_rows,
+    const std::vector<HSIDataReader*>& readers,
+    const std::function<void(const std::vector<HSIDataView>&, const int)>&
+        function);
+
+// Reads tile_ranges[tile][i] with readers[i] for each tile in order, and calls
+// function(tile_views, tile) with one view for each reader, reading the next
+// tile while the function runs as above. Used for tiles that are not
+// consecutive rows of one range.
+void ForEachPrefetchedTile(
+    const std::vector<std::vector<HSIDataRange>>& tile_ranges,
+    const std::vector<HSIDataReader*>& readers,
+    const std::function<void(const std::vector<HSIDataView>&, const int)>&
+        function);
+
+}  // namespace hsi
+
+#endif  // SRC_HSI_PARALLEL_H_
@@ -0,0 +1,534 @@
+#include "./hsi_quantized_data.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace hsi {
+namespace {
+
+// Identifies quantized data files, followed by the format version.
+const char kQuantizedFileMagic[4] = {'H', 'S', 'I', 'Q'};
+const int32_t kQuantizedFileVersion = 1;
+
+// Running statistics of a single band.
+struct BandStats {
+  double min = std::numeric_limits<double>::max();
+  double max = std::numeric_limits<double>::lowest();
+  double sum = 0;
+  double sum_squares = 0;
+  long num_values = 0;
+};
+
+// The bits of a float with all exponent bits set, which is infinity or NaN.
+// Values are classified by their bits because the release build assumes
+// finite math, under which std::isfinite() and comparisons with NaN may be
+// folded away.
+constexpr uint32_t kFloatExponentMask = 0x7f800000;
+
+uint32_t GetFloatBits(const float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+bool IsFiniteValue(const float value) {
+  return (GetFloatBits(value) & kFloatExponentMask) != kFloatExponentMask;
+}
+
+bool IsNaNValue(const float value) {
+  return (GetFloatBits(value) & 0x7fffffff) > kFloatExponentMask;
+}
+
+// Adds num_values values of the same band to the band statistics. Values that
+// are not finite (such as NaN no-data values) are skipped.
+void AddToBandStats(
+    const float* values, const int num_values, BandStats* stats) {
+  for (int i = 0; i < num_values; ++i) {
+    const float value = values[i];
+    if (!IsFiniteValue(value)) {
+      continue;
+    }
+    stats->min = std::min(stats->min, static_cast<double>(value));
+    stats->max = std::max(stats->max, static_cast<double>(value));
+    stats->sum += value;
+    stats->sum_squares += static_cast<double>(value) * value;
+    stats->num_values++;
+  }
+}
+
+// Adds all values of the data, converted to floats, to the stats of each band.
+void AddDataToBandStats(
+    const HSIData& hsi_data, std::vector<BandStats>* band_stats) {
+  const HSIData bil_data =
+      ConvertData(hsi_data, HSI_DATA_TYPE_FLOAT, HSI_INTERLEAVE_BIL);
+  const float* values =
+      reinterpret_cast<const float*>(bil_data.raw_data.data());
+  for (int row = 0; row < bil_data.num_rows; ++row) {
+    for (int band = 0; band < bil_data.num_bands; ++band) {
+      AddToBandStats(values, bil_data.num_cols, &(*band_stats)[band]);
+      values += bil_data.num_cols;
+    }
+  }
+}
+
+// Sets the size, scales and offsets of the quantized data from the band
+// statistics, and allocates the codes.
+void InitializeQuantizedData(
+    const int num_rows,
+    const int num_cols,
+    const std::vector<BandStats>& band_stats,
+    const HSIDataInterleaveFormat interleave_format,
+    const HSIQuantizationOptions& options,
+    HSIQuantizedData* quantized_data) {
+
+  if (options.bits != 8 && options.bits != 16) {
+    FatalError("Quantized data must use 8 or 16 bits.");
+  }
+  quantized_data->num_rows = num_rows;
+  quantized_data->num_cols = num_cols;
+  quantized_data->num_bands = static_cast<int>(band_stats.size());
+  quantized_data->interleave_format = interleave_format;
+  quantized_data->bits = options.bits;
+  quantized_data->band_scales.clear();
+  quantized_data->band_offsets.clear();
+  const double max_code = (1 << options.bits) - 1;
+  for (const BandStats& stats : band_stats) {
+    double low = 0;
+    double high = 0;
+    if (stats.num_values > 0) {
+      low = stats.min;
+      high = stats.max;
+      if (options.clip_std_devs > 0) {
+        const double mean = stats.sum / stats.num_values;
+        const double variance =
+            std::max(0.0, stats.sum_squares / stats.num_values - mean * mean);
+        const double clip_range = options.clip_std_devs * std::sqrt(variance);
+        low = std::max(low, mean - clip_range);
+        high = std::min(high, mean + clip_range);
+      }
+    }
+    quantized_data->band_scales.push_back((high - low) / max_code);
+    quantized_data->band_offsets.push_back(low);
+  }
+  quantized_data->codes.assign(
+      static_cast<long>(quantized_data->NumDataPoints()) * (options.bits / 8),
+      0);
+}
+
+// Quantizes num_values values to codes:
+//
+//   code = round((value - offset) * inverse_scale), clipped to [0, max_code].
+//
+// If kPerValue is true, offsets and inverse_scales hold one parameter for each
+// value (as for a BIP spectrum). Otherwise, the first parameter is used for
+// all values (as for a span of a single band). NaN values become code 0.
+template <typename CodeType, bool kPerValue>
+void QuantizeValues(
+    const float* values,
+    const long num_values,
+    const float* offsets,
+    const float* inverse_scales,
+    CodeType* codes) {
+
+  const float max_code = std::numeric_limits<CodeType>::max();
+  long i = 0;
+#ifdef __AVX2__
+  const __m256 zero_vector = _mm256_setzero_ps();
+  const __m256 max_code_vector = _mm256_set1_ps(max_code);
+  __m256 offset_vector = _mm256_set1_ps(offsets[0]);
+  __m256 inverse_scale_vector = _mm256_set1_ps(inverse_scales[0]);
+  // Gathers the low byte of each 32-bit lane after packing.
+  const __m256i byte_order = _mm256_setr_epi32(0, 4, 1, 1, 1, 1, 1, 1);
+  const __m256i abs_mask = _mm256_set1_epi32(0x7fffffff);
+  const __m256i exponent_mask = _mm256_set1_epi32(kFloatExponentMask);
+  for (; i + 8 <= num_values; i += 8) {
+    if (kPerValue) {
+      offset_vector = _mm256_loadu_ps(offsets + i);
+      inverse_scale_vector = _mm256_loadu_ps(inverse_scales + i);
+    }
+    __m256 scaled = _mm256_mul_ps(
+        _mm256_sub_ps(_mm256_loadu_ps(values + i), offset_vector),
+        inverse_scale_vector);
+    // NaN lanes are zeroed by their bits, since the min and max may return
+    // either operand for NaN under finite math.
+    const __m256i nan_lanes = _mm256_cmpgt_epi32(
+        _mm256_and_si256(_mm256_castps_si256(scaled), abs_mask),
+        exponent_mask);
+    scaled = _mm256_andnot_ps(_mm256_castsi256_ps(nan_lanes), scaled);
+    scaled = _mm256_min_ps(_mm256_max_ps(scaled, zero_vector), max_code_vector);
+    const __m256i code_lanes = _mm256_cvtps_epi32(scaled);
+    // The packs work within 128-bit lanes, so the results are gathered from
+    // both lanes afterwards.
+    const __m256i words = _mm256_packus_epi32(code_lanes, code_lanes);
+    if (sizeof(CodeType) == 1) {
+      const __m256i bytes = _mm256_permutevar8x32_epi32(
+          _mm256_packus_epi16(words, words), byte_order);
+      _mm_storel_epi64(
+          reinterpret_cast<__m128i*>(codes + i),
+          _mm256_castsi256_si128(bytes));
+    } else {
+      _mm_storeu_si128(
+          reinterpret_cast<__m128i*>(codes + i),
+          _mm256_castsi256_si128(
+              _mm256_permute4x64_epi64(words, _MM_SHUFFLE(3, 1, 2, 0))));
+    }
+  }
+#endif
+  for (; i < num_values; ++i) {
+    const long parameter_index = kPerValue ? i : 0;
+    float scaled = (values[i] - offsets[parameter_index]) *
+        inverse_scales[parameter_index];
+    if (IsNaNValue(scaled) || scaled < 0) {
+      scaled = 0;
+    } else if (scaled > max_code) {
+      scaled = max_code;
+    }
+    codes[i] = static_cast<CodeType>(std::lrint(scaled));
+  }
+}
+
+// Quantizes the data (all bands and columns of num_rows rows) into the codes
+// of the quantized data, starting at first_row.
+template <typename CodeType>
+void QuantizeRows(
+    const HSIData& hsi_data,
+    const int first_row,
+    const std::vector<float>& inverse_scales,
+    HSIQuantizedData* quantized_data) {
+
+  const HSIData float_data = ConvertData(
+      hsi_data, HSI_DATA_TYPE_FLOAT, quantized_data->interleave_format);
+  const float* values =
+      reinterpret_cast<const float*>(float_data.raw_data.data());
+  CodeType* codes = reinterpret_cast<CodeType*>(quantized_data->codes.data());
+  const float* offsets = quantized_data->band_offsets.data();
+  const int num_rows = float_data.num_rows;
+  const int num_cols = quantized_data->num_cols;
+  const int num_bands = quantized_data->num_bands;
+  const long row_size = static_cast<long>(num_cols) * num_bands;
+
+  switch (quantized_data->interleave_format) {
+    case HSI_INTERLEAVE_BSQ: {
+      const long band_size =
+          static_cast<long>(quantized_data->num_rows) * num_cols;
+      const long num_values = static_cast<long>(num_rows) * num_cols;
+      for (int band = 0; band < num_bands; ++band) {
+        QuantizeValues<CodeType, false>(
+            values + band * num_values,
+            num_values,
+            offsets + band,
+            inverse_scales.data() + band,
+            codes + band * band_size + static_cast<long>(first_row) * num_cols);
+      }
+      break;
+    }
+    case HSI_INTERLEAVE_BIL:
+      codes += first_row * row_size;
+      for (int row = 0; row < num_rows; ++row) {
+        for (int band = 0; band < num_bands; ++band) {
+          QuantizeValues<CodeType, false>(
+              values,
+              num_cols,
+              offsets + band,
+              inverse_scales.data() + band,
+              codes);
+          values += num_cols;
+          codes += num_cols;
+        }
+      }
+      break;
+    case HSI_INTERLEAVE_BIP:
+    default:
+      codes += first_row * row_size;
+      for (long pixel = 0; pixel < static_cast<long>(num_rows) * num_cols;
+           ++pixel) {
+        QuantizeValues<CodeType, true>(
+            values, num_bands, offsets, inverse_scales.data(), codes);
+        values += num_bands;
+        codes += num_bands;
+      }
+      break;
+  }
+}
+
+// Quantizes the rows of the data into the codes, starting at first_row.
+void QuantizeRows(
+    const HSIData& hsi_data,
+    const int first_row,
+    HSIQuantizedData* quantized_data) {
+
+  std::vector<float> inverse_scales;
+  for (const float scale : quantized_data->band_scales) {
+    inverse_scales.push_back(scale > 0 ? 1.0f / scale : 0.0f);
+  }
+  if (quantized_data->bits == 8) {
+    QuantizeRows<uint8_t>(hsi_data, first_row, inverse_scales, quantized_data);
+  } else {
+    QuantizeRows<uint16_t>(hsi_data, first_row, inverse_scales, quantized_data);
+  }
+}
+
+// Returns the index of the given value in the codes.
+long GetCodeIndex(
+    const HSIQuantizedData& quantized_data,
+    const int row,
+    const int col,
+    const int band) {
+
+  long row_stride;
+  long col_stride;
+  long band_stride;
+  GetInterleaveStrides(
+      quantized_data.interleave_format,
+      quantized_data.num_rows,
+      quantized_data.num_cols,
+      quantized_data.num_bands,
+      &row_stride,
+      &col_stride,
+      &band_stride);
+  return row * row_stride + col * col_stride + band * band_stride;
+}
+
+}  // namespace
+
+/*******************************************************************************
+*** HSIQuantizedData
+*******************************************************************************/
+
+int HSIQuantizedData::GetCode(
+    const int row, const int col, const int band) const {
+
+  const long index = GetCodeIndex(*this, row, col, band);
+  if (bits == 8) {
+    return codes[index];
+  }
+  uint16_t code;
+  std::memcpy(&code, codes.data() + 2 * index, sizeof(code));
+  return code;
+}
+
+double HSIQuantizedData::GetValueAsDouble(
+    const int row, const int col, const int band) const {
+
+  return GetCode(row, col, band) * static_cast<double>(band_scales[band]) +
+      band_offsets[band];
+}
+
+std::vector<double> HSIQuantizedData::GetSpectrumAsDoubles(
+    const int row, const int col) const {
+
+  std::vector<double> spectrum;
+  spectrum.reserve(num_bands);
+  for (int band = 0; band < num_bands; ++band) {
+    spectrum.push_back(GetValueAsDouble(row, col, band));
+  }
+  return spectrum;
+}
+
+void HSIQuantizedData::GetBandAsFloats(
+    const int band, float* band_values) const {
+
+  const float scale = band_scales[band];
+  const float offset = band_offsets[band];
+  long row_stride;
+  long col_stride;
+  long band_stride;
+  GetInterleaveStrides(
+      interleave_format,
+      num_rows,
+      num_cols,
+      num_bands,
+      &row_stride,
+      &col_stride,
+      &band_stride);
+  const uint16_t* codes16 = reinterpret_cast<const uint16_t*>(codes.data());
+  for (int row = 0; row < num_rows; ++row) {
+    const long row_index = row * row_stride + band * band_stride;
+    for (int col = 0; col < num_cols; ++col) {
+      const long index = row_index + col * col_stride;
+      const int code = (bits == 8) ? codes[index] : codes16[index];
+      *band_values++ = code * scale + offset;
+    }
+  }
+}
+
+HSIData HSIQuantizedData::Dequantize() const {
+  HSIData hsi_data;
+  hsi_data.num_rows = num_rows;
+  hsi_data.num_cols = num_cols;
+  hsi_data.num_bands = num_bands;
+  hsi_data.interleave_format = interleave_format;
+  hsi_data.data_type = HSI_DATA_TYPE_FLOAT;
+  hsi_data.raw_data.resize(static_cast<long>(NumDataPoints()) * sizeof(float));
+  float* values = reinterpret_cast<float*>(hsi_data.raw_data.data());
+  long row_stride;
+  long col_stride;
+  long band_stride;
+  GetInterleaveStrides(
+      interleave_format,
+      num_rows,
+      num_cols,
+      num_bands,
+      &row_stride,
+      &col_stride,
+      &band_stride);
+  const uint16_t* codes16 = reinterpret_cast<const uint16_t*>(codes.data());
+  for (int band = 0; band < num_bands; ++band) {
+    const float scale = band_scales[band];
+    const float offset = band_offsets[band];
+    for (int row = 0; row < num_rows; ++row) {
+      const long row_index = row * row_stride + band * band_stride;
+      for (int col = 0; col < num_cols; ++col) {
+        const long index = row_index + col * col_stride;
+        const int code = (bits == 8) ? codes[index] : codes16[index];
+        values[index] = code * scale + offset;
+      }
+    }
+  }
+  return hsi_data;
+}
+
+bool HSIQuantizedData::Save(const std::string& file_path) const {
+  std::ofstream data_file(file_path, std::ios::out | std::ios::binary);
+  if (!data_file.is_open()) {
+    Error("Could not open quantized data file " + file_path);
+    return false;
+  }
+  const int32_t header[] = {
+      kQuantizedFileVersion,
+      num_rows,
+      num_cols,
+      num_bands,
+      interleave_format,
+      bits};
+  data_file.write(kQuantizedFileMagic, sizeof(kQuantizedFileMagic));
+  data_file.write(reinterpret_cast<const char*>(header), sizeof(header));
+  data_file.write(
+      reinterpret_cast<const char*>(band_scales.data()),
+      band_scales.size() * sizeof(float));
+  data_file.write(
+      reinterpret_cast<const char*>(band_offsets.data()),
+      band_offsets.size() * sizeof(float));
+  data_file.write(
+      reinterpret_cast<const char*>(codes.data()), codes.size());
+  if (!data_file.good()) {
+    Error("Could not write quantized data file " + file_path);
+    return false;
+  }
+  return true;
+}
+
+bool HSIQuantizedData::Load(const std::string& file_path) {
+  std::ifstream data_file(file_path, std::ios::in | std::ios::binary);
+  if (!data_file.is_open()) {
+    Error("Could not open quantized data file " + file_path);
+    return false;
+  }
+  char magic[sizeof(kQuantizedFileMagic)];
+  int32_t header[6];
+  data_file.read(magic, sizeof(magic));
+  data_file.read(reinterpret_cast<char*>(header), sizeof(header));
+  if (!data_file.good() ||
+      std::memcmp(magic, kQuantizedFileMagic, sizeof(magic)) != 0 ||
+      header[0] != kQuantizedFileVersion ||
+      header[1] < 0 || header[2] < 0 || header[3] < 0 ||
+      (header[5] != 8 && header[5] != 16)) {
+    Error("Not a valid quantized data file: " + file_path);
+    return false;
+  }
+  num_rows = header[1];
+  num_cols = header[2];
+  num_bands = header[3];
+  interleave_format = static_cast<HSIDataInterleaveFormat>(header[4]);
+  bits = header[5];
+  band_scales.resize(num_bands);
+  band_offsets.resize(num_bands);
+  codes.resize(static_cast<long>(NumDataPoints()) * (bits / 8));
+  data_file.read(
+      reinterpret_cast<char*>(band_scales.data()), num_bands * sizeof(float));
+  data_file.read(
+      reinterpret_cast<char*>(band_offsets.data()), num_bands * sizeof(float));
+  data_file.read(reinterpret_cast<char*>(codes.data()), codes.size());
+  if (!data_file.good()) {
+    Error("Quantized data file is incomplete: " + file_path);
+    return false;
+  }
+  return true;
+}
+
+/*******************************************************************************
+*** Quantization
+*******************************************************************************/
+
+HSIQuantizedData QuantizeData(
+    const HSIDataView& data_view, const HSIQuantizationOptions& options) {
+
+  HSIData materialized_data;
+  const HSIData& hsi_data = data_view.GetCompactData(&materialized_data);
+
+  std::vector<BandStats> band_stats(hsi_data.num_bands);
+  AddDataToBandStats(hsi_data, &band_stats);
+  HSIQuantizedData quantized_data;
+  InitializeQuantizedData(
+      hsi_data.num_rows,
+      hsi_data.num_cols,
+      band_stats,
+      hsi_data.interleave_format,
+      options,
+      &quantized_data);
+  QuantizeRows(hsi_data, 0, &quantized_data);
+  return quantized_data;
+}
+
+HSIQuantizedData ReadQuantizedData(
+    const HSIDataRange& data_range,
+    const HSIQuantizationOptions& options,
+    HSIDataReader* reader) {
+
+  const int num_rows = data_range.end_row - data_range.start_row;
+  const int num_cols = data_range.end_col - data_range.start_col;
+  const int num_bands = data_range.end_band - data_range.start_band;
+  const int tile_rows = std::max(1, options.tile_rows);
+
+  // First pass: the band statistics.
+  std::vector<BandStats> band_stats(num_bands);
+  HSIDataRange tile_range = data_range;
+  for (int row = data_range.start_row; row < data_range.end_row;
+       row += tile_rows) {
+    tile_range.start_row = row;
+    tile_range.end_row = std::min(row + tile_rows, data_range.end_row);
+    reader->ReadData(tile_range);
+    AddDataToBandStats(reader->GetData(), &band_stats);
+  }
+
+  HSIQuantizedData quantized_data;
+  InitializeQuantizedData(
+      num_rows,
+      num_cols,
+      band_stats,
+      reader->GetOptions().GetInMemoryInterleaveFormat(),
+      options,
+      &quantized_data);
+
+  // Second pass: quantize the tiles.
+  for (int row = data_range.start_row; row < data_range.end_row;
+       row += tile_rows) {
+    tile_range.start_row = row;
+    tile_range.end_row = std::min(row + tile_rows, data_range.end_row);
+    reader->ReadData(tile_range);
+    QuantizeRows(
+        reader->GetData(), row - data_range.start_row, &quantized_data);
+  }
+  return quantized_data;
+}
+
+}  // namespace hsi
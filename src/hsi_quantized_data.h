@@ -0,0 +1,100 @@
+// Provides a compact, quantized representation of hyperspectral data. Each
+// band is linearly mapped to 8-bit (or 16-bit) unsigned codes with its own
+// scale and offset, derived from the statistics of that band:
+//
+//   value = code * band_scales[band] + band_offsets[band]
+//
+// 8-bit codes take a quarter of the memory of float data, which is enough for
+// visualization and approximate features. Values outside of the quantized
+// range of a band are clipped.
+
+#ifndef SRC_HSI_QUANTIZED_DATA_H_
+#define SRC_HSI_QUANTIZED_DATA_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "./hsi_data_reader.h"
+#include "./hsi_data_view.h"
+
+namespace hsi {
+
+// Options that control how the data is quantized.
+struct HSIQuantizationOptions {
+  // The number of bits per code: 8 or 16.
+  int bits = 8;
+
+  // If positive, the quantized range of each band is clipped to this many
+  // standard deviations around the band mean (and to the band's minimum and
+  // maximum). Otherwise, the range spans the band's minimum to maximum, so no
+  // values are clipped.
+  double clip_std_devs = 0;
+
+  // The number of rows read at a time by ReadQuantizedData().
+  int tile_rows = 64;
+};
+
+// Quantized hyperspectral data. The codes are stored in the same index order
+// as HSIData with the given interleave format.
+struct HSIQuantizedData {
+  int num_rows = 0;
+  int num_cols = 0;
+  int num_bands = 0;
+  HSIDataInterleaveFormat interleave_format = HSI_INTERLEAVE_BSQ;
+
+  // The number of bits per code: 8 or 16.
+  int bits = 8;
+
+  // The dequantization parameters of each band.
+  std::vector<float> band_scales;
+  std::vector<float> band_offsets;
+
+  // The codes, as bytes. 16-bit codes use two bytes in machine byte order.
+  std::vector<uint8_t> codes;
+
+  int NumDataPoints() const {
+    return num_rows * num_cols * num_bands;
+  }
+
+  // Returns the code at the given position. Indices are zero-indexed as in
+  // HSIData::GetValue().
+  int GetCode(const int row, const int col, const int band) const;
+
+  // Returns the dequantized value at the given position.
+  double GetValueAsDouble(const int row, const int col, const int band) const;
+
+  // Returns the dequantized spectrum of the pixel at the given row and col.
+  std::vector<double> GetSpectrumAsDoubles(const int row, const int col) const;
+
+  // Writes the dequantized image of the given band (num_rows * num_cols
+  // values in row-major order) to band_values.
+  void GetBandAsFloats(const int band, float* band_values) const;
+
+  // Returns the dequantized data as floats.
+  HSIData Dequantize() const;
+
+  // Saves the quantized data to, or loads it from, a binary file. Returns
+  // true on success.
+  bool Save(const std::string& file_path) const;
+  bool Load(const std::string& file_path);
+};
+
+// Quantizes data that is already in memory, given as a view (or as HSIData).
+// The band statistics are computed from the values of the view itself.
+HSIQuantizedData QuantizeData(
+    const HSIDataView& data_view, const HSIQuantizationOptions& options);
+
+// Reads the given range from the reader and quantizes it while reading, one
+// tile of rows at a time, so the full range is never held at full precision.
+// The range is read twice: the first pass computes the band statistics, and
+// the second pass quantizes the tiles. The codes keep the in-memory interleave
+// format of the reader.
+HSIQuantizedData ReadQuantizedData(
+    const HSIDataRange& data_range,
+    const HSIQuantizationOptions& options,
+    HSIDataReader* reader);
+
+}  // namespace hsi
+
+#endif  // SRC_HSI_QUANTIZED_DATA_H_
@@ -0,0 +1,298 @@
+#include "./hsi_roi.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+namespace hsi {
+namespace {
+
+// Returns the spans sorted by row and column, with overlapping and adjacent
+// spans in the same row merged and empty spans removed.
+std::vector<HSIRowSpan> NormalizeSpans(std::vector<HSIRowSpan> spans) {
+  std::sort(
+      spans.begin(),
+      spans.end(),
+      [](const HSIRowSpan& first, const HSIRowSpan& second) {
+        return (first.row != second.row) ?
+            first.row < second.row : first.start_col < second.start_col;
+      });
+  std::vector<HSIRowSpan> normalized_spans;
+  for (const HSIRowSpan& span : spans) {
+    if (span.end_col <= span.start_col) {
+      continue;
+    }
+    if (!normalized_spans.empty() &&
+        normalized_spans.back().row == span.row &&
+        normalized_spans.back().end_col >= span.start_col) {
+      normalized_spans.back().end_col =
+          std::max(normalized_spans.back().end_col, span.end_col);
+      continue;
+    }
+    normalized_spans.push_back(span);
+  }
+  return normalized_spans;
+}
+
+// Appends a run of values to the list of runs.
+void AddRun(
+    const long file_index,
+    const long num_values,
+    const long destination_index,
+    std::vector<HSIValueRun>* runs) {
+
+  HSIValueRun run;
+  run.file_index = file_index;
+  run.num_values = num_values;
+  run.destination_index = destination_index;
+  runs->push_back(run);
+}
+
+}  // namespace
+
+std::vector<HSIRowSpan> RasterizePolygon(
+    const std::vector<HSIPolygonVertex>& polygon,
+    const int num_rows,
+    const int num_cols) {
+
+  std::vector<HSIRowSpan> spans;
+  if (polygon.size() < 3) {
+    return spans;
+  }
+  double min_row = polygon[0].row;
+  double max_row = polygon[0].row;
+  for (const HSIPolygonVertex& vertex : polygon) {
+    min_row = std::min(min_row, vertex.row);
+    max_row = std::max(max_row, vertex.row);
+  }
+  const int start_row = std::max(0, static_cast<int>(std::floor(min_row)));
+  const int end_row =
+      std::min(num_rows, static_cast<int>(std::ceil(max_row)));
+
+  // Scan each row through the pixel centers, and fill between pairs of edge
+  // crossings.
+  std::vector<double> crossings;
+  for (int row = start_row; row < end_row; ++row) {
+    const double y = row + 0.5;
+    crossings.clear();
+    for (size_t i = 0; i < polygon.size(); ++i) {
+      const HSIPolygonVertex& first = polygon[i];
+      const HSIPolygonVertex& second = polygon[(i + 1) % polygon.size()];
+      if ((first.row <= y) != (second.row <= y)) {
+        crossings.push_back(
+            first.col + (y - first.row) * (second.col - first.col) /
+                (second.row - first.row));
+      }
+    }
+    std::sort(crossings.begin(), crossings.end());
+    for (size_t i = 0; i + 1 < crossings.size(); i += 2) {
+      // Pixels whose centers (col + 0.5) are from the first crossing up to
+      // the second.
+      HSIRowSpan span;
+      span.row = row;
+      span.start_col = std::max(
+          0, static_cast<int>(std::ceil(crossings[i] - 0.5)));
+      span.end_col = std::min(
+          num_cols, static_cast<int>(std::ceil(crossings[i + 1] - 0.5)));
+      if (span.end_col > span.start_col) {
+        spans.push_back(span);
+      }
+    }
+  }
+  return spans;
+}
+
+std::vector<HSIRowSpan> GetLabelSpans(
+    const HSIData& label_data, const double label) {
+
+  if (label_data.num_bands != 1) {
+    FatalError("Label rasters must have a single band.");
+  }
+  // With a single band, all interleave formats store the labels row by row.
+  const HSIData labels =
+      ConvertData(label_data, HSI_DATA_TYPE_DOUBLE, HSI_INTERLEAVE_BSQ);
+  const double* label_values =
+      reinterpret_cast<const double*>(labels.raw_data.data());
+  std::vector<HSIRowSpan> spans;
+  for (int row = 0; row < labels.num_rows; ++row) {
+    const double* row_labels =
+        label_values + static_cast<long>(row) * labels.num_cols;
+    int col = 0;
+    while (col < labels.num_cols) {
+      if (row_labels[col] != label) {
+        ++col;
+        continue;
+      }
+      HSIRowSpan span;
+      span.row = row;
+      span.start_col = col;
+      while (col < labels.num_cols && row_labels[col] == label) {
+        ++col;
+      }
+      span.end_col = col;
+      spans.push_back(span);
+    }
+  }
+  return spans;
+}
+
+std::vector<HSIRowSpan> GetDataSpans(
+    const HSIDataOptions& data_options,
+    const std::vector<HSIRowSpan>& image_spans) {
+
+  // Split the spans of samples where they wrap around rows of the data, which
+  // only happens for BSQ data.
+  std::vector<HSIRowSpan> spans;
+  for (const HSIRowSpan& image_span : image_spans) {
+    if (image_span.row < 0 || image_span.row >= data_options.GetNumLines() ||
+        image_span.start_col < 0 ||
+        image_span.end_col > data_options.GetNumSamples()) {
+      FatalError("ROI span is outside of the image.");
+    }
+    int sample = image_span.start_col;
+    while (sample < image_span.end_col) {
+      HSIRowSpan span;
+      data_options.GetPixelPosition(
+          sample, image_span.row, &span.row, &span.start_col);
+      span.end_col = std::min(
+          span.start_col + image_span.end_col - sample,
+          data_options.num_data_cols);
+      sample += span.end_col - span.start_col;
+      spans.push_back(span);
+    }
+  }
+  std::sort(
+      spans.begin(),
+      spans.end(),
+      [](const HSIRowSpan& first, const HSIRowSpan& second) {
+        return (first.row != second.row) ?
+            first.row < second.row : first.start_col < second.start_col;
+      });
+  return spans;
+}
+
+HSIROIData ReadROI(
+    const std::vector<HSIRowSpan>& spans,
+    const HSIROIReadOptions& options,
+    const HSIDataReader& reader) {
+
+  const HSIDataOptions& data_options = reader.GetOptions();
+  const int start_band = options.start_band;
+  const int end_band =
+      (options.end_band > 0) ? options.end_band : data_options.num_data_bands;
+  if (start_band < 0 || end_band > data_options.num_data_bands ||
+      end_band <= start_band) {
+    FatalError("Invalid band range: must be between 0 and " +
+               std::to_string(data_options.num_data_bands));
+  }
+  const std::vector<HSIRowSpan> roi_spans = NormalizeSpans(spans);
+  HSIROIData roi_data;
+  for (const HSIRowSpan& span : roi_spans) {
+    if (span.row < 0 || span.row >= data_options.num_data_rows ||
+        span.start_col < 0 || span.end_col > data_options.num_data_cols) {
+      FatalError("ROI span is outside of the data.");
+    }
+    for (int col = span.start_col; col < span.end_col; ++col) {
+      roi_data.rows.push_back(span.row);
+      roi_data.cols.push_back(col);
+    }
+  }
+
+  // The pixels are read as one row of pixels, in the interleave format of
+  // the file (for a single row, BSQ and BIL are both band by band), so the
+  // values of each span are contiguous in both the file and memory. Runs are
+  // added in file order.
+  long row_stride;
+  long col_stride;
+  long band_stride;
+  GetInterleaveStrides(
+      data_options.interleave_format,
+      data_options.num_data_rows,
+      data_options.num_data_cols,
+      data_options.num_data_bands,
+      &row_stride,
+      &col_stride,
+      &band_stride);
+  const long num_pixels = roi_data.rows.size();
+  const int num_bands = end_band - start_band;
+  std::vector<long> span_pixel_offsets;
+  long pixel_offset = 0;
+  for (const HSIRowSpan& span : roi_spans) {
+    span_pixel_offsets.push_back(pixel_offset);
+    pixel_offset += span.end_col - span.start_col;
+  }
+  std::vector<HSIValueRun> runs;
+  if (data_options.interleave_format == HSI_INTERLEAVE_BSQ) {
+    for (int band = start_band; band < end_band; ++band) {
+      for (size_t i = 0; i < roi_spans.size(); ++i) {
+        const HSIRowSpan& span = roi_spans[i];
+        AddRun(
+            band * band_stride + span.row * row_stride + span.start_col,
+            span.end_col - span.start_col,
+            (band - start_band) * num_pixels + span_pixel_offsets[i],
+            &runs);
+      }
+    }
+  } else if (data_options.interleave_format == HSI_INTERLEAVE_BIL) {
+    // The spans of each row are read band by band.
+    size_t first_span = 0;
+    while (first_span < roi_spans.size()) {
+      size_t end_span = first_span;
+      while (end_span < roi_spans.size() &&
+             roi_spans[end_span].row == roi_spans[first_span].row) {
+        ++end_span;
+      }
+      for (int band = start_band; band < end_band; ++band) {
+        for (size_t i = first_span; i < end_span; ++i) {
+          const HSIRowSpan& span = roi_spans[i];
+          AddRun(
+              span.row * row_stride + band * band_stride + span.start_col,
+              span.end_col - span.start_col,
+              (band - start_band) * num_pixels + span_pixel_offsets[i],
+              &runs);
+        }
+      }
+      first_span = end_span;
+    }
+  } else if (start_band == 0 && end_band == data_options.num_data_bands) {
+    // Whole BIP spectra are contiguous along the span.
+    for (size_t i = 0; i < roi_spans.size(); ++i) {
+      const HSIRowSpan& span = roi_spans[i];
+      AddRun(
+          span.row * row_stride + span.start_col * col_stride,
+          static_cast<long>(span.end_col - span.start_col) * num_bands,
+          span_pixel_offsets[i] * num_bands,
+          &runs);
+    }
+  } else {
+    for (size_t i = 0; i < roi_spans.size(); ++i) {
+      const HSIRowSpan& span = roi_spans[i];
+      for (int col = span.start_col; col < span.end_col; ++col) {
+        AddRun(
+            span.row * row_stride + col * col_stride + start_band,
+            num_bands,
+            (span_pixel_offsets[i] + col - span.start_col) * num_bands,
+            &runs);
+      }
+    }
+  }
+
+  HSIData& spectra = roi_data.spectra;
+  spectra.num_rows = 1;
+  spectra.num_cols = num_pixels;
+  spectra.num_bands = num_bands;
+  spectra.interleave_format = data_options.interleave_format;
+  spectra.data_type = GetUnpackedDataType(data_options.data_type);
+  spectra.raw_data.resize(
+      static_cast<long>(spectra.NumDataPoints()) *
+      GetDataSize(spectra.data_type));
+  reader.ReadValueRuns(runs, options.max_gap_bytes, spectra.raw_data.data());
+  ConvertToInMemoryFormat(data_options, &spectra);
+  if (spectra.interleave_format != HSI_INTERLEAVE_BIP) {
+    spectra = ConvertData(spectra, spectra.data_type, HSI_INTERLEAVE_BIP);
+  }
+  return roi_data;
+}
+
+}  // namespace hsi
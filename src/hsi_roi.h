@@ -0,0 +1,92 @@
+// Provides reads of irregular regions of interest (ROIs), such as polygons or
+// the pixels of a label raster. An ROI is described by the spans of columns
+// that it covers in each row, and only those spans are read from the file, so
+// the amount of data read scales with the area of the ROI instead of its
+// bounding box. Spans that are close together in the file are read together.
+//
+// Polygons and label rasters describe the image, whose rows are lines and
+// whose columns are samples, while reads take spans of the rows and columns of
+// the data. These differ for BSQ files, whose data rows are not image lines
+// (see HSIDataOptions::GetPixelPosition()), so image spans are mapped to the
+// data with GetDataSpans() before they are read.
+
+#ifndef SRC_HSI_ROI_H_
+#define SRC_HSI_ROI_H_
+
+#include <vector>
+
+#include "./hsi_data_reader.h"
+
+namespace hsi {
+
+// The columns start_col to end_col (non-inclusive) of a row.
+struct HSIRowSpan {
+  int row = 0;
+  int start_col = 0;
+  int end_col = 0;
+};
+
+// A polygon vertex in pixel coordinates, where pixel (r, c) covers rows r to
+// r + 1 and columns c to c + 1.
+struct HSIPolygonVertex {
+  double row = 0;
+  double col = 0;
+};
+
+struct HSIROIReadOptions {
+  // The bands to read. An end_band of 0 reads through the last band.
+  int start_band = 0;
+  int end_band = 0;
+
+  // Spans separated by at most this many bytes in the file are read with one
+  // read, instead of seeking over the gap between them.
+  long max_gap_bytes = 64 * 1024;
+};
+
+// The pixels of an ROI.
+struct HSIROIData {
+  // The data row and column of each pixel, in row-major order.
+  std::vector<int> rows;
+  std::vector<int> cols;
+
+  // The spectra of the pixels, as one row of pixels in the BIP interleave
+  // format (so each spectrum is contiguous), with the in-memory data type of
+  // the reader's options. Column i is the pixel at rows[i] and cols[i].
+  HSIData spectra;
+};
+
+// Returns the spans of the pixels whose centers are inside the polygon (by
+// the even-odd rule), clipped to num_rows and num_cols. The polygon is closed
+// from its last vertex back to its first. For a polygon in the image, the
+// rows and columns are the lines and samples of the image.
+std::vector<HSIRowSpan> RasterizePolygon(
+    const std::vector<HSIPolygonVertex>& polygon,
+    const int num_rows,
+    const int num_cols);
+
+// Returns the spans of the pixels of a single-band label raster that have the
+// given label, in the rows and columns of the label data. For a label raster
+// of the lines and samples of the image, these are image spans.
+std::vector<HSIRowSpan> GetLabelSpans(
+    const HSIData& label_data, const double label);
+
+// Returns the spans of the data rows and columns that hold the pixels of the
+// given spans of image lines (as rows) and samples (as columns), sorted by row
+// and column. The spans are the same for BIL and BIP data, and each line span
+// may be split at the ends of data rows for BSQ data. Fatal error if a span is
+// outside of the image.
+std::vector<HSIRowSpan> GetDataSpans(
+    const HSIDataOptions& data_options,
+    const std::vector<HSIRowSpan>& image_spans);
+
+// Reads the pixels of the given spans of data rows and columns (see
+// GetDataSpans() for spans of the image), which may be in any order and may
+// overlap. All spans must be within the data size of the reader's options.
+HSIROIData ReadROI(
+    const std::vector<HSIRowSpan>& spans,
+    const HSIROIReadOptions& options,
+    const HSIDataReader& reader);
+
+}  // namespace hsi
+
+#endif  // SRC_HSI_ROI_H_
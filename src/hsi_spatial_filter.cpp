@@ -0,0 +1,305 @@
+#include "./hsi_spatial_filter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "./hsi_parallel.h"
+#include "./hsi_weighted_sum.h"
+
+namespace hsi {
+namespace {
+
+// The number of rows filtered at a time. The row-filtered values of
+// a strip (and the rows around it) are kept in the cache for the column pass.
+constexpr int kStripRows = 32;
+
+// Returns the kernel to apply, where an empty kernel is the identity.
+std::vector<float> GetKernelOrIdentity(const std::vector<float>& kernel) {
+  if (kernel.empty()) {
+    return std::vector<float>(1, 1.0f);
+  }
+  if (kernel.size() % 2 == 0) {
+    FatalError("Spatial filter kernel sizes must be odd.");
+  }
+  return kernel;
+}
+
+// The layout of the values filtered together: rows of num_lines lines, each
+// with num_cols elements of num_channels consecutive values. BSQ band planes
+// have one line of one channel, BIL rows have one line for each band, and BIP
+// rows have one line of pixels with one channel for each band.
+struct PlaneLayout {
+  int num_rows = 0;
+  int num_cols = 0;
+  int num_lines = 1;
+  int num_channels = 1;
+  long row_stride = 0;
+
+  long line_length() const {
+    return static_cast<long>(num_cols) * num_channels;
+  }
+
+  long row_length() const {
+    return line_length() * num_lines;
+  }
+};
+
+// Scratch space for filtering strips.
+struct StripBuffers {
+  std::vector<float> padded_line;
+  std::vector<float> row_filtered_values;
+  std::vector<const float*> inputs;
+};
+
+// Filters rows start_row to end_row of a plane, where values and
+// filtered_values point to its first value.
+void FilterStrip(
+    const float* values,
+    const PlaneLayout& layout,
+    const int start_row,
+    const int end_row,
+    const std::vector<float>& row_kernel,
+    const std::vector<float>& col_kernel,
+    float* filtered_values,
+    StripBuffers* buffers) {
+
+  const int row_radius = row_kernel.size() / 2;
+  const int col_radius = col_kernel.size() / 2;
+  const int first_row = std::max(0, start_row - col_radius);
+  const int last_row = std::min(layout.num_rows, end_row + col_radius);
+  const int num_channels = layout.num_channels;
+  const long line_length = layout.line_length();
+  const long row_length = layout.row_length();
+
+  // Row pass, over the strip and the rows around it. Each line is copied with
+  // its edge elements repeated, so the kernel always applies to whole windows,
+  // and the kernel taps are shifted copies of the padded line.
+  buffers->padded_line.resize(line_length + 2 * row_radius * num_channels);
+  buffers->row_filtered_values.resize((last_row - first_row) * row_length);
+  buffers->inputs.resize(std::max(row_kernel.size(), col_kernel.size()));
+  float* padded_line = buffers->padded_line.data();
+  float* padded_values = padded_line + row_radius * num_channels;
+  for (int i = 0; i < static_cast<int>(row_kernel.size()); ++i) {
+    buffers->inputs[i] = padded_line + i * num_channels;
+  }
+  for (int row = first_row; row < last_row; ++row) {
+    for (int line = 0; line < layout.num_lines; ++line) {
+      const float* line_values =
+          values + row * layout.row_stride + line * line_length;
+      std::copy(line_values, line_values + line_length, padded_values);
+      for (int i = 1; i <= row_radius; ++i) {
+        std::copy(
+            line_values,
+            line_values + num_channels,
+            padded_values - i * num_channels);
+        std::copy(
+            line_values + line_length - num_channels,
+            line_values + line_length,
+            padded_values + line_length + (i - 1) * num_channels);
+      }
+      WeightedSum(
+          buffers->inputs.data(),
+          row_kernel.data(),
+          row_kernel.size(),
+          line_length,
+          buffers->row_filtered_values.data() +
+              (row - first_row) * row_length + line * line_length);
+    }
+  }
+
+  // Column pass, which combines whole rows at once.
+  for (int row = start_row; row < end_row; ++row) {
+    for (int i = 0; i < static_cast<int>(col_kernel.size()); ++i) {
+      const int input_row =
+          std::min(std::max(row - col_radius + i, 0), layout.num_rows - 1);
+      buffers->inputs[i] = buffers->row_filtered_values.data() +
+          (input_row - first_row) * row_length;
+    }
+    WeightedSum(
+        buffers->inputs.data(),
+        col_kernel.data(),
+        col_kernel.size(),
+        row_length,
+        filtered_values + row * layout.row_stride);
+  }
+}
+
+// Returns num_rows rows of the data, starting at start_row.
+HSIData GetRows(
+    const HSIData& hsi_data, const int start_row, const int num_rows) {
+
+  HSIData rows_data;
+  rows_data.num_rows = num_rows;
+  rows_data.num_cols = hsi_data.num_cols;
+  rows_data.num_bands = hsi_data.num_bands;
+  rows_data.interleave_format = hsi_data.interleave_format;
+  rows_data.data_type = hsi_data.data_type;
+  const long row_bytes = static_cast<long>(hsi_data.num_cols) *
+      GetDataSize(hsi_data.data_type);
+  if (hsi_data.interleave_format == HSI_INTERLEAVE_BSQ) {
+    // Copy the rows of each band plane.
+    for (int band = 0; band < hsi_data.num_bands; ++band) {
+      const auto band_rows = hsi_data.raw_data.begin() +
+          (static_cast<long>(band) * hsi_data.num_rows + start_row) *
+              row_bytes;
+      rows_data.raw_data.insert(
+          rows_data.raw_data.end(),
+          band_rows,
+          band_rows + num_rows * row_bytes);
+    }
+  } else {
+    const long pixel_row_bytes = row_bytes * hsi_data.num_bands;
+    rows_data.raw_data.assign(
+        hsi_data.raw_data.begin() + start_row * pixel_row_bytes,
+        hsi_data.raw_data.begin() + (start_row + num_rows) * pixel_row_bytes);
+  }
+  return rows_data;
+}
+
+}  // namespace
+
+std::vector<float> GetGaussianKernel(const double sigma, int radius) {
+  if (sigma <= 0) {
+    FatalError("The Gaussian standard deviation must be positive.");
+  }
+  if (radius <= 0) {
+    radius = static_cast<int>(std::ceil(3 * sigma));
+  }
+  std::vector<float> kernel(2 * radius + 1);
+  double sum = 0;
+  for (int i = -radius; i <= radius; ++i) {
+    const double weight = std::exp(-0.5 * i * i / (sigma * sigma));
+    kernel[i + radius] = weight;
+    sum += weight;
+  }
+  for (float& weight : kernel) {
+    weight /= sum;
+  }
+  return kernel;
+}
+
+std::vector<float> GetBoxKernel(const int size) {
+  if (size <= 0 || size % 2 == 0) {
+    FatalError("The box kernel size must be odd.");
+  }
+  return std::vector<float>(size, 1.0f / size);
+}
+
+HSIData FilterBands(
+    const HSIDataView& data_view, const HSISpatialFilterOptions& options) {
+
+  HSIData materialized_data;
+  const HSIData& hsi_data = data_view.GetCompactData(&materialized_data);
+
+  const std::vector<float> row_kernel =
+      GetKernelOrIdentity(options.row_kernel);
+  const std::vector<float> col_kernel =
+      GetKernelOrIdentity(options.col_kernel);
+
+  // Filter float values without copying them first.
+  HSIData float_data;
+  if (hsi_data.data_type != HSI_DATA_TYPE_FLOAT) {
+    float_data = ConvertData(
+        hsi_data, HSI_DATA_TYPE_FLOAT, hsi_data.interleave_format);
+  }
+  const float* values = reinterpret_cast<const float*>(
+      (hsi_data.data_type == HSI_DATA_TYPE_FLOAT) ?
+      hsi_data.raw_data.data() : float_data.raw_data.data());
+
+  HSIData filtered_data;
+  filtered_data.num_rows = hsi_data.num_rows;
+  filtered_data.num_cols = hsi_data.num_cols;
+  filtered_data.num_bands = hsi_data.num_bands;
+  filtered_data.interleave_format = hsi_data.interleave_format;
+  filtered_data.data_type = HSI_DATA_TYPE_FLOAT;
+  filtered_data.raw_data.resize(
+      static_cast<long>(hsi_data.NumDataPoints()) * sizeof(float));
+  if (hsi_data.NumDataPoints() == 0) {
+    return filtered_data;
+  }
+  float* filtered_values =
+      reinterpret_cast<float*>(filtered_data.raw_data.data());
+
+  // BSQ bands are filtered separately; BIL and BIP bands are filtered
+  // together, along whole rows of the data.
+  PlaneLayout layout;
+  layout.num_rows = hsi_data.num_rows;
+  layout.num_cols = hsi_data.num_cols;
+  int num_planes = 1;
+  long plane_stride = 0;
+  switch (hsi_data.interleave_format) {
+    case HSI_INTERLEAVE_BSQ:
+      layout.row_stride = hsi_data.num_cols;
+      num_planes = hsi_data.num_bands;
+      plane_stride = static_cast<long>(hsi_data.num_rows) * hsi_data.num_cols;
+      break;
+    case HSI_INTERLEAVE_BIL:
+      layout.num_lines = hsi_data.num_bands;
+      layout.row_stride = layout.row_length();
+      break;
+    case HSI_INTERLEAVE_BIP:
+    default:
+      layout.num_channels = hsi_data.num_bands;
+      layout.row_stride = layout.row_length();
+      break;
+  }
+  const int num_strips = (hsi_data.num_rows + kStripRows - 1) / kStripRows;
+  ParallelFor(
+      0, static_cast<long>(num_planes) * num_strips, options.num_threads, 1,
+      [&](const long begin, const long end) {
+        StripBuffers buffers;
+        for (long strip = begin; strip < end; ++strip) {
+          const long plane_offset = (strip / num_strips) * plane_stride;
+          const int start_row = (strip % num_strips) * kStripRows;
+          FilterStrip(
+              values + plane_offset,
+              layout,
+              start_row,
+              std::min(start_row + kStripRows, hsi_data.num_rows),
+              row_kernel,
+              col_kernel,
+              filtered_values + plane_offset,
+              &buffers);
+        }
+      });
+  return filtered_data;
+}
+
+void ReadFilteredBands(
+    const HSIDataRange& data_range,
+    const HSISpatialFilterOptions& options,
+    HSIDataReader* reader,
+    const FilteredRowsCallback& callback) {
+
+  const HSIDataOptions& data_options = reader->GetOptions();
+  const bool is_bsq = (data_options.interleave_format == HSI_INTERLEAVE_BSQ);
+  const int col_radius = options.col_kernel.size() / 2;
+  const int tile_rows = std::max(1, options.tile_rows);
+  HSIDataRange tile_range = data_range;
+  for (int row = data_range.start_row; row < data_range.end_row;
+       row += tile_rows) {
+    // Read the rows that the column kernel needs around the tile. The rows of
+    // BSQ files are not image lines, so their tiles are read as the whole
+    // data rows that hold the lines, and reshaped into planes of lines.
+    const int end_row = std::min(row + tile_rows, data_range.end_row);
+    tile_range.start_row = std::max(row - col_radius, data_range.start_row);
+    tile_range.end_row = std::min(end_row + col_radius, data_range.end_row);
+    HSIData filtered_data;
+    if (is_bsq) {
+      reader->ReadData(GetBSQImageDataRange(data_options, tile_range));
+      filtered_data = FilterBands(
+          GetBSQImageRange(
+              data_options, tile_range, reader->GetData(), HSI_INTERLEAVE_BSQ),
+          options);
+    } else {
+      reader->ReadData(tile_range);
+      filtered_data = FilterBands(reader->GetData(), options);
+    }
+    callback(
+        GetRows(filtered_data, row - tile_range.start_row, end_row - row),
+        row - data_range.start_row);
+  }
+}
+
+}  // namespace hsi
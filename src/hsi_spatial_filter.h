@@ -0,0 +1,73 @@
+// Provides separable spatial (2D) filtering of each band of hyperspectral
+// data, such as Gaussian or box smoothing, or derivative kernels for edges.
+// Each band is filtered with a row kernel (along the columns of each row) and
+// then a column kernel (along the rows of each column). Values beyond the
+// edges of the data repeat the nearest edge value.
+//
+// The filters work on data in any interleave format: BSQ band planes are
+// filtered one at a time, and BIL and BIP bands together along whole rows.
+// Rows are filtered in strips, so that the intermediate rows of the two passes
+// stay in the cache, both passes are vectorized, and the bands and strips are
+// split across multiple threads.
+
+#ifndef SRC_HSI_SPATIAL_FILTER_H_
+#define SRC_HSI_SPATIAL_FILTER_H_
+
+#include <functional>
+#include <vector>
+
+#include "./hsi_data_reader.h"
+#include "./hsi_data_view.h"
+
+namespace hsi {
+
+struct HSISpatialFilterOptions {
+  // The weights applied along each row (horizontally) and along each column
+  // (vertically), centered on the filtered value. Sizes must be odd. An empty
+  // kernel leaves that direction unfiltered. The kernels are applied as a
+  // correlation, that is, without being flipped.
+  std::vector<float> row_kernel;
+  std::vector<float> col_kernel;
+
+  // The number of threads. Zero means one for each hardware thread.
+  int num_threads = 0;
+
+  // The number of rows read at a time by ReadFilteredBands().
+  int tile_rows = 64;
+};
+
+// Returns the normalized Gaussian kernel with the given standard deviation (in
+// pixels). If radius is 0, it is set to 3 standard deviations.
+std::vector<float> GetGaussianKernel(const double sigma, int radius = 0);
+
+// Returns the normalized box (mean) kernel of the given odd size.
+std::vector<float> GetBoxKernel(const int size);
+
+// Returns the filtered data of the view (or of HSIData) as floats, with the
+// size of the view and the interleave format of its data. The rows of the data are filtered as image lines, so data
+// read from BSQ files, whose rows are not lines (see
+// HSIDataOptions::GetPixelPosition()), must be reshaped with
+// GetBSQImageRange() first.
+HSIData FilterBands(
+    const HSIDataView& data_view, const HSISpatialFilterOptions& options);
+
+// Called by ReadFilteredBands() with the filtered rows of each tile, starting
+// at the given row of the range.
+typedef std::function<void(const HSIData& filtered_rows, const int start_row)>
+    FilteredRowsCallback;
+
+// Filters the given range as above, reading one tile of rows at a time (plus
+// the rows around it that the column kernel needs) from the reader, so that
+// scenes larger than memory can be processed. The result is the same as
+// filtering the whole range at once. For BSQ files, the rows and columns of
+// the range are image lines and samples, and the filtered rows are BSQ planes
+// of lines.
+void ReadFilteredBands(
+    const HSIDataRange& data_range,
+    const HSISpatialFilterOptions& options,
+    HSIDataReader* reader,
+    const FilteredRowsCallback& callback);
+
+}  // namespace hsi
+
+#endif  // SRC_HSI_SPATIAL_FILTER_H_
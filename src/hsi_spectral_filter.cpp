@@ -0,0 +1,274 @@
+#include "./hsi_spectral_filter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#include "./hsi_parallel.h"
+#include "./hsi_weighted_sum.h"
+
+namespace hsi {
+namespace {
+
+// The number of values of each band plane filtered at a time for BSQ data,
+// so that the planes of the window stay in the cache.
+constexpr long kFilterBlockSize = 4096;
+
+// The filter weights for each output band.
+class FilterWindows {
+ public:
+  FilterWindows(const HSISpectralFilterOptions& options, const int num_bands)
+      : window_size_(options.window_size), num_bands_(num_bands) {
+
+    const double scale =
+        1.0 / std::pow(options.band_spacing, options.derivative_order);
+    for (int position = 0; position < window_size_; ++position) {
+      const std::vector<double> coefficients = GetSavitzkyGolayCoefficients(
+          options.window_size,
+          options.polynomial_order,
+          options.derivative_order,
+          position);
+      std::vector<float> weights;
+      for (const double coefficient : coefficients) {
+        weights.push_back(coefficient * scale);
+      }
+      weights_.push_back(weights);
+    }
+  }
+
+  int window_size() const {
+    return window_size_;
+  }
+
+  // Returns the first band of the window of the given output band. Windows
+  // are centered on the band, except near the first and last bands.
+  int GetWindowStart(const int band) const {
+    return std::min(
+        std::max(band - window_size_ / 2, 0), num_bands_ - window_size_);
+  }
+
+  const float* GetWeights(const int band) const {
+    return weights_[band - GetWindowStart(band)].data();
+  }
+
+ private:
+  const int window_size_;
+  const int num_bands_;
+  std::vector<std::vector<float>> weights_;
+};
+
+// Filters bands that are stored as planes (or lines) of length values, where
+// consecutive bands are band_stride values apart.
+void FilterBandPlanes(
+    const float* values,
+    const long band_stride,
+    const long length,
+    const int num_bands,
+    const FilterWindows& windows,
+    float* filtered_values) {
+
+  std::vector<const float*> inputs(windows.window_size());
+  for (int band = 0; band < num_bands; ++band) {
+    const int window_start = windows.GetWindowStart(band);
+    for (int i = 0; i < windows.window_size(); ++i) {
+      inputs[i] = values + (window_start + i) * band_stride;
+    }
+    WeightedSum(
+        inputs.data(),
+        windows.GetWeights(band),
+        windows.window_size(),
+        length,
+        filtered_values + band * band_stride);
+  }
+}
+
+// Filters a single contiguous spectrum.
+void FilterSpectrum(
+    const float* spectrum,
+    const int num_bands,
+    const FilterWindows& windows,
+    float* filtered_spectrum) {
+
+  // Bands with a centered window share the same weights, so they are computed
+  // together as shifted copies of the spectrum.
+  const int window_size = windows.window_size();
+  const int half_window = window_size / 2;
+  std::vector<const float*> inputs(window_size);
+  for (int i = 0; i < window_size; ++i) {
+    inputs[i] = spectrum + i;
+  }
+  WeightedSum(
+      inputs.data(),
+      windows.GetWeights(half_window),
+      window_size,
+      num_bands - 2 * half_window,
+      filtered_spectrum + half_window);
+
+  // Bands near the edges.
+  for (int i = 0; i < 2 * half_window; ++i) {
+    const int band = (i < half_window) ? i : num_bands - 2 * half_window + i;
+    const float* window = spectrum + windows.GetWindowStart(band);
+    const float* weights = windows.GetWeights(band);
+    float sum = 0;
+    for (int j = 0; j < window_size; ++j) {
+      sum += weights[j] * window[j];
+    }
+    filtered_spectrum[band] = sum;
+  }
+}
+
+}  // namespace
+
+std::vector<double> GetSavitzkyGolayCoefficients(
+    const int window_size,
+    const int polynomial_order,
+    const int derivative_order,
+    const int position) {
+
+  if (window_size < 1 || polynomial_order < 0 ||
+      polynomial_order >= window_size || derivative_order < 0 ||
+      derivative_order > polynomial_order || position < 0 ||
+      position >= window_size) {
+    FatalError("Invalid Savitzky-Golay filter parameters.");
+  }
+  // Fit the polynomial with x measured from the position, so the derivative
+  // there is derivative_order! times the polynomial coefficient of that
+  // order. The coefficient is row derivative_order of the pseudo-inverse
+  // (A^T A)^-1 A^T of the Vandermonde matrix A, which is computed by solving
+  // (A^T A) z = e (the normal matrix is symmetric).
+  const int num_terms = polynomial_order + 1;
+  std::vector<std::vector<double>> normal_matrix(
+      num_terms, std::vector<double>(num_terms + 1, 0));
+  for (int row = 0; row < num_terms; ++row) {
+    for (int col = 0; col < num_terms; ++col) {
+      for (int i = 0; i < window_size; ++i) {
+        normal_matrix[row][col] += std::pow(i - position, row + col);
+      }
+    }
+    normal_matrix[row][num_terms] = (row == derivative_order) ? 1 : 0;
+  }
+  // Gauss-Jordan elimination with partial pivoting.
+  for (int col = 0; col < num_terms; ++col) {
+    int pivot = col;
+    for (int row = col + 1; row < num_terms; ++row) {
+      if (std::abs(normal_matrix[row][col]) >
+          std::abs(normal_matrix[pivot][col])) {
+        pivot = row;
+      }
+    }
+    std::swap(normal_matrix[col], normal_matrix[pivot]);
+    for (int row = 0; row < num_terms; ++row) {
+      if (row == col) {
+        continue;
+      }
+      const double factor = normal_matrix[row][col] / normal_matrix[col][col];
+      for (int i = col; i <= num_terms; ++i) {
+        normal_matrix[row][i] -= factor * normal_matrix[col][i];
+      }
+    }
+  }
+  double factorial = 1;
+  for (int i = 2; i <= derivative_order; ++i) {
+    factorial *= i;
+  }
+  std::vector<double> coefficients(window_size, 0);
+  for (int i = 0; i < window_size; ++i) {
+    for (int term = 0; term < num_terms; ++term) {
+      const double z =
+          normal_matrix[term][num_terms] / normal_matrix[term][term];
+      coefficients[i] += factorial * z * std::pow(i - position, term);
+    }
+  }
+  return coefficients;
+}
+
+HSIData FilterSpectra(
+    const HSIDataView& data_view, const HSISpectralFilterOptions& options) {
+
+  HSIData materialized_data;
+  const HSIData& hsi_data = data_view.GetCompactData(&materialized_data);
+
+  if (options.window_size % 2 == 0 ||
+      options.window_size > hsi_data.num_bands) {
+    FatalError("The filter window size must be odd and at most the number "
+               "of bands.");
+  }
+  const FilterWindows windows(options, hsi_data.num_bands);
+
+  // Filter float values without copying them first.
+  HSIData float_data;
+  if (hsi_data.data_type != HSI_DATA_TYPE_FLOAT) {
+    float_data = ConvertData(
+        hsi_data, HSI_DATA_TYPE_FLOAT, hsi_data.interleave_format);
+  }
+  const float* values = reinterpret_cast<const float*>(
+      (hsi_data.data_type == HSI_DATA_TYPE_FLOAT) ?
+      hsi_data.raw_data.data() : float_data.raw_data.data());
+
+  HSIData filtered_data;
+  filtered_data.num_rows = hsi_data.num_rows;
+  filtered_data.num_cols = hsi_data.num_cols;
+  filtered_data.num_bands = hsi_data.num_bands;
+  filtered_data.interleave_format = hsi_data.interleave_format;
+  filtered_data.data_type = HSI_DATA_TYPE_FLOAT;
+  filtered_data.raw_data.resize(
+      static_cast<long>(hsi_data.NumDataPoints()) * sizeof(float));
+  float* filtered_values =
+      reinterpret_cast<float*>(filtered_data.raw_data.data());
+
+  const int num_bands = hsi_data.num_bands;
+  const int num_cols = hsi_data.num_cols;
+  const long num_pixels = static_cast<long>(hsi_data.num_rows) * num_cols;
+  switch (hsi_data.interleave_format) {
+    case HSI_INTERLEAVE_BSQ:
+      ParallelFor(
+          0, num_pixels, options.num_threads, kFilterBlockSize,
+          [&](const long begin, const long end) {
+            for (long pixel = begin; pixel < end; pixel += kFilterBlockSize) {
+              FilterBandPlanes(
+                  values + pixel,
+                  num_pixels,
+                  std::min(kFilterBlockSize, end - pixel),
+                  num_bands,
+                  windows,
+                  filtered_values + pixel);
+            }
+          });
+      break;
+    case HSI_INTERLEAVE_BIL:
+      ParallelFor(
+          0, hsi_data.num_rows, options.num_threads, 1,
+          [&](const long begin, const long end) {
+            const long row_size = static_cast<long>(num_cols) * num_bands;
+            for (long row = begin; row < end; ++row) {
+              FilterBandPlanes(
+                  values + row * row_size,
+                  num_cols,
+                  num_cols,
+                  num_bands,
+                  windows,
+                  filtered_values + row * row_size);
+            }
+          });
+      break;
+    case HSI_INTERLEAVE_BIP:
+    default:
+      ParallelFor(
+          0, num_pixels, options.num_threads,
+          std::max(1L, kFilterBlockSize / num_bands),
+          [&](const long begin, const long end) {
+            for (long pixel = begin; pixel < end; ++pixel) {
+              FilterSpectrum(
+                  values + pixel * num_bands,
+                  num_bands,
+                  windows,
+                  filtered_values + pixel * num_bands);
+            }
+          });
+      break;
+  }
+  return filtered_data;
+}
+
+}  // namespace hsi
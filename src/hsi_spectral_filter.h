@@ -0,0 +1,60 @@
+// Provides Savitzky-Golay filtering along the spectral (band) axis of
+// hyperspectral data: smoothing, and first or higher derivatives of the
+// spectra. Each output value is a weighted sum of the values in a window of
+// neighboring bands, where the weights are those of a least-squares
+// polynomial fit to the window.
+//
+// The filters work on data in any interleave format. For BSQ and BIL data,
+// whole band planes (or band lines) are combined at once; for BIP data, the
+// sums run along each spectrum. Both are vectorized, and pixels are split
+// across multiple threads.
+
+#ifndef SRC_HSI_SPECTRAL_FILTER_H_
+#define SRC_HSI_SPECTRAL_FILTER_H_
+
+#include <vector>
+
+#include "./hsi_data_reader.h"
+#include "./hsi_data_view.h"
+
+namespace hsi {
+
+struct HSISpectralFilterOptions {
+  // The number of bands in the window. Must be odd, and at most the number of
+  // bands of the data.
+  int window_size = 7;
+
+  // The order of the fitted polynomial. Must be less than the window size.
+  int polynomial_order = 2;
+
+  // The derivative to compute: 0 for smoothing, 1 for the first derivative,
+  // and so on. Must be at most the polynomial order.
+  int derivative_order = 0;
+
+  // The distance between two bands (e.g. in nanometers), which scales the
+  // derivatives.
+  double band_spacing = 1;
+
+  // The number of threads. Zero means one for each hardware thread.
+  int num_threads = 0;
+};
+
+// Returns the window_size weights that compute the derivative_order
+// derivative, at the given position in the window (from 0 to
+// window_size - 1), of the polynomial of polynomial_order fit to the window
+// values. Positions other than the center are used near the first and last
+// bands, where the window cannot be centered.
+std::vector<double> GetSavitzkyGolayCoefficients(
+    const int window_size,
+    const int polynomial_order,
+    const int derivative_order,
+    const int position);
+
+// Returns the filtered data of the view (or of HSIData) as floats, with the
+// size of the view and the interleave format of its data.
+HSIData FilterSpectra(
+    const HSIDataView& data_view, const HSISpectralFilterOptions& options);
+
+}  // namespace hsi
+
+#endif  // SRC_HSI_SPECTRAL_FILTER_H_
@@ -0,0 +1,820 @@
+#include "./hsi_spectral_index.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include "./hsi_parallel.h"
+#include "./hsi_roi.h"
+#include "./hsi_target_detection.h"
+
+namespace hsi {
+namespace {
+
+const char kIndexFileMagic[4] = {'H', 'S', 'I', 'N'};
+const int32_t kIndexFileVersion = 1;
+
+// The number of codewords of each subspace, so that codes are single bytes.
+constexpr int kCodebookSize = 256;
+
+// The number of arrays that follow the header in the index data.
+constexpr int kNumArrays = 7;
+
+// The number of pixels encoded at a time by each thread.
+constexpr long kPixelBlockSize = 256;
+
+float SquaredDistance(const float* a, const float* b, const int size) {
+  float sum = 0;
+  for (int i = 0; i < size; ++i) {
+    const float difference = a[i] - b[i];
+    sum += difference * difference;
+  }
+  return sum;
+}
+
+// Scales the spectrum to unit length, unless it is all zeros.
+void NormalizeSpectrum(const int num_bands, float* spectrum) {
+  float squared_norm = 0;
+  for (int band = 0; band < num_bands; ++band) {
+    squared_norm += spectrum[band] * spectrum[band];
+  }
+  if (squared_norm > 0) {
+    const float scale = 1 / std::sqrt(squared_norm);
+    for (int band = 0; band < num_bands; ++band) {
+      spectrum[band] *= scale;
+    }
+  }
+}
+
+// Returns the centroids (each num_dims long) with their dimensions as rows, so
+// that the distances to all centroids can be computed together.
+std::vector<float> TransposeCentroids(
+    const float* centroids, const int num_centroids, const int num_dims) {
+
+  std::vector<float> transposed(static_cast<long>(num_centroids) * num_dims);
+  for (int centroid = 0; centroid < num_centroids; ++centroid) {
+    for (int dim = 0; dim < num_dims; ++dim) {
+      transposed[dim * num_centroids + centroid] =
+          centroids[centroid * num_dims + dim];
+    }
+  }
+  return transposed;
+}
+
+// Returns the index of the centroid nearest to the point, given the
+// transposed centroids, using distances (num_centroids long) as scratch space.
+int FindNearestCentroid(
+    const float* point,
+    const float* transposed_centroids,
+    const int num_centroids,
+    const int num_dims,
+    float* distances) {
+
+  std::fill(distances, distances + num_centroids, 0.0f);
+  for (int dim = 0; dim < num_dims; ++dim) {
+    const float value = point[dim];
+    const float* centroid_values = transposed_centroids + dim * num_centroids;
+    for (int centroid = 0; centroid < num_centroids; ++centroid) {
+      const float difference = value - centroid_values[centroid];
+      distances[centroid] += difference * difference;
+    }
+  }
+  return std::min_element(distances, distances + num_centroids) - distances;
+}
+
+// Returns num_centroids centroids of the points (each num_dims long) from
+// Lloyd's k-means iterations, starting from evenly spaced points. Centroids
+// that lose all of their points keep their previous position.
+std::vector<float> ComputeKMeans(
+    const std::vector<float>& points,
+    const int num_dims,
+    const int num_centroids,
+    const int num_iterations,
+    const int num_threads) {
+
+  const long num_points = points.size() / num_dims;
+  std::vector<float> centroids(static_cast<long>(num_centroids) * num_dims);
+  for (int i = 0; i < num_centroids; ++i) {
+    const long point = (num_points >= num_centroids) ?
+        i * num_points / num_centroids : i % num_points;
+    std::copy(
+        points.begin() + point * num_dims,
+        points.begin() + (point + 1) * num_dims,
+        centroids.begin() + i * num_dims);
+  }
+  std::vector<int> assignments(num_points);
+  std::vector<double> sums(centroids.size());
+  std::vector<long> counts(num_centroids);
+  for (int iteration = 0; iteration < num_iterations; ++iteration) {
+    const std::vector<float> transposed_centroids =
+        TransposeCentroids(centroids.data(), num_centroids, num_dims);
+    ParallelFor(
+        0, num_points, num_threads, kPixelBlockSize,
+        [&](const long begin, const long end) {
+          std::vector<float> distances(num_centroids);
+          for (long point = begin; point < end; ++point) {
+            assignments[point] = FindNearestCentroid(
+                &points[point * num_dims],
+                transposed_centroids.data(),
+                num_centroids,
+                num_dims,
+                distances.data());
+          }
+        });
+    std::fill(sums.begin(), sums.end(), 0.0);
+    std::fill(counts.begin(), counts.end(), 0);
+    for (long point = 0; point < num_points; ++point) {
+      const int centroid = assignments[point];
+      counts[centroid]++;
+      for (int dim = 0; dim < num_dims; ++dim) {
+        sums[centroid * num_dims + dim] += points[point * num_dims + dim];
+      }
+    }
+    for (int centroid = 0; centroid < num_centroids; ++centroid) {
+      if (counts[centroid] == 0) {
+        continue;
+      }
+      for (int dim = 0; dim < num_dims; ++dim) {
+        centroids[centroid * num_dims + dim] =
+            sums[centroid * num_dims + dim] / counts[centroid];
+      }
+    }
+  }
+  return centroids;
+}
+
+// Returns the first num_components principal axes of the symmetric n x n
+// matrix (row-major) as the rows of a num_components x n matrix, using cyclic
+// Jacobi rotations.
+std::vector<float> GetPrincipalAxes(
+    std::vector<double> matrix, const int n, const int num_components) {
+
+  std::vector<double> vectors(static_cast<long>(n) * n, 0);
+  for (int i = 0; i < n; ++i) {
+    vectors[i * n + i] = 1;
+  }
+  for (int sweep = 0; sweep < 50; ++sweep) {
+    double off_diagonal = 0;
+    double diagonal = 0;
+    for (int i = 0; i < n; ++i) {
+      diagonal += matrix[i * n + i] * matrix[i * n + i];
+      for (int j = i + 1; j < n; ++j) {
+        off_diagonal += matrix[i * n + j] * matrix[i * n + j];
+      }
+    }
+    if (off_diagonal <= 1e-22 * diagonal) {
+      break;
+    }
+    for (int p = 0; p < n; ++p) {
+      for (int q = p + 1; q < n; ++q) {
+        const double apq = matrix[p * n + q];
+        if (apq == 0) {
+          continue;
+        }
+        // The rotation that zeros matrix[p][q].
+        const double theta =
+            (matrix[q * n + q] - matrix[p * n + p]) / (2 * apq);
+        const double t = (theta >= 0 ? 1 : -1) /
+            (std::abs(theta) + std::sqrt(theta * theta + 1));
+        const double c = 1 / std::sqrt(t * t + 1);
+        const double s = t * c;
+        for (int k = 0; k < n; ++k) {
+          const double akp = matrix[k * n + p];
+          const double akq = matrix[k * n + q];
+          matrix[k * n + p] = c * akp - s * akq;
+          matrix[k * n + q] = s * akp + c * akq;
+        }
+        for (int k = 0; k < n; ++k) {
+          const double apk = matrix[p * n + k];
+          const double aqk = matrix[q * n + k];
+          matrix[p * n + k] = c * apk - s * aqk;
+          matrix[q * n + k] = s * apk + c * aqk;
+        }
+        for (int k = 0; k < n; ++k) {
+          const double vkp = vectors[k * n + p];
+          const double vkq = vectors[k * n + q];
+          vectors[k * n + p] = c * vkp - s * vkq;
+          vectors[k * n + q] = s * vkp + c * vkq;
+        }
+      }
+    }
+  }
+
+  // The eigenvectors are the columns of vectors; order them by decreasing
+  // eigenvalue.
+  std::vector<int> order(n);
+  for (int i = 0; i < n; ++i) {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(), [&](const int a, const int b) {
+    return matrix[a * n + a] > matrix[b * n + b];
+  });
+  std::vector<float> axes(static_cast<long>(num_components) * n);
+  for (int component = 0; component < num_components; ++component) {
+    for (int i = 0; i < n; ++i) {
+      axes[component * n + i] = vectors[i * n + order[component]];
+    }
+  }
+  return axes;
+}
+
+// Reads about max_pixels pixels, on a regular grid over all scenes, and
+// returns their spectra as floats.
+std::vector<float> ReadTrainingSpectra(
+    const std::vector<HSIDataReader*>& scenes,
+    const int num_bands,
+    const long max_pixels) {
+
+  long total_pixels = 0;
+  for (const HSIDataReader* scene : scenes) {
+    total_pixels += static_cast<long>(scene->GetOptions().num_data_rows) *
+        scene->GetOptions().num_data_cols;
+  }
+  const double ratio =
+      static_cast<double>(total_pixels) / std::max(1L, max_pixels);
+  int row_step = 1;
+  int col_step = 1;
+  if (ratio > 1) {
+    row_step = std::max(1, static_cast<int>(std::sqrt(ratio)));
+    col_step = std::max(1, static_cast<int>(std::ceil(ratio / row_step)));
+  }
+
+  std::vector<float> spectra;
+  std::vector<int> rows;
+  std::vector<int> cols;
+  for (HSIDataReader* scene : scenes) {
+    const HSIDataOptions& scene_options = scene->GetOptions();
+    HSIDataRange row_range;
+    row_range.start_col = 0;
+    row_range.end_col = scene_options.num_data_cols;
+    row_range.start_band = 0;
+    row_range.end_band = num_bands;
+    cols.clear();
+    for (int col = 0; col < scene_options.num_data_cols; col += col_step) {
+      cols.push_back(col);
+    }
+    rows.assign(cols.size(), 0);
+    for (int row = 0; row < scene_options.num_data_rows; row += row_step) {
+      row_range.start_row = row;
+      row_range.end_row = row + 1;
+      scene->ReadData(row_range);
+      const long offset = spectra.size();
+      spectra.resize(offset + cols.size() * num_bands);
+      scene->GetData().GatherSpectra(
+          rows.data(), cols.data(), cols.size(), &spectra[offset]);
+    }
+  }
+  return spectra;
+}
+
+}  // namespace
+
+HSISpectralIndex::~HSISpectralIndex() {
+  Clear();
+}
+
+void HSISpectralIndex::Clear() {
+  if (mapped_data_ != nullptr) {
+    munmap(mapped_data_, mapped_size_);
+    mapped_data_ = nullptr;
+    mapped_size_ = 0;
+  }
+  buffer_.clear();
+  header_ = nullptr;
+}
+
+int HSISpectralIndex::num_scenes() const {
+  return header_ == nullptr ? 0 : header_->num_scenes;
+}
+
+int HSISpectralIndex::num_bands() const {
+  return header_ == nullptr ? 0 : header_->num_bands;
+}
+
+long HSISpectralIndex::num_pixels() const {
+  return header_ == nullptr ? 0 : header_->num_entries;
+}
+
+long HSISpectralIndex::GetArrayOffsets(const Header& header, long* offsets) {
+  const long num_components = header.num_components;
+  const long sizes[kNumArrays] = {
+      header.num_bands * static_cast<long>(sizeof(float)),
+      num_components * header.num_bands * static_cast<long>(sizeof(float)),
+      header.num_lists * num_components * static_cast<long>(sizeof(float)),
+      kCodebookSize * num_components * static_cast<long>(sizeof(float)),
+      (header.num_lists + 1L) * static_cast<long>(sizeof(int64_t)),
+      header.num_entries * static_cast<long>(sizeof(Entry)),
+      header.num_entries * header.num_subspaces};
+  // Each array starts at a multiple of 8 bytes.
+  long size = sizeof(Header);
+  for (int i = 0; i < kNumArrays; ++i) {
+    size = (size + 7) / 8 * 8;
+    offsets[i] = size;
+    size += sizes[i];
+  }
+  return size;
+}
+
+bool HSISpectralIndex::SetArrays(const char* data, const long data_size) {
+  if (data_size < static_cast<long>(sizeof(Header))) {
+    return false;
+  }
+  const Header* header = reinterpret_cast<const Header*>(data);
+  if (std::memcmp(header->magic, kIndexFileMagic, sizeof(header->magic)) != 0 ||
+      header->version != kIndexFileVersion ||
+      header->num_scenes <= 0 || header->num_bands <= 0 ||
+      header->num_components <= 0 ||
+      header->num_components > header->num_bands ||
+      header->num_lists <= 0 || header->num_subspaces <= 0 ||
+      header->num_components % header->num_subspaces != 0 ||
+      header->num_entries < 0) {
+    return false;
+  }
+  long offsets[kNumArrays];
+  if (GetArrayOffsets(*header, offsets) > data_size) {
+    return false;
+  }
+  header_ = header;
+  mean_ = reinterpret_cast<const float*>(data + offsets[0]);
+  projection_ = reinterpret_cast<const float*>(data + offsets[1]);
+  centroids_ = reinterpret_cast<const float*>(data + offsets[2]);
+  codebooks_ = reinterpret_cast<const float*>(data + offsets[3]);
+  list_offsets_ = reinterpret_cast<const int64_t*>(data + offsets[4]);
+  entries_ = reinterpret_cast<const Entry*>(data + offsets[5]);
+  codes_ = reinterpret_cast<const uint8_t*>(data + offsets[6]);
+  return true;
+}
+
+void HSISpectralIndex::ProjectSpectrum(
+    float* spectrum, float* components) const {
+
+  const int num_bands = header_->num_bands;
+  if (header_->normalize) {
+    NormalizeSpectrum(num_bands, spectrum);
+  }
+  for (int band = 0; band < num_bands; ++band) {
+    spectrum[band] -= mean_[band];
+  }
+  for (int component = 0; component < header_->num_components; ++component) {
+    const float* axis = projection_ + static_cast<long>(component) * num_bands;
+    float sum = 0;
+    for (int band = 0; band < num_bands; ++band) {
+      sum += axis[band] * spectrum[band];
+    }
+    components[component] = sum;
+  }
+}
+
+void HSISpectralIndex::Build(
+    const std::vector<HSIDataReader*>& scenes,
+    const HSISpectralIndexOptions& options) {
+
+  Clear();
+  if (scenes.empty()) {
+    FatalError("The spectral index requires at least one scene.");
+  }
+  const int num_bands = scenes[0]->GetOptions().num_data_bands;
+  long num_entries = 0;
+  for (const HSIDataReader* scene : scenes) {
+    if (scene->GetOptions().num_data_bands != num_bands) {
+      FatalError("All indexed scenes must have the same bands.");
+    }
+    num_entries += static_cast<long>(scene->GetOptions().num_data_rows) *
+        scene->GetOptions().num_data_cols;
+  }
+  const int num_components = std::min(options.num_components, num_bands);
+  const int num_subspaces = options.num_subspaces;
+  if (num_components <= 0 || num_subspaces <= 0 ||
+      num_components % num_subspaces != 0 || options.num_lists <= 0) {
+    FatalError("The components must divide evenly into the subspaces.");
+  }
+  const int subspace_dims = num_components / num_subspaces;
+
+  Header header;
+  std::memcpy(header.magic, kIndexFileMagic, sizeof(header.magic));
+  header.version = kIndexFileVersion;
+  header.num_scenes = scenes.size();
+  header.num_bands = num_bands;
+  header.num_components = num_components;
+  header.num_lists = options.num_lists;
+  header.num_subspaces = num_subspaces;
+  header.normalize = options.normalize;
+  header.num_entries = num_entries;
+  long offsets[kNumArrays];
+  buffer_.assign(GetArrayOffsets(header, offsets), 0);
+  std::memcpy(buffer_.data(), &header, sizeof(header));
+  float* mean = reinterpret_cast<float*>(&buffer_[offsets[0]]);
+  float* projection = reinterpret_cast<float*>(&buffer_[offsets[1]]);
+  float* centroids = reinterpret_cast<float*>(&buffer_[offsets[2]]);
+  float* codebooks = reinterpret_cast<float*>(&buffer_[offsets[3]]);
+  int64_t* list_offsets = reinterpret_cast<int64_t*>(&buffer_[offsets[4]]);
+  Entry* entries = reinterpret_cast<Entry*>(&buffer_[offsets[5]]);
+  uint8_t* codes = reinterpret_cast<uint8_t*>(&buffer_[offsets[6]]);
+
+  // Train the projection onto the principal components of a sample.
+  std::vector<float> training_spectra = ReadTrainingSpectra(
+      scenes, num_bands, options.max_training_pixels);
+  const long num_training = training_spectra.size() / num_bands;
+  if (num_training == 0) {
+    FatalError("The indexed scenes have no pixels.");
+  }
+  if (options.normalize) {
+    for (long pixel = 0; pixel < num_training; ++pixel) {
+      NormalizeSpectrum(num_bands, &training_spectra[pixel * num_bands]);
+    }
+  }
+  HSIData training_data;
+  training_data.num_rows = 1;
+  training_data.num_cols = num_training;
+  training_data.num_bands = num_bands;
+  training_data.interleave_format = HSI_INTERLEAVE_BIP;
+  training_data.data_type = HSI_DATA_TYPE_FLOAT;
+  training_data.raw_data.assign(
+      reinterpret_cast<const char*>(training_spectra.data()),
+      reinterpret_cast<const char*>(
+          training_spectra.data() + training_spectra.size()));
+  HSIBackgroundOptions stats_options;
+  stats_options.num_threads = options.num_threads;
+  const HSIBackgroundStats training_stats =
+      ComputeBackgroundStats(training_data, stats_options);
+  std::copy(training_stats.mean.begin(), training_stats.mean.end(), mean);
+  const std::vector<float> axes =
+      GetPrincipalAxes(training_stats.covariance, num_bands, num_components);
+  std::copy(axes.begin(), axes.end(), projection);
+  if (!SetArrays(buffer_.data(), buffer_.size())) {
+    FatalError("Failed to build the spectral index.");
+  }
+
+  // Train the coarse centroids on the projected sample, and the codebook of
+  // each subspace on the residuals from the centroids.
+  std::vector<float> training_components(num_training * num_components);
+  ParallelFor(
+      0, num_training, options.num_threads, kPixelBlockSize,
+      [&](const long begin, const long end) {
+        for (long pixel = begin; pixel < end; ++pixel) {
+          ProjectSpectrum(
+              &training_spectra[pixel * num_bands],
+              &training_components[pixel * num_components]);
+        }
+      });
+  const std::vector<float> coarse_centroids = ComputeKMeans(
+      training_components,
+      num_components,
+      options.num_lists,
+      options.num_iterations,
+      options.num_threads);
+  std::copy(coarse_centroids.begin(), coarse_centroids.end(), centroids);
+  const std::vector<float> transposed_centroids =
+      TransposeCentroids(centroids, options.num_lists, num_components);
+  std::vector<std::vector<float>> subspace_residuals(num_subspaces);
+  std::vector<float> distances(std::max(options.num_lists, kCodebookSize));
+  for (long pixel = 0; pixel < num_training; ++pixel) {
+    const float* components = &training_components[pixel * num_components];
+    const float* centroid = centroids + num_components * FindNearestCentroid(
+        components,
+        transposed_centroids.data(),
+        options.num_lists,
+        num_components,
+        distances.data());
+    for (int dim = 0; dim < num_components; ++dim) {
+      subspace_residuals[dim / subspace_dims].push_back(
+          components[dim] - centroid[dim]);
+    }
+  }
+  std::vector<float> transposed_codebooks;
+  for (int subspace = 0; subspace < num_subspaces; ++subspace) {
+    const std::vector<float> codebook = ComputeKMeans(
+        subspace_residuals[subspace],
+        subspace_dims,
+        kCodebookSize,
+        options.num_iterations,
+        options.num_threads);
+    std::copy(
+        codebook.begin(),
+        codebook.end(),
+        codebooks + subspace * kCodebookSize * subspace_dims);
+    const std::vector<float> transposed_codebook =
+        TransposeCentroids(codebook.data(), kCodebookSize, subspace_dims);
+    transposed_codebooks.insert(
+        transposed_codebooks.end(),
+        transposed_codebook.begin(),
+        transposed_codebook.end());
+  }
+
+  // Encode every pixel, in the order of the scenes and their pixels.
+  std::vector<int32_t> pixel_lists(num_entries);
+  std::vector<uint8_t> pixel_codes(num_entries * num_subspaces);
+  const int tile_rows = std::max(1, options.tile_rows);
+  long scene_offset = 0;
+  for (HSIDataReader* scene : scenes) {
+    const HSIDataOptions& scene_options = scene->GetOptions();
+    const int num_cols = scene_options.num_data_cols;
+    HSIDataRange tile_range;
+    tile_range.start_col = 0;
+    tile_range.end_col = num_cols;
+    tile_range.start_band = 0;
+    tile_range.end_band = num_bands;
+    for (int row = 0; row < scene_options.num_data_rows; row += tile_rows) {
+      tile_range.start_row = row;
+      tile_range.end_row =
+          std::min(row + tile_rows, scene_options.num_data_rows);
+      scene->ReadData(tile_range);
+      const HSIData& tile_data = scene->GetData();
+      const long first_entry = scene_offset + static_cast<long>(row) * num_cols;
+      ParallelFor(
+          0, static_cast<long>(tile_data.num_rows) * num_cols,
+          options.num_threads, kPixelBlockSize,
+          [&](const long begin, const long end) {
+            std::vector<int> rows(kPixelBlockSize);
+            std::vector<int> cols(kPixelBlockSize);
+            std::vector<float> spectra(kPixelBlockSize * num_bands);
+            std::vector<float> components(num_components);
+            std::vector<float> distances(
+                std::max(options.num_lists, kCodebookSize));
+            for (long pixel = begin; pixel < end; pixel += kPixelBlockSize) {
+              const long block_size = std::min(kPixelBlockSize, end - pixel);
+              for (long i = 0; i < block_size; ++i) {
+                rows[i] = (pixel + i) / num_cols;
+                cols[i] = (pixel + i) % num_cols;
+              }
+              tile_data.GatherSpectra(
+                  rows.data(), cols.data(), block_size, spectra.data());
+              for (long i = 0; i < block_size; ++i) {
+                const long entry = first_entry + pixel + i;
+                ProjectSpectrum(&spectra[i * num_bands], components.data());
+                const int list = FindNearestCentroid(
+                    components.data(),
+                    transposed_centroids.data(),
+                    options.num_lists,
+                    num_components,
+                    distances.data());
+                pixel_lists[entry] = list;
+                const float* centroid = centroids + list * num_components;
+                for (int dim = 0; dim < num_components; ++dim) {
+                  components[dim] -= centroid[dim];
+                }
+                for (int subspace = 0; subspace < num_subspaces; ++subspace) {
+                  pixel_codes[entry * num_subspaces + subspace] =
+                      FindNearestCentroid(
+                          &components[subspace * subspace_dims],
+                          &transposed_codebooks[
+                              subspace * kCodebookSize * subspace_dims],
+                          kCodebookSize,
+                          subspace_dims,
+                          distances.data());
+                }
+              }
+            }
+          });
+    }
+    scene_offset += static_cast<long>(scene_options.num_data_rows) * num_cols;
+  }
+
+  // Group the entries by list, keeping them in pixel order within each list.
+  std::fill(list_offsets, list_offsets + options.num_lists + 1, 0);
+  for (long entry = 0; entry < num_entries; ++entry) {
+    list_offsets[pixel_lists[entry] + 1]++;
+  }
+  for (int list = 0; list < options.num_lists; ++list) {
+    list_offsets[list + 1] += list_offsets[list];
+  }
+  std::vector<int64_t> list_ends(
+      list_offsets, list_offsets + options.num_lists);
+  scene_offset = 0;
+  for (size_t scene = 0; scene < scenes.size(); ++scene) {
+    const int num_rows = scenes[scene]->GetOptions().num_data_rows;
+    const int num_cols = scenes[scene]->GetOptions().num_data_cols;
+    for (long pixel = 0; pixel < static_cast<long>(num_rows) * num_cols;
+         ++pixel) {
+      const long entry = scene_offset + pixel;
+      const int64_t position = list_ends[pixel_lists[entry]]++;
+      entries[position].scene = scene;
+      entries[position].row = pixel / num_cols;
+      entries[position].col = pixel % num_cols;
+      std::copy(
+          pixel_codes.begin() + entry * num_subspaces,
+          pixel_codes.begin() + (entry + 1) * num_subspaces,
+          codes + position * num_subspaces);
+    }
+    scene_offset += static_cast<long>(num_rows) * num_cols;
+  }
+}
+
+bool HSISpectralIndex::Save(const std::string& file_path) const {
+  if (header_ == nullptr) {
+    Error("Cannot save an empty spectral index.");
+    return false;
+  }
+  long offsets[kNumArrays];
+  const long data_size = GetArrayOffsets(*header_, offsets);
+  std::ofstream index_file(file_path, std::ios::out | std::ios::binary);
+  if (!index_file.is_open()) {
+    Error("Could not open spectral index file " + file_path);
+    return false;
+  }
+  index_file.write(reinterpret_cast<const char*>(header_), data_size);
+  if (!index_file.good()) {
+    Error("Could not write spectral index file " + file_path);
+    return false;
+  }
+  return true;
+}
+
+bool HSISpectralIndex::Load(const std::string& file_path) {
+  Clear();
+  const int fd = open(file_path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    Error("Could not open spectral index file " + file_path);
+    return false;
+  }
+  struct stat file_stat;
+  void* mapped = MAP_FAILED;
+  if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0) {
+    mapped = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    Error("Could not map spectral index file " + file_path);
+    return false;
+  }
+  mapped_data_ = mapped;
+  mapped_size_ = file_stat.st_size;
+  if (!SetArrays(reinterpret_cast<const char*>(mapped), mapped_size_)) {
+    Error("Not a valid spectral index file: " + file_path);
+    Clear();
+    return false;
+  }
+  return true;
+}
+
+std::vector<HSISpectralMatch> HSISpectralIndex::Search(
+    const std::vector<double>& spectrum,
+    const int k,
+    const HSISpectralSearchOptions& options,
+    const std::vector<const HSIDataReader*>& scenes) const {
+
+  if (header_ == nullptr) {
+    FatalError("The spectral index is empty.");
+  }
+  const int num_bands = header_->num_bands;
+  const int num_components = header_->num_components;
+  const int num_subspaces = header_->num_subspaces;
+  const int subspace_dims = num_components / num_subspaces;
+  if (static_cast<int>(spectrum.size()) != num_bands) {
+    FatalError("The query must have the bands of the indexed scenes.");
+  }
+  if (static_cast<int>(scenes.size()) != header_->num_scenes) {
+    FatalError("The search requires the indexed scenes.");
+  }
+  if (k <= 0) {
+    return std::vector<HSISpectralMatch>();
+  }
+
+  // Find the lists nearest to the query.
+  std::vector<float> query(spectrum.begin(), spectrum.end());
+  std::vector<float> components(num_components);
+  ProjectSpectrum(query.data(), components.data());
+  std::vector<std::pair<float, int>> lists(header_->num_lists);
+  for (int list = 0; list < header_->num_lists; ++list) {
+    lists[list] = std::make_pair(
+        SquaredDistance(
+            components.data(), centroids_ + list * num_components,
+            num_components),
+        list);
+  }
+  const int num_probes =
+      std::max(1, std::min(options.num_probes, header_->num_lists));
+  std::partial_sort(lists.begin(), lists.begin() + num_probes, lists.end());
+
+  // Scan their codes with tables of the distances from the query's residual
+  // to the codewords of each subspace, keeping the nearest candidates.
+  const size_t num_candidates =
+      static_cast<size_t>(k) * std::max(1, options.candidates_per_neighbor);
+  std::priority_queue<std::pair<float, int64_t>> candidates;
+  std::vector<float> residual(num_components);
+  std::vector<float> tables(num_subspaces * kCodebookSize);
+  for (int probe = 0; probe < num_probes; ++probe) {
+    const int list = lists[probe].second;
+    const float* centroid = centroids_ + list * num_components;
+    for (int dim = 0; dim < num_components; ++dim) {
+      residual[dim] = components[dim] - centroid[dim];
+    }
+    for (int subspace = 0; subspace < num_subspaces; ++subspace) {
+      const float* codebook =
+          codebooks_ + subspace * kCodebookSize * subspace_dims;
+      for (int code = 0; code < kCodebookSize; ++code) {
+        tables[subspace * kCodebookSize + code] = SquaredDistance(
+            &residual[subspace * subspace_dims],
+            codebook + code * subspace_dims,
+            subspace_dims);
+      }
+    }
+    for (int64_t entry = list_offsets_[list]; entry < list_offsets_[list + 1];
+         ++entry) {
+      const uint8_t* entry_codes = codes_ + entry * num_subspaces;
+      float distance = 0;
+      for (int subspace = 0; subspace < num_subspaces; ++subspace) {
+        distance += tables[subspace * kCodebookSize + entry_codes[subspace]];
+      }
+      if (candidates.size() < num_candidates) {
+        candidates.push(std::make_pair(distance, entry));
+      } else if (distance < candidates.top().first) {
+        candidates.pop();
+        candidates.push(std::make_pair(distance, entry));
+      }
+    }
+  }
+
+  // Re-rank the candidates by their exact spectra, read from each scene in
+  // file order.
+  std::vector<Entry> candidate_entries;
+  while (!candidates.empty()) {
+    candidate_entries.push_back(entries_[candidates.top().second]);
+    candidates.pop();
+  }
+  std::sort(
+      candidate_entries.begin(),
+      candidate_entries.end(),
+      [](const Entry& a, const Entry& b) {
+        return a.scene != b.scene ? a.scene < b.scene :
+            (a.row != b.row ? a.row < b.row : a.col < b.col);
+      });
+  double query_norm = 0;
+  for (const double value : spectrum) {
+    query_norm += value * value;
+  }
+  query_norm = std::sqrt(query_norm);
+  HSIROIReadOptions roi_options;
+  roi_options.max_gap_bytes = options.max_gap_bytes;
+  std::vector<HSISpectralMatch> matches;
+  for (size_t first = 0; first < candidate_entries.size();) {
+    const int scene = candidate_entries[first].scene;
+    std::vector<HSIRowSpan> spans;
+    size_t end = first;
+    for (; end < candidate_entries.size() &&
+           candidate_entries[end].scene == scene;
+         ++end) {
+      HSIRowSpan span;
+      span.row = candidate_entries[end].row;
+      span.start_col = candidate_entries[end].col;
+      span.end_col = span.start_col + 1;
+      spans.push_back(span);
+    }
+    const HSIROIData roi_data = ReadROI(spans, roi_options, *scenes[scene]);
+    const HSIData spectra = ConvertData(
+        roi_data.spectra, HSI_DATA_TYPE_DOUBLE, HSI_INTERLEAVE_BIP);
+    const double* values =
+        reinterpret_cast<const double*>(spectra.raw_data.data());
+    for (size_t i = 0; i < roi_data.rows.size(); ++i) {
+      const double* pixel_spectrum = values + i * num_bands;
+      double distance = 0;
+      if (header_->normalize) {
+        double dot_product = 0;
+        double pixel_norm = 0;
+        for (int band = 0; band < num_bands; ++band) {
+          dot_product += spectrum[band] * pixel_spectrum[band];
+          pixel_norm += pixel_spectrum[band] * pixel_spectrum[band];
+        }
+        pixel_norm = std::sqrt(pixel_norm);
+        distance = (query_norm > 0 && pixel_norm > 0) ?
+            std::acos(std::max(-1.0, std::min(
+                1.0, dot_product / (query_norm * pixel_norm)))) :
+            M_PI / 2;
+      } else {
+        for (int band = 0; band < num_bands; ++band) {
+          const double difference = spectrum[band] - pixel_spectrum[band];
+          distance += difference * difference;
+        }
+        distance = std::sqrt(distance);
+      }
+      HSISpectralMatch match;
+      match.scene = scene;
+      match.row = roi_data.rows[i];
+      match.col = roi_data.cols[i];
+      match.distance = distance;
+      matches.push_back(match);
+    }
+    first = end;
+  }
+  std::sort(
+      matches.begin(),
+      matches.end(),
+      [](const HSISpectralMatch& a, const HSISpectralMatch& b) {
+        return a.distance < b.distance;
+      });
+  if (static_cast<int>(matches.size()) > k) {
+    matches.resize(k);
+  }
+  return matches;
+}
+
+}  // namespace hsi
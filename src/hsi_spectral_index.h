@@ -0,0 +1,183 @@
+// Provides an approximate nearest-neighbor index of the pixel spectra of one
+// or more scenes, for finding the pixels most similar to a query spectrum.
+//
+// Spectra are projected onto their principal components and indexed with an
+// inverted file of product-quantized codes (IVF-PQ): the projected spectra are
+// assigned to the nearest of a set of coarse centroids, and the residual from
+// that centroid is encoded with one byte for each of a few subspaces. A query
+// scans only the lists of the centroids nearest to it, scoring the codes with
+// lookup tables, and the best candidates are re-ranked by their exact spectra,
+// which are read from the scenes.
+//
+// The index is stored as one flat block of arrays, which is written to a file
+// as is and memory-mapped when loaded, so large indices open instantly and
+// are paged in as the queries touch them.
+
+#ifndef SRC_HSI_SPECTRAL_INDEX_H_
+#define SRC_HSI_SPECTRAL_INDEX_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "./hsi_data_reader.h"
+
+namespace hsi {
+
+struct HSISpectralIndexOptions {
+  // The number of principal components that spectra are projected onto. This
+  // is limited to the number of bands, and must be a multiple of
+  // num_subspaces.
+  int num_components = 32;
+
+  // The number of coarse centroids (inverted lists).
+  int num_lists = 256;
+
+  // The number of subspaces of the product quantizer, each encoded with one
+  // byte.
+  int num_subspaces = 8;
+
+  // If true, spectra are scaled to unit length before they are indexed, so
+  // the search finds the smallest spectral angles. Otherwise it finds the
+  // smallest Euclidean distances.
+  bool normalize = true;
+
+  // The maximum number of pixels, sampled evenly from all scenes, used to
+  // train the projection and the quantizers.
+  long max_training_pixels = 50000;
+
+  // The number of k-means iterations used to train the quantizers.
+  int num_iterations = 10;
+
+  // The number of threads. Zero means one for each hardware thread.
+  int num_threads = 0;
+
+  // The number of rows read at a time when the scenes are indexed.
+  int tile_rows = 64;
+};
+
+struct HSISpectralSearchOptions {
+  // The number of inverted lists scanned.
+  int num_probes = 8;
+
+  // The number of candidates re-ranked with their exact spectra, for each
+  // requested neighbor.
+  int candidates_per_neighbor = 10;
+
+  // Candidates separated by at most this many bytes in a scene's file are
+  // read with one read.
+  long max_gap_bytes = 64 * 1024;
+};
+
+// A pixel found by HSISpectralIndex::Search().
+struct HSISpectralMatch {
+  // The index of the scene, in the order the scenes were indexed.
+  int scene = 0;
+  int row = 0;
+  int col = 0;
+
+  // The spectral angle in radians if the index normalizes spectra, and the
+  // Euclidean distance otherwise.
+  double distance = 0;
+};
+
+class HSISpectralIndex {
+ public:
+  HSISpectralIndex() {}
+  ~HSISpectralIndex();
+
+  HSISpectralIndex(const HSISpectralIndex&) = delete;
+  HSISpectralIndex& operator=(const HSISpectralIndex&) = delete;
+
+  // Builds the index of all pixels of the scenes, which must have the same
+  // bands. The scenes are read twice: once for a sample of training pixels,
+  // and once to encode every pixel, one tile of rows at a time.
+  void Build(
+      const std::vector<HSIDataReader*>& scenes,
+      const HSISpectralIndexOptions& options);
+
+  // Saves the index to a file, or loads it by memory-mapping the file.
+  // Returns true on success.
+  bool Save(const std::string& file_path) const;
+  bool Load(const std::string& file_path);
+
+  int num_scenes() const;
+  int num_bands() const;
+  long num_pixels() const;
+
+  // Returns the (up to) k pixels whose spectra are nearest to the query
+  // spectrum, nearest first. The scenes must be the indexed scenes, in the
+  // same order; the candidates' exact spectra are read from them.
+  std::vector<HSISpectralMatch> Search(
+      const std::vector<double>& spectrum,
+      const int k,
+      const HSISpectralSearchOptions& options,
+      const std::vector<const HSIDataReader*>& scenes) const;
+
+ private:
+  // The size and parameters of the index, at the start of the index data.
+  struct Header {
+    char magic[4];
+    int32_t version;
+    int32_t num_scenes;
+    int32_t num_bands;
+    int32_t num_components;
+    int32_t num_lists;
+    int32_t num_subspaces;
+    int32_t normalize;
+    int64_t num_entries;
+  };
+
+  // The location of an indexed pixel.
+  struct Entry {
+    int32_t scene;
+    int32_t row;
+    int32_t col;
+  };
+
+  // Returns the size of the index data with the given header, and writes the
+  // offsets of the arrays below (in the order they are declared) to offsets.
+  static long GetArrayOffsets(const Header& header, long* offsets);
+
+  // Points the array pointers below into data (of data_size bytes). Returns
+  // false if the data is not a valid index.
+  bool SetArrays(const char* data, const long data_size);
+
+  // Releases the index data.
+  void Clear();
+
+  // Normalizes (if enabled) and centers the spectrum in place, and writes its
+  // projection onto the principal components to components.
+  void ProjectSpectrum(float* spectrum, float* components) const;
+
+  // The index data: the arrays, either in buffer_ or in a mapped file.
+  std::vector<char> buffer_;
+  void* mapped_data_ = nullptr;
+  long mapped_size_ = 0;
+
+  const Header* header_ = nullptr;
+
+  // The mean spectrum subtracted before the projection.
+  const float* mean_ = nullptr;
+
+  // The num_components x num_bands projection matrix, row-major.
+  const float* projection_ = nullptr;
+
+  // The num_lists x num_components coarse centroids.
+  const float* centroids_ = nullptr;
+
+  // The 256 codewords of each subspace, each num_components / num_subspaces
+  // long.
+  const float* codebooks_ = nullptr;
+
+  // The entries of list i are list_offsets_[i] to list_offsets_[i + 1].
+  const int64_t* list_offsets_ = nullptr;
+  const Entry* entries_ = nullptr;
+
+  // The num_subspaces codes of each entry.
+  const uint8_t* codes_ = nullptr;
+};
+
+}  // namespace hsi
+
+#endif  // SRC_HSI_SPECTRAL_INDEX_H_
@@ -0,0 +1,616 @@
+#include "./hsi_target_detection.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "./hsi_data_view.h"
+#include "./hsi_parallel.h"
+
+namespace hsi {
+namespace {
+
+// The number of pixels processed at a time by each thread.
+constexpr long kPixelBlockSize = 256;
+
+// Rounds up to a multiple of the number of floats in an AVX register.
+int RoundUpToVector(const int size) {
+  return (size + 7) / 8 * 8;
+}
+
+// Rounds up to a multiple of the number of matrix rows multiplied at a time.
+int RoundUpToRowGroup(const int size) {
+  return (size + 3) / 4 * 4;
+}
+
+#ifdef __AVX2__
+inline __m256 MultiplyAdd(const __m256 a, const __m256 b, const __m256 c) {
+#ifdef __FMA__
+  return _mm256_fmadd_ps(a, b, c);
+#else
+  return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#endif
+}
+
+inline float HorizontalSum(const __m256 values) {
+  const __m128 sum = _mm_add_ps(
+      _mm256_castps256_ps128(values), _mm256_extractf128_ps(values, 1));
+  const __m128 pair_sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  return _mm_cvtss_f32(
+      _mm_add_ss(pair_sum, _mm_shuffle_ps(pair_sum, pair_sum, 1)));
+}
+
+// Multiplies four rows of a matrix by kNumPixels spectra, over the first
+// length values (a multiple of 8) of each. Each loaded value of the rows is
+// used for all of the spectra, and each value of the spectra for all rows.
+template <int kNumPixels>
+void MultiplyRowGroup(
+    const float* rows,
+    const int stride,
+    const int length,
+    const float* spectra,
+    const int num_rows,
+    float* products) {
+
+  __m256 sums[kNumPixels][4];
+  for (int pixel = 0; pixel < kNumPixels; ++pixel) {
+    for (int row = 0; row < 4; ++row) {
+      sums[pixel][row] = _mm256_setzero_ps();
+    }
+  }
+  for (int i = 0; i < length; i += 8) {
+    __m256 row_values[4];
+    for (int row = 0; row < 4; ++row) {
+      row_values[row] = _mm256_loadu_ps(rows + row * stride + i);
+    }
+    for (int pixel = 0; pixel < kNumPixels; ++pixel) {
+      const __m256 values = _mm256_loadu_ps(spectra + pixel * stride + i);
+      for (int row = 0; row < 4; ++row) {
+        sums[pixel][row] =
+            MultiplyAdd(row_values[row], values, sums[pixel][row]);
+      }
+    }
+  }
+  for (int pixel = 0; pixel < kNumPixels; ++pixel) {
+    for (int row = 0; row < 4; ++row) {
+      products[pixel * num_rows + row] = HorizontalSum(sums[pixel][row]);
+    }
+  }
+}
+#endif
+
+// Multiplies a matrix of num_rows rows (a multiple of 4) by num_pixels
+// spectra, where each row and spectrum has stride values (a multiple of 8),
+// and writes the product of row i and pixel j to products[j * num_rows + i].
+// If is_lower_triangular, the values above the diagonal (which must be zero)
+// are skipped.
+void MultiplyMatrix(
+    const float* matrix,
+    const int num_rows,
+    const int stride,
+    const bool is_lower_triangular,
+    const float* spectra,
+    const long num_pixels,
+    float* products) {
+
+  for (long pixel = 0; pixel < num_pixels; pixel += 2) {
+    const int block_pixels = std::min(2L, num_pixels - pixel);
+    const float* block_spectra = spectra + pixel * stride;
+    float* block_products = products + pixel * num_rows;
+    for (int row = 0; row < num_rows; row += 4) {
+      const int length = is_lower_triangular ?
+          std::min(stride, RoundUpToVector(row + 4)) : stride;
+      const float* rows = matrix + static_cast<long>(row) * stride;
+#ifdef __AVX2__
+      if (block_pixels == 2) {
+        MultiplyRowGroup<2>(
+            rows, stride, length, block_spectra, num_rows,
+            block_products + row);
+      } else {
+        MultiplyRowGroup<1>(
+            rows, stride, length, block_spectra, num_rows,
+            block_products + row);
+      }
+#else
+      for (int i = 0; i < block_pixels; ++i) {
+        for (int j = 0; j < 4; ++j) {
+          float sum = 0;
+          for (int k = 0; k < length; ++k) {
+            sum += rows[j * stride + k] * block_spectra[i * stride + k];
+          }
+          block_products[i * num_rows + row + j] = sum;
+        }
+      }
+#endif
+    }
+  }
+}
+
+// Accumulates the sums and the sums of products of the bands of spectra,
+// relative to a shift spectrum (close to the mean) for accuracy. The spectra
+// are collected into band-major blocks, whose products with themselves are
+// computed with MultiplyMatrix() in float and added up in double.
+class CovarianceAccumulator {
+ public:
+  explicit CovarianceAccumulator(const std::vector<float>& shift)
+      : shift_(shift),
+        num_bands_(shift.size()),
+        num_block_rows_(RoundUpToRowGroup(num_bands_)),
+        sums_(num_bands_, 0),
+        products_(static_cast<long>(num_bands_) * num_bands_, 0),
+        block_(num_block_rows_ * kPixelBlockSize, 0),
+        block_products_(static_cast<long>(num_bands_) * num_block_rows_) {}
+
+  void AddSpectrum(const float* spectrum) {
+    for (int band = 0; band < num_bands_; ++band) {
+      block_[band * kPixelBlockSize + block_size_] =
+          spectrum[band] - shift_[band];
+    }
+    if (++block_size_ == kPixelBlockSize) {
+      Flush();
+    }
+  }
+
+  // Adds the spectra of the current block to the sums.
+  void Flush() {
+    if (block_size_ == 0) {
+      return;
+    }
+    for (int band = 0; band < num_bands_; ++band) {
+      float* values = &block_[band * kPixelBlockSize];
+      std::fill(values + block_size_, values + kPixelBlockSize, 0.0f);
+      double sum = 0;
+      for (long i = 0; i < block_size_; ++i) {
+        sum += values[i];
+      }
+      sums_[band] += sum;
+    }
+    MultiplyMatrix(
+        block_.data(),
+        num_block_rows_,
+        kPixelBlockSize,
+        false,
+        block_.data(),
+        num_bands_,
+        block_products_.data());
+    for (int i = 0; i < num_bands_; ++i) {
+      for (int j = 0; j < num_bands_; ++j) {
+        products_[i * num_bands_ + j] +=
+            block_products_[i * num_block_rows_ + j];
+      }
+    }
+    num_pixels_ += block_size_;
+    block_size_ = 0;
+  }
+
+  long num_pixels() const {
+    return num_pixels_;
+  }
+  const std::vector<double>& sums() const {
+    return sums_;
+  }
+  const std::vector<double>& products() const {
+    return products_;
+  }
+
+ private:
+  const std::vector<float> shift_;
+  const int num_bands_;
+  const int num_block_rows_;
+  long num_pixels_ = 0;
+  std::vector<double> sums_;
+  std::vector<double> products_;
+  std::vector<float> block_;
+  long block_size_ = 0;
+  std::vector<float> block_products_;
+};
+
+// Returns the index of the first sampled pixel of a tile, whose first pixel is
+// pixel first_pixel of the sampled range.
+long GetFirstSample(const long first_pixel, const int pixel_step) {
+  return (pixel_step - first_pixel % pixel_step) % pixel_step;
+}
+
+// Returns the spectrum of the given pixel of the data as floats.
+std::vector<float> GetSpectrum(const HSIData& hsi_data, const long pixel) {
+  const int row = pixel / hsi_data.num_cols;
+  const int col = pixel % hsi_data.num_cols;
+  std::vector<float> spectrum(hsi_data.num_bands);
+  hsi_data.GatherSpectra(&row, &col, 1, spectrum.data());
+  return spectrum;
+}
+
+// Adds the sampled pixels of the data to the accumulators, splitting them
+// evenly between the accumulators (one for each thread). The sampled pixels
+// are every pixel_step-th pixel from first_sample.
+void AddToAccumulators(
+    const HSIData& hsi_data,
+    const long first_sample,
+    const int pixel_step,
+    std::vector<CovarianceAccumulator>* accumulators) {
+
+  const long num_pixels =
+      static_cast<long>(hsi_data.num_rows) * hsi_data.num_cols;
+  if (first_sample >= num_pixels) {
+    return;
+  }
+  const long num_samples = (num_pixels - 1 - first_sample) / pixel_step + 1;
+  const long num_accumulators = accumulators->size();
+  ParallelFor(
+      0, num_accumulators, num_accumulators, 1,
+      [&](const long begin, const long end) {
+        std::vector<int> rows;
+        std::vector<int> cols;
+        std::vector<float> spectra;
+        for (long index = begin; index < end; ++index) {
+          CovarianceAccumulator& accumulator = (*accumulators)[index];
+          const long first = num_samples * index / num_accumulators;
+          const long last = num_samples * (index + 1) / num_accumulators;
+          for (long sample = first; sample < last;
+               sample += kPixelBlockSize) {
+            const long block_size = std::min(kPixelBlockSize, last - sample);
+            rows.resize(block_size);
+            cols.resize(block_size);
+            for (long i = 0; i < block_size; ++i) {
+              const long pixel = first_sample + (sample + i) * pixel_step;
+              rows[i] = pixel / hsi_data.num_cols;
+              cols[i] = pixel % hsi_data.num_cols;
+            }
+            spectra.resize(block_size * hsi_data.num_bands);
+            hsi_data.GatherSpectra(
+                rows.data(), cols.data(), block_size, spectra.data());
+            for (long i = 0; i < block_size; ++i) {
+              accumulator.AddSpectrum(&spectra[i * hsi_data.num_bands]);
+            }
+          }
+        }
+      });
+}
+
+// Merges the accumulators into the background statistics.
+HSIBackgroundStats MergeAccumulators(
+    const std::vector<float>& shift,
+    std::vector<CovarianceAccumulator>* accumulators) {
+
+  const int num_bands = shift.size();
+  HSIBackgroundStats stats;
+  stats.num_bands = num_bands;
+  std::vector<double> sums(num_bands, 0);
+  std::vector<double> products(static_cast<long>(num_bands) * num_bands, 0);
+  for (CovarianceAccumulator& accumulator : *accumulators) {
+    accumulator.Flush();
+    stats.num_pixels += accumulator.num_pixels();
+    for (int i = 0; i < num_bands; ++i) {
+      sums[i] += accumulator.sums()[i];
+    }
+    for (size_t i = 0; i < products.size(); ++i) {
+      products[i] += accumulator.products()[i];
+    }
+  }
+  if (stats.num_pixels == 0) {
+    FatalError("No pixels were sampled for the background statistics.");
+  }
+  const double num_pixels = stats.num_pixels;
+  stats.mean.resize(num_bands);
+  for (int i = 0; i < num_bands; ++i) {
+    stats.mean[i] = shift[i] + sums[i] / num_pixels;
+  }
+  stats.covariance.resize(products.size());
+  for (int i = 0; i < num_bands; ++i) {
+    for (int j = 0; j < num_bands; ++j) {
+      stats.covariance[i * num_bands + j] =
+          (products[i * num_bands + j] - sums[i] * sums[j] / num_pixels) /
+          std::max(1.0, num_pixels - 1);
+    }
+  }
+  return stats;
+}
+
+}  // namespace
+
+HSIBackgroundStats ComputeBackgroundStats(
+    const HSIData& hsi_data, const HSIBackgroundOptions& options) {
+
+  const int pixel_step = std::max(1, options.pixel_step);
+  if (hsi_data.num_rows == 0 || hsi_data.num_cols == 0) {
+    FatalError("No pixels were sampled for the background statistics.");
+  }
+  const std::vector<float> shift = GetSpectrum(hsi_data, 0);
+  std::vector<CovarianceAccumulator> accumulators(
+      GetNumThreads(options.num_threads), CovarianceAccumulator(shift));
+  AddToAccumulators(hsi_data, 0, pixel_step, &accumulators);
+  return MergeAccumulators(shift, &accumulators);
+}
+
+HSIBackgroundStats ReadBackgroundStats(
+    const HSIDataRange& data_range,
+    const HSIBackgroundOptions& options,
+    HSIDataReader* reader) {
+
+  const int pixel_step = std::max(1, options.pixel_step);
+  const int num_cols = data_range.end_col - data_range.start_col;
+  if (data_range.end_row <= data_range.start_row || num_cols <= 0) {
+    FatalError("No pixels were sampled for the background statistics.");
+  }
+  // The first spectrum of the first tile is the shift of all accumulators.
+  std::vector<float> shift;
+  std::vector<CovarianceAccumulator> accumulators;
+  ForEachPrefetchedTile(
+      data_range,
+      options.tile_rows,
+      reader,
+      [&](const HSIDataView& tile_view, const int start_row) {
+        const HSIData& tile_data = tile_view.GetUnderlyingData();
+        if (accumulators.empty()) {
+          shift = GetSpectrum(tile_data, 0);
+          accumulators = std::vector<CovarianceAccumulator>(
+              GetNumThreads(options.num_threads),
+              CovarianceAccumulator(shift));
+        }
+        const long first_pixel = static_cast<long>(start_row) * num_cols;
+        AddToAccumulators(
+            tile_data,
+            GetFirstSample(first_pixel, pixel_step),
+            pixel_step,
+            &accumulators);
+      });
+  return MergeAccumulators(shift, &accumulators);
+}
+
+HSITargetDetector::HSITargetDetector(
+    const HSIBackgroundStats& background,
+    const std::vector<std::vector<double>>& targets,
+    const HSITargetDetectionOptions& options)
+    : options_(options),
+      num_targets_(targets.size()),
+      num_bands_(background.num_bands),
+      padded_bands_(RoundUpToVector(background.num_bands)) {
+
+  const int n = num_bands_;
+  if (n <= 0 || background.num_pixels < 2 ||
+      static_cast<int>(background.mean.size()) != n ||
+      background.covariance.size() != static_cast<size_t>(n) * n) {
+    FatalError("The background statistics need at least two pixels.");
+  }
+  if (num_targets_ == 0) {
+    FatalError("Target detection requires at least one target.");
+  }
+  for (const std::vector<double>& target : targets) {
+    if (static_cast<int>(target.size()) != n) {
+      FatalError("Targets must have the bands of the background statistics.");
+    }
+  }
+
+  // CEM uses the correlation matrix, and the others the covariance matrix,
+  // with the diagonal loaded by the regularization.
+  const bool is_cem = (options_.detector == HSI_DETECTOR_CEM);
+  std::vector<double> matrix = background.covariance;
+  if (is_cem) {
+    const double scale =
+        (background.num_pixels - 1.0) / background.num_pixels;
+    for (int i = 0; i < n; ++i) {
+      for (int j = 0; j < n; ++j) {
+        matrix[i * n + j] = matrix[i * n + j] * scale +
+            background.mean[i] * background.mean[j];
+      }
+    }
+  }
+  double mean_diagonal = 0;
+  for (int i = 0; i < n; ++i) {
+    mean_diagonal += matrix[i * n + i] / n;
+  }
+  for (int i = 0; i < n; ++i) {
+    matrix[i * n + i] += options_.regularization * mean_diagonal;
+  }
+
+  // Factor the matrix as L L^T, and invert L.
+  std::vector<double> factor(n * n, 0);
+  for (int j = 0; j < n; ++j) {
+    double diagonal = matrix[j * n + j];
+    for (int k = 0; k < j; ++k) {
+      diagonal -= factor[j * n + k] * factor[j * n + k];
+    }
+    if (!(diagonal > 0)) {
+      FatalError("The background covariance matrix is singular.");
+    }
+    factor[j * n + j] = std::sqrt(diagonal);
+    for (int i = j + 1; i < n; ++i) {
+      double value = matrix[i * n + j];
+      for (int k = 0; k < j; ++k) {
+        value -= factor[i * n + k] * factor[j * n + k];
+      }
+      factor[i * n + j] = value / factor[j * n + j];
+    }
+  }
+  std::vector<double> whitening(n * n, 0);
+  for (int col = 0; col < n; ++col) {
+    whitening[col * n + col] = 1 / factor[col * n + col];
+    for (int i = col + 1; i < n; ++i) {
+      double value = 0;
+      for (int k = col; k < i; ++k) {
+        value -= factor[i * n + k] * whitening[k * n + col];
+      }
+      whitening[i * n + col] = value / factor[i * n + i];
+    }
+  }
+
+  // The filter of a target s is M^-1 s = L^-T (L^-1 s), scaled by the squared
+  // norm of L^-1 s (or its square root for ACE).
+  center_.assign(padded_bands_, 0);
+  if (!is_cem) {
+    std::copy(background.mean.begin(), background.mean.end(), center_.begin());
+  }
+  filters_.assign(
+      static_cast<long>(RoundUpToRowGroup(num_targets_)) * padded_bands_, 0);
+  std::vector<double> whitened_target(n);
+  for (int target = 0; target < num_targets_; ++target) {
+    double squared_norm = 0;
+    for (int i = 0; i < n; ++i) {
+      double value = 0;
+      for (int k = 0; k <= i; ++k) {
+        value += whitening[i * n + k] *
+            (targets[target][k] - (is_cem ? 0 : background.mean[k]));
+      }
+      whitened_target[i] = value;
+      squared_norm += value * value;
+    }
+    if (!(squared_norm > 0)) {
+      FatalError("Targets must differ from the background mean.");
+    }
+    const double scale = (options_.detector == HSI_DETECTOR_ACE) ?
+        1 / std::sqrt(squared_norm) : 1 / squared_norm;
+    for (int band = 0; band < n; ++band) {
+      double value = 0;
+      for (int k = band; k < n; ++k) {
+        value += whitening[k * n + band] * whitened_target[k];
+      }
+      filters_[target * padded_bands_ + band] = value * scale;
+    }
+  }
+  if (options_.detector == HSI_DETECTOR_ACE) {
+    whitening_matrix_.assign(
+        static_cast<long>(RoundUpToRowGroup(n)) * padded_bands_, 0);
+    for (int i = 0; i < n; ++i) {
+      for (int k = 0; k <= i; ++k) {
+        whitening_matrix_[i * padded_bands_ + k] = whitening[i * n + k];
+      }
+    }
+  }
+}
+
+void HSITargetDetector::ScoreSpectra(
+    const float* spectra,
+    const long num_pixels,
+    const long stride,
+    float* scores) const {
+
+  const bool is_ace = (options_.detector == HSI_DETECTOR_ACE);
+  const int num_filter_rows = filters_.size() / padded_bands_;
+  const int num_whitening_rows = whitening_matrix_.size() / padded_bands_;
+  const long max_block_size = std::min(num_pixels, kPixelBlockSize);
+  // The padding bands of the centered spectra stay zero.
+  std::vector<float> centered(max_block_size * padded_bands_, 0);
+  std::vector<float> products(max_block_size * num_filter_rows);
+  std::vector<float> whitened(max_block_size * num_whitening_rows);
+  for (long pixel = 0; pixel < num_pixels; pixel += kPixelBlockSize) {
+    const long block_size = std::min(kPixelBlockSize, num_pixels - pixel);
+    for (long i = 0; i < block_size; ++i) {
+      const float* spectrum = spectra + (pixel + i) * num_bands_;
+      float* centered_spectrum = &centered[i * padded_bands_];
+      for (int band = 0; band < num_bands_; ++band) {
+        centered_spectrum[band] = spectrum[band] - center_[band];
+      }
+    }
+    MultiplyMatrix(
+        filters_.data(),
+        num_filter_rows,
+        padded_bands_,
+        false,
+        centered.data(),
+        block_size,
+        products.data());
+    if (is_ace) {
+      MultiplyMatrix(
+          whitening_matrix_.data(),
+          num_whitening_rows,
+          padded_bands_,
+          true,
+          centered.data(),
+          block_size,
+          whitened.data());
+    }
+    for (long i = 0; i < block_size; ++i) {
+      float squared_distance = 0;
+      if (is_ace) {
+        for (int row = 0; row < num_whitening_rows; ++row) {
+          const float value = whitened[i * num_whitening_rows + row];
+          squared_distance += value * value;
+        }
+      }
+      for (int target = 0; target < num_targets_; ++target) {
+        float score = products[i * num_filter_rows + target];
+        if (is_ace) {
+          score = (squared_distance > 0) ?
+              std::min(1.0f, score * score / squared_distance) : 0;
+        }
+        scores[target * stride + pixel + i] = score;
+      }
+    }
+  }
+}
+
+void HSITargetDetector::Score(const float* spectrum, float* scores) const {
+  ScoreSpectra(spectrum, 1, 1, scores);
+}
+
+HSIData HSITargetDetector::Score(const HSIDataView& data_view) const {
+  HSIData materialized_data;
+  const HSIData& hsi_data = data_view.GetCompactData(&materialized_data);
+  if (hsi_data.num_bands != num_bands_) {
+    FatalError("The data must have the bands of the background statistics.");
+  }
+  HSIData score_data;
+  score_data.num_rows = hsi_data.num_rows;
+  score_data.num_cols = hsi_data.num_cols;
+  score_data.num_bands = num_targets_;
+  score_data.interleave_format = HSI_INTERLEAVE_BSQ;
+  score_data.data_type = HSI_DATA_TYPE_FLOAT;
+  score_data.raw_data.resize(
+      static_cast<long>(score_data.NumDataPoints()) * sizeof(float));
+  float* scores = reinterpret_cast<float*>(score_data.raw_data.data());
+
+  const long num_pixels =
+      static_cast<long>(hsi_data.num_rows) * hsi_data.num_cols;
+  const bool is_bip_float =
+      hsi_data.interleave_format == HSI_INTERLEAVE_BIP &&
+      hsi_data.data_type == HSI_DATA_TYPE_FLOAT;
+  ParallelFor(
+      0, num_pixels, options_.num_threads, kPixelBlockSize,
+      [&](const long begin, const long end) {
+        std::vector<int> rows;
+        std::vector<int> cols;
+        std::vector<float> spectra;
+        for (long pixel = begin; pixel < end; pixel += kPixelBlockSize) {
+          const long block_size = std::min(kPixelBlockSize, end - pixel);
+          const float* block_spectra;
+          if (is_bip_float) {
+            block_spectra =
+                reinterpret_cast<const float*>(hsi_data.raw_data.data()) +
+                pixel * num_bands_;
+          } else {
+            rows.resize(block_size);
+            cols.resize(block_size);
+            for (long i = 0; i < block_size; ++i) {
+              rows[i] = (pixel + i) / hsi_data.num_cols;
+              cols[i] = (pixel + i) % hsi_data.num_cols;
+            }
+            spectra.resize(block_size * num_bands_);
+            hsi_data.GatherSpectra(
+                rows.data(), cols.data(), block_size, spectra.data());
+            block_spectra = spectra.data();
+          }
+          ScoreSpectra(block_spectra, block_size, num_pixels, scores + pixel);
+        }
+      });
+  return score_data;
+}
+
+void HSITargetDetector::ReadScores(
+    const HSIDataRange& data_range,
+    HSIDataReader* reader,
+    const ScoreRowsCallback& callback) const {
+
+  ForEachPrefetchedTile(
+      data_range,
+      options_.tile_rows,
+      reader,
+      [&](const HSIDataView& tile_view, const int start_row) {
+        callback(Score(tile_view), start_row);
+      });
+}
+
+}  // namespace hsi
@@ -0,0 +1,153 @@
+// Provides target detection with the matched filter (MF), constrained energy
+// minimization (CEM) and adaptive coherence estimator (ACE) detectors, which
+// score every pixel against one or more target spectra relative to the
+// background statistics of the scene.
+//
+// The background mean and covariance are accumulated from a (sampled) pass
+// over the data. The detector factors the covariance once and precomputes a
+// filter for each target, so scoring a block of pixels is a product of the
+// filter matrix (and for ACE, the triangular whitening matrix) with the
+// block's spectra, computed with SIMD over blocks of pixels in parallel.
+
+#ifndef SRC_HSI_TARGET_DETECTION_H_
+#define SRC_HSI_TARGET_DETECTION_H_
+
+#include <functional>
+#include <vector>
+
+#include "./hsi_data_reader.h"
+#include "./hsi_data_view.h"
+
+namespace hsi {
+
+struct HSIBackgroundOptions {
+  // Only every pixel_step-th pixel (in row-major order) is sampled.
+  int pixel_step = 1;
+
+  // The number of threads. Zero means one for each hardware thread.
+  int num_threads = 0;
+
+  // The number of rows read at a time by ReadBackgroundStats().
+  int tile_rows = 64;
+};
+
+struct HSIBackgroundStats {
+  int num_bands = 0;
+
+  // The number of sampled pixels.
+  long num_pixels = 0;
+
+  // The mean spectrum.
+  std::vector<double> mean;
+
+  // The (unbiased) num_bands x num_bands covariance matrix, row-major.
+  std::vector<double> covariance;
+};
+
+// Returns the background statistics of the sampled pixels of the data.
+HSIBackgroundStats ComputeBackgroundStats(
+    const HSIData& hsi_data, const HSIBackgroundOptions& options);
+
+// Returns the background statistics of the given range as above, reading one
+// tile of rows at a time from the reader.
+HSIBackgroundStats ReadBackgroundStats(
+    const HSIDataRange& data_range,
+    const HSIBackgroundOptions& options,
+    HSIDataReader* reader);
+
+enum HSIDetectorType {
+  // Matched filter: the projection of the mean-subtracted spectrum onto the
+  // target in whitened space, scaled so the target itself scores one.
+  HSI_DETECTOR_MF,
+
+  // Constrained energy minimization: as above, but with the correlation
+  // matrix (which includes the mean) and without subtracting the mean.
+  HSI_DETECTOR_CEM,
+
+  // Adaptive coherence estimator: the squared cosine of the angle between the
+  // mean-subtracted spectrum and the target in whitened space, from 0 to 1.
+  HSI_DETECTOR_ACE
+};
+
+struct HSITargetDetectionOptions {
+  HSIDetectorType detector = HSI_DETECTOR_ACE;
+
+  // Added to the diagonal of the covariance (or correlation) matrix, relative
+  // to its mean diagonal value, so that it can be inverted for nearly
+  // degenerate backgrounds.
+  double regularization = 1e-6;
+
+  // The number of threads. Zero means one for each hardware thread.
+  int num_threads = 0;
+
+  // The number of rows read at a time by ReadScores().
+  int tile_rows = 64;
+};
+
+// Called by HSITargetDetector::ReadScores() with the scores of each tile,
+// starting at the given row of the range.
+typedef std::function<void(const HSIData& score_rows, const int start_row)>
+    ScoreRowsCallback;
+
+class HSITargetDetector {
+ public:
+  // targets holds the target spectra, which must have the number of bands of
+  // the background statistics and of the scored data.
+  HSITargetDetector(
+      const HSIBackgroundStats& background,
+      const std::vector<std::vector<double>>& targets,
+      const HSITargetDetectionOptions& options);
+
+  int num_targets() const {
+    return num_targets_;
+  }
+
+  // Computes the score of each target for a spectrum of num_bands values.
+  void Score(const float* spectrum, float* scores) const;
+
+  // Returns the scores of all pixels of the view (or of HSIData) as BSQ float
+  // data with one band for each target.
+  HSIData Score(const HSIDataView& data_view) const;
+
+  // Scores the given range as above, reading one tile of rows at a time from
+  // the reader (the next tile while the current one is scored). The range
+  // must include all bands.
+  void ReadScores(
+      const HSIDataRange& data_range,
+      HSIDataReader* reader,
+      const ScoreRowsCallback& callback) const;
+
+ private:
+  // Computes the scores of num_pixels contiguous spectra, writing the score
+  // of target i for pixel j to scores[i * stride + j].
+  void ScoreSpectra(
+      const float* spectra,
+      const long num_pixels,
+      const long stride,
+      float* scores) const;
+
+  const HSITargetDetectionOptions options_;
+  int num_targets_;
+  int num_bands_;
+
+  // The number of bands rounded up for the vectorized products. The matrices
+  // below have this many columns, and a multiple of four rows, padded with
+  // zeros.
+  int padded_bands_;
+
+  // Subtracted from each spectrum before the products: the background mean,
+  // or zero for CEM.
+  std::vector<float> center_;
+
+  // The filter of each target.
+  std::vector<float> filters_;
+
+  // For ACE, the inverse of the Cholesky factor of the covariance (lower
+  // triangular). The squared norm of its product with a centered spectrum is
+  // the squared Mahalanobis distance of the spectrum.
+  std::vector<float> whitening_matrix_;
+};
+
+}  // namespace hsi
+
+#endif  // SRC_HSI_TARGET_DETECTION_H_
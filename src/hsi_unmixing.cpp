@@ -0,0 +1,488 @@
+#include "./hsi_unmixing.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "./hsi_data_view.h"
+#include "./hsi_parallel.h"
+
+namespace hsi {
+namespace {
+
+// The number of pixels unmixed at a time by each thread.
+constexpr long kPixelBlockSize = 256;
+
+// Solves A X = B by Gauss-Jordan elimination with partial pivoting, where
+// system is the n x (n + m) row-major matrix [A B]. On success, the last m
+// columns hold X. Returns false if A is singular.
+bool SolveLinearSystem(const int n, const int m, double* system) {
+  const int num_cols = n + m;
+  double max_abs_value = 0;
+  for (int i = 0; i < n * num_cols; ++i) {
+    max_abs_value = std::max(max_abs_value, std::abs(system[i]));
+  }
+  const double singular_threshold = max_abs_value * 1e-12;
+  for (int col = 0; col < n; ++col) {
+    int pivot = col;
+    for (int row = col + 1; row < n; ++row) {
+      if (std::abs(system[row * num_cols + col]) >
+          std::abs(system[pivot * num_cols + col])) {
+        pivot = row;
+      }
+    }
+    if (std::abs(system[pivot * num_cols + col]) <= singular_threshold) {
+      return false;
+    }
+    if (pivot != col) {
+      std::swap_ranges(
+          system + pivot * num_cols,
+          system + (pivot + 1) * num_cols,
+          system + col * num_cols);
+    }
+    const double pivot_value = system[col * num_cols + col];
+    for (int i = col; i < num_cols; ++i) {
+      system[col * num_cols + i] /= pivot_value;
+    }
+    for (int row = 0; row < n; ++row) {
+      const double factor = system[row * num_cols + col];
+      if (row == col || factor == 0) {
+        continue;
+      }
+      for (int i = col; i < num_cols; ++i) {
+        system[row * num_cols + i] -= factor * system[col * num_cols + i];
+      }
+    }
+  }
+  return true;
+}
+
+// Computes the dot products of a spectrum with num_endmembers endmembers.
+void ProjectSpectrum(
+    const float* endmembers,
+    const int num_endmembers,
+    const int num_bands,
+    const float* spectrum,
+    double* projections) {
+
+#ifdef __AVX2__
+  // Up to four endmembers at a time share the loads of the spectrum.
+  const int num_vector_bands = num_bands - num_bands % 8;
+  for (int endmember = 0; endmember < num_endmembers; endmember += 4) {
+    const int count = std::min(4, num_endmembers - endmember);
+    const float* rows[4];
+    __m256 sums[4];
+    for (int i = 0; i < count; ++i) {
+      rows[i] = endmembers + static_cast<long>(endmember + i) * num_bands;
+      sums[i] = _mm256_setzero_ps();
+    }
+    for (int band = 0; band < num_vector_bands; band += 8) {
+      const __m256 values = _mm256_loadu_ps(spectrum + band);
+      for (int i = 0; i < count; ++i) {
+#ifdef __FMA__
+        sums[i] = _mm256_fmadd_ps(
+            _mm256_loadu_ps(rows[i] + band), values, sums[i]);
+#else
+        sums[i] = _mm256_add_ps(
+            sums[i], _mm256_mul_ps(_mm256_loadu_ps(rows[i] + band), values));
+#endif
+      }
+    }
+    for (int i = 0; i < count; ++i) {
+      float lanes[8];
+      _mm256_storeu_ps(lanes, sums[i]);
+      double sum = 0;
+      for (int lane = 0; lane < 8; ++lane) {
+        sum += lanes[lane];
+      }
+      for (int band = num_vector_bands; band < num_bands; ++band) {
+        sum += rows[i][band] * spectrum[band];
+      }
+      projections[endmember + i] = sum;
+    }
+  }
+#else
+  for (int endmember = 0; endmember < num_endmembers; ++endmember) {
+    const float* row = endmembers + static_cast<long>(endmember) * num_bands;
+    double sum = 0;
+    for (int band = 0; band < num_bands; ++band) {
+      sum += row[band] * spectrum[band];
+    }
+    projections[endmember] = sum;
+  }
+#endif
+}
+
+// Solves the constrained problem for pixels whose solution with all
+// endmembers is infeasible, with Lawson-Hanson active-set iterations on the
+// Gram matrix. The scratch space is reused for all pixels.
+class ActiveSetSolver {
+ public:
+  ActiveSetSolver(
+      const std::vector<double>& gram_matrix,
+      const bool sum_to_one,
+      const int max_iterations,
+      const double tolerance)
+      : gram_matrix_(gram_matrix),
+        num_endmembers_(std::sqrt(gram_matrix.size()) + 0.5),
+        sum_to_one_(sum_to_one),
+        max_iterations_(max_iterations),
+        tolerance_(tolerance),
+        is_passive_(num_endmembers_),
+        gradient_(num_endmembers_),
+        solution_(num_endmembers_) {}
+
+  // Computes the abundances from the projections of a spectrum onto the
+  // endmembers. abundances holds the (infeasible) solution with all
+  // endmembers, whose positive endmembers are tried as the first passive set.
+  void Solve(const double* projections, double* abundances) {
+    const int n = num_endmembers_;
+    passive_set_.clear();
+    for (int i = 0; i < n; ++i) {
+      if (abundances[i] > 0) {
+        passive_set_.push_back(i);
+      }
+    }
+    if (!StartFromPassiveSet(projections, abundances)) {
+      StartFromVertex(projections, abundances);
+    }
+
+    for (int iteration = 0; iteration < max_iterations_; ++iteration) {
+      // The negative gradient of the residual, less the sum-to-one
+      // multiplier (which makes it zero for the passive endmembers).
+      for (int i = 0; i < n; ++i) {
+        double gradient = projections[i];
+        for (const int j : passive_set_) {
+          gradient -= gram_matrix_[i * n + j] * abundances[j];
+        }
+        gradient_[i] = gradient;
+      }
+      double multiplier = 0;
+      if (sum_to_one_) {
+        for (const int i : passive_set_) {
+          multiplier += gradient_[i] / passive_set_.size();
+        }
+      }
+      int entering = -1;
+      for (int i = 0; i < n; ++i) {
+        if (!is_passive_[i] && gradient_[i] - multiplier > tolerance_ &&
+            (entering < 0 || gradient_[i] > gradient_[entering])) {
+          entering = i;
+        }
+      }
+      if (entering < 0) {
+        return;
+      }
+      passive_set_.push_back(entering);
+      is_passive_[entering] = true;
+
+      // Move towards the solution on the passive set until an abundance
+      // would become negative, and remove the endmembers that reach zero.
+      for (int step = 0; step < n && !passive_set_.empty(); ++step) {
+        if (!SolvePassiveSet(projections)) {
+          return;
+        }
+        double step_size = 1;
+        int blocking = -1;
+        for (const int i : passive_set_) {
+          if (solution_[i] <= 0) {
+            const double decrease = abundances[i] - solution_[i];
+            const double ratio =
+                (decrease > 0) ? abundances[i] / decrease : 0.0;
+            if (ratio < step_size) {
+              step_size = ratio;
+              blocking = i;
+            }
+          }
+        }
+        for (const int i : passive_set_) {
+          abundances[i] += step_size * (solution_[i] - abundances[i]);
+        }
+        if (blocking < 0) {
+          break;
+        }
+        // The blocking endmember is removed even if rounding left its
+        // abundance slightly positive.
+        abundances[blocking] = 0;
+        size_t num_remaining = 0;
+        for (const int i : passive_set_) {
+          if (abundances[i] <= 0) {
+            abundances[i] = 0;
+            is_passive_[i] = false;
+          } else {
+            passive_set_[num_remaining++] = i;
+          }
+        }
+        passive_set_.resize(num_remaining);
+      }
+    }
+  }
+
+ private:
+  // Starts from the solution on the current passive set, after removing the
+  // endmembers whose abundances are not positive until it is feasible.
+  // Returns false if no endmembers remain.
+  bool StartFromPassiveSet(const double* projections, double* abundances) {
+    std::fill(is_passive_.begin(), is_passive_.end(), false);
+    while (!passive_set_.empty()) {
+      if (!SolvePassiveSet(projections)) {
+        return false;
+      }
+      size_t num_remaining = 0;
+      for (const int i : passive_set_) {
+        if (solution_[i] > 0) {
+          passive_set_[num_remaining++] = i;
+        }
+      }
+      if (num_remaining == passive_set_.size()) {
+        break;
+      }
+      passive_set_.resize(num_remaining);
+    }
+    if (passive_set_.empty()) {
+      return false;
+    }
+    std::fill(abundances, abundances + num_endmembers_, 0.0);
+    for (const int i : passive_set_) {
+      abundances[i] = solution_[i];
+      is_passive_[i] = true;
+    }
+    return true;
+  }
+
+  // Starts from no endmembers, or with the sum-to-one constraint, from the
+  // single endmember closest to the spectrum, so every iterate is feasible.
+  void StartFromVertex(const double* projections, double* abundances) {
+    const int n = num_endmembers_;
+    passive_set_.clear();
+    std::fill(abundances, abundances + n, 0.0);
+    if (sum_to_one_) {
+      int best = 0;
+      for (int i = 1; i < n; ++i) {
+        if (2 * projections[i] - gram_matrix_[i * n + i] >
+            2 * projections[best] - gram_matrix_[best * n + best]) {
+          best = i;
+        }
+      }
+      passive_set_.push_back(best);
+      is_passive_[best] = true;
+      abundances[best] = 1;
+    }
+  }
+
+  // Solves the least squares problem restricted to the passive endmembers
+  // (with the sum-to-one constraint if enabled) into solution_. Returns false
+  // if the system is singular.
+  bool SolvePassiveSet(const double* projections) {
+    const int n = num_endmembers_;
+    const int num_passive = passive_set_.size();
+    const int size = sum_to_one_ ? num_passive + 1 : num_passive;
+    system_.assign(size * (size + 1), 0);
+    for (int row = 0; row < num_passive; ++row) {
+      double* system_row = &system_[row * (size + 1)];
+      for (int col = 0; col < num_passive; ++col) {
+        system_row[col] =
+            gram_matrix_[passive_set_[row] * n + passive_set_[col]];
+      }
+      system_row[size] = projections[passive_set_[row]];
+      if (sum_to_one_) {
+        system_row[num_passive] = 1;
+        system_[num_passive * (size + 1) + row] = 1;
+      }
+    }
+    if (sum_to_one_) {
+      system_[num_passive * (size + 1) + size] = 1;
+    }
+    if (!SolveLinearSystem(size, 1, system_.data())) {
+      return false;
+    }
+    for (int i = 0; i < num_passive; ++i) {
+      solution_[passive_set_[i]] = system_[i * (size + 1) + size];
+    }
+    return true;
+  }
+
+  const std::vector<double>& gram_matrix_;
+  const int num_endmembers_;
+  const bool sum_to_one_;
+  const int max_iterations_;
+  const double tolerance_;
+  std::vector<int> passive_set_;
+  std::vector<bool> is_passive_;
+  std::vector<double> gradient_;
+  std::vector<double> solution_;
+  std::vector<double> system_;
+};
+
+}  // namespace
+
+HSIUnmixer::HSIUnmixer(
+    const std::vector<std::vector<double>>& endmembers,
+    const HSIUnmixingOptions& options)
+    : options_(options),
+      num_endmembers_(endmembers.size()),
+      num_bands_(endmembers.empty() ? 0 : endmembers[0].size()) {
+
+  if (num_endmembers_ == 0 || num_bands_ == 0) {
+    FatalError("Unmixing requires at least one endmember.");
+  }
+  for (const std::vector<double>& endmember : endmembers) {
+    if (static_cast<int>(endmember.size()) != num_bands_) {
+      FatalError("All endmembers must have the same number of bands.");
+    }
+    endmembers_.insert(endmembers_.end(), endmember.begin(), endmember.end());
+  }
+  const int n = num_endmembers_;
+  gram_matrix_.assign(n * n, 0);
+  double max_diagonal = 0;
+  for (int i = 0; i < n; ++i) {
+    for (int j = 0; j < n; ++j) {
+      for (int band = 0; band < num_bands_; ++band) {
+        gram_matrix_[i * n + j] += endmembers[i][band] * endmembers[j][band];
+      }
+    }
+    max_diagonal = std::max(max_diagonal, gram_matrix_[i * n + i]);
+  }
+  tolerance_ = max_diagonal * 1e-10;
+
+  // Invert the Gram matrix, bordered by the sum-to-one constraint if
+  // enabled, for the solution with all endmembers.
+  const int size = options_.sum_to_one ? n + 1 : n;
+  std::vector<double> system(size * 2 * size, 0);
+  for (int row = 0; row < size; ++row) {
+    for (int col = 0; col < size; ++col) {
+      system[row * 2 * size + col] = (row < n && col < n) ?
+          gram_matrix_[row * n + col] : ((row == n && col == n) ? 0 : 1);
+    }
+    system[row * 2 * size + size + row] = 1;
+  }
+  if (!SolveLinearSystem(size, size, system.data())) {
+    FatalError("Endmembers must be linearly independent.");
+  }
+  solution_matrix_.resize(n * n);
+  solution_offset_.assign(n, 0);
+  for (int row = 0; row < n; ++row) {
+    for (int col = 0; col < n; ++col) {
+      solution_matrix_[row * n + col] = system[row * 2 * size + size + col];
+    }
+    if (options_.sum_to_one) {
+      solution_offset_[row] = system[row * 2 * size + size + n];
+    }
+  }
+}
+
+void HSIUnmixer::UnmixSpectra(
+    const float* spectra,
+    const long num_pixels,
+    const long stride,
+    float* abundances) const {
+
+  const int n = num_endmembers_;
+  std::vector<double> projections(n);
+  std::vector<double> solution(n);
+  ActiveSetSolver solver(
+      gram_matrix_,
+      options_.sum_to_one,
+      options_.max_iterations,
+      tolerance_);
+  for (long pixel = 0; pixel < num_pixels; ++pixel) {
+    ProjectSpectrum(
+        endmembers_.data(),
+        n,
+        num_bands_,
+        spectra + pixel * num_bands_,
+        projections.data());
+    bool is_feasible = true;
+    for (int i = 0; i < n; ++i) {
+      double value = solution_offset_[i];
+      for (int j = 0; j < n; ++j) {
+        value += solution_matrix_[i * n + j] * projections[j];
+      }
+      solution[i] = value;
+      is_feasible = is_feasible && value >= 0;
+    }
+    if (!is_feasible) {
+      solver.Solve(projections.data(), solution.data());
+    }
+    for (int i = 0; i < n; ++i) {
+      abundances[i * stride + pixel] = std::max(0.0, solution[i]);
+    }
+  }
+}
+
+void HSIUnmixer::Unmix(const float* spectrum, float* abundances) const {
+  UnmixSpectra(spectrum, 1, 1, abundances);
+}
+
+HSIData HSIUnmixer::Unmix(const HSIDataView& data_view) const {
+  HSIData materialized_data;
+  const HSIData& hsi_data = data_view.GetCompactData(&materialized_data);
+  if (hsi_data.num_bands != num_bands_) {
+    FatalError("The data must have one band for each endmember band.");
+  }
+  HSIData abundance_data;
+  abundance_data.num_rows = hsi_data.num_rows;
+  abundance_data.num_cols = hsi_data.num_cols;
+  abundance_data.num_bands = num_endmembers_;
+  abundance_data.interleave_format = HSI_INTERLEAVE_BSQ;
+  abundance_data.data_type = HSI_DATA_TYPE_FLOAT;
+  abundance_data.raw_data.resize(
+      static_cast<long>(abundance_data.NumDataPoints()) * sizeof(float));
+  float* abundances = reinterpret_cast<float*>(abundance_data.raw_data.data());
+
+  const long num_pixels =
+      static_cast<long>(hsi_data.num_rows) * hsi_data.num_cols;
+  const bool is_bip_float =
+      hsi_data.interleave_format == HSI_INTERLEAVE_BIP &&
+      hsi_data.data_type == HSI_DATA_TYPE_FLOAT;
+  ParallelFor(
+      0, num_pixels, options_.num_threads, kPixelBlockSize,
+      [&](const long begin, const long end) {
+        std::vector<int> rows;
+        std::vector<int> cols;
+        std::vector<float> spectra;
+        for (long pixel = begin; pixel < end; pixel += kPixelBlockSize) {
+          const long block_size = std::min(kPixelBlockSize, end - pixel);
+          const float* block_spectra;
+          if (is_bip_float) {
+            block_spectra =
+                reinterpret_cast<const float*>(hsi_data.raw_data.data()) +
+                pixel * num_bands_;
+          } else {
+            rows.resize(block_size);
+            cols.resize(block_size);
+            for (long i = 0; i < block_size; ++i) {
+              rows[i] = (pixel + i) / hsi_data.num_cols;
+              cols[i] = (pixel + i) % hsi_data.num_cols;
+            }
+            spectra.resize(block_size * num_bands_);
+            hsi_data.GatherSpectra(
+                rows.data(), cols.data(), block_size, spectra.data());
+            block_spectra = spectra.data();
+          }
+          UnmixSpectra(
+              block_spectra, block_size, num_pixels, abundances + pixel);
+        }
+      });
+  return abundance_data;
+}
+
+void HSIUnmixer::ReadAbundances(
+    const HSIDataRange& data_range,
+    HSIDataReader* reader,
+    const AbundanceRowsCallback& callback) const {
+
+  ForEachPrefetchedTile(
+      data_range,
+      options_.tile_rows,
+      reader,
+      [&](const HSIDataView& tile_view, const int start_row) {
+        callback(Unmix(tile_view), start_row);
+      });
+}
+
+}  // namespace hsi
@@ -0,0 +1,101 @@
+// Provides linear spectral unmixing: the fractional abundances of a set of
+// endmember spectra in each pixel, by non-negative least squares (NNLS) or
+// fully constrained least squares (FCLS, where the abundances also sum to
+// one).
+//
+// The endmember Gram matrix and the solution of the unconstrained (or only
+// sum-to-one constrained) problem are computed once. Most pixels are mixtures
+// of all endmembers and are solved by that alone; the others are solved with
+// an active-set method on the Gram matrix, without the spectra. The
+// projections of the spectra onto the endmembers are vectorized, and blocks
+// of pixels are unmixed in parallel.
+
+#ifndef SRC_HSI_UNMIXING_H_
+#define SRC_HSI_UNMIXING_H_
+
+#include <functional>
+#include <vector>
+
+#include "./hsi_data_reader.h"
+#include "./hsi_data_view.h"
+
+namespace hsi {
+
+struct HSIUnmixingOptions {
+  // If true, the abundances of each pixel sum to one (FCLS). Otherwise they
+  // are only non-negative (NNLS).
+  bool sum_to_one = true;
+
+  // The maximum number of active-set iterations for a pixel.
+  int max_iterations = 100;
+
+  // The number of threads. Zero means one for each hardware thread.
+  int num_threads = 0;
+
+  // The number of rows read at a time by ReadAbundances().
+  int tile_rows = 64;
+};
+
+// Called by HSIUnmixer::ReadAbundances() with the abundances of each tile,
+// starting at the given row of the range.
+typedef std::function<void(const HSIData& abundance_rows, const int start_row)>
+    AbundanceRowsCallback;
+
+class HSIUnmixer {
+ public:
+  // endmembers holds the spectra of the endmembers, which must be linearly
+  // independent and have the same number of bands as the unmixed data.
+  HSIUnmixer(
+      const std::vector<std::vector<double>>& endmembers,
+      const HSIUnmixingOptions& options);
+
+  int num_endmembers() const {
+    return num_endmembers_;
+  }
+
+  // Computes the abundances of a spectrum of num_bands values.
+  void Unmix(const float* spectrum, float* abundances) const;
+
+  // Returns the abundances of all pixels of the view (or of HSIData) as BSQ
+  // float data with one band for each endmember.
+  HSIData Unmix(const HSIDataView& data_view) const;
+
+  // Unmixes the given range as above, reading one tile of rows at a time from
+  // the reader (the next tile while the current one is unmixed). The range
+  // must include all bands.
+  void ReadAbundances(
+      const HSIDataRange& data_range,
+      HSIDataReader* reader,
+      const AbundanceRowsCallback& callback) const;
+
+ private:
+  // Computes the abundances of num_pixels contiguous spectra, writing the
+  // abundance of endmember i of pixel j to abundances[i * stride + j].
+  void UnmixSpectra(
+      const float* spectra,
+      const long num_pixels,
+      const long stride,
+      float* abundances) const;
+
+  const HSIUnmixingOptions options_;
+  int num_endmembers_;
+  int num_bands_;
+
+  // The endmembers as floats, one after the other, for the projections.
+  std::vector<float> endmembers_;
+
+  // The Gram matrix of the endmembers (row-major).
+  std::vector<double> gram_matrix_;
+
+  // The solution with all endmembers is
+  //   solution_matrix_ * projections + solution_offset_.
+  std::vector<double> solution_matrix_;
+  std::vector<double> solution_offset_;
+
+  // Values of the active-set gradient up to this are treated as zero.
+  double tolerance_;
+};
+
+}  // namespace hsi
+
+#endif  // SRC_HSI_UNMIXING_H_
@@ -0,0 +1,44 @@
+#include "./hsi_weighted_sum.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace hsi {
+
+void WeightedSum(
+    const float* const* inputs,
+    const float* weights,
+    const int num_inputs,
+    const long length,
+    float* output) {
+
+  long i = 0;
+#ifdef __AVX2__
+  for (; i + 8 <= length; i += 8) {
+    __m256 sum = _mm256_mul_ps(
+        _mm256_set1_ps(weights[0]), _mm256_loadu_ps(inputs[0] + i));
+    for (int j = 1; j < num_inputs; ++j) {
+#ifdef __FMA__
+      sum = _mm256_fmadd_ps(
+          _mm256_set1_ps(weights[j]), _mm256_loadu_ps(inputs[j] + i), sum);
+#else
+      sum = _mm256_add_ps(
+          sum,
+          _mm256_mul_ps(
+              _mm256_set1_ps(weights[j]), _mm256_loadu_ps(inputs[j] + i)));
+#endif
+    }
+    _mm256_storeu_ps(output + i, sum);
+  }
+#endif
+  for (; i < length; ++i) {
+    float sum = weights[0] * inputs[0][i];
+    for (int j = 1; j < num_inputs; ++j) {
+      sum += weights[j] * inputs[j][i];
+    }
+    output[i] = sum;
+  }
+}
+
+}  // namespace hsi
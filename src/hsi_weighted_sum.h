@@ -0,0 +1,19 @@
+// Provides the vectorized weighted sum of rows of floats that the spatial and
+// spectral filters apply their kernels with.
+
+#ifndef SRC_HSI_WEIGHTED_SUM_H_
+#define SRC_HSI_WEIGHTED_SUM_H_
+
+namespace hsi {
+
+// Computes output[i] = sum_j(weights[j] * inputs[j][i]) for length values.
+void WeightedSum(
+    const float* const* inputs,
+    const float* weights,
+    const int num_inputs,
+    const long length,
+    float* output);
+
+}  // namespace hsi
+
+#endif  // SRC_HSI_WEIGHTED_SUM_H_
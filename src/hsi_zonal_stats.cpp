@@ -0,0 +1,231 @@
+#include "./hsi_zonal_stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include <vector>
+
+#include "./hsi_data_view.h"
+#include "./hsi_parallel.h"
+
+namespace hsi {
+namespace {
+
+// The per-band sums of the zones seen by one thread.
+class ZoneTable {
+ public:
+  explicit ZoneTable(const int num_bands) : num_bands_(num_bands) {}
+
+  void AddSpectrum(const long label, const float* spectrum) {
+    // Neighboring pixels usually have the same label, so the last zone is
+    // checked before the hash table.
+    if (last_zone_ < 0 || label != last_label_) {
+      last_zone_ = GetZone(label);
+      last_label_ = label;
+    }
+    counts_[last_zone_]++;
+    double* sums = &sums_[static_cast<long>(last_zone_) * num_bands_];
+    double* sums_of_squares =
+        &sums_of_squares_[static_cast<long>(last_zone_) * num_bands_];
+    for (int band = 0; band < num_bands_; ++band) {
+      const double value = spectrum[band];
+      sums[band] += value;
+      sums_of_squares[band] += value * value;
+    }
+  }
+
+  const std::vector<long>& labels() const {
+    return labels_;
+  }
+
+  const std::vector<long>& counts() const {
+    return counts_;
+  }
+
+  const std::vector<double>& sums() const {
+    return sums_;
+  }
+
+  const std::vector<double>& sums_of_squares() const {
+    return sums_of_squares_;
+  }
+
+ private:
+  // Returns the index of the zone, adding it if it is new.
+  int GetZone(const long label) {
+    const auto itr = zone_indices_.find(label);
+    if (itr != zone_indices_.end()) {
+      return itr->second;
+    }
+    const int zone = labels_.size();
+    zone_indices_[label] = zone;
+    labels_.push_back(label);
+    counts_.push_back(0);
+    sums_.resize(sums_.size() + num_bands_, 0);
+    sums_of_squares_.resize(sums_of_squares_.size() + num_bands_, 0);
+    return zone;
+  }
+
+  const int num_bands_;
+  std::unordered_map<long, int> zone_indices_;
+  std::vector<long> labels_;
+  std::vector<long> counts_;
+  std::vector<double> sums_;
+  std::vector<double> sums_of_squares_;
+  long last_label_ = 0;
+  int last_zone_ = -1;
+};
+
+// Adds the pixels of the data to the tables, splitting the pixels evenly
+// between the tables (one for each thread).
+void AddToZoneTables(
+    const HSIData& hsi_data,
+    const HSIData& label_data,
+    std::vector<ZoneTable>* tables) {
+
+  if (label_data.num_bands != 1) {
+    FatalError("Label rasters must have a single band.");
+  }
+  if (label_data.num_rows != hsi_data.num_rows ||
+      label_data.num_cols != hsi_data.num_cols) {
+    FatalError("The label raster must have the size of the data.");
+  }
+  // Accumulate whole spectra at a time, from float BIP values.
+  HSIData float_data;
+  if (hsi_data.data_type != HSI_DATA_TYPE_FLOAT ||
+      hsi_data.interleave_format != HSI_INTERLEAVE_BIP) {
+    float_data =
+        ConvertData(hsi_data, HSI_DATA_TYPE_FLOAT, HSI_INTERLEAVE_BIP);
+  }
+  const float* values = reinterpret_cast<const float*>(
+      float_data.raw_data.empty() ?
+      hsi_data.raw_data.data() : float_data.raw_data.data());
+  // With a single band, all interleave formats store the labels row by row.
+  const HSIData labels =
+      ConvertData(label_data, HSI_DATA_TYPE_DOUBLE, HSI_INTERLEAVE_BSQ);
+  const double* label_values =
+      reinterpret_cast<const double*>(labels.raw_data.data());
+
+  const int num_bands = hsi_data.num_bands;
+  const long num_pixels =
+      static_cast<long>(hsi_data.num_rows) * hsi_data.num_cols;
+  const long num_tables = tables->size();
+  ParallelFor(
+      0, num_tables, num_tables, 1,
+      [&](const long begin, const long end) {
+        for (long table = begin; table < end; ++table) {
+          const long first_pixel = num_pixels * table / num_tables;
+          const long end_pixel = num_pixels * (table + 1) / num_tables;
+          for (long pixel = first_pixel; pixel < end_pixel; ++pixel) {
+            (*tables)[table].AddSpectrum(
+                static_cast<long>(label_values[pixel]),
+                values + pixel * num_bands);
+          }
+        }
+      });
+}
+
+// Merges the tables into the statistics of all zones.
+HSIZonalStats MergeZoneTables(
+    const std::vector<ZoneTable>& tables, const int num_bands) {
+
+  HSIZonalStats zonal_stats;
+  zonal_stats.num_bands = num_bands;
+  for (const ZoneTable& table : tables) {
+    zonal_stats.labels.insert(
+        zonal_stats.labels.end(),
+        table.labels().begin(),
+        table.labels().end());
+  }
+  std::sort(zonal_stats.labels.begin(), zonal_stats.labels.end());
+  zonal_stats.labels.erase(
+      std::unique(zonal_stats.labels.begin(), zonal_stats.labels.end()),
+      zonal_stats.labels.end());
+
+  const long num_values =
+      static_cast<long>(zonal_stats.labels.size()) * num_bands;
+  std::vector<double> sums(num_values, 0);
+  std::vector<double> sums_of_squares(num_values, 0);
+  zonal_stats.pixel_counts.assign(zonal_stats.labels.size(), 0);
+  for (const ZoneTable& table : tables) {
+    for (size_t i = 0; i < table.labels().size(); ++i) {
+      const long zone = zonal_stats.FindZone(table.labels()[i]);
+      zonal_stats.pixel_counts[zone] += table.counts()[i];
+      for (int band = 0; band < num_bands; ++band) {
+        sums[zone * num_bands + band] += table.sums()[i * num_bands + band];
+        sums_of_squares[zone * num_bands + band] +=
+            table.sums_of_squares()[i * num_bands + band];
+      }
+    }
+  }
+
+  zonal_stats.means.resize(num_values);
+  zonal_stats.std_devs.resize(num_values);
+  for (long i = 0; i < num_values; ++i) {
+    const double count = zonal_stats.pixel_counts[i / num_bands];
+    const double mean = sums[i] / count;
+    zonal_stats.means[i] = mean;
+    zonal_stats.std_devs[i] =
+        std::sqrt(std::max(0.0, sums_of_squares[i] / count - mean * mean));
+  }
+  return zonal_stats;
+}
+
+}  // namespace
+
+int HSIZonalStats::FindZone(const long label) const {
+  const auto itr = std::lower_bound(labels.begin(), labels.end(), label);
+  if (itr == labels.end() || *itr != label) {
+    return -1;
+  }
+  return itr - labels.begin();
+}
+
+HSIZonalStats ComputeZonalStats(
+    const HSIDataView& data_view,
+    const HSIDataView& label_view,
+    const HSIZonalStatsOptions& options) {
+
+  HSIData materialized_data;
+  HSIData materialized_labels;
+  const HSIData& hsi_data = data_view.GetCompactData(&materialized_data);
+  const HSIData& label_data = label_view.GetCompactData(&materialized_labels);
+
+  std::vector<ZoneTable> tables(
+      GetNumThreads(options.num_threads), ZoneTable(hsi_data.num_bands));
+  AddToZoneTables(hsi_data, label_data, &tables);
+  return MergeZoneTables(tables, hsi_data.num_bands);
+}
+
+HSIZonalStats ReadZonalStats(
+    const HSIDataRange& data_range,
+    const HSIZonalStatsOptions& options,
+    HSIDataReader* reader,
+    HSIDataReader* label_reader) {
+
+  if (label_reader->GetOptions().num_data_rows !=
+          reader->GetOptions().num_data_rows ||
+      label_reader->GetOptions().num_data_cols !=
+          reader->GetOptions().num_data_cols) {
+    FatalError("The label raster must have the size of the data.");
+  }
+  const int num_bands = data_range.end_band - data_range.start_band;
+  std::vector<ZoneTable> tables(
+      GetNumThreads(options.num_threads), ZoneTable(num_bands));
+  HSIDataRange label_range = data_range;
+  label_range.start_band = 0;
+  label_range.end_band = 1;
+  ForEachPrefetchedTile(
+      {data_range, label_range},
+      options.tile_rows,
+      {reader, label_reader},
+      [&tables](const std::vector<HSIDataView>& tile_views, const int) {
+        AddToZoneTables(
+            tile_views[0].GetUnderlyingData(),
+            tile_views[1].GetUnderlyingData(),
+            &tables);
+      });
+  return MergeZoneTables(tables, num_bands);
+}
+
+}  // namespace hsi
@@ -0,0 +1,64 @@
+// Provides zonal statistics: the pixel count, mean spectrum, and standard
+// deviation of each band for every zone (label) of a label raster, such as
+// the fields of a scene.
+//
+// The statistics are accumulated one tile of rows at a time, with one table of
+// per-band sums for each thread, and the tables are merged at the end. Memory
+// use is constant apart from the tables, which grow with the number of zones.
+// While a tile is accumulated, the next tile is read on another thread, so
+// scenes are processed at about the speed that they can be read.
+
+#ifndef SRC_HSI_ZONAL_STATS_H_
+#define SRC_HSI_ZONAL_STATS_H_
+
+#include <vector>
+
+#include "./hsi_data_reader.h"
+#include "./hsi_data_view.h"
+
+namespace hsi {
+
+struct HSIZonalStatsOptions {
+  // The number of threads. Zero means one for each hardware thread.
+  int num_threads = 0;
+
+  // The number of rows read at a time by ReadZonalStats().
+  int tile_rows = 64;
+};
+
+// The statistics of all zones, sorted by label.
+struct HSIZonalStats {
+  int num_bands = 0;
+  std::vector<long> labels;
+  std::vector<long> pixel_counts;
+
+  // The mean and (population) standard deviation of each band of each zone,
+  // with the num_bands values of zone i starting at index i * num_bands.
+  std::vector<double> means;
+  std::vector<double> std_devs;
+
+  // Returns the index of the zone with the given label, or -1 if there is no
+  // such zone.
+  int FindZone(const long label) const;
+};
+
+// Returns the statistics of the zones of the view (or of HSIData). The labels
+// are a single-band raster with integer labels and the same number of rows
+// and columns as the view.
+HSIZonalStats ComputeZonalStats(
+    const HSIDataView& data_view,
+    const HSIDataView& label_view,
+    const HSIZonalStatsOptions& options);
+
+// Returns the statistics of the zones of the given range, reading the data and
+// the labels (the first band of label_reader, at the same rows and columns)
+// one tile of rows at a time.
+HSIZonalStats ReadZonalStats(
+    const HSIDataRange& data_range,
+    const HSIZonalStatsOptions& options,
+    HSIDataReader* reader,
+    HSIDataReader* label_reader);
+
+}  // namespace hsi
+
+#endif  // SRC_HSI_ZONAL_STATS_H_
@@ -1,21 +1,2011 @@
 // Runs some basic tests on specified data and serves as an example for using
-// the code.
+// the code. With the argument --regression, runs regression tests on small
+// generated files instead.
 
+#include <dirent.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <random>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include "./hsi_data_compare.h"
 #include "./hsi_data_reader.h"
+#include "./hsi_data_view.h"
+#include "./hsi_destriping.h"
+#include "./hsi_geo_window.h"
+#include "./hsi_glt_ortho.h"
+#include "./hsi_half_float.h"
+#include "./hsi_integer_kernels.h"
+#include "./hsi_line_writer.h"
+#include "./hsi_output_cube.h"
+#include "./hsi_packed_data.h"
+#include "./hsi_quantized_data.h"
+#include "./hsi_roi.h"
+#include "./hsi_spatial_filter.h"
+#include "./hsi_spectral_filter.h"
+#include "./hsi_target_detection.h"
+#include "./hsi_unmixing.h"
+#include "./hsi_zonal_stats.h"
 
 using hsi::HSIData;
 using hsi::HSIDataOptions;
 using hsi::HSIDataReader;
 
+namespace {
+
+// The number of failed checks.
+int num_failures = 0;
+
+void Check(const bool condition, const std::string& description) {
+  if (!condition) {
+    std::cerr << "FAILED: " << description << std::endl;
+    ++num_failures;
+  }
+}
+
+// Writes the values (of any type) to a new file in the test directory, and
+// returns its path.
+template <typename T>
+std::string WriteTestFile(
+    const std::string& directory,
+    const std::string& name,
+    const std::vector<T>& values) {
+
+  const std::string path = directory + "/" + name;
+  std::ofstream file(path, std::ios::binary);
+  file.write(reinterpret_cast<const char*>(values.data()),
+             values.size() * sizeof(T));
+  return path;
+}
+
+HSIDataOptions GetTestOptions(
+    const std::string& path,
+    const hsi::HSIDataType data_type,
+    const int num_rows,
+    const int num_cols,
+    const int num_bands) {
+
+  HSIDataOptions data_options(path);
+  data_options.interleave_format = hsi::HSI_INTERLEAVE_BSQ;
+  data_options.data_type = data_type;
+  data_options.num_data_rows = num_rows;
+  data_options.num_data_cols = num_cols;
+  data_options.num_data_bands = num_bands;
+  return data_options;
+}
+
+hsi::HSIDataRange GetFullRange(const HSIDataOptions& data_options) {
+  hsi::HSIDataRange data_range;
+  data_range.end_row = data_options.num_data_rows;
+  data_range.end_col = data_options.num_data_cols;
+  data_range.end_band = data_options.num_data_bands;
+  return data_range;
+}
+
+// Returns in-memory float data of the given size and interleave format,
+// holding the values in that interleave order.
+HSIData GetFloatData(
+    const int num_rows,
+    const int num_cols,
+    const int num_bands,
+    const hsi::HSIDataInterleaveFormat interleave_format,
+    const std::vector<float>& values) {
+
+  HSIData hsi_data;
+  hsi_data.num_rows = num_rows;
+  hsi_data.num_cols = num_cols;
+  hsi_data.num_bands = num_bands;
+  hsi_data.interleave_format = interleave_format;
+  hsi_data.data_type = hsi::HSI_DATA_TYPE_FLOAT;
+  hsi_data.raw_data.assign(
+      reinterpret_cast<const char*>(values.data()),
+      reinterpret_cast<const char*>(values.data() + values.size()));
+  return hsi_data;
+}
+
+// Cached reads of complex data must keep the extracted components apart.
+void TestCacheKeepsComplexComponents(const std::string& directory) {
+  const std::string path = WriteTestFile(
+      directory, "complex.bin", std::vector<float>{1, 1, 3, 4});
+  HSIDataOptions data_options =
+      GetTestOptions(path, hsi::HSI_DATA_TYPE_COMPLEX_FLOAT, 1, 2, 1);
+  data_options.cache_directory = directory;
+  data_options.extract_complex_component = true;
+
+  data_options.complex_component = hsi::HSI_COMPLEX_MAGNITUDE;
+  HSIDataReader magnitude_reader(data_options);
+  magnitude_reader.ReadData(GetFullRange(data_options));
+  Check(std::abs(magnitude_reader.GetData().GetValueAsDouble(0, 1, 0) - 5) <
+            1e-6,
+        "cached complex magnitude");
+
+  data_options.complex_component = hsi::HSI_COMPLEX_PHASE;
+  HSIDataReader phase_reader(data_options);
+  phase_reader.ReadData(GetFullRange(data_options));
+  Check(std::abs(phase_reader.GetData().GetValueAsDouble(0, 0, 0) -
+                 std::atan2(1.0, 1.0)) < 1e-6,
+        "cached complex phase after a cached magnitude read");
+}
+
+// Caching a regenerated file must replace the entries of its earlier
+// versions, while keeping other conversions of the current version.
+void TestCacheRemovesOutdatedEntries(const std::string& directory) {
+  const std::string cache_directory = directory + "/outdated_cache";
+  if (mkdir(cache_directory.c_str(), 0755) != 0) {
+    Check(false, "create the cache directory");
+    return;
+  }
+  const auto count_cached_files = [&cache_directory]() {
+    int num_files = 0;
+    DIR* cache = opendir(cache_directory.c_str());
+    struct dirent* entry;
+    while ((entry = readdir(cache)) != nullptr) {
+      const std::string name(entry->d_name);
+      num_files += (name.size() > 4 &&
+                    name.compare(name.size() - 4, 4, ".dat") == 0);
+    }
+    closedir(cache);
+    return num_files;
+  };
+
+  for (int version = 0; version < 3; ++version) {
+    const std::string path = WriteTestFile(
+        directory, "regenerated.bin", std::vector<float>(2 * 3 * 4, version));
+    HSIDataOptions data_options =
+        GetTestOptions(path, hsi::HSI_DATA_TYPE_FLOAT, 2, 3, 4);
+    data_options.cache_directory = cache_directory;
+    for (const bool convert_interleave_format : {false, true}) {
+      data_options.convert_interleave_format = convert_interleave_format;
+      HSIDataReader reader(data_options);
+      reader.ReadData(GetFullRange(data_options));
+      Check(reader.GetData().GetValueAsDouble(1, 2, 3) == version,
+            "cached read of a regenerated file");
+    }
+  }
+  Check(count_cached_files() == 2,
+        "the cache keeps only entries of the current file version");
+}
+
+// Reads through the cache must see ranges written in place, even within the
+// same second as the write.
+void TestCachedReadAfterWriteRange(const std::string& directory) {
+  const std::string path = WriteTestFile(
+      directory, "write_range.bin", std::vector<float>(4 * 5 * 3, 1.0f));
+  HSIDataOptions data_options =
+      GetTestOptions(path, hsi::HSI_DATA_TYPE_FLOAT, 4, 5, 3);
+  data_options.cache_directory = directory;
+  HSIDataReader reader(data_options);
+  reader.ReadData(GetFullRange(data_options));
+
+  hsi::HSIDataRange patch_range;
+  patch_range.start_row = 1;
+  patch_range.end_row = 3;
+  patch_range.start_col = 2;
+  patch_range.end_col = 4;
+  patch_range.start_band = 1;
+  patch_range.end_band = 2;
+  HSIData patch;
+  patch.num_rows = 2;
+  patch.num_cols = 2;
+  patch.num_bands = 1;
+  patch.interleave_format = hsi::HSI_INTERLEAVE_BIP;
+  patch.data_type = hsi::HSI_DATA_TYPE_DOUBLE;
+  const std::vector<double> patch_values(4, 100.0);
+  patch.raw_data.assign(
+      reinterpret_cast<const char*>(patch_values.data()),
+      reinterpret_cast<const char*>(patch_values.data() + 4));
+  reader.WriteRange(patch_range, patch, hsi::HSIWriteRangeOptions());
+
+  reader.ReadData(GetFullRange(data_options));
+  const HSIData& hsi_data = reader.GetData();
+  Check(hsi_data.GetValueAsDouble(2, 3, 1) == 100,
+        "cached read after WriteRange returns the written value");
+  Check(hsi_data.GetValueAsDouble(2, 3, 0) == 1 &&
+            hsi_data.GetValueAsDouble(0, 3, 1) == 1,
+        "WriteRange leaves values outside of the range unchanged");
+}
+
+// Range reads must seek to their first value (even when it is the second
+// value of the file) and count value positions from the header offset.
+void TestReadRangeAfterHeader(const std::string& directory) {
+  const int num_rows = 3;
+  const int num_cols = 4;
+  const int num_bands = 2;
+  const int header_values = 4;
+  std::vector<float> values(header_values + num_rows * num_cols * num_bands);
+  for (int i = 0; i < static_cast<int>(values.size()); ++i) {
+    values[i] = static_cast<float>(i - header_values);
+  }
+  const std::string path = WriteTestFile(directory, "header.bin", values);
+  const hsi::HSIDataInterleaveFormat interleave_formats[] = {
+      hsi::HSI_INTERLEAVE_BSQ, hsi::HSI_INTERLEAVE_BIL,
+      hsi::HSI_INTERLEAVE_BIP};
+  for (const hsi::HSIDataInterleaveFormat interleave_format :
+       interleave_formats) {
+    for (const int header_offset : {0, header_values}) {
+      HSIDataOptions data_options = GetTestOptions(
+          path, hsi::HSI_DATA_TYPE_FLOAT, num_rows, num_cols, num_bands);
+      data_options.interleave_format = interleave_format;
+      data_options.header_offset = header_offset * sizeof(float);
+      hsi::HSIDataRange data_range = GetFullRange(data_options);
+      data_range.start_col = 1;
+      HSIDataReader reader(data_options);
+      reader.ReadData(data_range);
+      const HSIData& hsi_data = reader.GetData();
+
+      bool matches = true;
+      for (int row = 0; row < num_rows; ++row) {
+        for (int col = 1; col < num_cols; ++col) {
+          for (int band = 0; band < num_bands; ++band) {
+            long index = 0;
+            if (interleave_format == hsi::HSI_INTERLEAVE_BSQ) {
+              index = (band * num_rows + row) * num_cols + col;
+            } else if (interleave_format == hsi::HSI_INTERLEAVE_BIL) {
+              index = (row * num_bands + band) * num_cols + col;
+            } else {
+              index = (row * num_cols + col) * num_bands + band;
+            }
+            matches = matches &&
+                      hsi_data.GetValueAsDouble(row, col - 1, band) ==
+                          values[header_offset + index];
+          }
+        }
+      }
+      Check(matches, "range reads start at the first value after the header");
+    }
+  }
+}
+
+// Lines appended after Close() must be refused, even when the writer waits
+// for room in a full buffer.
+void TestAppendLineAfterClose(const std::string& directory) {
+  HSIDataOptions data_options = GetTestOptions(
+      directory + "/lines.bin", hsi::HSI_DATA_TYPE_INT16, 0, 3, 2);
+  hsi::HSILineWriterOptions writer_options;
+  writer_options.buffer_lines = 2;
+  writer_options.wait_when_full = true;
+  hsi::HSILineWriter writer(
+      data_options, directory + "/lines.hdr", writer_options);
+  const std::vector<char> line(writer.line_size(), 1);
+  for (int i = 0; i < 5; ++i) {
+    writer.AppendLine(line.data());
+  }
+  writer.Close();
+  Check(writer.num_lines_written() == 5, "line writer writes every line");
+  bool appended = false;
+  for (int i = 0; i < 5; ++i) {
+    appended |= writer.AppendLine(line.data());
+  }
+  Check(!appended, "AppendLine() after Close() returns false");
+}
+
+// Every line accepted while Close() runs on another thread must be written.
+void TestCloseWhileAppending(const std::string& directory) {
+  HSIDataOptions data_options = GetTestOptions(
+      directory + "/racing_lines.bin", hsi::HSI_DATA_TYPE_INT16, 0, 4, 2);
+  int num_lost_lines = 0;
+  for (int trial = 0; trial < 50; ++trial) {
+    hsi::HSILineWriterOptions writer_options;
+    writer_options.buffer_lines = 8;
+    writer_options.wait_when_full = (trial % 2 == 1);
+    writer_options.idle_sleep_micros = 1;
+    hsi::HSILineWriter writer(data_options, "", writer_options);
+    const std::vector<char> line(writer.line_size(), 1);
+    std::atomic<long> num_accepted(0);
+    std::atomic<bool> capturing(true);
+    std::thread capture_thread([&]() {
+      while (capturing.load()) {
+        num_accepted += writer.AppendLine(line.data());
+      }
+    });
+    std::this_thread::sleep_for(std::chrono::microseconds(trial * 10));
+    writer.Close();
+    capturing.store(false);
+    capture_thread.join();
+    num_lost_lines += num_accepted.load() - writer.num_lines_written();
+  }
+  Check(num_lost_lines == 0, "lines accepted during Close() are written");
+}
+
+// Ranges written in place and to output cubes must be converted to the
+// file's data type, interleave format, and byte order.
+void TestWriteRangeToBigEndianFiles(const std::string& directory) {
+  const std::string path = WriteTestFile(
+      directory, "big_endian.bin", std::vector<int16_t>(2 * 3 * 2, 0));
+  HSIDataOptions data_options =
+      GetTestOptions(path, hsi::HSI_DATA_TYPE_INT16, 2, 3, 2);
+  data_options.interleave_format = hsi::HSI_INTERLEAVE_BIL;
+  data_options.big_endian = true;
+
+  hsi::HSIDataRange patch_range = GetFullRange(data_options);
+  patch_range.start_col = 1;
+  HSIData patch;
+  patch.num_rows = 2;
+  patch.num_cols = 2;
+  patch.num_bands = 2;
+  patch.interleave_format = hsi::HSI_INTERLEAVE_BIP;
+  patch.data_type = hsi::HSI_DATA_TYPE_FLOAT;
+  std::vector<float> patch_values;
+  for (int row = 0; row < 2; ++row) {
+    for (int col = 1; col < 3; ++col) {
+      for (int band = 0; band < 2; ++band) {
+        patch_values.push_back(300 * row + 20 * col + band);
+      }
+    }
+  }
+  patch.raw_data.assign(
+      reinterpret_cast<const char*>(patch_values.data()),
+      reinterpret_cast<const char*>(patch_values.data() + 8));
+  HSIDataReader(data_options).WriteRange(
+      patch_range, patch, hsi::HSIWriteRangeOptions());
+
+  HSIDataOptions cube_options = data_options;
+  cube_options.hsi_file_path = directory + "/big_endian_cube.bin";
+  {
+    hsi::HSIOutputCube output_cube(cube_options, "");
+    output_cube.WriteRange(patch_range, patch);
+  }
+
+  for (const HSIDataOptions& file_options : {data_options, cube_options}) {
+    HSIDataReader reader(file_options);
+    reader.ReadData(GetFullRange(file_options));
+    const HSIData& hsi_data = reader.GetData();
+    bool all_equal = true;
+    for (int row = 0; row < 2; ++row) {
+      for (int col = 0; col < 3; ++col) {
+        for (int band = 0; band < 2; ++band) {
+          const double expected = col == 0 ? 0 : 300 * row + 20 * col + band;
+          all_equal &= hsi_data.GetValueAsDouble(row, col, band) == expected;
+        }
+      }
+    }
+    Check(all_equal, "range written to big endian " +
+                         file_options.hsi_file_path);
+  }
+}
+
+// Writes a BSQ float file with one band of the given numbers of samples and
+// lines, where each value is the offset of its pixel in the band (line *
+// num_samples + sample), and returns its options.
+HSIDataOptions WritePixelOffsetFile(
+    const std::string& directory,
+    const std::string& name,
+    const int num_samples,
+    const int num_lines) {
+
+  std::vector<float> values(num_samples * num_lines);
+  for (size_t i = 0; i < values.size(); ++i) {
+    values[i] = static_cast<float>(i);
+  }
+  // Rows are samples for BSQ data, as in HSIDataOptions::ReadHeaderFromFile().
+  return GetTestOptions(
+      WriteTestFile(directory, name, values),
+      hsi::HSI_DATA_TYPE_FLOAT,
+      num_samples,
+      num_lines,
+      1);
+}
+
+// Geographic windows of non-square BSQ images must hold the pixels at the
+// samples and lines of the window.
+void TestGeoWindowOfBSQData(const std::string& directory) {
+  const int num_samples = 5;
+  HSIDataOptions data_options =
+      WritePixelOffsetFile(directory, "geo_window.bsq", num_samples, 3);
+  // Samples increase along x and lines decrease along y, one unit per pixel.
+  data_options.map_info.projection = "Arbitrary";
+  const HSIDataReader reader(data_options);
+
+  // Samples 2 to 4 of lines 0 and 1.
+  const hsi::HSIROIData roi_data =
+      hsi::ReadGeoWindow(2, -2, 5, 0, hsi::HSIROIReadOptions(), reader);
+  std::vector<float> values;
+  for (int i = 0; i < roi_data.spectra.num_cols; ++i) {
+    values.push_back(roi_data.spectra.GetValueAsDouble(0, i, 0));
+  }
+  std::sort(values.begin(), values.end());
+  Check(values == std::vector<float>({2, 3, 4, 7, 8, 9}),
+        "geographic window of non-square BSQ data");
+}
+
+// Orthorectification of non-square BSQ images must take each cell from the
+// sample and line of the GLT.
+void TestOrthorectifyBSQData(const std::string& directory) {
+  const HSIDataOptions raw_options =
+      WritePixelOffsetFile(directory, "glt_raw.bsq", 5, 3);
+  const HSIDataReader raw_reader(raw_options);
+
+  // One row of three cells, with the 1-based sample and line of each.
+  const std::vector<int32_t> glt_values = {4, 1, 2, 3, 5, 2};
+  HSIDataOptions glt_options = GetTestOptions(
+      WriteTestFile(directory, "glt.bip", glt_values),
+      hsi::HSI_DATA_TYPE_INT32,
+      1,
+      3,
+      2);
+  glt_options.interleave_format = hsi::HSI_INTERLEAVE_BIP;
+  HSIDataReader glt_reader(glt_options);
+
+  std::vector<double> values(3, -1);
+  hsi::Orthorectify(
+      hsi::HSIGLTOrthoOptions(),
+      raw_reader,
+      &glt_reader,
+      [&values](const HSIData& ortho_rows, const int start_row) {
+        for (int row = 0; row < ortho_rows.num_rows; ++row) {
+          for (int col = 0; col < ortho_rows.num_cols; ++col) {
+            values.at((start_row + row) * 3 + col) =
+                ortho_rows.GetValueAsDouble(row, col, 0);
+          }
+        }
+      });
+  Check(values == std::vector<double>({3, 11, 9}),
+        "orthorectification of non-square BSQ data");
+}
+
+// Writes the image of the given numbers of samples, lines, and bands, whose
+// values are get_value(sample, line, band), to a float file of the given
+// interleave format, and returns its options.
+HSIDataOptions WriteImageFile(
+    const std::string& directory,
+    const std::string& name,
+    const hsi::HSIDataInterleaveFormat interleave_format,
+    const int num_samples,
+    const int num_lines,
+    const int num_bands,
+    const std::function<float(int sample, int line, int band)>& get_value) {
+
+  std::vector<float> values(num_samples * num_lines * num_bands);
+  for (int line = 0; line < num_lines; ++line) {
+    for (int sample = 0; sample < num_samples; ++sample) {
+      for (int band = 0; band < num_bands; ++band) {
+        int index = 0;
+        if (interleave_format == hsi::HSI_INTERLEAVE_BSQ) {
+          index = (band * num_lines + line) * num_samples + sample;
+        } else if (interleave_format == hsi::HSI_INTERLEAVE_BIL) {
+          index = (line * num_bands + band) * num_samples + sample;
+        } else {
+          index = (line * num_samples + sample) * num_bands + band;
+        }
+        values[index] = get_value(sample, line, band);
+      }
+    }
+  }
+  // Rows are samples for BSQ data, as in HSIDataOptions::ReadHeaderFromFile().
+  const bool is_bsq = (interleave_format == hsi::HSI_INTERLEAVE_BSQ);
+  HSIDataOptions data_options = GetTestOptions(
+      WriteTestFile(directory, name, values),
+      hsi::HSI_DATA_TYPE_FLOAT,
+      is_bsq ? num_samples : num_lines,
+      is_bsq ? num_lines : num_samples,
+      num_bands);
+  data_options.interleave_format = interleave_format;
+  return data_options;
+}
+
+// Writes the image as above to a BSQ and to a BIL file, and returns their
+// options in that order.
+std::vector<HSIDataOptions> WriteBSQAndBILFiles(
+    const std::string& directory,
+    const std::string& name,
+    const int num_samples,
+    const int num_lines,
+    const int num_bands,
+    const std::function<float(int sample, int line, int band)>& get_value) {
+
+  return {
+      WriteImageFile(directory, name + ".bsq", hsi::HSI_INTERLEAVE_BSQ,
+                     num_samples, num_lines, num_bands, get_value),
+      WriteImageFile(directory, name + ".bil", hsi::HSI_INTERLEAVE_BIL,
+                     num_samples, num_lines, num_bands, get_value)};
+}
+
+// Destriping of non-square BSQ images must correct the samples of each line,
+// and match the destriping of the same image stored as BIL.
+void TestDestripingOfBSQData(const std::string& directory) {
+  const int num_samples = 4;
+  const int num_lines = 6;
+  const int num_bands = 2;
+  // Each line has its own level, and each sample a stripe.
+  const std::vector<HSIDataOptions> file_options = WriteBSQAndBILFiles(
+      directory,
+      "stripes",
+      num_samples,
+      num_lines,
+      num_bands,
+      [](const int sample, const int line, const int band) {
+        return static_cast<float>(
+            (line * 7) % 5 + 3 * band + 10 * sample * (band + 1));
+      });
+
+  // All lines, and samples 1 to 3.
+  hsi::HSIDataRange image_range;
+  image_range.end_row = num_lines;
+  image_range.start_col = 1;
+  image_range.end_col = num_samples;
+  image_range.end_band = num_bands;
+  const int range_samples = num_samples - 1;
+  for (const int tile_rows : {1, 4}) {
+    hsi::HSIDestripingOptions options;
+    options.tile_rows = tile_rows;
+    std::vector<std::vector<float>> destriped_values;
+    for (const HSIDataOptions& data_options : file_options) {
+      HSIDataReader reader(data_options);
+      hsi::HSIDestriper destriper(range_samples, num_bands, options);
+      destriper.ReadColumnStats(image_range, &reader);
+      destriper.ComputeCorrection();
+      std::vector<float> values(num_lines * num_bands * range_samples, -1);
+      destriper.ReadDestripedLines(
+          image_range,
+          &reader,
+          [&values, range_samples](
+              const HSIData& lines, const int start_row) {
+            for (int row = 0; row < lines.num_rows; ++row) {
+              for (int band = 0; band < lines.num_bands; ++band) {
+                for (int col = 0; col < range_samples; ++col) {
+                  values.at(((start_row + row) * num_bands + band) *
+                                range_samples + col) =
+                      lines.GetValueAsDouble(row, col, band);
+                }
+              }
+            }
+          });
+      destriped_values.push_back(values);
+    }
+    bool lines_are_flat = true;
+    for (int line = 0; line < num_lines; ++line) {
+      for (int band = 0; band < num_bands; ++band) {
+        const float* line_values = &destriped_values[0][
+            (line * num_bands + band) * range_samples];
+        for (int col = 1; col < range_samples; ++col) {
+          lines_are_flat &= std::abs(line_values[col] - line_values[0]) < 1e-4;
+        }
+      }
+    }
+    Check(lines_are_flat, "destriping removes the stripes of BSQ samples");
+    Check(destriped_values[0] == destriped_values[1],
+          "destriping of BSQ data matches the same image in BIL");
+  }
+}
+
+// Spatial filtering of non-square BSQ images must filter along the lines and
+// samples of the image, and match filtering the same image in memory and
+// stored as BIL.
+void TestSpatialFilterOfBSQData(const std::string& directory) {
+  const int num_samples = 5;
+  const int num_lines = 3;
+  const int num_bands = 2;
+  const auto get_value = [](const int sample, const int line, const int band) {
+    return static_cast<float>(sample * sample + 7 * line + 50 * band);
+  };
+  const std::vector<HSIDataOptions> file_options = WriteBSQAndBILFiles(
+      directory, "filter", num_samples, num_lines, num_bands, get_value);
+
+  // All lines, and samples 1 to 4.
+  hsi::HSIDataRange image_range;
+  image_range.end_row = num_lines;
+  image_range.start_col = 1;
+  image_range.end_col = num_samples;
+  image_range.end_band = num_bands;
+  const int range_samples = num_samples - 1;
+  std::vector<float> image_values;
+  for (int band = 0; band < num_bands; ++band) {
+    for (int line = 0; line < num_lines; ++line) {
+      for (int sample = 1; sample < num_samples; ++sample) {
+        image_values.push_back(get_value(sample, line, band));
+      }
+    }
+  }
+  hsi::HSISpatialFilterOptions options;
+  options.row_kernel = {0.25f, 0.5f, 0.25f};
+  options.col_kernel = {0.5f, 0.25f, 0.25f};
+  const HSIData expected_data = hsi::FilterBands(
+      GetFloatData(num_lines, range_samples, num_bands,
+                   hsi::HSI_INTERLEAVE_BSQ, image_values),
+      options);
+
+  for (const int tile_rows : {1, 2}) {
+    options.tile_rows = tile_rows;
+    for (const HSIDataOptions& data_options : file_options) {
+      HSIDataReader reader(data_options);
+      bool matches = true;
+      int num_filtered_lines = 0;
+      hsi::ReadFilteredBands(
+          image_range,
+          options,
+          &reader,
+          [&](const HSIData& filtered_rows, const int start_row) {
+            num_filtered_lines += filtered_rows.num_rows;
+            matches &= (filtered_rows.num_cols == range_samples);
+            for (int row = 0; row < filtered_rows.num_rows; ++row) {
+              for (int col = 0; col < range_samples; ++col) {
+                for (int band = 0; band < num_bands; ++band) {
+                  matches &= std::abs(
+                      filtered_rows.GetValueAsDouble(row, col, band) -
+                      expected_data.GetValueAsDouble(
+                          start_row + row, col, band)) < 1e-4;
+                }
+              }
+            }
+          });
+      Check(matches && num_filtered_lines == num_lines,
+            "spatial filtering of " +
+                std::string(data_options.interleave_format ==
+                            hsi::HSI_INTERLEAVE_BSQ ? "BSQ" : "BIL") +
+                " data matches filtering the image in memory");
+    }
+  }
+}
+
+// Polygon and label spans of non-square images must read the pixels at their
+// lines and samples from files of every interleave format.
+void TestROIOfImageSpans(const std::string& directory) {
+  const int num_samples = 5;
+  const int num_lines = 3;
+  const int num_bands = 2;
+  const auto get_value = [](const int sample, const int line, const int band) {
+    return static_cast<float>(100 * band + 10 * line + sample);
+  };
+
+  // A triangle that covers samples 1 to 4 of line 0, 2 to 4 of line 1, and 4
+  // of line 2.
+  std::vector<hsi::HSIPolygonVertex> polygon(3);
+  polygon[1].col = num_samples;
+  polygon[2].row = num_lines;
+  polygon[2].col = num_samples;
+  const std::vector<hsi::HSIRowSpan> polygon_spans =
+      hsi::RasterizePolygon(polygon, num_lines, num_samples);
+  // Labels of 2 at lines 0 and 2 of samples 0, 3, and 4.
+  std::vector<float> labels(num_lines * num_samples, 1);
+  for (const int pixel : {0, 3, 4, 10, 13, 14}) {
+    labels[pixel] = 2;
+  }
+  const std::vector<hsi::HSIRowSpan> label_spans = hsi::GetLabelSpans(
+      GetFloatData(num_lines, num_samples, 1, hsi::HSI_INTERLEAVE_BSQ, labels),
+      2);
+  const std::vector<std::vector<int>> expected_pixels = {
+      {1, 2, 3, 4, 7, 8, 9, 14}, {0, 3, 4, 10, 13, 14}};
+
+  const hsi::HSIDataInterleaveFormat interleave_formats[] = {
+      hsi::HSI_INTERLEAVE_BSQ, hsi::HSI_INTERLEAVE_BIL,
+      hsi::HSI_INTERLEAVE_BIP};
+  for (const hsi::HSIDataInterleaveFormat interleave_format :
+       interleave_formats) {
+    const HSIDataOptions data_options = WriteImageFile(
+        directory, "roi.dat", interleave_format, num_samples, num_lines,
+        num_bands, get_value);
+    const HSIDataReader reader(data_options);
+    const std::vector<hsi::HSIRowSpan>* image_spans[] = {
+        &polygon_spans, &label_spans};
+    for (int i = 0; i < 2; ++i) {
+      const hsi::HSIROIData roi_data = hsi::ReadROI(
+          hsi::GetDataSpans(data_options, *image_spans[i]),
+          hsi::HSIROIReadOptions(),
+          reader);
+      // Pixels are found through their offsets in the image, which are also
+      // their offsets in each band of BSQ data.
+      std::vector<int> pixels;
+      bool values_match = true;
+      for (size_t j = 0; j < roi_data.rows.size(); ++j) {
+        const int pixel =
+            roi_data.rows[j] * data_options.num_data_cols + roi_data.cols[j];
+        pixels.push_back(pixel);
+        for (int band = 0; band < num_bands; ++band) {
+          values_match &=
+              roi_data.spectra.GetValueAsDouble(0, j, band) ==
+              get_value(pixel % num_samples, pixel / num_samples, band);
+        }
+      }
+      std::sort(pixels.begin(), pixels.end());
+      Check(pixels == expected_pixels[i] && values_match,
+            std::string(i == 0 ? "polygon" : "label") +
+                " ROI of non-square data in interleave format " +
+                std::to_string(interleave_format));
+    }
+  }
+}
+
+// Values that are not finite must be skipped by the band statistics, and NaN
+// no-data values must be quantized to code 0, also in release builds that
+// assume finite math.
+void TestQuantizationSkipsNaN() {
+  const int num_cols = 37;
+  const int infinite_col = 4;
+  std::vector<float> values(num_cols);
+  for (int col = 0; col < num_cols; ++col) {
+    values[col] = (col % 5 == 2) ? std::numeric_limits<float>::quiet_NaN()
+                                 : static_cast<float>(col);
+  }
+  values[infinite_col] = std::numeric_limits<float>::infinity();
+  HSIData hsi_data;
+  hsi_data.num_rows = 1;
+  hsi_data.num_cols = num_cols;
+  hsi_data.num_bands = 1;
+  hsi_data.interleave_format = hsi::HSI_INTERLEAVE_BIL;
+  hsi_data.data_type = hsi::HSI_DATA_TYPE_FLOAT;
+  hsi_data.raw_data.assign(
+      reinterpret_cast<const char*>(values.data()),
+      reinterpret_cast<const char*>(values.data() + num_cols));
+
+  for (const double clip_std_devs : {0.0, 10.0}) {
+    hsi::HSIQuantizationOptions options;
+    options.clip_std_devs = clip_std_devs;
+    const hsi::HSIQuantizedData quantized_data =
+        hsi::QuantizeData(hsi_data, options);
+    const double scale = quantized_data.band_scales[0];
+    bool values_match = std::abs(scale - (num_cols - 1) / 255.0) < 1e-6 &&
+        std::abs(quantized_data.band_offsets[0]) < 1e-6;
+    bool nan_codes_are_zero = true;
+    for (int col = 0; col < num_cols; ++col) {
+      if (col % 5 == 2) {
+        nan_codes_are_zero &= (quantized_data.GetCode(0, col, 0) == 0);
+      } else if (col == infinite_col) {
+        values_match &= (quantized_data.GetCode(0, col, 0) == 255);
+      } else {
+        values_match &=
+            std::abs(quantized_data.GetValueAsDouble(0, col, 0) - col) <=
+            scale;
+      }
+    }
+    const std::string clipping =
+        (clip_std_devs > 0) ? " with clipping" : " without clipping";
+    Check(values_match, "quantization skips values that are not finite" +
+              clipping);
+    Check(nan_codes_are_zero, "NaN values are quantized to 0" + clipping);
+  }
+}
+
+// Values that become NaN must be counted as changes, also in release builds
+// that assume finite math, while NaN and infinite values that are the same in
+// both cubes are unchanged.
+void TestComparisonCountsNaNChanges() {
+  const int num_cols = 37;
+  const float nan = std::numeric_limits<float>::quiet_NaN();
+  const float infinity = std::numeric_limits<float>::infinity();
+  std::vector<float> first_values(2 * num_cols);
+  for (int i = 0; i < 2 * num_cols; ++i) {
+    first_values[i] = i;
+  }
+  first_values[3] = nan;
+  first_values[40] = infinity;
+  std::vector<float> second_values = first_values;
+  second_values[5] = nan;
+  second_values[num_cols + 33] = nan;
+  first_values[20] = nan;
+  second_values[11] += 0.5f;
+
+  const hsi::HSIComparisonResult result = hsi::CompareData(
+      GetFloatData(1, num_cols, 2, hsi::HSI_INTERLEAVE_BIL, first_values),
+      GetFloatData(1, num_cols, 2, hsi::HSI_INTERLEAVE_BIL, second_values),
+      hsi::HSIComparisonOptions());
+  Check(!result.IsUnchanged() && result.num_changed_pixels == 4,
+        "NaN values on one side are changed pixels");
+  Check(result.changed_pixel_mask[5] == 1 &&
+            result.changed_pixel_mask[20] == 1 &&
+            result.changed_pixel_mask[33] == 1 &&
+            result.changed_pixel_mask[3] == 0 &&
+            result.changed_pixel_mask[num_cols - 1] == 0,
+        "changed pixel mask of NaN values");
+  Check(result.band_stats[0].num_changed_values == 3 &&
+            result.band_stats[1].num_changed_values == 1,
+        "changed values per band with NaN values");
+  Check(result.max_abs_difference == infinity,
+        "NaN changes have an infinite absolute difference");
+  Check(std::abs(result.band_stats[0].mean_difference + 0.5 / num_cols) <
+            1e-9 &&
+            result.band_stats[1].mean_difference == 0,
+        "NaN values are left out of the mean difference");
+}
+
+// Zonal statistics read in prefetched tiles must match a direct computation,
+// for any number of threads and tile size.
+void TestZonalStatsOfTiles(const std::string& directory) {
+  const int num_rows = 13;
+  const int num_cols = 11;
+  const int num_bands = 3;
+  std::mt19937 random(11);
+  std::uniform_real_distribution<float> uniform(-5, 20);
+  std::vector<float> values(num_rows * num_cols * num_bands);
+  for (float& value : values) {
+    value = uniform(random);
+  }
+  std::vector<int16_t> labels(num_rows * num_cols);
+  for (int16_t& label : labels) {
+    label = static_cast<int16_t>(random() % 5) - 1;
+  }
+  HSIDataOptions data_options = GetTestOptions(
+      WriteTestFile(directory, "zonal.bil", values),
+      hsi::HSI_DATA_TYPE_FLOAT,
+      num_rows,
+      num_cols,
+      num_bands);
+  data_options.interleave_format = hsi::HSI_INTERLEAVE_BIL;
+  HSIDataOptions label_options = GetTestOptions(
+      WriteTestFile(directory, "zonal_labels.bin", labels),
+      hsi::HSI_DATA_TYPE_INT16,
+      num_rows,
+      num_cols,
+      1);
+
+  hsi::HSIDataRange data_range;
+  data_range.start_row = 1;
+  data_range.end_row = 12;
+  data_range.start_col = 2;
+  data_range.end_col = 10;
+  data_range.start_band = 1;
+  data_range.end_band = 3;
+  const int range_bands = data_range.end_band - data_range.start_band;
+
+  // Sums of each label over the range, in double.
+  std::vector<long> counts(5, 0);
+  std::vector<double> sums(5 * range_bands, 0);
+  std::vector<double> squared_sums(5 * range_bands, 0);
+  for (int row = data_range.start_row; row < data_range.end_row; ++row) {
+    for (int col = data_range.start_col; col < data_range.end_col; ++col) {
+      const int zone = labels[row * num_cols + col] + 1;
+      ++counts[zone];
+      for (int band = 0; band < range_bands; ++band) {
+        const double value = values[
+            (row * num_bands + data_range.start_band + band) * num_cols + col];
+        sums[zone * range_bands + band] += value;
+        squared_sums[zone * range_bands + band] += value * value;
+      }
+    }
+  }
+
+  bool all_match = true;
+  for (const int num_threads : {1, 3}) {
+    for (const int tile_rows : {1, 4, 64}) {
+      hsi::HSIZonalStatsOptions options;
+      options.num_threads = num_threads;
+      options.tile_rows = tile_rows;
+      HSIDataReader reader(data_options);
+      HSIDataReader label_reader(label_options);
+      const hsi::HSIZonalStats stats =
+          hsi::ReadZonalStats(data_range, options, &reader, &label_reader);
+      all_match &= stats.num_bands == range_bands;
+      for (int zone = 0; zone < 5; ++zone) {
+        const int index = stats.FindZone(zone - 1);
+        if (counts[zone] == 0) {
+          all_match &= index < 0;
+          continue;
+        }
+        all_match &= index >= 0 && stats.pixel_counts[index] == counts[zone];
+        for (int band = 0; band < range_bands && index >= 0; ++band) {
+          const double mean = sums[zone * range_bands + band] / counts[zone];
+          const double std_dev = std::sqrt(std::max(
+              0.0,
+              squared_sums[zone * range_bands + band] / counts[zone] -
+                  mean * mean));
+          all_match &=
+              std::abs(stats.means[index * range_bands + band] - mean) <
+                  1e-9 &&
+              std::abs(stats.std_devs[index * range_bands + band] -
+                       std_dev) < 1e-6;
+        }
+      }
+    }
+  }
+  Check(all_match, "zonal statistics of prefetched tiles");
+}
+
+// Returns the squared residual of the spectrum for the given abundances.
+double GetUnmixingResidual(
+    const std::vector<std::vector<double>>& endmembers,
+    const std::vector<double>& spectrum,
+    const std::vector<double>& abundances) {
+
+  double residual = 0;
+  for (size_t band = 0; band < spectrum.size(); ++band) {
+    double value = spectrum[band];
+    for (size_t i = 0; i < endmembers.size(); ++i) {
+      value -= abundances[i] * endmembers[i][band];
+    }
+    residual += value * value;
+  }
+  return residual;
+}
+
+// Returns the smallest residual of any feasible abundances, by solving the
+// least squares problem on every subset of the endmembers: the optimum is the
+// unconstrained (or only sum-to-one constrained) solution on its support.
+double GetOptimalUnmixingResidual(
+    const std::vector<std::vector<double>>& endmembers,
+    const std::vector<double>& spectrum,
+    const bool sum_to_one) {
+
+  const int n = endmembers.size();
+  double best_residual = sum_to_one ?
+      std::numeric_limits<double>::max() :
+      GetUnmixingResidual(endmembers, spectrum, std::vector<double>(n, 0));
+  for (int subset = 1; subset < (1 << n); ++subset) {
+    std::vector<int> members;
+    for (int i = 0; i < n; ++i) {
+      if (subset & (1 << i)) {
+        members.push_back(i);
+      }
+    }
+    // The normal equations, with a Lagrange multiplier for the sum.
+    const int m = members.size();
+    const int size = sum_to_one ? m + 1 : m;
+    std::vector<std::vector<double>> system(
+        size, std::vector<double>(size + 1, 0));
+    for (int row = 0; row < m; ++row) {
+      for (size_t band = 0; band < spectrum.size(); ++band) {
+        for (int col = 0; col < m; ++col) {
+          system[row][col] += endmembers[members[row]][band] *
+              endmembers[members[col]][band];
+        }
+        system[row][size] += endmembers[members[row]][band] * spectrum[band];
+      }
+      if (sum_to_one) {
+        system[row][m] = 1;
+        system[m][row] = 1;
+      }
+    }
+    if (sum_to_one) {
+      system[m][size] = 1;
+    }
+    for (int col = 0; col < size; ++col) {
+      int pivot = col;
+      for (int row = col + 1; row < size; ++row) {
+        if (std::abs(system[row][col]) > std::abs(system[pivot][col])) {
+          pivot = row;
+        }
+      }
+      std::swap(system[col], system[pivot]);
+      for (int row = 0; row < size; ++row) {
+        if (row != col) {
+          const double factor = system[row][col] / system[col][col];
+          for (int k = col; k <= size; ++k) {
+            system[row][k] -= factor * system[col][k];
+          }
+        }
+      }
+    }
+    std::vector<double> abundances(n, 0);
+    bool feasible = true;
+    for (int i = 0; i < m; ++i) {
+      abundances[members[i]] = system[i][size] / system[i][i];
+      feasible = feasible && abundances[members[i]] >= 0;
+    }
+    if (feasible) {
+      best_residual = std::min(
+          best_residual, GetUnmixingResidual(endmembers, spectrum, abundances));
+    }
+  }
+  return best_residual;
+}
+
+// Kernels given a view of part of the data must return the same results as
+// for the materialized view, and use whole views without copying them.
+void TestKernelsAcceptViews() {
+  const int num_rows = 5;
+  const int num_cols = 6;
+  const int num_bands = 7;
+  std::mt19937 random(5);
+  std::uniform_real_distribution<float> uniform(0, 10);
+  std::vector<float> values(num_rows * num_cols * num_bands);
+  for (float& value : values) {
+    value = uniform(random);
+  }
+  const HSIData hsi_data = GetFloatData(
+      num_rows, num_cols, num_bands, hsi::HSI_INTERLEAVE_BIL, values);
+  HSIData materialized_data;
+  Check(&hsi::HSIDataView(hsi_data).GetCompactData(&materialized_data) ==
+            &hsi_data && materialized_data.raw_data.empty(),
+        "whole views are used without copying them");
+
+  hsi::HSIDataRange crop_range;
+  crop_range.start_row = 1;
+  crop_range.end_row = 4;
+  crop_range.start_col = 2;
+  crop_range.end_col = 5;
+  crop_range.end_band = num_bands;
+  const hsi::HSIDataView view = hsi::HSIDataView(hsi_data).Crop(crop_range);
+  const HSIData crop = view.Materialize();
+
+  hsi::HSISpectralFilterOptions spectral_options;
+  spectral_options.window_size = 5;
+  Check(hsi::FilterSpectra(view, spectral_options).raw_data ==
+            hsi::FilterSpectra(crop, spectral_options).raw_data,
+        "spectral filtering of a view");
+  hsi::HSISpatialFilterOptions spatial_options;
+  spatial_options.row_kernel = hsi::GetBoxKernel(3);
+  spatial_options.col_kernel = hsi::GetBoxKernel(3);
+  Check(hsi::FilterBands(view, spatial_options).raw_data ==
+            hsi::FilterBands(crop, spatial_options).raw_data,
+        "spatial filtering of a view");
+  const hsi::HSIUnmixer unmixer(
+      {std::vector<double>(num_bands, 1), {1, 2, 3, 4, 5, 6, 7}},
+      hsi::HSIUnmixingOptions());
+  Check(unmixer.Unmix(view).raw_data == unmixer.Unmix(crop).raw_data,
+        "unmixing of a view");
+  hsi::HSIDataRange shifted_range = crop_range;
+  shifted_range.start_col = 1;
+  shifted_range.end_col = 4;
+  Check(hsi::CompareData(view, crop, hsi::HSIComparisonOptions())
+            .IsUnchanged() &&
+            !hsi::CompareData(
+                view,
+                hsi::HSIDataView(hsi_data).Crop(shifted_range),
+                hsi::HSIComparisonOptions()).IsUnchanged(),
+        "comparison of views");
+}
+
+// Checks the integer kernels on the values (which must not be empty) against
+// scalar computations. The values are also used as the rows of an image of
+// num_cols columns for binning.
+template <typename T>
+void CheckIntegerKernels(
+    const std::vector<T>& values,
+    const int num_cols,
+    const std::string& description) {
+
+  const long num_values = values.size();
+  int64_t sum = 0;
+  T min_value = values[0];
+  T max_value = values[0];
+  for (const T value : values) {
+    sum += value;
+    min_value = std::min(min_value, value);
+    max_value = std::max(max_value, value);
+  }
+  Check(hsi::SumValues(values.data(), num_values) == sum,
+        "integer sum of " + description);
+  Check(hsi::MeanValue(values.data(), num_values) ==
+            static_cast<double>(sum) / num_values,
+        "integer mean of " + description);
+  T kernel_min = 0;
+  T kernel_max = 0;
+  hsi::GetMinMax(values.data(), num_values, &kernel_min, &kernel_max);
+  Check(kernel_min == min_value && kernel_max == max_value,
+        "integer min and max of " + description);
+
+  // Histograms of the upper half of the values (so that some are outside of
+  // the bins), with one bin per value and with wider bins.
+  const T histogram_min = static_cast<T>(min_value / 2 + max_value / 2);
+  const int32_t range = static_cast<int32_t>(max_value) - histogram_min + 1;
+  for (const int num_bins : {static_cast<int>(range), 7}) {
+    std::vector<long> bin_counts(num_bins, 0);
+    std::vector<long> expected_counts(num_bins, 0);
+    for (const T value : values) {
+      if (value >= histogram_min) {
+        const int64_t offset = static_cast<int32_t>(value) - histogram_min;
+        expected_counts[offset * num_bins / range]++;
+      }
+    }
+    hsi::AddToHistogram(
+        values.data(), num_values, histogram_min, max_value, num_bins,
+        bin_counts.data());
+    Check(bin_counts == expected_counts,
+          "integer histogram of " + description + " with " +
+              std::to_string(num_bins) + " bins");
+  }
+
+  // Thresholds below the values and at the largest value.
+  for (const T threshold : {histogram_min, max_value}) {
+    std::vector<uint8_t> mask(num_values, 2);
+    long expected_num_above = 0;
+    bool mask_matches = true;
+    const long num_above = hsi::ThresholdValues(
+        values.data(), num_values, threshold, mask.data());
+    for (long i = 0; i < num_values; ++i) {
+      expected_num_above += (values[i] > threshold);
+      mask_matches &= (mask[i] == (values[i] > threshold ? 1 : 0));
+    }
+    Check(mask_matches && num_above == expected_num_above,
+          "integer threshold of " + description);
+  }
+
+  // The values minus the values in reverse order.
+  const std::vector<T> reversed(values.rbegin(), values.rend());
+  std::vector<int32_t> differences(num_values);
+  hsi::SubtractValues(
+      values.data(), reversed.data(), num_values, differences.data());
+  bool differences_match = true;
+  for (long i = 0; i < num_values; ++i) {
+    differences_match &= (differences[i] ==
+        static_cast<int32_t>(values[i]) - reversed[i]);
+  }
+  Check(differences_match, "integer differences of " + description);
+
+  // 3 x 3 bins of the whole rows, rounded half away from zero.
+  const int bin_size = 3;
+  const int num_rows = num_values / num_cols;
+  const int num_binned_cols = num_cols / bin_size;
+  std::vector<T> binned_values(
+      (num_rows / bin_size) * num_binned_cols);
+  hsi::BinImage(
+      values.data(), num_rows, num_cols, bin_size, binned_values.data());
+  bool bins_match = true;
+  for (size_t bin = 0; bin < binned_values.size(); ++bin) {
+    const int row = (bin / num_binned_cols) * bin_size;
+    const int col = (bin % num_binned_cols) * bin_size;
+    int64_t bin_sum = 0;
+    for (int i = 0; i < bin_size * bin_size; ++i) {
+      bin_sum += values[(row + i / bin_size) * num_cols + col + i % bin_size];
+    }
+    const double mean = static_cast<double>(bin_sum) / (bin_size * bin_size);
+    bins_match &= (binned_values[bin] == static_cast<T>(std::round(mean)));
+  }
+  Check(bins_match, "integer binning of " + description);
+}
+
+// The integer kernels must match scalar computations, including the tails
+// that do not fill a vector and values at the ends of the type's range.
+void TestIntegerKernels() {
+  std::mt19937 random(3);
+  std::uniform_int_distribution<int> int16_uniform(-32768, 32767);
+  std::uniform_int_distribution<int> uint16_uniform(0, 65535);
+  // 16 * 64 + 7 values, and saturated values whose sums exceed 32 bits in
+  // each vector lane unless they are flushed into 64 bits.
+  const int num_random_values = 1031;
+  const int num_saturated_values = 16 * 40000 + 9;
+  std::vector<int16_t> int16_values(num_random_values);
+  std::vector<uint16_t> uint16_values(num_random_values);
+  for (int i = 0; i < num_random_values; ++i) {
+    int16_values[i] = static_cast<int16_t>(int16_uniform(random));
+    uint16_values[i] = static_cast<uint16_t>(uint16_uniform(random));
+  }
+  CheckIntegerKernels(int16_values, 37, "random int16 values");
+  CheckIntegerKernels(uint16_values, 37, "random uint16 values");
+  CheckIntegerKernels(
+      std::vector<int16_t>(num_saturated_values, 32767), 1001,
+      "int16 values of 32767");
+  CheckIntegerKernels(
+      std::vector<int16_t>(num_saturated_values, -32768), 1001,
+      "int16 values of -32768");
+  CheckIntegerKernels(
+      std::vector<uint16_t>(num_saturated_values, 65535), 1001,
+      "uint16 values of 65535");
+}
+
+// Packs the samples of the given bit depth into a bit stream as described in
+// hsi_packed_data.h, starting first_bit bits into the first byte, one bit at
+// a time.
+std::vector<uint8_t> PackSamples(
+    const std::vector<uint16_t>& samples,
+    const int first_bit,
+    const int bit_depth,
+    const bool msb_first) {
+
+  std::vector<uint8_t> bytes(
+      hsi::GetPackedByteCount(first_bit, samples.size(), bit_depth), 0);
+  long position = first_bit;
+  for (const uint16_t sample : samples) {
+    for (int i = 0; i < bit_depth; ++i, ++position) {
+      const int sample_bit = msb_first ? bit_depth - 1 - i : i;
+      const int byte_bit = msb_first ? 7 - position % 8 : position % 8;
+      if ((sample >> sample_bit) & 1) {
+        bytes[position / 8] |= static_cast<uint8_t>(1 << byte_bit);
+      }
+    }
+  }
+  return bytes;
+}
+
+// Unpacking 10, 12, and 14-bit samples must match a bit-by-bit packing in
+// both bit orders and from every bit of the first byte, and packed files must
+// read the same samples through ReadValueRuns() and ReadData().
+void TestPackedSamples(const std::string& directory) {
+  std::mt19937 random(13);
+  const int num_samples = 37;
+  for (const int bit_depth : {10, 12, 14}) {
+    std::uniform_int_distribution<int> uniform(0, (1 << bit_depth) - 1);
+    std::vector<uint16_t> samples(num_samples);
+    for (uint16_t& sample : samples) {
+      sample = static_cast<uint16_t>(uniform(random));
+    }
+    samples[0] = static_cast<uint16_t>((1 << bit_depth) - 1);
+    samples[1] = 0;
+    for (const bool msb_first : {true, false}) {
+      bool samples_match = true;
+      bool floats_match = true;
+      for (int first_bit = 0; first_bit < 8; ++first_bit) {
+        const std::vector<uint8_t> bytes =
+            PackSamples(samples, first_bit, bit_depth, msb_first);
+        Check(static_cast<long>(bytes.size()) ==
+                  (first_bit + num_samples * bit_depth + 7) / 8,
+              "packed byte count");
+        std::vector<uint16_t> unpacked_samples(num_samples);
+        std::vector<float> unpacked_floats(num_samples);
+        hsi::UnpackSamples(
+            bytes.data(), first_bit, num_samples, bit_depth, msb_first,
+            unpacked_samples.data());
+        hsi::UnpackSamples(
+            bytes.data(), first_bit, num_samples, bit_depth, msb_first,
+            unpacked_floats.data());
+        samples_match &= (unpacked_samples == samples);
+        floats_match &= std::equal(
+            samples.begin(), samples.end(), unpacked_floats.begin());
+      }
+      const std::string description = std::to_string(bit_depth) + "-bit " +
+          (msb_first ? "MSB" : "LSB") + "-first samples";
+      Check(samples_match, "unpacking " + description);
+      Check(floats_match, "unpacking " + description + " to floats");
+
+      // A BIP file of 3 x 4 pixels of 3 bands (36 samples), read in runs
+      // that start at odd bits, both separately and coalesced.
+      HSIDataOptions data_options = GetTestOptions(
+          WriteTestFile(
+              directory,
+              "packed.dat",
+              PackSamples(samples, 0, bit_depth, msb_first)),
+          (bit_depth == 10) ? hsi::HSI_DATA_TYPE_PACKED_UINT10 :
+              (bit_depth == 12) ? hsi::HSI_DATA_TYPE_PACKED_UINT12 :
+                                  hsi::HSI_DATA_TYPE_PACKED_UINT14,
+          3,
+          4,
+          3);
+      data_options.interleave_format = hsi::HSI_INTERLEAVE_BIP;
+      data_options.packed_msb_first = msb_first;
+      const HSIDataReader reader(data_options);
+      std::vector<hsi::HSIValueRun> runs(3);
+      const long run_values[][2] = {{1, 3}, {7, 5}, {29, 7}};
+      long num_run_values = 0;
+      for (int i = 0; i < 3; ++i) {
+        runs[i].file_index = run_values[i][0];
+        runs[i].num_values = run_values[i][1];
+        runs[i].destination_index = num_run_values;
+        num_run_values += runs[i].num_values;
+      }
+      for (const long max_gap_bytes : {0L, 64L}) {
+        std::vector<uint16_t> run_samples(num_run_values);
+        reader.ReadValueRuns(
+            runs, max_gap_bytes, reinterpret_cast<char*>(run_samples.data()));
+        bool runs_match = true;
+        for (const hsi::HSIValueRun& run : runs) {
+          for (long j = 0; j < run.num_values; ++j) {
+            runs_match &= (run_samples[run.destination_index + j] ==
+                           samples[run.file_index + j]);
+          }
+        }
+        Check(runs_match, "ReadValueRuns() of " + description);
+      }
+      for (const bool as_floats : {false, true}) {
+        HSIDataOptions read_options = data_options;
+        read_options.convert_data_type = as_floats;
+        HSIDataReader range_reader(read_options);
+        hsi::HSIDataRange data_range = GetFullRange(read_options);
+        data_range.start_row = 1;
+        data_range.start_col = 1;
+        range_reader.ReadData(data_range);
+        bool values_match = true;
+        for (int row = 1; row < 3; ++row) {
+          for (int col = 1; col < 4; ++col) {
+            for (int band = 0; band < 3; ++band) {
+              values_match &=
+                  range_reader.GetData().GetValueAsDouble(
+                      row - 1, col - 1, band) ==
+                  samples[(row * 4 + col) * 3 + band];
+            }
+          }
+        }
+        Check(values_match,
+              "ReadData() of " + description + (as_floats ? " as floats" : ""));
+      }
+    }
+  }
+}
+
+// Returns the bits of a float and vice versa.
+uint32_t GetBits(const float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+float GetFloat(const uint32_t bits) {
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+// Checks that the single-value and the array conversion of each value give
+// the expected 16-bit value. The arrays have a length that leaves a tail
+// after the vectorized conversions (of 8 or 16 values).
+void CheckFloatsTo16Bits(
+    const std::vector<float>& values,
+    const std::vector<uint16_t>& expected,
+    const bool bfloat16,
+    const std::string& description) {
+
+  std::vector<float> tail_values = values;
+  std::vector<uint16_t> tail_expected = expected;
+  while (tail_values.size() % 16 != 3) {
+    tail_values.push_back(values[tail_values.size() % values.size()]);
+    tail_expected.push_back(expected[tail_expected.size() % expected.size()]);
+  }
+  std::vector<uint16_t> converted(tail_values.size());
+  bool matches = true;
+  if (bfloat16) {
+    hsi::ConvertFloatsToBFloat16s(
+        tail_values.data(), tail_values.size(), converted.data());
+    for (size_t i = 0; i < values.size(); ++i) {
+      matches &= (hsi::FloatToBFloat16(values[i]) == expected[i]);
+    }
+  } else {
+    hsi::ConvertFloatsToHalfs(
+        tail_values.data(), tail_values.size(), converted.data());
+    for (size_t i = 0; i < values.size(); ++i) {
+      matches &= (hsi::FloatToHalf(values[i]) == expected[i]);
+    }
+  }
+  Check(matches, description);
+  Check(converted == tail_expected, description + " in arrays");
+}
+
+// Half and bfloat16 conversions must round to nearest even (also for half
+// subnormals), overflow to infinity from 65520 on, and keep NaNs as NaNs, in
+// the scalar code and in the F16C and AVX2 code of native builds.
+void TestHalfFloatConversions() {
+  // Every 16-bit value that is not NaN converts to a float and back exactly.
+  std::vector<uint16_t> all_bits(1 << 16);
+  for (int i = 0; i < (1 << 16); ++i) {
+    all_bits[i] = static_cast<uint16_t>(i);
+  }
+  for (const bool bfloat16 : {false, true}) {
+    const std::string format = bfloat16 ? "bfloat16" : "half";
+    const uint16_t exponent_mask = bfloat16 ? 0x7F80 : 0x7C00;
+    std::vector<float> values(all_bits.size());
+    if (bfloat16) {
+      hsi::ConvertBFloat16sToFloats(
+          all_bits.data(), all_bits.size() - 3, values.data());
+      for (size_t i = all_bits.size() - 3; i < all_bits.size(); ++i) {
+        values[i] = hsi::BFloat16ToFloat(all_bits[i]);
+      }
+    } else {
+      hsi::ConvertHalfsToFloats(
+          all_bits.data(), all_bits.size() - 3, values.data());
+      for (size_t i = all_bits.size() - 3; i < all_bits.size(); ++i) {
+        values[i] = hsi::HalfToFloat(all_bits[i]);
+      }
+    }
+    bool round_trips = true;
+    bool widening_matches = true;
+    std::vector<float> finite_values;
+    std::vector<uint16_t> finite_bits;
+    for (int i = 0; i < (1 << 16); ++i) {
+      const uint16_t bits = all_bits[i];
+      const float value = bfloat16 ?
+          hsi::BFloat16ToFloat(bits) : hsi::HalfToFloat(bits);
+      widening_matches &= (GetBits(value) == GetBits(values[i]));
+      const bool is_nan = (bits & exponent_mask) == exponent_mask &&
+          (bits & ~exponent_mask & 0x7FFF) != 0;
+      round_trips &= (std::isnan(value) == is_nan);
+      if (!is_nan) {
+        finite_values.push_back(value);
+        finite_bits.push_back(bits);
+      }
+    }
+    Check(round_trips && widening_matches,
+          format + " values widen to floats (NaN only from NaN)");
+    CheckFloatsTo16Bits(
+        finite_values, finite_bits, bfloat16,
+        format + " values round trip through floats");
+
+    // Ties between two consecutive positive values round to the even one,
+    // and the float values next to the ties round to the nearest. For halfs,
+    // this includes the subnormals, whose ties are (m + 0.5) * 2^-24.
+    std::vector<float> tie_values;
+    std::vector<uint16_t> tie_expected;
+    const uint16_t max_finite = exponent_mask - 1;
+    for (uint16_t bits = 0; bits < max_finite; bits += 7) {
+      const float low = bfloat16 ?
+          hsi::BFloat16ToFloat(bits) : hsi::HalfToFloat(bits);
+      const float high = bfloat16 ?
+          hsi::BFloat16ToFloat(bits + 1) : hsi::HalfToFloat(bits + 1);
+      const float tie = static_cast<float>(
+          (static_cast<double>(low) + high) / 2);
+      tie_values.push_back(tie);
+      tie_expected.push_back((bits % 2 == 0) ? bits : bits + 1);
+      tie_values.push_back(std::nextafter(tie, 0.0f));
+      tie_expected.push_back(bits);
+      tie_values.push_back(std::nextafter(tie, high));
+      tie_expected.push_back(bits + 1);
+    }
+    CheckFloatsTo16Bits(
+        tie_values, tie_expected, bfloat16,
+        format + " ties round to even");
+
+    // Infinities, NaNs (which must not become infinities), and overflows.
+    const float infinity = std::numeric_limits<float>::infinity();
+    std::vector<float> special_values = {
+        infinity, -infinity, GetFloat(0x7F800001), GetFloat(0xFFC00000),
+        GetFloat(0x7FFFFFFF), 0.0f, -0.0f, GetFloat(1), -GetFloat(1)};
+    std::vector<uint16_t> special_expected = {
+        exponent_mask, static_cast<uint16_t>(0x8000 | exponent_mask)};
+    for (int i = 2; i < 5; ++i) {
+      special_expected.push_back(0);
+    }
+    special_expected.insert(special_expected.end(), {0, 0x8000, 0, 0x8000});
+    if (bfloat16) {
+      // The largest float rounds up beyond the largest bfloat16.
+      special_values.push_back(std::numeric_limits<float>::max());
+      special_expected.push_back(exponent_mask);
+    } else {
+      // 65520 is the tie between 65504 and the next step, 65536, which is
+      // beyond the half range.
+      special_values.insert(
+          special_values.end(),
+          {65504.0f, std::nextafter(65520.0f, 0.0f), 65520.0f, -65520.0f,
+           1e10f, 2.9802322e-8f, std::nextafter(2.9802322e-8f, 1.0f)});
+      special_expected.insert(
+          special_expected.end(),
+          {0x7BFF, 0x7BFF, 0x7C00, 0xFC00, 0x7C00, 0, 1});
+    }
+    std::vector<uint16_t> converted(special_values.size());
+    for (size_t i = 0; i < special_values.size(); ++i) {
+      converted[i] = bfloat16 ?
+          hsi::FloatToBFloat16(special_values[i]) :
+          hsi::FloatToHalf(special_values[i]);
+    }
+    // NaNs are only checked for staying NaN (with the sign kept).
+    for (int i = 2; i < 5; ++i) {
+      const uint16_t magnitude = converted[i] & 0x7FFF;
+      Check(magnitude > exponent_mask &&
+                (converted[i] & 0x8000) == (GetBits(special_values[i]) >> 31
+                                            << 15),
+            format + " NaN " + std::to_string(GetBits(special_values[i])) +
+                " stays NaN");
+      special_expected[i] = converted[i];
+    }
+    CheckFloatsTo16Bits(
+        special_values, special_expected, bfloat16,
+        format + " conversion of infinities, NaNs, zeros, and overflows");
+  }
+}
+
+// Checks GatherValues() and GatherSpectra() of data of type T against
+// GetValueAsDouble(), in each interleave format. Positions outside of the
+// data must give 0.
+template <typename T>
+void CheckGathers(const hsi::HSIDataType data_type, const std::string& name) {
+  const int num_rows = 5;
+  const int num_cols = 7;
+  const int num_bands = 3;
+  std::mt19937 random(17);
+  std::uniform_int_distribution<int> value_uniform(0, 250);
+  std::vector<T> values(num_rows * num_cols * num_bands);
+  for (T& value : values) {
+    // Negative values for signed types, and fractions for floating point.
+    value = static_cast<T>(
+        value_uniform(random) - (std::numeric_limits<T>::is_signed ? 120 : 0) +
+        (std::numeric_limits<T>::is_integer ? 0 : 0.25));
+  }
+
+  // 8 * 25 + 3 positions, to leave tails for vector gathers. Every 7th
+  // position is one beyond an end of the data.
+  const int num_positions = 203;
+  std::uniform_int_distribution<int> row_uniform(0, num_rows - 1);
+  std::uniform_int_distribution<int> col_uniform(0, num_cols - 1);
+  std::uniform_int_distribution<int> band_uniform(0, num_bands - 1);
+  std::vector<int> rows(num_positions);
+  std::vector<int> cols(num_positions);
+  std::vector<int> bands(num_positions);
+  for (int i = 0; i < num_positions; ++i) {
+    rows[i] = row_uniform(random);
+    cols[i] = col_uniform(random);
+    bands[i] = band_uniform(random);
+    switch ((i % 7 == 0) ? i / 7 % 6 : -1) {
+      case 0: rows[i] = -1; break;
+      case 1: rows[i] = num_rows; break;
+      case 2: cols[i] = -1; break;
+      case 3: cols[i] = num_cols; break;
+      case 4: bands[i] = -1; break;
+      case 5: bands[i] = num_bands; break;
+    }
+  }
+
+  const hsi::HSIDataInterleaveFormat interleave_formats[] = {
+      hsi::HSI_INTERLEAVE_BSQ, hsi::HSI_INTERLEAVE_BIL,
+      hsi::HSI_INTERLEAVE_BIP};
+  for (const hsi::HSIDataInterleaveFormat interleave_format :
+       interleave_formats) {
+    HSIData hsi_data;
+    hsi_data.num_rows = num_rows;
+    hsi_data.num_cols = num_cols;
+    hsi_data.num_bands = num_bands;
+    hsi_data.interleave_format = interleave_format;
+    hsi_data.data_type = data_type;
+    hsi_data.raw_data.assign(
+        reinterpret_cast<const char*>(values.data()),
+        reinterpret_cast<const char*>(values.data() + values.size()));
+    const auto get_value = [&](const int row, const int col, const int band) {
+      if (row < 0 || row >= num_rows || col < 0 || col >= num_cols ||
+          band < 0 || band >= num_bands) {
+        return 0.0;
+      }
+      return hsi_data.GetValueAsDouble(row, col, band);
+    };
+
+    std::vector<float> float_values(num_positions);
+    std::vector<double> double_values(num_positions);
+    hsi_data.GatherValues(
+        rows.data(), cols.data(), bands.data(), num_positions,
+        float_values.data());
+    hsi_data.GatherValues(
+        rows.data(), cols.data(), bands.data(), num_positions,
+        double_values.data());
+    bool values_match = true;
+    for (int i = 0; i < num_positions; ++i) {
+      const double value = get_value(rows[i], cols[i], bands[i]);
+      values_match &= (float_values[i] == static_cast<float>(value));
+      values_match &= (double_values[i] == value);
+    }
+
+    std::vector<float> float_spectra(num_positions * num_bands);
+    std::vector<double> double_spectra(num_positions * num_bands);
+    hsi_data.GatherSpectra(
+        rows.data(), cols.data(), num_positions, float_spectra.data());
+    hsi_data.GatherSpectra(
+        rows.data(), cols.data(), num_positions, double_spectra.data());
+    bool spectra_match = true;
+    for (int i = 0; i < num_positions; ++i) {
+      for (int band = 0; band < num_bands; ++band) {
+        const double value = get_value(rows[i], cols[i], band);
+        const int index = i * num_bands + band;
+        spectra_match &= (float_spectra[index] == static_cast<float>(value));
+        spectra_match &= (double_spectra[index] == value);
+      }
+    }
+    const std::string description =
+        name + " data in interleave format " +
+        std::to_string(interleave_format);
+    Check(values_match, "gathered values of " + description);
+    Check(spectra_match, "gathered spectra of " + description);
+  }
+}
+
+// Gathers must give the same values as GetValueAsDouble() for each data type.
+void TestGathers() {
+  CheckGathers<uint8_t>(hsi::HSI_DATA_TYPE_BYTE, "byte");
+  CheckGathers<int16_t>(hsi::HSI_DATA_TYPE_INT16, "int16");
+  CheckGathers<uint16_t>(hsi::HSI_DATA_TYPE_UNSIGNED_INT16, "uint16");
+  CheckGathers<int32_t>(hsi::HSI_DATA_TYPE_INT32, "int32");
+  CheckGathers<uint32_t>(hsi::HSI_DATA_TYPE_UNSIGNED_INT32, "uint32");
+  CheckGathers<float>(hsi::HSI_DATA_TYPE_FLOAT, "float");
+  CheckGathers<double>(hsi::HSI_DATA_TYPE_DOUBLE, "double");
+}
+
+// Savitzky-Golay filters must have the tabulated coefficients, and must
+// reproduce polynomials of up to their order and their derivatives in all
+// windows, including those at the first and last bands, with derivatives
+// scaled by the band spacing.
+void TestSavitzkyGolayFilters() {
+  const auto coefficients_match = [](
+      const std::vector<double>& coefficients,
+      const std::vector<double>& expected_coefficients) {
+    bool match = coefficients.size() == expected_coefficients.size();
+    for (size_t i = 0; match && i < coefficients.size(); ++i) {
+      match = std::abs(coefficients[i] - expected_coefficients[i]) < 1e-12;
+    }
+    return match;
+  };
+  Check(coefficients_match(
+            hsi::GetSavitzkyGolayCoefficients(5, 2, 0, 2),
+            {-3 / 35.0, 12 / 35.0, 17 / 35.0, 12 / 35.0, -3 / 35.0}),
+        "Savitzky-Golay smoothing coefficients");
+  Check(coefficients_match(
+            hsi::GetSavitzkyGolayCoefficients(5, 2, 1, 2),
+            {-0.2, -0.1, 0, 0.1, 0.2}),
+        "Savitzky-Golay first derivative coefficients");
+  Check(coefficients_match(
+            hsi::GetSavitzkyGolayCoefficients(5, 2, 0, 0),
+            {31 / 35.0, 9 / 35.0, -3 / 35.0, -5 / 35.0, 3 / 35.0}),
+        "Savitzky-Golay smoothing coefficients at the first band");
+  Check(coefficients_match(
+            hsi::GetSavitzkyGolayCoefficients(5, 2, 0, 4),
+            {3 / 35.0, -5 / 35.0, -3 / 35.0, 9 / 35.0, 31 / 35.0}),
+        "Savitzky-Golay smoothing coefficients at the last band");
+
+  // Each spectrum is a quadratic of the wavelength, which the filters fit
+  // exactly.
+  const int num_rows = 3;
+  const int num_cols = 5;
+  const int num_bands = 9;
+  const double band_spacing = 2.5;
+  const auto get_coefficient = [](
+      const int row, const int col, const int term) {
+    return (row + 1) * (term + 1) * 0.1 - col * 0.05 * term;
+  };
+  const auto get_derivative = [&](
+      const int row, const int col, const int band, const int order) {
+    const double x = band * band_spacing;
+    const double a = get_coefficient(row, col, 0);
+    const double b = get_coefficient(row, col, 1);
+    const double c = get_coefficient(row, col, 2);
+    switch (order) {
+      case 0: return a + b * x + c * x * x;
+      case 1: return b + 2 * c * x;
+      default: return 2 * c;
+    }
+  };
+  const hsi::HSIDataInterleaveFormat interleave_formats[] = {
+      hsi::HSI_INTERLEAVE_BSQ, hsi::HSI_INTERLEAVE_BIL,
+      hsi::HSI_INTERLEAVE_BIP};
+  for (const hsi::HSIDataInterleaveFormat interleave_format :
+       interleave_formats) {
+    long row_stride;
+    long col_stride;
+    long band_stride;
+    hsi::GetInterleaveStrides(
+        interleave_format, num_rows, num_cols, num_bands, &row_stride,
+        &col_stride, &band_stride);
+    std::vector<float> values(num_rows * num_cols * num_bands);
+    for (int row = 0; row < num_rows; ++row) {
+      for (int col = 0; col < num_cols; ++col) {
+        for (int band = 0; band < num_bands; ++band) {
+          values[row * row_stride + col * col_stride + band * band_stride] =
+              static_cast<float>(get_derivative(row, col, band, 0));
+        }
+      }
+    }
+    const HSIData hsi_data = GetFloatData(
+        num_rows, num_cols, num_bands, interleave_format, values);
+    for (int derivative_order = 0; derivative_order <= 2;
+         ++derivative_order) {
+      hsi::HSISpectralFilterOptions options;
+      options.window_size = 5;
+      options.polynomial_order = 2;
+      options.derivative_order = derivative_order;
+      options.band_spacing = band_spacing;
+      const HSIData filtered_data = hsi::FilterSpectra(hsi_data, options);
+      bool values_match = true;
+      for (int row = 0; row < num_rows; ++row) {
+        for (int col = 0; col < num_cols; ++col) {
+          for (int band = 0; band < num_bands; ++band) {
+            const double expected_value =
+                get_derivative(row, col, band, derivative_order);
+            values_match &=
+                std::abs(filtered_data.GetValueAsDouble(row, col, band) -
+                         expected_value) <
+                1e-4 * std::max(1.0, std::abs(expected_value));
+          }
+        }
+      }
+      Check(values_match,
+            "Savitzky-Golay derivative " + std::to_string(derivative_order) +
+                " in interleave format " + std::to_string(interleave_format));
+    }
+  }
+}
+
+// The matched filter and ACE must score each target as one, ACE scores must
+// stay in [0, 1], and CEM scores must match x^T R^-1 d / (d^T R^-1 d),
+// computed with the correlation matrix R of the pixels of a small cube.
+void TestTargetDetection() {
+  const int num_rows = 6;
+  const int num_cols = 7;
+  const int num_bands = 5;
+  const int num_pixels = num_rows * num_cols;
+  std::mt19937 random(19);
+  std::uniform_real_distribution<float> uniform(0.5f, 2);
+  std::vector<float> values(num_pixels * num_bands);
+  for (float& value : values) {
+    value = uniform(random);
+  }
+  // BSQ data, so the spectra are gathered before scoring.
+  std::vector<float> bsq_values(values.size());
+  for (int pixel = 0; pixel < num_pixels; ++pixel) {
+    for (int band = 0; band < num_bands; ++band) {
+      bsq_values[band * num_pixels + pixel] = values[pixel * num_bands + band];
+    }
+  }
+  const HSIData hsi_data = GetFloatData(
+      num_rows, num_cols, num_bands, hsi::HSI_INTERLEAVE_BSQ, bsq_values);
+  const hsi::HSIBackgroundStats background =
+      hsi::ComputeBackgroundStats(hsi_data, hsi::HSIBackgroundOptions());
+  const std::vector<std::vector<double>> targets = {
+      {1.9, 0.6, 1.7, 0.8, 1.2}, {0.7, 1.1, 1.8, 1.5, 0.6}};
+  const int num_targets = targets.size();
+  hsi::HSITargetDetectionOptions options;
+  options.regularization = 0;
+
+  options.detector = hsi::HSI_DETECTOR_MF;
+  const hsi::HSITargetDetector matched_filter(background, targets, options);
+  bool targets_match = true;
+  for (int target = 0; target < num_targets; ++target) {
+    const std::vector<float> spectrum(
+        targets[target].begin(), targets[target].end());
+    std::vector<float> scores(num_targets);
+    matched_filter.Score(spectrum.data(), scores.data());
+    targets_match &= std::abs(scores[target] - 1) < 1e-4;
+  }
+  Check(targets_match, "matched filter scores of the targets");
+
+  options.detector = hsi::HSI_DETECTOR_ACE;
+  const hsi::HSITargetDetector ace(background, targets, options);
+  bool ace_targets_match = true;
+  for (int target = 0; target < num_targets; ++target) {
+    const std::vector<float> spectrum(
+        targets[target].begin(), targets[target].end());
+    std::vector<float> scores(num_targets);
+    ace.Score(spectrum.data(), scores.data());
+    ace_targets_match &= std::abs(scores[target] - 1) < 1e-4;
+  }
+  Check(ace_targets_match, "ACE scores of the targets");
+  const HSIData ace_scores = ace.Score(hsi_data);
+  bool ace_in_range = true;
+  for (int pixel = 0; pixel < num_pixels; ++pixel) {
+    for (int target = 0; target < num_targets; ++target) {
+      const double score = ace_scores.GetValueAsDouble(
+          pixel / num_cols, pixel % num_cols, target);
+      ace_in_range &= (score >= 0 && score <= 1);
+    }
+  }
+  Check(ace_in_range, "ACE scores from 0 to 1");
+
+  // R^-1 d of each target, by Gauss-Jordan elimination of [R | d].
+  std::vector<std::vector<double>> matrix(
+      num_bands, std::vector<double>(num_bands + num_targets, 0));
+  for (int pixel = 0; pixel < num_pixels; ++pixel) {
+    const float* spectrum = &values[pixel * num_bands];
+    for (int i = 0; i < num_bands; ++i) {
+      for (int j = 0; j < num_bands; ++j) {
+        matrix[i][j] += static_cast<double>(spectrum[i]) * spectrum[j] /
+            num_pixels;
+      }
+    }
+  }
+  for (int i = 0; i < num_bands; ++i) {
+    for (int target = 0; target < num_targets; ++target) {
+      matrix[i][num_bands + target] = targets[target][i];
+    }
+  }
+  for (int col = 0; col < num_bands; ++col) {
+    for (int row = 0; row < num_bands; ++row) {
+      if (row == col) {
+        continue;
+      }
+      const double factor = matrix[row][col] / matrix[col][col];
+      for (int i = col; i < num_bands + num_targets; ++i) {
+        matrix[row][i] -= factor * matrix[col][i];
+      }
+    }
+  }
+  options.detector = hsi::HSI_DETECTOR_CEM;
+  const HSIData cem_scores =
+      hsi::HSITargetDetector(background, targets, options).Score(hsi_data);
+  bool cem_scores_match = true;
+  for (int target = 0; target < num_targets; ++target) {
+    std::vector<double> filter(num_bands);
+    double target_energy = 0;
+    for (int i = 0; i < num_bands; ++i) {
+      filter[i] = matrix[i][num_bands + target] / matrix[i][i];
+      target_energy += filter[i] * targets[target][i];
+    }
+    for (int pixel = 0; pixel < num_pixels; ++pixel) {
+      double expected_score = 0;
+      for (int i = 0; i < num_bands; ++i) {
+        expected_score += filter[i] * values[pixel * num_bands + i];
+      }
+      expected_score /= target_energy;
+      const double score = cem_scores.GetValueAsDouble(
+          pixel / num_cols, pixel % num_cols, target);
+      cem_scores_match &= std::abs(score - expected_score) <
+          1e-3 * std::max(1.0, std::abs(expected_score));
+    }
+  }
+  Check(cem_scores_match, "CEM scores of the closed form");
+}
+
+// Progressive reads must deliver each level once, from coarse to fine, with
+// the pixels of each level as in ReadData(), and must not read the pixels of
+// earlier levels again. The file is rewritten with new values after each
+// level, so the final data shows the level at which each pixel was read.
+void TestProgressiveRead(const std::string& directory) {
+  const int num_rows = 13;
+  const int num_cols = 11;
+  const int num_bands = 3;
+  const int num_values = num_rows * num_cols * num_bands;
+  hsi::HSIDataRange data_range;
+  data_range.start_row = 1;
+  data_range.end_row = num_rows;
+  data_range.start_col = 2;
+  data_range.end_col = num_cols;
+  data_range.start_band = 1;
+  data_range.end_band = num_bands;
+  const int initial_stride = 4;
+  // Returns the index of the level that first reads the pixel of the range.
+  const auto get_pixel_level = [](const int row, const int col) {
+    int level = 0;
+    for (int stride = initial_stride;
+         row % stride != 0 || col % stride != 0; stride /= 2) {
+      ++level;
+    }
+    return level;
+  };
+
+  const hsi::HSIDataInterleaveFormat interleave_formats[] = {
+      hsi::HSI_INTERLEAVE_BSQ, hsi::HSI_INTERLEAVE_BIL,
+      hsi::HSI_INTERLEAVE_BIP};
+  for (const hsi::HSIDataInterleaveFormat interleave_format :
+       interleave_formats) {
+    // The values of version v of the file are their index plus 1000 * v.
+    const auto write_file = [&](const int version) {
+      std::vector<float> values(num_values);
+      for (int i = 0; i < num_values; ++i) {
+        values[i] = static_cast<float>(i + 1000 * version);
+      }
+      return WriteTestFile(directory, "progressive.dat", values);
+    };
+    HSIDataOptions data_options = GetTestOptions(
+        write_file(0), hsi::HSI_DATA_TYPE_FLOAT, num_rows, num_cols,
+        num_bands);
+    data_options.interleave_format = interleave_format;
+    HSIDataReader full_reader(data_options);
+    full_reader.ReadData(data_range);
+    const HSIData full_data = full_reader.GetData();
+
+    for (const bool rewrite_file : {false, true}) {
+      write_file(0);
+      HSIDataReader reader(data_options);
+      std::vector<int> level_strides;
+      bool levels_match = true;
+      reader.ReadDataProgressive(
+          data_range,
+          initial_stride,
+          [&](const HSIData& level_data, const int level_stride) {
+            const int level = level_strides.size();
+            level_strides.push_back(level_stride);
+            for (int row = 0; row < full_data.num_rows; ++row) {
+              for (int col = 0; col < full_data.num_cols; ++col) {
+                if (rewrite_file || get_pixel_level(row, col) != level) {
+                  continue;
+                }
+                for (int band = 0; band < full_data.num_bands; ++band) {
+                  levels_match &=
+                      level_data.GetValueAsDouble(row, col, band) ==
+                      full_data.GetValueAsDouble(row, col, band);
+                }
+              }
+            }
+            if (rewrite_file) {
+              write_file(level + 1);
+            }
+          });
+      const std::string description = " in interleave format " +
+          std::to_string(interleave_format) +
+          (rewrite_file ? " of a rewritten file" : "");
+      Check(level_strides == std::vector<int>({4, 2, 1}),
+            "progressive read delivers each level once" + description);
+
+      // Pixels keep the values of the file at their level.
+      bool values_match = true;
+      for (int row = 0; row < full_data.num_rows; ++row) {
+        for (int col = 0; col < full_data.num_cols; ++col) {
+          const int version = rewrite_file ? get_pixel_level(row, col) : 0;
+          for (int band = 0; band < full_data.num_bands; ++band) {
+            values_match &=
+                reader.GetData().GetValueAsDouble(row, col, band) ==
+                full_data.GetValueAsDouble(row, col, band) + 1000 * version;
+          }
+        }
+      }
+      Check(levels_match && values_match,
+            "progressive read levels make up the range" + description);
+    }
+  }
+}
+
+// NNLS and FCLS abundances must be optimal, which is checked against brute
+// force on random problems with many active constraints.
+void TestUnmixingIsOptimal() {
+  const int num_endmembers = 5;
+  const int num_bands = 8;
+  const int num_problems = 20000;
+  std::mt19937 random(7);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  std::normal_distribution<double> normal(0, 1);
+  for (const bool sum_to_one : {false, true}) {
+    int num_suboptimal = 0;
+    for (int problem = 0; problem < num_problems; ++problem) {
+      // Float values, so that the solver sees exactly these spectra.
+      std::vector<std::vector<double>> endmembers(
+          num_endmembers, std::vector<double>(num_bands));
+      for (std::vector<double>& endmember : endmembers) {
+        for (double& value : endmember) {
+          value = static_cast<float>(uniform(random));
+        }
+      }
+      std::vector<double> spectrum(num_bands);
+      std::vector<float> float_spectrum(num_bands);
+      for (int band = 0; band < num_bands; ++band) {
+        float_spectrum[band] = normal(random);
+        spectrum[band] = float_spectrum[band];
+      }
+      hsi::HSIUnmixingOptions options;
+      options.sum_to_one = sum_to_one;
+      const hsi::HSIUnmixer unmixer(endmembers, options);
+      std::vector<float> float_abundances(num_endmembers);
+      unmixer.Unmix(float_spectrum.data(), float_abundances.data());
+      const std::vector<double> abundances(
+          float_abundances.begin(), float_abundances.end());
+      const double residual =
+          GetUnmixingResidual(endmembers, spectrum, abundances);
+      const double optimal_residual =
+          GetOptimalUnmixingResidual(endmembers, spectrum, sum_to_one);
+      if (residual > optimal_residual * (1 + 1e-5) + 1e-6) {
+        ++num_suboptimal;
+      }
+    }
+    Check(num_suboptimal == 0,
+          std::string(sum_to_one ? "FCLS" : "NNLS") + " abundances are " +
+              "optimal (" + std::to_string(num_suboptimal) + " of " +
+              std::to_string(num_problems) + " suboptimal)");
+  }
+}
+
+int RunRegressionTests() {
+  char directory_template[] = "/tmp/hsi_test_XXXXXX";
+  const char* directory = mkdtemp(directory_template);
+  if (directory == nullptr) {
+    std::cerr << "Could not create a test directory." << std::endl;
+    return -1;
+  }
+  TestCacheKeepsComplexComponents(directory);
+  TestCachedReadAfterWriteRange(directory);
+  TestCacheRemovesOutdatedEntries(directory);
+  TestReadRangeAfterHeader(directory);
+  TestWriteRangeToBigEndianFiles(directory);
+  TestAppendLineAfterClose(directory);
+  TestCloseWhileAppending(directory);
+  TestGeoWindowOfBSQData(directory);
+  TestOrthorectifyBSQData(directory);
+  TestROIOfImageSpans(directory);
+  TestDestripingOfBSQData(directory);
+  TestSpatialFilterOfBSQData(directory);
+  TestQuantizationSkipsNaN();
+  TestComparisonCountsNaNChanges();
+  TestZonalStatsOfTiles(directory);
+  TestUnmixingIsOptimal();
+  TestKernelsAcceptViews();
+  TestIntegerKernels();
+  TestPackedSamples(directory);
+  TestHalfFloatConversions();
+  TestProgressiveRead(directory);
+  TestGathers();
+  TestSavitzkyGolayFilters();
+  TestTargetDetection();
+
+  const std::string remove_command = std::string("rm -rf ") + directory;
+  if (system(remove_command.c_str()) != 0) {
+    std::cerr << "Could not remove " << directory << "." << std::endl;
+  }
+  if (num_failures > 0) {
+    std::cerr << num_failures << " checks failed." << std::endl;
+    return -1;
+  }
+  std::cout << "All regression tests passed." << std::endl;
+  return 0;
+}
+
+}  // namespace
+
 int main(int argc, char** argv) {
   if (argc < 2) {
-    std::cerr << "Required argument: path to HSI file." << std::endl;
+    std::cerr << "Required argument: path to HSI file, or --regression."
+              << std::endl;
     return -1;
   }
+  if (std::string(argv[1]) == "--regression") {
+    return RunRegressionTests();
+  }
   const std::string file_path(argv[1]);
 
   // Set range of data we want to read.